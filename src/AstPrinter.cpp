@@ -1,4 +1,5 @@
 #include "AstPrinter.h"
+#include "LoxString.h"
 #include <sstream>
 #include <fmt/format.h>
 
@@ -18,8 +19,8 @@ any AstPrinter::visitGroupingExpr(Grouping* expr)
 
 std::string AstPrinter::anyToString(const any* obj)
 {
-    if (const std::string* ptr = std::any_cast<std::string>(obj)) {
-        return *ptr;
+    if (const StringRef* ptr = std::any_cast<StringRef>(obj)) {
+        return ptr->str();
     }
     if (const double* ptr = std::any_cast<double>(obj)) {
         return std::to_string(*ptr);
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <any>
+#include <cstdint>
+
+namespace lox {
+
+class LoxCallable;
+
+// What a call site remembers about the global function it called last.
+// It holds while version matches the globals' version, which changes
+// whenever a global holding a function is rebound.
+struct CallCache
+{
+    // Whether the callee is a global variable, set by the Resolver. Only
+    // those calls are cached.
+    bool global = false;
+    // Whether the callee is a property, obj.name(...), set by the Resolver.
+    // Those calls go through the callee's PropertyCache instead.
+    bool property = false;
+    // Zero while empty; versions start at 1.
+    uint64_t version = 0;
+    // The callee as its global held it, and as the call checked it.
+    // Its arity matched this call's arguments when it was cached.
+    std::any callee;
+    LoxCallable* function = nullptr;
+};
+
+}
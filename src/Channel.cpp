@@ -0,0 +1,94 @@
+#include "Channel.h"
+#include "Lox.h"
+#include "Native.h"
+#include <fmt/format.h>
+#include <memory>
+#include <unordered_map>
+
+namespace lox {
+
+Channel& Channel::named(const std::string& name)
+{
+    static std::mutex mutex;
+    static std::unordered_map<std::string, std::unique_ptr<Channel>> channels;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto& channel = channels[name];
+    if (channel == nullptr) channel = std::make_unique<Channel>();
+    return *channel;
+}
+
+void Channel::send(Message message)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        messages.push_back(std::move(message));
+    }
+    ready.notify_one();
+}
+
+std::optional<Channel::Message> Channel::receive(
+    const std::function<bool()>& giveUp)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    // Whatever giveUp() watches doesn't notify this channel.
+    auto arrived = [this]() { return !messages.empty(); };
+    while (!ready.wait_for(lock, kPoll, arrived)) {
+        if (giveUp()) return std::nullopt;
+    }
+    auto message = std::move(messages.front());
+    messages.pop_front();
+    return message;
+}
+
+Channel::Message Channel::copyOut(const any& value)
+{
+    if (auto number = std::any_cast<double>(&value)) return *number;
+    if (auto boolean = std::any_cast<bool>(&value)) return *boolean;
+    if (auto string = std::any_cast<StringRef>(&value)) return string->str();
+    if (std::any_cast<std::nullptr_t>(&value)) return nullptr;
+    throw NativeError("Only nil, booleans, numbers and strings can be sent.");
+}
+
+any Channel::copyIn(const Message& message)
+{
+    if (auto number = std::get_if<double>(&message)) return *number;
+    if (auto boolean = std::get_if<bool>(&message)) return *boolean;
+    if (auto string = std::get_if<std::string>(&message)) {
+        return LoxString::make(*string);
+    }
+    return nullptr;
+}
+
+void registerChannelNatives(Interpreter& interpreter)
+{
+    registerNative(interpreter, "spawn", [](const std::string& path) {
+        Isolate::current()->spawn(path);
+    });
+    registerNative(interpreter, "send",
+        [](const std::string& channel, const any& value) {
+            Channel::named(channel).send(Channel::copyOut(value));
+        });
+    // Fails rather than waiting forever when the isolates that could
+    // send have all finished or one of them failed, and stops for a
+    // cancel(), from a timeout or an embedder, like a safepoint would.
+    registerNative(interpreter, "receive",
+        [&interpreter](const std::string& channel) {
+            auto isolate = Isolate::current();
+            const char* cancelled = nullptr;
+            const char* starved = nullptr;
+            auto message = Channel::named(channel).receive([&]() {
+                cancelled = interpreter.takeCancel();
+                if (cancelled == nullptr) starved = isolate->starved();
+                return cancelled != nullptr || starved != nullptr;
+            });
+            if (cancelled != nullptr) throw NativeError(cancelled);
+            if (!message) {
+                throw NativeError(fmt::format(
+                    "Nothing can arrive on '{}': {}", channel, starved));
+            }
+            return Channel::copyIn(*message);
+        });
+}
+
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <any>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <variant>
+
+namespace lox {
+
+class Interpreter;
+
+// A queue of messages between isolates, found by name. Isolates share no
+// heap, so values are copied in and out, and only nil, booleans, numbers
+// and strings can be sent.
+//
+// Channels are the one thing isolates share. Each one is created the
+// first time any isolate names it and lives as long as the process.
+class Channel
+{
+public:
+    using Message = std::variant<std::nullptr_t, bool, double, std::string>;
+
+    static Channel& named(const std::string& name);
+
+    // Throws a NativeError for values that can't be sent.
+    static Message copyOut(const std::any& value);
+    // Strings are made again in the receiving isolate.
+    static std::any copyIn(const Message& message);
+
+    void send(Message message);
+    // Waits until a message arrives, or returns nothing once the channel
+    // is empty and giveUp() is true. giveUp() is polled every kPoll.
+    std::optional<Message> receive(const std::function<bool()>& giveUp);
+
+    static constexpr std::chrono::milliseconds kPoll{10};
+
+private:
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::deque<Message> messages;
+};
+
+// Defines the natives spawn(path), send(channel, value) and
+// receive(channel) for an isolate's interpreter.
+void registerChannelNatives(Interpreter& interpreter);
+
+}
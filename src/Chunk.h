@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "Value.h"
+
+namespace lox {
+
+// Every instruction of the VM. Operands follow the opcode in the code
+// stream; "u8"/"u16" give their width, u16 is big-endian.
+#define LOX_OPCODES(X) \
+    X(CONSTANT)       /* u16 constant: push it */ \
+    X(NONE)           /* push the value of a missing return value */ \
+    X(NIL) \
+    X(TRUE) \
+    X(FALSE) \
+    X(POP) \
+    X(GET_LOCAL)      /* u8 slot */ \
+    X(SET_LOCAL)      /* u8 slot */ \
+    X(GET_GLOBAL)     /* u16 name constant */ \
+    X(DEFINE_GLOBAL)  /* u16 name constant */ \
+    X(SET_GLOBAL)     /* u16 name constant */ \
+    X(GET_UPVALUE)    /* u8 index */ \
+    X(SET_UPVALUE)    /* u8 index */ \
+    X(EQUAL) \
+    X(NOT_EQUAL) \
+    X(GREATER) \
+    X(GREATER_EQUAL) \
+    X(LESS) \
+    X(LESS_EQUAL) \
+    X(ADD) \
+    X(SUBTRACT) \
+    X(MULTIPLY) \
+    X(DIVIDE) \
+    X(NOT) \
+    X(NEGATE) \
+    X(PRINT) \
+    X(JUMP)           /* u16 forward offset */ \
+    X(JUMP_IF_FALSE)  /* u16 forward offset, leaves the condition */ \
+    X(LOOP)           /* u16 backward offset */ \
+    X(CALL)           /* u8 argument count */ \
+    X(CLOSURE)        /* u16 function, then u8 isLocal, u8 index per upvalue */ \
+    X(CLOSE_UPVALUE) \
+    X(RETURN)
+
+enum class OpCode : uint8_t
+{
+#define LOX_OPCODE_ENUM(name) name,
+    LOX_OPCODES(LOX_OPCODE_ENUM)
+#undef LOX_OPCODE_ENUM
+};
+
+struct FunctionProto;
+
+// The bytecode of one function.
+struct Chunk
+{
+    std::vector<uint8_t> code;
+    // Source line of every byte in code, for runtime errors.
+    std::vector<int> lines;
+    std::vector<Value> constants;
+    // Functions declared directly inside this one.
+    std::vector<FunctionProto*> functions;
+
+    void write(uint8_t byte, int line)
+    {
+        code.push_back(byte);
+        lines.push_back(line);
+    }
+};
+
+// A compiled function. Owned by the VM for as long as it lives, closures
+// only point at it.
+struct FunctionProto
+{
+    std::string name;
+    int arity = 0;
+    int upvalueCount = 0;
+    Chunk chunk;
+};
+
+}
@@ -0,0 +1,813 @@
+#include "ClosureCompiler.h"
+#include "Interpreter.h"
+#include "LoxClass.h"
+#include "LoxString.h"
+#include "Generator.h"
+
+namespace lox {
+
+namespace {
+
+// The arithmetic and comparison operators share their operand check;
+// apply is the operator itself, inlined into the node's closure.
+template <typename Apply>
+ExprCode numeric(ExprNode* left, ExprNode* right, const Token* op, Apply apply)
+{
+    return [left, right, op, apply](Interpreter& interpreter) -> any {
+        auto a = (*left)(interpreter);
+        auto b = (*right)(interpreter);
+        auto x = std::any_cast<double>(&a);
+        auto y = std::any_cast<double>(&b);
+        if (x != nullptr && y != nullptr) return apply(*x, *y);
+        throw RuntimeError(*op, "Operands must be numbers.");
+    };
+}
+
+}
+
+const CompiledBlock* ClosureCompiler::compile(
+    std::vector<std::unique_ptr<Stmt>>& statements)
+{
+    auto program = std::make_unique<CompiledBlock>();
+    for (auto& stmt : statements) {
+        program->statements.push_back(compile(stmt.get()));
+    }
+    programs.push_back(std::move(program));
+    return programs.back().get();
+}
+
+ExprNode* ClosureCompiler::compile(Expr* expr)
+{
+    expr->accept(this);
+    return expression;
+}
+
+StmtCode ClosureCompiler::compile(Stmt* stmt)
+{
+    stmt->accept(this);
+    return std::move(statement);
+}
+
+std::shared_ptr<CompiledBlock> ClosureCompiler::compileBlock(
+    vector<unique_ptr<Stmt>>& statements)
+{
+    auto block = std::make_shared<CompiledBlock>();
+    for (auto& stmt : statements) {
+        block->statements.push_back(compile(stmt.get()));
+    }
+    return block;
+}
+
+ExprNode* ClosureCompiler::node(ExprCode code)
+{
+    nodes.push_back(ExprNode{variant(std::move(code))});
+    return &nodes.back();
+}
+
+const ExprCode* ClosureCompiler::variant(ExprCode code)
+{
+    variants.push_back(std::move(code));
+    return &variants.back();
+}
+
+void ClosureCompiler::specialize(ExprNode* self, ExprCode code)
+{
+    self->code = variant(std::move(code));
+    ++stats.specializations;
+}
+
+void ClosureCompiler::deoptimize(ExprNode* self, const ExprCode* generic)
+{
+    self->code = generic;
+    ++stats.deoptimizations;
+}
+
+void ClosureCompiler::rewrite(ExprNode* self, ExprCode code,
+    const ExprCode* generic)
+{
+    if (code) {
+        specialize(self, std::move(code));
+    }
+    else {
+        self->code = generic;
+    }
+}
+
+void ClosureCompiler::preload(ExprNode* self, ExprCode code,
+    const ExprCode* generic)
+{
+    self->code = code ? variant(std::move(code)) : generic;
+    ++stats.profiled;
+}
+
+void ClosureCompiler::useProfile(Profile* profile, bool record)
+{
+    this->profile = profile;
+    recording = record;
+}
+
+ClosureCompiler::Site ClosureCompiler::profileSite()
+{
+    size_t index = nextSite++;
+    if (profile == nullptr) return Site{nullptr, nullptr};
+    // Look before recording: site() creates the entry.
+    auto seen = profile->find(index);
+    return Site{recording ? &profile->site(index) : nullptr, seen};
+}
+
+any ClosureCompiler::visitAssignExpr(Assign* expr)
+{
+    auto value = compile(expr->value.get());
+    int depth = expr->depth;
+    int slot = expr->slot;
+    if (depth == 0) {
+        expression = node([value, slot](Interpreter& interpreter) {
+            auto result = (*value)(interpreter);
+            interpreter.environment->slot(slot) = result;
+            return result;
+        });
+    }
+    else if (depth > 0) {
+        expression = node([value, depth, slot](Interpreter& interpreter) {
+            auto result = (*value)(interpreter);
+            interpreter.environment->assignAt(depth, slot, result);
+            return result;
+        });
+    }
+    else {
+        const Token* name = expr->name.get();
+        expression = node([value, name](Interpreter& interpreter) {
+            auto result = (*value)(interpreter);
+            interpreter.globals->assign(*name, result);
+            return result;
+        });
+    }
+    return any();
+}
+
+any ClosureCompiler::visitBinaryExpr(Binary* expr)
+{
+    auto left = compile(expr->left.get());
+    auto right = compile(expr->right.get());
+    auto generic = variant(genericBinary(expr, left, right));
+    auto profiled = profileSite();
+    auto record = profiled.record;
+    auto self = node(ExprCode());
+    self->code = variant([this, self, expr, left, right, generic, record]
+        (Interpreter& interpreter) {
+        auto a = (*left)(interpreter);
+        any b;
+        {
+            TempRootGuard roots(&interpreter);
+            roots.push(&a);
+            b = (*right)(interpreter);
+        }
+        if (record != nullptr) record->observe(a, b);
+        rewrite(self, quickenBinary(self, expr, left, right, generic, record,
+            Profile::typeOf(a), Profile::typeOf(b)), generic);
+        return interpreter.binary(expr, a, b);
+    });
+    if (auto seen = profiled.seen) {
+        preload(self, quickenBinary(self, expr, left, right, generic, record,
+            seen->left, seen->right), generic);
+    }
+    expression = self;
+    return any();
+}
+
+ExprCode ClosureCompiler::genericBinary(Binary* expr,
+    ExprNode* left, ExprNode* right)
+{
+    const Token* op = expr->op.get();
+    switch (op->type) {
+    case TokenType::GREATER:
+        return numeric(left, right, op,
+            [](double a, double b) { return a > b; });
+    case TokenType::GREATER_EQUAL:
+        return numeric(left, right, op,
+            [](double a, double b) { return a >= b; });
+    case TokenType::LESS:
+        return numeric(left, right, op,
+            [](double a, double b) { return a < b; });
+    case TokenType::LESS_EQUAL:
+        return numeric(left, right, op,
+            [](double a, double b) { return a <= b; });
+    case TokenType::MINUS:
+        return numeric(left, right, op,
+            [](double a, double b) { return a - b; });
+    case TokenType::SLASH:
+        return numeric(left, right, op,
+            [](double a, double b) { return a / b; });
+    case TokenType::STAR:
+        return numeric(left, right, op,
+            [](double a, double b) { return a * b; });
+    case TokenType::PLUS:
+        return [left, right, op](Interpreter& interpreter) -> any {
+            auto a = (*left)(interpreter);
+            auto b = (*right)(interpreter);
+            auto x = std::any_cast<double>(&a);
+            auto y = std::any_cast<double>(&b);
+            if (x != nullptr && y != nullptr) return *x + *y;
+            auto leftString = std::any_cast<StringRef>(&a);
+            auto rightString = std::any_cast<StringRef>(&b);
+            if (leftString != nullptr && rightString != nullptr) {
+                return LoxString::concat(leftString->get(), rightString->get());
+            }
+            throw RuntimeError(*op,
+                "Operands must be two numbers or two strings.");
+        };
+    case TokenType::BANG_EQUAL:
+    case TokenType::EQUAL_EQUAL: {
+        bool equal = op->type == TokenType::EQUAL_EQUAL;
+        // Only equality looks at a function operand, so only it has to
+        // keep the left one alive while the right one is evaluated.
+        return [left, right, equal](Interpreter& interpreter) -> any {
+            auto a = (*left)(interpreter);
+            any b;
+            {
+                TempRootGuard roots(&interpreter);
+                roots.push(&a);
+                b = (*right)(interpreter);
+            }
+            return interpreter.isEqual(a, b) == equal;
+        };
+    }
+    default:
+        return [](Interpreter&) { return any(); };
+    }
+}
+
+// The variant for operands of types a and b, or none if the generic code
+// suits them best.
+ExprCode ClosureCompiler::quickenBinary(ExprNode* self, Binary* expr,
+    ExprNode* left, ExprNode* right, const ExprCode* generic,
+    SiteProfile* record, uint8_t a, uint8_t b)
+{
+    auto numbers = [&](auto apply) {
+        return numberBinary(self, expr, left, right, generic, record, apply);
+    };
+
+    auto type = expr->op->type;
+    if (a == Profile::NUMBER && b == Profile::NUMBER) {
+        switch (type) {
+        case TokenType::GREATER:
+            return numbers([](double x, double y) { return x > y; });
+        case TokenType::GREATER_EQUAL:
+            return numbers([](double x, double y) { return x >= y; });
+        case TokenType::LESS:
+            return numbers([](double x, double y) { return x < y; });
+        case TokenType::LESS_EQUAL:
+            return numbers([](double x, double y) { return x <= y; });
+        case TokenType::MINUS:
+            return numbers([](double x, double y) { return x - y; });
+        case TokenType::PLUS:
+            return numbers([](double x, double y) { return x + y; });
+        case TokenType::SLASH:
+            return numbers([](double x, double y) { return x / y; });
+        case TokenType::STAR:
+            return numbers([](double x, double y) { return x * y; });
+        case TokenType::BANG_EQUAL:
+            return numbers([](double x, double y) { return x != y; });
+        case TokenType::EQUAL_EQUAL:
+            return numbers([](double x, double y) { return x == y; });
+        default:
+            break;
+        }
+    }
+    else if (type == TokenType::PLUS && a == Profile::STRING
+        && b == Profile::STRING) {
+        return [this, self, expr, left, right, generic, record]
+            (Interpreter& interpreter) -> any {
+            auto a = (*left)(interpreter);
+            auto b = (*right)(interpreter);
+            auto x = std::any_cast<StringRef>(&a);
+            auto y = std::any_cast<StringRef>(&b);
+            if (x != nullptr && y != nullptr) {
+                return LoxString::concat(x->get(), y->get());
+            }
+            if (record != nullptr) record->observe(a, b);
+            deoptimize(self, generic);
+            return interpreter.binary(expr, a, b);
+        };
+    }
+    return ExprCode();
+}
+
+// The left operand is checked first: as long as it is a number, the
+// right one can't collect anything the node still needs.
+template <typename Apply>
+ExprCode ClosureCompiler::numberBinary(ExprNode* self, Binary* expr,
+    ExprNode* left, ExprNode* right, const ExprCode* generic,
+    SiteProfile* record, Apply apply)
+{
+    return [this, self, expr, left, right, generic, record, apply]
+        (Interpreter& interpreter) -> any {
+        auto a = (*left)(interpreter);
+        if (auto x = std::any_cast<double>(&a)) {
+            auto b = (*right)(interpreter);
+            if (auto y = std::any_cast<double>(&b)) return apply(*x, *y);
+            if (record != nullptr) record->observe(a, b);
+            deoptimize(self, generic);
+            return interpreter.binary(expr, a, b);
+        }
+        deoptimize(self, generic);
+        any b;
+        {
+            TempRootGuard roots(&interpreter);
+            roots.push(&a);
+            b = (*right)(interpreter);
+        }
+        if (record != nullptr) record->observe(a, b);
+        return interpreter.binary(expr, a, b);
+    };
+}
+
+any ClosureCompiler::visitCallExpr(Call* expr)
+{
+    if (expr->cache.property) {
+        compileMethodCall(expr);
+        return any();
+    }
+    auto callee = compile(expr->callee.get());
+    std::vector<ExprNode*> arguments;
+    for (auto& argument : *expr->arguments) {
+        arguments.push_back(compile(argument.get()));
+    }
+
+    auto generic = variant(genericCall(expr, callee, arguments));
+    auto profiled = profileSite();
+    auto record = profiled.record;
+    // Calling a Lox function skips the callee's type dispatch and the
+    // virtual call.
+    auto quicken = [this, expr, callee, arguments, generic, record]
+        (ExprNode* self, uint8_t type) -> ExprCode {
+        if (type != Profile::FUNCTION) return ExprCode();
+        return [this, self, expr, callee, arguments, generic, record]
+            (Interpreter& interpreter) {
+            StackMark mark(&interpreter);
+            auto slot = evaluateCall(interpreter, expr, callee, arguments);
+            Arguments values(slot + 1,
+                interpreter.stack.current() - slot - 1);
+            if (auto function = std::any_cast<LoxFunction*>(slot)) {
+                if (values.size() == (*function)->LoxFunction::arity()
+                    && !interpreter.tooDeep()) {
+                    CallDepthGuard depth(&interpreter);
+                    return (*function)->LoxFunction::call(&interpreter, values);
+                }
+            }
+            else {
+                if (record != nullptr) record->observe(*slot);
+                deoptimize(self, generic);
+            }
+            return interpreter.invoke(expr, *slot, values);
+        };
+    };
+
+    auto self = node(ExprCode());
+    self->code = variant([this, self, expr, callee, arguments, generic,
+        record, quicken](Interpreter& interpreter) {
+        StackMark mark(&interpreter);
+        auto slot = evaluateCall(interpreter, expr, callee, arguments);
+        if (record != nullptr) record->observe(*slot);
+        rewrite(self, quicken(self, Profile::typeOf(*slot)), generic);
+        return interpreter.invoke(expr, *slot, Arguments(slot + 1,
+            interpreter.stack.current() - slot - 1));
+    });
+    if (auto seen = profiled.seen) {
+        preload(self, quicken(self, seen->left), generic);
+    }
+    expression = self;
+    return any();
+}
+
+// obj.name(...) calls a method without binding it, through the property
+// cache of its Get.
+void ClosureCompiler::compileMethodCall(Call* expr)
+{
+    auto get = static_cast<Get*>(expr->callee.get());
+    auto object = compile(get->object.get());
+    std::vector<ExprNode*> arguments;
+    for (auto& argument : *expr->arguments) {
+        arguments.push_back(compile(argument.get()));
+    }
+
+    expression = node([expr, get, object, arguments](Interpreter& interpreter) {
+        StackMark mark(&interpreter);
+        auto slot = evaluateCall(interpreter, expr, object, {});
+        auto instance = std::any_cast<LoxInstance*>(slot);
+        if (instance == nullptr) {
+            throw RuntimeError(*get->name, "Only instances have properties.");
+        }
+        auto method = interpreter.lookUpProperty(get, *instance, *slot);
+        for (auto argument : arguments) {
+            auto value = (*argument)(interpreter);
+            if (interpreter.stack.full()) {
+                throw RuntimeError(*expr->paren, "Stack overflow.");
+            }
+            interpreter.stack.push(std::move(value));
+        }
+        return interpreter.callProperty(expr, method, slot);
+    });
+}
+
+ExprCode ClosureCompiler::genericCall(Call* expr, ExprNode* callee,
+    std::vector<ExprNode*> arguments)
+{
+    return [expr, callee, arguments](Interpreter& interpreter) {
+        StackMark mark(&interpreter);
+        auto slot = evaluateCall(interpreter, expr, callee, arguments);
+        return interpreter.invoke(expr, *slot, Arguments(slot + 1,
+            interpreter.stack.current() - slot - 1));
+    };
+}
+
+// Pushes the callee and the arguments onto the value stack, where the
+// collector sees them, and returns the callee's slot.
+any* ClosureCompiler::evaluateCall(Interpreter& interpreter, Call* expr,
+    ExprNode* callee, const std::vector<ExprNode*>& arguments)
+{
+    auto& stack = interpreter.stack;
+    if (stack.full()) {
+        throw RuntimeError(*expr->paren, "Stack overflow.");
+    }
+    auto slot = stack.push((*callee)(interpreter));
+    for (auto argument : arguments) {
+        auto value = (*argument)(interpreter);
+        if (stack.full()) {
+            throw RuntimeError(*expr->paren, "Stack overflow.");
+        }
+        stack.push(std::move(value));
+    }
+    return slot;
+}
+
+any ClosureCompiler::visitGetExpr(Get* expr)
+{
+    auto object = compile(expr->object.get());
+    expression = node([expr, object](Interpreter& interpreter) {
+        auto value = (*object)(interpreter);
+        TempRootGuard roots(&interpreter);
+        roots.push(&value);
+        return interpreter.getProperty(expr, value);
+    });
+    return any();
+}
+
+any ClosureCompiler::visitGroupingExpr(Grouping* expr)
+{
+    expression = compile(expr->expression.get());
+    return any();
+}
+
+any ClosureCompiler::visitLiteralExpr(Literal* expr)
+{
+    auto value = interpreter->constants.at(expr->constant);
+    expression = node([value](Interpreter&) { return value; });
+    return any();
+}
+
+any ClosureCompiler::visitLogicalExpr(Logical* expr)
+{
+    auto left = compile(expr->left.get());
+    auto right = compile(expr->right.get());
+    // The value that ends the evaluation early.
+    bool stop = expr->op->type == TokenType::OR;
+
+    auto generic = variant([left, right, stop](Interpreter& interpreter) {
+        auto value = (*left)(interpreter);
+        if (interpreter.isTruthy(&value) == stop) return value;
+        return (*right)(interpreter);
+    });
+
+    auto profiled = profileSite();
+    auto record = profiled.record;
+    auto self = node(ExprCode());
+    auto quicken = [this, self, left, right, stop, generic, record]
+        (uint8_t type) -> ExprCode {
+        if (type != Profile::BOOLEAN) return ExprCode();
+        return [this, self, left, right, stop, generic, record]
+            (Interpreter& interpreter) {
+            auto value = (*left)(interpreter);
+            if (auto condition = std::any_cast<bool>(&value)) {
+                if (*condition == stop) return value;
+                return (*right)(interpreter);
+            }
+            if (record != nullptr) record->observe(value);
+            deoptimize(self, generic);
+            if (interpreter.isTruthy(&value) == stop) return value;
+            return (*right)(interpreter);
+        };
+    };
+    self->code = variant([this, self, left, right, stop, generic, record,
+        quicken](Interpreter& interpreter) {
+        auto value = (*left)(interpreter);
+        if (record != nullptr) record->observe(value);
+        rewrite(self, quicken(Profile::typeOf(value)), generic);
+        if (interpreter.isTruthy(&value) == stop) return value;
+        return (*right)(interpreter);
+    });
+    if (auto seen = profiled.seen) preload(self, quicken(seen->left), generic);
+    expression = self;
+    return any();
+}
+
+any ClosureCompiler::visitUnaryExpr(Unary* expr)
+{
+    auto right = compile(expr->right.get());
+    bool negate = expr->op->type == TokenType::MINUS;
+
+    auto generic = variant([expr, right](Interpreter& interpreter) {
+        return interpreter.unary(expr, (*right)(interpreter));
+    });
+
+    auto profiled = profileSite();
+    auto record = profiled.record;
+    auto self = node(ExprCode());
+    auto quicken = [this, self, expr, right, negate, generic, record]
+        (uint8_t type) -> ExprCode {
+        if (negate && type == Profile::NUMBER) {
+            return [this, self, expr, right, generic, record]
+                (Interpreter& interpreter) -> any {
+                auto value = (*right)(interpreter);
+                if (auto number = std::any_cast<double>(&value)) {
+                    return -*number;
+                }
+                if (record != nullptr) record->observe(value);
+                deoptimize(self, generic);
+                return interpreter.unary(expr, value);
+            };
+        }
+        if (!negate && type == Profile::BOOLEAN) {
+            return [this, self, expr, right, generic, record]
+                (Interpreter& interpreter) -> any {
+                auto value = (*right)(interpreter);
+                if (auto boolean = std::any_cast<bool>(&value)) {
+                    return !*boolean;
+                }
+                if (record != nullptr) record->observe(value);
+                deoptimize(self, generic);
+                return interpreter.unary(expr, value);
+            };
+        }
+        return ExprCode();
+    };
+    self->code = variant([this, self, expr, right, generic, record, quicken]
+        (Interpreter& interpreter) {
+        auto value = (*right)(interpreter);
+        if (record != nullptr) record->observe(value);
+        rewrite(self, quicken(Profile::typeOf(value)), generic);
+        return interpreter.unary(expr, value);
+    });
+    if (auto seen = profiled.seen) preload(self, quicken(seen->left), generic);
+    expression = self;
+    return any();
+}
+
+any ClosureCompiler::visitSetExpr(Set* expr)
+{
+    auto object = compile(expr->object.get());
+    auto value = compile(expr->value.get());
+    expression = node([expr, object, value](Interpreter& interpreter) {
+        auto instance = (*object)(interpreter);
+        if (std::any_cast<LoxInstance*>(&instance) == nullptr) {
+            throw RuntimeError(*expr->name, "Only instances have fields.");
+        }
+        TempRootGuard roots(&interpreter);
+        roots.push(&instance);
+        auto result = (*value)(interpreter);
+        interpreter.setProperty(expr, instance, result);
+        return result;
+    });
+    return any();
+}
+
+any ClosureCompiler::visitSuperExpr(Super* expr)
+{
+    expression = node([expr](Interpreter& interpreter) {
+        return interpreter.superMethod(expr);
+    });
+    return any();
+}
+
+any ClosureCompiler::visitThisExpr(This* expr)
+{
+    int depth = expr->depth;
+    expression = node([depth](Interpreter& interpreter) {
+        return interpreter.environment->getAt(depth, 0);
+    });
+    return any();
+}
+
+any ClosureCompiler::visitVarExprExpr(VarExpr* expr)
+{
+    int depth = expr->depth;
+    int slot = expr->slot;
+    if (depth == 0) {
+        expression = node([slot](Interpreter& interpreter) {
+            return interpreter.environment->slot(slot);
+        });
+    }
+    else if (depth > 0) {
+        expression = node([depth, slot](Interpreter& interpreter) {
+            return interpreter.environment->getAt(depth, slot);
+        });
+    }
+    else {
+        const Token* name = expr->name.get();
+        expression = node([name](Interpreter& interpreter) {
+            return interpreter.globals->get(*name);
+        });
+    }
+    return any();
+}
+
+any ClosureCompiler::visitBlockStmt(Block* stmt)
+{
+    auto block = compileBlock(*stmt->statements);
+    int slots = stmt->slots;
+    bool escapes = stmt->escapes;
+    statement = [block, slots, escapes](Interpreter& interpreter) {
+        auto scope = Environment::create(interpreter.heap,
+            interpreter.environment, slots, escapes);
+        ScopeGuard guard(&interpreter, scope, escapes);
+        return block->run(interpreter);
+    };
+    return any();
+}
+
+any ClosureCompiler::visitExpressionStmt(Expression* stmt)
+{
+    auto expr = compile(stmt->expr.get());
+    statement = [expr](Interpreter& interpreter) {
+        (*expr)(interpreter);
+        return false;
+    };
+    return any();
+}
+
+any ClosureCompiler::visitFunctionStmt(Function* stmt)
+{
+    // The closure that declares the function keeps its body alive.
+    auto body = compileBlock(*stmt->body);
+    bodies[stmt] = body.get();
+    statement = [stmt, body](Interpreter& interpreter) {
+        auto function = interpreter.heap.make<LoxFunction>(stmt,
+            interpreter.environment, body.get());
+        interpreter.define(stmt->slot, *stmt->name, function);
+        return false;
+    };
+    return any();
+}
+
+any ClosureCompiler::visitClassStmt(Class* stmt)
+{
+    // As with functions, the declaring closure keeps the bodies alive.
+    std::vector<std::shared_ptr<CompiledBlock>> bodies;
+    std::vector<const CompiledBlock*> compiled;
+    for (auto& method : *stmt->methods) {
+        bodies.push_back(compileBlock(*method->body));
+        compiled.push_back(bodies.back().get());
+        this->bodies[method.get()] = compiled.back();
+    }
+    statement = [stmt, bodies, compiled](Interpreter& interpreter) {
+        interpreter.declareClass(stmt, compiled.data());
+        return false;
+    };
+    return any();
+}
+
+// Drops the condition's value before the statement it guards runs, as
+// Interpreter::test() does.
+bool ClosureCompiler::test(Interpreter& interpreter, ExprNode* condition)
+{
+    auto predict = (*condition)(interpreter);
+    return interpreter.isTruthy(&predict);
+}
+
+any ClosureCompiler::visitIfStmt(If* stmt)
+{
+    auto condition = compile(stmt->condition.get());
+    auto thenBranch = compile(stmt->thenBranch.get());
+    StmtCode elseBranch = [](Interpreter&) { return false; };
+    if (stmt->elseBranch != nullptr) {
+        elseBranch = compile(stmt->elseBranch.get());
+    }
+
+    auto profiled = profileSite();
+    if (auto record = profiled.record) {
+        statement = [condition, thenBranch, elseBranch, record]
+            (Interpreter& interpreter) {
+            if (test(interpreter, condition)) {
+                ++record->taken;
+                return thenBranch(interpreter);
+            }
+            ++record->skipped;
+            return elseBranch(interpreter);
+        };
+    }
+    else if (profiled.seen != nullptr
+        && profiled.seen->skipped > profiled.seen->taken) {
+        // Tests for the branch the profile saw more often first.
+        ++stats.profiled;
+        statement = [condition, thenBranch, elseBranch]
+            (Interpreter& interpreter) {
+            if (!test(interpreter, condition)) return elseBranch(interpreter);
+            return thenBranch(interpreter);
+        };
+    }
+    else if (stmt->elseBranch != nullptr) {
+        statement = [condition, thenBranch, elseBranch]
+            (Interpreter& interpreter) {
+            if (test(interpreter, condition)) return thenBranch(interpreter);
+            return elseBranch(interpreter);
+        };
+    }
+    else {
+        statement = [condition, thenBranch](Interpreter& interpreter) {
+            if (test(interpreter, condition)) return thenBranch(interpreter);
+            return false;
+        };
+    }
+    return any();
+}
+
+any ClosureCompiler::visitPrintStmt(Print* stmt)
+{
+    auto expr = compile(stmt->expr.get());
+    statement = [expr](Interpreter& interpreter) {
+        interpreter.print((*expr)(interpreter));
+        return false;
+    };
+    return any();
+}
+
+any ClosureCompiler::visitReturnStmt(Return* stmt)
+{
+    if (stmt->value != nullptr) {
+        auto value = compile(stmt->value.get());
+        statement = [value](Interpreter& interpreter) {
+            interpreter.returnValue = (*value)(interpreter);
+            return true;
+        };
+    }
+    else {
+        statement = [](Interpreter&) { return true; };
+    }
+    return any();
+}
+
+any ClosureCompiler::visitVarStmtStmt(VarStmt* stmt)
+{
+    ExprNode* initializer = nullptr;
+    if (stmt->initializer != nullptr) {
+        initializer = compile(stmt->initializer.get());
+    }
+    else {
+        initializer = node([](Interpreter&) { return any(nullptr); });
+    }
+
+    int slot = stmt->slot;
+    if (slot >= 0) {
+        statement = [initializer, slot](Interpreter& interpreter) {
+            auto value = (*initializer)(interpreter);
+            interpreter.environment->slot(slot) = std::move(value);
+            return false;
+        };
+    }
+    else {
+        const Token* name = stmt->name.get();
+        statement = [initializer, name](Interpreter& interpreter) {
+            interpreter.globals->define(name->lexeme,
+                (*initializer)(interpreter));
+            return false;
+        };
+    }
+    return any();
+}
+
+any ClosureCompiler::visitWhileStmt(While* stmt)
+{
+    auto condition = compile(stmt->condition.get());
+    auto body = compile(stmt->body.get());
+    auto keyword = stmt->keyword.get();
+    statement = [condition, body, keyword](Interpreter& interpreter) {
+        for (;;) {
+            if (!test(interpreter, condition)) return false;
+            interpreter.tick(*keyword);
+            if (body(interpreter)) return true;
+        }
+    };
+    return any();
+}
+
+any ClosureCompiler::visitYieldStmt(Yield* stmt)
+{
+    auto value = compile(stmt->value.get());
+    statement = [value](Interpreter& interpreter) {
+        interpreter.generators.back()->yield((*value)(interpreter));
+        return false;
+    };
+    return any();
+}
+
+}
@@ -0,0 +1,176 @@
+#pragma once
+
+#include "autogen/Expr.h"
+#include "autogen/Stmt.h"
+#include "Profile.h"
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace lox {
+
+class Interpreter;
+
+// An expression compiled to a C++ closure: evaluates it in the
+// interpreter's current scope.
+using ExprCode = std::function<any(Interpreter&)>;
+// A compiled statement. Returns true when a return statement ran; the
+// value waits in the interpreter's returnValue, as on the tree-walker.
+using StmtCode = std::function<bool(Interpreter&)>;
+
+// A compiled expression. Parents call it through code, which a node that
+// specializes itself points at a variant suited to the operand types it
+// has seen.
+struct ExprNode
+{
+    const ExprCode* code;
+
+    any operator()(Interpreter& interpreter) const
+    { return (*code)(interpreter); }
+};
+
+// A compiled program or function body.
+struct CompiledBlock
+{
+    std::vector<StmtCode> statements;
+
+    bool run(Interpreter& interpreter) const
+    {
+        for (auto& statement : statements) {
+            if (statement(interpreter)) return true;
+        }
+        return false;
+    }
+};
+
+struct QuickeningStats
+{
+    // Nodes rewritten to a variant for the types they saw.
+    uint64_t specializations = 0;
+    // Specialized nodes that saw other types and fell back for good.
+    uint64_t deoptimizations = 0;
+    // Nodes and if statements set up from a profile before they ran.
+    uint64_t profiled = 0;
+};
+
+// Walks the resolved AST once and turns every node into a closure bound
+// to its children, its slot coordinates and the code for its operator.
+// Running the result does no visitor dispatch and no switch on token
+// types. Scopes, values, calls and errors are the Interpreter's own, so
+// programs behave exactly as they do on the tree-walker.
+//
+// Binary, unary, logical and call nodes start out uninitialized. The
+// first run looks at the operand types and rewrites the node to a
+// variant for them, such as adding numbers or calling a Lox function.
+// A variant that sees other types rewrites the node to the generic code
+// and stays there.
+//
+// With a profile, nodes the profile saw start out rewritten to the
+// variant for the types it recorded, and if statements test the branch
+// it saw taken more often first.
+class ClosureCompiler: public ExprVisitor, public StmtVisitor
+{
+    // A node's entries in the profile: the one to record into, and the
+    // one an earlier run left.
+    struct Site
+    {
+        SiteProfile* record;
+        const SiteProfile* seen;
+    };
+
+public:
+    explicit ClosureCompiler(Interpreter* interpreter):
+        interpreter(interpreter) {}
+    ~ClosureCompiler() override = default;
+
+    // The result stays owned by the compiler, so functions it declares
+    // can still be called from programs compiled later.
+    const CompiledBlock* compile(std::vector<std::unique_ptr<Stmt>>& statements);
+
+    // The compiled body of a function declared by a compiled program.
+    const CompiledBlock* body(const Function* declaration) const
+    { return bodies.at(declaration); }
+
+    const QuickeningStats& statistics() const { return stats; }
+
+    // Sets up the nodes of later programs from profile, and if record is
+    // set, records into it what they see.
+    void useProfile(Profile* profile, bool record);
+
+    any visitAssignExpr(Assign* expr) override;
+    any visitBinaryExpr(Binary* expr) override;
+    any visitCallExpr(Call* expr) override;
+    any visitGetExpr(Get* expr) override;
+    any visitGroupingExpr(Grouping* expr) override;
+    any visitLiteralExpr(Literal* expr) override;
+    any visitLogicalExpr(Logical* expr) override;
+    any visitSetExpr(Set* expr) override;
+    any visitSuperExpr(Super* expr) override;
+    any visitThisExpr(This* expr) override;
+    any visitUnaryExpr(Unary* expr) override;
+    any visitVarExprExpr(VarExpr* expr) override;
+
+    any visitBlockStmt(Block* stmt) override;
+    any visitExpressionStmt(Expression* stmt) override;
+    any visitFunctionStmt(Function* stmt) override;
+    any visitClassStmt(Class* stmt) override;
+    any visitIfStmt(If* stmt) override;
+    any visitPrintStmt(Print* stmt) override;
+    any visitReturnStmt(Return* stmt) override;
+    any visitVarStmtStmt(VarStmt* stmt) override;
+    any visitWhileStmt(While* stmt) override;
+    any visitYieldStmt(Yield* stmt) override;
+
+private:
+    ExprNode* compile(Expr* expr);
+    StmtCode compile(Stmt* stmt);
+    std::shared_ptr<CompiledBlock> compileBlock(
+        vector<unique_ptr<Stmt>>& statements);
+
+    ExprNode* node(ExprCode code);
+    // Keeps code for as long as the compiler lives. A node may be
+    // rewritten while its old code is still running further up the C++
+    // stack, so replaced code is never freed.
+    const ExprCode* variant(ExprCode code);
+    void specialize(ExprNode* self, ExprCode code);
+    void deoptimize(ExprNode* self, const ExprCode* generic);
+    // Rewrites an uninitialized node to code, or to generic if it is empty.
+    void rewrite(ExprNode* self, ExprCode code, const ExprCode* generic);
+    void preload(ExprNode* self, ExprCode code, const ExprCode* generic);
+    Site profileSite();
+
+    ExprCode genericBinary(Binary* expr, ExprNode* left, ExprNode* right);
+    ExprCode quickenBinary(ExprNode* self, Binary* expr, ExprNode* left,
+        ExprNode* right, const ExprCode* generic, SiteProfile* record,
+        uint8_t a, uint8_t b);
+    template <typename Apply>
+    ExprCode numberBinary(ExprNode* self, Binary* expr, ExprNode* left,
+        ExprNode* right, const ExprCode* generic, SiteProfile* record,
+        Apply apply);
+    ExprCode genericCall(Call* expr, ExprNode* callee,
+        std::vector<ExprNode*> arguments);
+    void compileMethodCall(Call* expr);
+    static bool test(Interpreter& interpreter, ExprNode* condition);
+    static any* evaluateCall(Interpreter& interpreter, Call* expr,
+        ExprNode* callee, const std::vector<ExprNode*>& arguments);
+
+    Interpreter* interpreter;
+    // Set by the visitor of the node just compiled.
+    ExprNode* expression = nullptr;
+    StmtCode statement;
+    std::vector<std::unique_ptr<CompiledBlock>> programs;
+    // Owned by the programs' code, see visitFunctionStmt().
+    std::unordered_map<const Function*, const CompiledBlock*> bodies;
+    std::deque<ExprNode> nodes;
+    std::deque<ExprCode> variants;
+    QuickeningStats stats;
+    Profile* profile = nullptr;
+    bool recording = false;
+    // Profiled nodes are numbered in the order they are compiled.
+    size_t nextSite = 0;
+};
+
+}
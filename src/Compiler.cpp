@@ -0,0 +1,481 @@
+#include "Compiler.h"
+#include "Lox.h"
+
+namespace lox {
+
+FunctionProto* Compiler::compile(std::vector<std::unique_ptr<Stmt>>& statements)
+{
+    FunctionState script;
+    script.function = newFunction("script", 0);
+    script.enclosing = nullptr;
+    // Slot 0 of every frame holds the running closure.
+    script.locals.push_back(Local{"", 0, false});
+    current = &script;
+
+    compileBody(statements);
+    emit(OpCode::NONE);
+    emit(OpCode::RETURN);
+
+    current = nullptr;
+    return hadError ? nullptr : script.function;
+}
+
+FunctionProto* Compiler::newFunction(const std::string& name, int arity)
+{
+    functions.push_back(std::make_unique<FunctionProto>());
+    auto function = functions.back().get();
+    function->name = name;
+    function->arity = arity;
+    return function;
+}
+
+void Compiler::compileBody(vector<unique_ptr<Stmt>>& statements)
+{
+    for (auto& statement : statements) {
+        compile(statement.get());
+    }
+}
+
+void Compiler::failed(const std::string& message)
+{
+    error(line, message);
+    hadError = true;
+}
+
+// The bytecode has no objects yet; programs with classes run on the
+// other engines.
+void Compiler::unsupportedClass(const Token& token)
+{
+    if (sawClass) return;
+    sawClass = true;
+    line = token.line;
+    failed("Classes are not supported by the bytecode engine.");
+}
+
+void Compiler::unsupportedGenerator(const Token& token)
+{
+    if (sawGenerator) return;
+    sawGenerator = true;
+    line = token.line;
+    failed("Generators are not supported by the bytecode engine.");
+}
+
+void Compiler::emitShort(int value)
+{
+    emitByte((value >> 8) & 0xff);
+    emitByte(value & 0xff);
+}
+
+int Compiler::emitJump(OpCode op)
+{
+    emit(op);
+    emitShort(0xffff);
+    return chunk().code.size() - 2;
+}
+
+void Compiler::patchJump(int offset)
+{
+    // Counted from just after the operand.
+    int jump = chunk().code.size() - offset - 2;
+    if (jump > UINT16_MAX) {
+        failed("Too much code to jump over.");
+    }
+    chunk().code[offset] = (jump >> 8) & 0xff;
+    chunk().code[offset + 1] = jump & 0xff;
+}
+
+void Compiler::emitLoop(int start)
+{
+    emit(OpCode::LOOP);
+    int offset = chunk().code.size() - start + 2;
+    if (offset > UINT16_MAX) {
+        failed("Loop body too large.");
+    }
+    emitShort(offset);
+}
+
+int Compiler::makeConstant(Value value)
+{
+    auto& constants = chunk().constants;
+    if (constants.size() > UINT16_MAX) {
+        failed("Too many constants in one chunk.");
+        return 0;
+    }
+    constants.push_back(std::move(value));
+    return constants.size() - 1;
+}
+
+int Compiler::nameConstant(const Token& name)
+{
+    auto string = LoxString::intern(name.lexeme);
+    auto iter = current->nameConstants.find(string.get());
+    if (iter != current->nameConstants.end()) return iter->second;
+    int index = makeConstant(string);
+    current->nameConstants[string.get()] = index;
+    return index;
+}
+
+void Compiler::endScope()
+{
+    auto& locals = current->locals;
+    --current->scopeDepth;
+    while (!locals.empty() && locals.back().depth > current->scopeDepth) {
+        emit(locals.back().captured ? OpCode::CLOSE_UPVALUE : OpCode::POP);
+        locals.pop_back();
+    }
+}
+
+void Compiler::addLocal(const Token& name)
+{
+    if (current->locals.size() > UINT8_MAX) {
+        failed("Too many local variables in function.");
+        return;
+    }
+    current->locals.push_back(Local{name.lexeme, current->scopeDepth, false});
+}
+
+int Compiler::resolveLocal(FunctionState* state, const std::string& name)
+{
+    for (int i = state->locals.size() - 1; i >= 0; --i) {
+        if (state->locals[i].name == name) return i;
+    }
+    return -1;
+}
+
+int Compiler::resolveUpvalue(FunctionState* state, const std::string& name)
+{
+    if (state->enclosing == nullptr) return -1;
+
+    int local = resolveLocal(state->enclosing, name);
+    if (local != -1) {
+        state->enclosing->locals[local].captured = true;
+        return addUpvalue(state, local, true);
+    }
+
+    int upvalue = resolveUpvalue(state->enclosing, name);
+    if (upvalue != -1) {
+        return addUpvalue(state, upvalue, false);
+    }
+    return -1;
+}
+
+int Compiler::addUpvalue(FunctionState* state, int index, bool isLocal)
+{
+    auto& upvalues = state->upvalues;
+    for (int i = 0; i < upvalues.size(); ++i) {
+        if (upvalues[i].index == index && upvalues[i].isLocal == isLocal) {
+            return i;
+        }
+    }
+    if (upvalues.size() > UINT8_MAX) {
+        failed("Too many closure variables in function.");
+        return 0;
+    }
+    upvalues.push_back(UpvalueRef{static_cast<uint8_t>(index), isLocal});
+    return upvalues.size() - 1;
+}
+
+void Compiler::namedVariable(const Token& name, bool assign)
+{
+    line = name.line;
+    if (int slot = resolveLocal(current, name.lexeme); slot != -1) {
+        emit(assign ? OpCode::SET_LOCAL : OpCode::GET_LOCAL);
+        emitByte(slot);
+    }
+    else if (int index = resolveUpvalue(current, name.lexeme); index != -1) {
+        emit(assign ? OpCode::SET_UPVALUE : OpCode::GET_UPVALUE);
+        emitByte(index);
+    }
+    else {
+        int constant = nameConstant(name);
+        emit(assign ? OpCode::SET_GLOBAL : OpCode::GET_GLOBAL);
+        emitShort(constant);
+    }
+}
+
+any Compiler::visitAssignExpr(Assign* expr)
+{
+    compile(expr->value.get());
+    namedVariable(*expr->name, true);
+    return any();
+}
+
+any Compiler::visitBinaryExpr(Binary* expr)
+{
+    compile(expr->left.get());
+    compile(expr->right.get());
+
+    line = expr->op->line;
+    switch (expr->op->type) {
+    case TokenType::GREATER: emit(OpCode::GREATER); break;
+    case TokenType::GREATER_EQUAL: emit(OpCode::GREATER_EQUAL); break;
+    case TokenType::LESS: emit(OpCode::LESS); break;
+    case TokenType::LESS_EQUAL: emit(OpCode::LESS_EQUAL); break;
+    case TokenType::MINUS: emit(OpCode::SUBTRACT); break;
+    case TokenType::PLUS: emit(OpCode::ADD); break;
+    case TokenType::SLASH: emit(OpCode::DIVIDE); break;
+    case TokenType::STAR: emit(OpCode::MULTIPLY); break;
+    case TokenType::BANG_EQUAL: emit(OpCode::NOT_EQUAL); break;
+    case TokenType::EQUAL_EQUAL: emit(OpCode::EQUAL); break;
+    default:
+        break;
+    }
+    return any();
+}
+
+any Compiler::visitCallExpr(Call* expr)
+{
+    compile(expr->callee.get());
+    for (auto& argument : *expr->arguments) {
+        compile(argument.get());
+    }
+    line = expr->paren->line;
+    emit(OpCode::CALL);
+    emitByte(expr->arguments->size());
+    return any();
+}
+
+any Compiler::visitGroupingExpr(Grouping* expr)
+{
+    compile(expr->expression.get());
+    return any();
+}
+
+any Compiler::visitLiteralExpr(Literal* expr)
+{
+    line = expr->value->line;
+    auto& value = literals.at(expr->constant);
+    if (auto ptr = std::any_cast<bool>(&value)) {
+        emit(*ptr ? OpCode::TRUE : OpCode::FALSE);
+        return any();
+    }
+    if (std::any_cast<nullptr_t>(&value)) {
+        emit(OpCode::NIL);
+        return any();
+    }
+
+    auto iter = current->literalConstants.find(expr->constant);
+    int constant = 0;
+    if (iter != current->literalConstants.end()) {
+        constant = iter->second;
+    }
+    else {
+        if (auto ptr = std::any_cast<double>(&value)) {
+            constant = makeConstant(*ptr);
+        }
+        else {
+            constant = makeConstant(*std::any_cast<StringRef>(&value));
+        }
+        current->literalConstants[expr->constant] = constant;
+    }
+    emit(OpCode::CONSTANT);
+    emitShort(constant);
+    return any();
+}
+
+any Compiler::visitLogicalExpr(Logical* expr)
+{
+    compile(expr->left.get());
+    line = expr->op->line;
+    if (expr->op->type == TokenType::AND) {
+        int endJump = emitJump(OpCode::JUMP_IF_FALSE);
+        emit(OpCode::POP);
+        compile(expr->right.get());
+        patchJump(endJump);
+    }
+    else {
+        int elseJump = emitJump(OpCode::JUMP_IF_FALSE);
+        int endJump = emitJump(OpCode::JUMP);
+        patchJump(elseJump);
+        emit(OpCode::POP);
+        compile(expr->right.get());
+        patchJump(endJump);
+    }
+    return any();
+}
+
+any Compiler::visitUnaryExpr(Unary* expr)
+{
+    compile(expr->right.get());
+    line = expr->op->line;
+    if (expr->op->type == TokenType::MINUS) {
+        emit(OpCode::NEGATE);
+    }
+    else {
+        emit(OpCode::NOT);
+    }
+    return any();
+}
+
+any Compiler::visitVarExprExpr(VarExpr* expr)
+{
+    namedVariable(*expr->name, false);
+    return any();
+}
+
+any Compiler::visitBlockStmt(Block* stmt)
+{
+    beginScope();
+    compileBody(*stmt->statements);
+    endScope();
+    return any();
+}
+
+any Compiler::visitExpressionStmt(Expression* stmt)
+{
+    compile(stmt->expr.get());
+    emit(OpCode::POP);
+    return any();
+}
+
+any Compiler::visitFunctionStmt(Function* stmt)
+{
+    line = stmt->name->line;
+    // Declared before the body is compiled so that it can call itself.
+    bool local = current->scopeDepth > 0;
+    if (local) addLocal(*stmt->name);
+
+    FunctionState state;
+    state.function = newFunction(stmt->name->lexeme, stmt->params->size());
+    state.enclosing = current;
+    state.scopeDepth = 1;
+    state.locals.push_back(Local{"", 0, false});
+    current = &state;
+    for (auto& param : *stmt->params) {
+        addLocal(param);
+    }
+    compileBody(*stmt->body);
+    emit(OpCode::NONE);
+    emit(OpCode::RETURN);
+    current = state.enclosing;
+
+    state.function->upvalueCount = state.upvalues.size();
+    auto& functions = chunk().functions;
+    if (functions.size() > UINT16_MAX) {
+        failed("Too many functions in one chunk.");
+    }
+    functions.push_back(state.function);
+
+    line = stmt->name->line;
+    emit(OpCode::CLOSURE);
+    emitShort(functions.size() - 1);
+    for (auto& upvalue : state.upvalues) {
+        emitByte(upvalue.isLocal ? 1 : 0);
+        emitByte(upvalue.index);
+    }
+    if (!local) {
+        int name = nameConstant(*stmt->name);
+        emit(OpCode::DEFINE_GLOBAL);
+        emitShort(name);
+    }
+    return any();
+}
+
+any Compiler::visitIfStmt(If* stmt)
+{
+    compile(stmt->condition.get());
+    int thenJump = emitJump(OpCode::JUMP_IF_FALSE);
+    emit(OpCode::POP);
+    compile(stmt->thenBranch.get());
+    int elseJump = emitJump(OpCode::JUMP);
+    patchJump(thenJump);
+    emit(OpCode::POP);
+    if (stmt->elseBranch != nullptr) {
+        compile(stmt->elseBranch.get());
+    }
+    patchJump(elseJump);
+    return any();
+}
+
+any Compiler::visitPrintStmt(Print* stmt)
+{
+    compile(stmt->expr.get());
+    emit(OpCode::PRINT);
+    return any();
+}
+
+any Compiler::visitReturnStmt(Return* stmt)
+{
+    if (stmt->value != nullptr) {
+        compile(stmt->value.get());
+    }
+    else {
+        emit(OpCode::NONE);
+    }
+    line = stmt->keyword->line;
+    emit(OpCode::RETURN);
+    return any();
+}
+
+any Compiler::visitVarStmtStmt(VarStmt* stmt)
+{
+    if (stmt->initializer != nullptr) {
+        compile(stmt->initializer.get());
+    }
+    else {
+        emit(OpCode::NIL);
+    }
+
+    line = stmt->name->line;
+    if (current->scopeDepth > 0) {
+        // The value already sits in the new local's slot.
+        addLocal(*stmt->name);
+    }
+    else {
+        int name = nameConstant(*stmt->name);
+        emit(OpCode::DEFINE_GLOBAL);
+        emitShort(name);
+    }
+    return any();
+}
+
+any Compiler::visitWhileStmt(While* stmt)
+{
+    int loopStart = chunk().code.size();
+    compile(stmt->condition.get());
+    int exitJump = emitJump(OpCode::JUMP_IF_FALSE);
+    emit(OpCode::POP);
+    compile(stmt->body.get());
+    emitLoop(loopStart);
+    patchJump(exitJump);
+    emit(OpCode::POP);
+    return any();
+}
+
+any Compiler::visitGetExpr(Get* expr)
+{
+    unsupportedClass(*expr->name);
+    return any();
+}
+
+any Compiler::visitSetExpr(Set* expr)
+{
+    unsupportedClass(*expr->name);
+    return any();
+}
+
+any Compiler::visitSuperExpr(Super* expr)
+{
+    unsupportedClass(*expr->keyword);
+    return any();
+}
+
+any Compiler::visitThisExpr(This* expr)
+{
+    unsupportedClass(*expr->keyword);
+    return any();
+}
+
+any Compiler::visitClassStmt(Class* stmt)
+{
+    unsupportedClass(*stmt->name);
+    return any();
+}
+
+any Compiler::visitYieldStmt(Yield* stmt)
+{
+    unsupportedGenerator(*stmt->keyword);
+    return any();
+}
+
+}
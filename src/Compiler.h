@@ -0,0 +1,119 @@
+#pragma once
+
+#include "autogen/Expr.h"
+#include "autogen/Stmt.h"
+#include "Chunk.h"
+#include "ConstantPool.h"
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace lox {
+
+// Compiles a resolved program to bytecode for the Vm. Locals are kept in
+// stack slots and variables captured by closures become upvalues, so the
+// compiler tracks scopes itself; the Resolver has already reported any
+// scoping errors by the time it runs.
+class Compiler: public ExprVisitor, public StmtVisitor
+{
+public:
+    Compiler(const ConstantPool& literals,
+        std::vector<std::unique_ptr<FunctionProto>>& functions):
+        literals(literals), functions(functions) {}
+    ~Compiler() override = default;
+
+    // Returns the function that runs the program at the top level, or
+    // nullptr after reporting an error.
+    FunctionProto* compile(std::vector<std::unique_ptr<Stmt>>& statements);
+
+    any visitAssignExpr(Assign* expr) override;
+    any visitBinaryExpr(Binary* expr) override;
+    any visitCallExpr(Call* expr) override;
+    any visitGetExpr(Get* expr) override;
+    any visitGroupingExpr(Grouping* expr) override;
+    any visitLiteralExpr(Literal* expr) override;
+    any visitLogicalExpr(Logical* expr) override;
+    any visitSetExpr(Set* expr) override;
+    any visitSuperExpr(Super* expr) override;
+    any visitThisExpr(This* expr) override;
+    any visitUnaryExpr(Unary* expr) override;
+    any visitVarExprExpr(VarExpr* expr) override;
+
+    any visitBlockStmt(Block* stmt) override;
+    any visitExpressionStmt(Expression* stmt) override;
+    any visitFunctionStmt(Function* stmt) override;
+    any visitClassStmt(Class* stmt) override;
+    any visitIfStmt(If* stmt) override;
+    any visitPrintStmt(Print* stmt) override;
+    any visitReturnStmt(Return* stmt) override;
+    any visitVarStmtStmt(VarStmt* stmt) override;
+    any visitWhileStmt(While* stmt) override;
+    any visitYieldStmt(Yield* stmt) override;
+
+private:
+    struct Local
+    {
+        std::string name;
+        int depth;
+        bool captured;
+    };
+
+    struct UpvalueRef
+    {
+        uint8_t index;
+        bool isLocal;
+    };
+
+    // The function being compiled, nested like the source.
+    struct FunctionState
+    {
+        FunctionProto* function;
+        FunctionState* enclosing;
+        std::vector<Local> locals;
+        std::vector<UpvalueRef> upvalues;
+        int scopeDepth = 0;
+        // Literal pool index to constant index in this function's chunk.
+        std::unordered_map<int, int> literalConstants;
+        std::unordered_map<const LoxString*, int> nameConstants;
+    };
+
+    FunctionProto* newFunction(const std::string& name, int arity);
+    void compile(Expr* expr) { expr->accept(this); }
+    void compile(Stmt* stmt) { stmt->accept(this); }
+    void compileBody(vector<unique_ptr<Stmt>>& statements);
+
+    Chunk& chunk() { return current->function->chunk; }
+    void emit(OpCode op) { emitByte(static_cast<uint8_t>(op)); }
+    void emitByte(uint8_t byte) { chunk().write(byte, line); }
+    void emitShort(int value);
+    int emitJump(OpCode op);
+    void patchJump(int offset);
+    void emitLoop(int start);
+    int makeConstant(Value value);
+    int nameConstant(const Token& name);
+
+    void beginScope() { ++current->scopeDepth; }
+    void endScope();
+    void addLocal(const Token& name);
+    int resolveLocal(FunctionState* state, const std::string& name);
+    int resolveUpvalue(FunctionState* state, const std::string& name);
+    int addUpvalue(FunctionState* state, int index, bool isLocal);
+    void namedVariable(const Token& name, bool assign);
+    void failed(const std::string& message);
+    void unsupportedClass(const Token& token);
+    void unsupportedGenerator(const Token& token);
+
+    const ConstantPool& literals;
+    std::vector<std::unique_ptr<FunctionProto>>& functions;
+    FunctionState* current = nullptr;
+    // Line of the node being compiled, recorded for every byte emitted.
+    int line = 0;
+    bool hadError = false;
+    // Reported once, at the first class feature.
+    bool sawClass = false;
+    // Reported once, at the first yield.
+    bool sawGenerator = false;
+};
+
+}
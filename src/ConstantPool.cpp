@@ -0,0 +1,36 @@
+#include "ConstantPool.h"
+#include "LoxString.h"
+#include <cstring>
+
+namespace lox {
+
+int ConstantPool::append(const std::any& value)
+{
+    values.push_back(value);
+    return values.size() - 1;
+}
+
+int ConstantPool::add(const std::any& value)
+{
+    if (auto ptr = std::any_cast<double>(&value)) {
+        uint64_t bits = 0;
+        std::memcpy(&bits, ptr, sizeof(bits));
+        auto iter = numbers.find(bits);
+        if (iter != numbers.end()) return iter->second;
+        return numbers[bits] = append(value);
+    }
+    if (auto ptr = std::any_cast<StringRef>(&value)) {
+        auto iter = strings.find(ptr->get());
+        if (iter != strings.end()) return iter->second;
+        return strings[ptr->get()] = append(value);
+    }
+    if (auto ptr = std::any_cast<bool>(&value)) {
+        int& index = *ptr ? trueIndex : falseIndex;
+        if (index < 0) index = append(value);
+        return index;
+    }
+    if (nilIndex < 0) nilIndex = append(std::any(nullptr));
+    return nilIndex;
+}
+
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <any>
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace lox {
+
+class LoxString;
+
+// Literal values of a program, boxed once when the program is parsed.
+// Identical literals share one entry, and Literal nodes refer to their
+// entry by index, so evaluating a literal never allocates.
+class ConstantPool
+{
+public:
+    int add(const std::any& value);
+    const std::any& at(int index) const { return values[index]; }
+    size_t size() const { return values.size(); }
+
+private:
+    int append(const std::any& value);
+
+    std::vector<std::any> values;
+    // Numbers are keyed by bit pattern so 0 and -0 stay distinct.
+    std::unordered_map<uint64_t, int> numbers;
+    // Literal strings are interned, so the object identifies the value.
+    std::unordered_map<const LoxString*, int> strings;
+    int nilIndex = -1;
+    int trueIndex = -1;
+    int falseIndex = -1;
+};
+
+}
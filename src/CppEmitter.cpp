@@ -0,0 +1,429 @@
+#include "CppEmitter.h"
+#include "Lox.h"
+#include "LoxString.h"
+#include <fmt/format.h>
+#include <utility>
+
+namespace lox {
+
+std::string CppEmitter::emit(std::vector<std::unique_ptr<Stmt>>& statements)
+{
+    units.push_back(Unit{std::string(), 1, 0});
+    global("clock");
+    global("sqrt");
+    line("lox_rt::define(g_clock, lox_rt::clockNative());");
+    line("lox_rt::define(g_sqrt, lox_rt::sqrtNative());");
+    for (auto& statement : statements) {
+        emit(statement.get());
+    }
+    auto script = std::move(units.back().code);
+    units.pop_back();
+
+    std::string source = kCppRuntime;
+    source += "\n";
+    source += constants;
+    for (auto& name : globals) {
+        source += fmt::format("static lox_rt::Global g_{}(\"{}\");\n",
+            name, name);
+    }
+    source += "\n" + prototypes + "\n" + functions;
+    source += "static void script()\n{\n" + script + "}\n\n";
+    source += "int main()\n{\n    return lox_rt::run(script);\n}\n";
+    return source;
+}
+
+std::string CppEmitter::emit(Expr* expr)
+{
+    return std::any_cast<std::string>(expr->accept(this));
+}
+
+void CppEmitter::emit(Stmt* stmt)
+{
+    stmt->accept(this);
+}
+
+void CppEmitter::line(const std::string& text)
+{
+    auto& unit = units.back();
+    unit.code.append(unit.indent * 4, ' ');
+    unit.code += text;
+    unit.code += '\n';
+}
+
+void CppEmitter::beginScope(int slots, bool escapes)
+{
+    int id = nextScope++;
+    if (escapes) {
+        line(fmt::format("auto e{} = std::make_shared<lox_rt::Env>({}, {});",
+            id, environment(), slots));
+    }
+    scopes.push_back(Scope{id, escapes});
+}
+
+void CppEmitter::endScope()
+{
+    scopes.pop_back();
+}
+
+std::string CppEmitter::environment()
+{
+    auto& unit = units.back();
+    for (size_t i = scopes.size(); i > unit.firstScope; --i) {
+        if (scopes[i - 1].escapes) return fmt::format("e{}", scopes[i - 1].id);
+    }
+    // Every scope around a closure escapes, so the innermost one outside
+    // this function is the one it captured.
+    return unit.firstScope > 0 ? "closure" : "nullptr";
+}
+
+std::string CppEmitter::variable(const Token& name, int depth, int slot)
+{
+    if (depth < 0) return global(name.lexeme);
+
+    size_t index = scopes.size() - 1 - depth;
+    auto& unit = units.back();
+    if (index >= unit.firstScope) {
+        auto& scope = scopes[index];
+        if (scope.escapes) return fmt::format("e{}->slots[{}]", scope.id, slot);
+        return fmt::format("l{}_{}", scope.id, slot);
+    }
+
+    std::string access = "closure";
+    for (size_t i = index + 1; i < unit.firstScope; ++i) {
+        access += "->enclosing";
+    }
+    return fmt::format("{}->slots[{}]", access, slot);
+}
+
+std::string CppEmitter::global(const std::string& name)
+{
+    globals.insert(name);
+    return "g_" + name;
+}
+
+std::string CppEmitter::string(const std::string& text)
+{
+    std::string literal;
+    for (unsigned char c : text) {
+        if (c == '"' || c == '\\') {
+            literal += '\\';
+            literal += c;
+        }
+        else if (c < 0x20 || c >= 0x7f) {
+            // Octal escapes stop after three digits, unlike \x.
+            literal += fmt::format("\\{:03o}", c);
+        }
+        else {
+            literal += c;
+        }
+    }
+
+    auto name = fmt::format("s{}", nextString++);
+    constants += fmt::format(
+        "static const lox_rt::Value {} = lox_rt::string(std::string(\"{}\", {}));\n",
+        name, literal, text.size());
+    return name;
+}
+
+any CppEmitter::visitAssignExpr(Assign* expr)
+{
+    auto value = emit(expr->value.get());
+    auto target = variable(*expr->name, expr->depth, expr->slot);
+    if (expr->depth < 0) {
+        return fmt::format("lox_rt::assign({}, {}, {})",
+            target, value, expr->name->line);
+    }
+    return fmt::format("({} = {})", target, value);
+}
+
+any CppEmitter::visitBinaryExpr(Binary* expr)
+{
+    const char* function = nullptr;
+    switch (expr->op->type) {
+    case TokenType::GREATER: function = "greater"; break;
+    case TokenType::GREATER_EQUAL: function = "greaterEqual"; break;
+    case TokenType::LESS: function = "less"; break;
+    case TokenType::LESS_EQUAL: function = "lessEqual"; break;
+    case TokenType::MINUS: function = "subtract"; break;
+    case TokenType::PLUS: function = "add"; break;
+    case TokenType::SLASH: function = "divide"; break;
+    case TokenType::STAR: function = "multiply"; break;
+    case TokenType::BANG_EQUAL: function = "notEqual"; break;
+    case TokenType::EQUAL_EQUAL: function = "equal"; break;
+    default: function = "equal"; break;
+    }
+    // Braced initializers evaluate left to right.
+    return fmt::format("lox_rt::{}({{{}, {}}}, {})", function,
+        emit(expr->left.get()), emit(expr->right.get()), expr->op->line);
+}
+
+any CppEmitter::visitCallExpr(Call* expr)
+{
+    auto code = fmt::format("lox_rt::call(std::array<lox_rt::Value, {}>{{{}",
+        expr->arguments->size() + 1, emit(expr->callee.get()));
+    for (auto& argument : *expr->arguments) {
+        code += ", " + emit(argument.get());
+    }
+    return code + fmt::format("}}, {})", expr->paren->line);
+}
+
+any CppEmitter::visitGetExpr(Get* expr)
+{
+    return fmt::format("lox_rt::getProperty({}, \"{}\", {})",
+        emit(expr->object.get()), expr->name->lexeme, expr->name->line);
+}
+
+any CppEmitter::visitGroupingExpr(Grouping* expr)
+{
+    return "(" + emit(expr->expression.get()) + ")";
+}
+
+any CppEmitter::visitLiteralExpr(Literal* expr)
+{
+    auto& literal = expr->value->literal;
+    if (auto number = std::any_cast<double>(&literal)) {
+        auto digits = fmt::format("{}", *number);
+        if (digits.find_first_of(".e") == std::string::npos) digits += ".0";
+        return fmt::format("lox_rt::Value({})", digits);
+    }
+    if (auto text = std::any_cast<StringRef>(&literal)) {
+        return string(text->str());
+    }
+    if (auto boolean = std::any_cast<bool>(&literal)) {
+        return std::string(*boolean ? "lox_rt::Value(true)" : "lox_rt::Value(false)");
+    }
+    return std::string("lox_rt::Value(nullptr)");
+}
+
+any CppEmitter::visitLogicalExpr(Logical* expr)
+{
+    bool isOr = expr->op->type == TokenType::OR;
+    return fmt::format(
+        "[&]() -> lox_rt::Value {{ lox_rt::Value left = {}; "
+        "if ({}lox_rt::truthy(left)) return left; return {}; }}()",
+        emit(expr->left.get()), isOr ? "" : "!", emit(expr->right.get()));
+}
+
+any CppEmitter::visitSetExpr(Set* expr)
+{
+    // The object must be an instance before the value is evaluated.
+    return fmt::format(
+        "[&]() -> lox_rt::Value {{ auto object = lox_rt::fields({}, {}); "
+        "return lox_rt::setProperty(object, \"{}\", {}); }}()",
+        emit(expr->object.get()), expr->name->line, expr->name->lexeme,
+        emit(expr->value.get()));
+}
+
+any CppEmitter::visitSuperExpr(Super* expr)
+{
+    return fmt::format("lox_rt::superMethod({}, {}, \"{}\", {})",
+        variable(*expr->keyword, expr->depth, expr->slot),
+        variable(*expr->keyword, expr->depth - 1, 0),
+        expr->method->lexeme, expr->method->line);
+}
+
+any CppEmitter::visitThisExpr(This* expr)
+{
+    return variable(*expr->keyword, expr->depth, expr->slot);
+}
+
+any CppEmitter::visitUnaryExpr(Unary* expr)
+{
+    auto right = emit(expr->right.get());
+    if (expr->op->type == TokenType::MINUS) {
+        return fmt::format("lox_rt::negate({}, {})", right, expr->op->line);
+    }
+    return fmt::format("lox_rt::logicalNot({})", right);
+}
+
+any CppEmitter::visitVarExprExpr(VarExpr* expr)
+{
+    auto target = variable(*expr->name, expr->depth, expr->slot);
+    if (expr->depth < 0) {
+        return fmt::format("lox_rt::get({}, {})", target, expr->name->line);
+    }
+    return target;
+}
+
+any CppEmitter::visitBlockStmt(Block* stmt)
+{
+    line("{");
+    ++units.back().indent;
+    beginScope(stmt->slots, stmt->escapes);
+    for (auto& statement : *stmt->statements) {
+        emit(statement.get());
+    }
+    endScope();
+    --units.back().indent;
+    line("}");
+    return any();
+}
+
+any CppEmitter::visitExpressionStmt(Expression* stmt)
+{
+    line(emit(stmt->expr.get()) + ";");
+    return any();
+}
+
+any CppEmitter::visitFunctionStmt(Function* stmt)
+{
+    auto& name = stmt->name->lexeme;
+    auto value = fmt::format("lox_rt::function(\"{}\", {}, {}, {})",
+        name, stmt->params->size(), function(stmt), environment());
+    if (scopes.empty()) {
+        line(fmt::format("lox_rt::define({}, {});", global(name), value));
+    }
+    else {
+        line(fmt::format("{} = {};",
+            variable(*stmt->name, 0, stmt->slot), value));
+    }
+    return any();
+}
+
+// Methods see the class's scopes as enclosing ones: the scope binding
+// 'super', which the runtime creates along with the class, and the one
+// binding 'this', created whenever a method is bound.
+any CppEmitter::visitClassStmt(Class* stmt)
+{
+    auto& name = stmt->name->lexeme;
+    std::string superclass;
+    if (stmt->superclass != nullptr) {
+        superclass = emit(stmt->superclass.get());
+        scopes.push_back(Scope{nextScope++, true});
+    }
+    scopes.push_back(Scope{nextScope++, true});
+    std::string methods;
+    for (auto& method : *stmt->methods) {
+        if (!methods.empty()) methods += ", ";
+        methods += fmt::format("{{\"{}\", {}, {}}}", method->name->lexeme,
+            method->params->size(), function(method.get()));
+    }
+    scopes.pop_back();
+    if (stmt->superclass != nullptr) scopes.pop_back();
+
+    std::string value;
+    if (stmt->superclass != nullptr) {
+        value = fmt::format("lox_rt::subclass(\"{}\", {}, {}, {{{}}}, {})",
+            name, superclass, environment(), methods,
+            stmt->superclass->name->line);
+    }
+    else {
+        value = fmt::format("lox_rt::klass(\"{}\", {}, {{{}}})",
+            name, environment(), methods);
+    }
+    define(*stmt->name, stmt->slot, value);
+    return any();
+}
+
+std::string CppEmitter::function(Function* stmt)
+{
+    auto function = fmt::format("f{}_{}", nextFunction++, stmt->name->lexeme);
+    auto signature = fmt::format("static lox_rt::Value {}("
+        "[[maybe_unused]] const std::shared_ptr<lox_rt::Env>& closure, "
+        "[[maybe_unused]] lox_rt::Value* args)",
+        function);
+
+    units.push_back(Unit{std::string(), 1, scopes.size()});
+    beginScope(stmt->slots, stmt->escapes);
+    for (size_t i = 0; i < stmt->params->size(); ++i) {
+        auto& param = stmt->params->at(i);
+        if (stmt->escapes) {
+            line(fmt::format("{} = args[{}];", variable(param, 0, i), i));
+        }
+        else {
+            line(fmt::format("lox_rt::Value {} = args[{}];",
+                variable(param, 0, i), i));
+        }
+    }
+    for (auto& statement : *stmt->body) {
+        emit(statement.get());
+    }
+    line("return lox_rt::Value();");
+    endScope();
+
+    prototypes += signature + ";\n";
+    functions += signature + "\n{\n" + units.back().code + "}\n\n";
+    units.pop_back();
+    return function;
+}
+
+any CppEmitter::visitIfStmt(If* stmt)
+{
+    line(fmt::format("if (lox_rt::truthy({})) {{",
+        emit(stmt->condition.get())));
+    ++units.back().indent;
+    emit(stmt->thenBranch.get());
+    --units.back().indent;
+    if (stmt->elseBranch != nullptr) {
+        line("}");
+        line("else {");
+        ++units.back().indent;
+        emit(stmt->elseBranch.get());
+        --units.back().indent;
+    }
+    line("}");
+    return any();
+}
+
+any CppEmitter::visitPrintStmt(Print* stmt)
+{
+    line(fmt::format("lox_rt::print({});", emit(stmt->expr.get())));
+    return any();
+}
+
+any CppEmitter::visitReturnStmt(Return* stmt)
+{
+    if (stmt->value == nullptr) {
+        line("return lox_rt::Value();");
+    }
+    else {
+        line(fmt::format("return {};", emit(stmt->value.get())));
+    }
+    return any();
+}
+
+any CppEmitter::visitVarStmtStmt(VarStmt* stmt)
+{
+    std::string value = "lox_rt::Value(nullptr)";
+    if (stmt->initializer != nullptr) {
+        value = emit(stmt->initializer.get());
+    }
+    define(*stmt->name, stmt->slot, value);
+    return any();
+}
+
+void CppEmitter::define(const Token& name, int slot, const std::string& value)
+{
+    if (scopes.empty()) {
+        line(fmt::format("lox_rt::define({}, {});",
+            global(name.lexeme), value));
+    }
+    else if (scopes.back().escapes) {
+        line(fmt::format("{} = {};", variable(name, 0, slot), value));
+    }
+    else {
+        line(fmt::format("lox_rt::Value {} = {};",
+            variable(name, 0, slot), value));
+    }
+}
+
+any CppEmitter::visitWhileStmt(While* stmt)
+{
+    line(fmt::format("while (lox_rt::truthy({})) {{",
+        emit(stmt->condition.get())));
+    ++units.back().indent;
+    emit(stmt->body.get());
+    --units.back().indent;
+    line("}");
+    return any();
+}
+
+// The runtime has no coroutines to suspend a C++ function with.
+any CppEmitter::visitYieldStmt(Yield* stmt)
+{
+    if (std::exchange(sawGenerator, true)) return any();
+    error(*stmt->keyword, "Generators are not supported by --emit-cpp.");
+    return any();
+}
+
+}
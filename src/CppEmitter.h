@@ -0,0 +1,106 @@
+#pragma once
+
+#include "autogen/Expr.h"
+#include "autogen/Stmt.h"
+#include <set>
+#include <string>
+#include <vector>
+
+namespace lox {
+
+// Source of the runtime every emitted program includes, see CppRuntime.cpp.
+extern const char* const kCppRuntime;
+
+// Translates a resolved program to a self-contained C++17 translation
+// unit, printed by --emit-cpp.
+//
+// Each Lox function becomes a C++ function. Variables use the Resolver's
+// coordinates: a scope no closure can capture becomes plain C++ locals,
+// one that can is a reference-counted environment the closures share,
+// and globals are named cells that stay late bound. The runtime repeats
+// the interpreter's semantics and error messages, so a program prints
+// the same output and exits with the same status either way.
+class CppEmitter: public ExprVisitor, public StmtVisitor
+{
+    struct Scope
+    {
+        int id;
+        bool escapes;
+    };
+
+    // A function being emitted, or the top-level script.
+    struct Unit
+    {
+        std::string code;
+        int indent;
+        // Index in scopes of the unit's outermost scope.
+        size_t firstScope;
+    };
+
+public:
+    CppEmitter() = default;
+    ~CppEmitter() override = default;
+
+    std::string emit(std::vector<std::unique_ptr<Stmt>>& statements);
+
+    any visitAssignExpr(Assign* expr) override;
+    any visitBinaryExpr(Binary* expr) override;
+    any visitCallExpr(Call* expr) override;
+    any visitGetExpr(Get* expr) override;
+    any visitGroupingExpr(Grouping* expr) override;
+    any visitLiteralExpr(Literal* expr) override;
+    any visitLogicalExpr(Logical* expr) override;
+    any visitSetExpr(Set* expr) override;
+    any visitSuperExpr(Super* expr) override;
+    any visitThisExpr(This* expr) override;
+    any visitUnaryExpr(Unary* expr) override;
+    any visitVarExprExpr(VarExpr* expr) override;
+
+    any visitBlockStmt(Block* stmt) override;
+    any visitExpressionStmt(Expression* stmt) override;
+    any visitFunctionStmt(Function* stmt) override;
+    any visitClassStmt(Class* stmt) override;
+    any visitIfStmt(If* stmt) override;
+    any visitPrintStmt(Print* stmt) override;
+    any visitReturnStmt(Return* stmt) override;
+    any visitVarStmtStmt(VarStmt* stmt) override;
+    any visitWhileStmt(While* stmt) override;
+    any visitYieldStmt(Yield* stmt) override;
+
+private:
+    std::string emit(Expr* expr);
+    void emit(Stmt* stmt);
+    void line(const std::string& text);
+    // Emits the body of a function or method as a C++ function and
+    // returns its name.
+    std::string function(Function* stmt);
+    // Defines a variable declared at the Resolver's slot in the current
+    // scope.
+    void define(const Token& name, int slot, const std::string& value);
+
+    // Opens a scope in the current unit, creating its environment if
+    // closures can capture it.
+    void beginScope(int slots, bool escapes);
+    void endScope();
+    // The innermost environment, or nullptr when there is none.
+    std::string environment();
+    // The variable at the Resolver's (depth, slot), or the global name.
+    std::string variable(const Token& name, int depth, int slot);
+    std::string global(const std::string& name);
+    std::string string(const std::string& text);
+
+    std::vector<Scope> scopes;
+    std::vector<Unit> units;
+    int nextScope = 0;
+    // Declarations and definitions of the emitted functions.
+    std::string prototypes;
+    std::string functions;
+    std::string constants;
+    std::set<std::string> globals;
+    int nextFunction = 0;
+    int nextString = 0;
+    // Reported once, at the first yield.
+    bool sawGenerator = false;
+};
+
+}
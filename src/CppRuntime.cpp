@@ -0,0 +1,513 @@
+#include "CppEmitter.h"
+
+namespace lox {
+
+// The runtime every program from --emit-cpp starts with. It mirrors the
+// interpreter: the same values, truthiness, equality, number formatting,
+// error messages and call depth limit.
+const char* const kCppRuntime = R"runtime(#include <array>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <initializer_list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace lox_rt {
+
+struct Object
+{
+    virtual ~Object() = default;
+};
+
+struct Value
+{
+    enum class Type : unsigned char
+    {
+        // What a function without a return value produces.
+        NONE, NIL, BOOL, NUMBER, STRING, FUNCTION, NATIVE, CLASS, INSTANCE
+    };
+
+    Value(): type(Type::NONE), number(0) {}
+    Value(std::nullptr_t): type(Type::NIL), number(0) {}
+    Value(bool boolean): type(Type::BOOL), boolean(boolean) {}
+    Value(double number): type(Type::NUMBER), number(number) {}
+    Value(Type type, std::shared_ptr<Object> object):
+        type(type), number(0), object(std::move(object)) {}
+
+    Type type;
+    union
+    {
+        bool boolean;
+        double number;
+    };
+    std::shared_ptr<Object> object;
+};
+
+struct String: Object
+{
+    explicit String(std::string text): text(std::move(text)) {}
+    std::string text;
+};
+
+// An environment that closures can capture. Scopes no closure can see
+// are plain C++ locals instead. Environments are reference counted, so
+// one that holds a closure over itself is never freed.
+struct Env
+{
+    Env(std::shared_ptr<Env> enclosing, int slots):
+        enclosing(std::move(enclosing)), slots(slots) {}
+
+    std::shared_ptr<Env> enclosing;
+    std::vector<Value> slots;
+};
+
+using Code = Value (*)(const std::shared_ptr<Env>& closure, Value* args);
+
+struct Function: Object
+{
+    Function(const char* name, int arity, Code code,
+        std::shared_ptr<Env> closure, bool initializer = false):
+        name(name), arity(arity), code(code), closure(std::move(closure)),
+        initializer(initializer) {}
+
+    const char* name;
+    int arity;
+    Code code;
+    std::shared_ptr<Env> closure;
+    // An initializer returns 'this', which its closure binds.
+    bool initializer;
+};
+
+struct Method
+{
+    const char* name;
+    int arity;
+    Code code;
+};
+
+// Methods include the inherited ones. Their closure encloses the scope
+// that binds 'this', which bind() adds.
+struct Class: Object
+{
+    explicit Class(const char* name): name(name) {}
+
+    const char* name;
+    std::unordered_map<std::string, std::shared_ptr<Function>> methods;
+    std::shared_ptr<Function> initializer;
+};
+
+struct Instance: Object
+{
+    explicit Instance(std::shared_ptr<Class> klass): klass(std::move(klass)) {}
+
+    std::shared_ptr<Class> klass;
+    std::unordered_map<std::string, Value> fields;
+};
+
+struct Native: Object
+{
+    Native(int arity, Value (*code)(Value* args, int line)):
+        arity(arity), code(code) {}
+
+    int arity;
+    Value (*code)(Value* args, int line);
+};
+
+struct RuntimeError
+{
+    std::string message;
+    int line;
+};
+
+struct Global
+{
+    explicit Global(const char* name): name(name) {}
+
+    const char* name;
+    bool defined = false;
+    Value value;
+};
+
+struct Operands
+{
+    Value left;
+    Value right;
+};
+
+constexpr int kMaxCallDepth = 10000;
+inline int callDepth = 0;
+
+[[noreturn]] inline void fail(std::string message, int line)
+{
+    throw RuntimeError{std::move(message), line};
+}
+
+inline Value string(std::string text)
+{
+    return Value(Value::Type::STRING, std::make_shared<String>(std::move(text)));
+}
+
+inline Value function(const char* name, int arity, Code code,
+    std::shared_ptr<Env> closure)
+{
+    return Value(Value::Type::FUNCTION,
+        std::make_shared<Function>(name, arity, code, std::move(closure)));
+}
+
+inline const std::string& text(const Value& value)
+{
+    return static_cast<String*>(value.object.get())->text;
+}
+
+inline bool truthy(const Value& value)
+{
+    if (value.type == Value::Type::BOOL) return value.boolean;
+    return value.type != Value::Type::NONE && value.type != Value::Type::NIL;
+}
+
+inline bool same(const Value& a, const Value& b)
+{
+    if (a.type != b.type) return false;
+    switch (a.type) {
+    case Value::Type::NONE:
+    case Value::Type::NIL:
+        return true;
+    case Value::Type::BOOL:
+        return a.boolean == b.boolean;
+    case Value::Type::NUMBER:
+        return a.number == b.number;
+    case Value::Type::STRING:
+        return text(a) == text(b);
+    default:
+        return a.object == b.object;
+    }
+}
+
+inline std::string format(double number)
+{
+    char buffer[64];
+    double whole = 0.0;
+    if (std::modf(number, &whole) == 0.0) {
+        std::snprintf(buffer, sizeof(buffer), "%.0f", number);
+        return buffer;
+    }
+    if (std::isnan(number)) return std::signbit(number) ? "-nan" : "nan";
+
+    // The shortest digits that read back as the same number, written in
+    // fixed notation for exponents from -4 to 15.
+    auto end = std::to_chars(buffer, buffer + sizeof(buffer), number,
+        std::chars_format::scientific).ptr;
+    std::string scientific(buffer, end);
+    auto e = scientific.find('e');
+    int exponent = std::stoi(scientific.substr(e + 1));
+    if (exponent < -4 || exponent >= 16) return scientific;
+
+    std::string sign = number < 0 ? "-" : "";
+    std::string digits;
+    for (size_t i = sign.size(); i < e; ++i) {
+        if (scientific[i] != '.') digits += scientific[i];
+    }
+    if (exponent < 0) {
+        return sign + "0." + std::string(-exponent - 1, '0') + digits;
+    }
+    size_t integral = exponent + 1;
+    if (digits.size() <= integral) {
+        return sign + digits + std::string(integral - digits.size(), '0');
+    }
+    return sign + digits.substr(0, integral) + "." + digits.substr(integral);
+}
+
+inline std::string stringify(const Value& value)
+{
+    switch (value.type) {
+    case Value::Type::NONE:
+        return "";
+    case Value::Type::NIL:
+        return "nil";
+    case Value::Type::BOOL:
+        return value.boolean ? "true" : "false";
+    case Value::Type::NUMBER:
+        return format(value.number);
+    case Value::Type::STRING:
+        return text(value);
+    case Value::Type::FUNCTION:
+        return std::string("<fn ")
+            + static_cast<Function*>(value.object.get())->name + " >";
+    case Value::Type::NATIVE:
+        return "<native fn>";
+    case Value::Type::CLASS:
+        return static_cast<Class*>(value.object.get())->name;
+    case Value::Type::INSTANCE:
+        return std::string(static_cast<Instance*>(value.object.get())
+            ->klass->name) + " instance";
+    }
+    return "";
+}
+
+inline void print(const Value& value)
+{
+    auto output = stringify(value);
+    output += '\n';
+    std::fwrite(output.data(), 1, output.size(), stdout);
+}
+
+inline void define(Global& global, Value value)
+{
+    global.value = std::move(value);
+    global.defined = true;
+}
+
+inline const Value& get(const Global& global, int line)
+{
+    if (!global.defined) {
+        fail(std::string("Undefined variable '") + global.name + "'.", line);
+    }
+    return global.value;
+}
+
+inline const Value& assign(Global& global, Value value, int line)
+{
+    if (!global.defined) {
+        fail(std::string("Undefined variable '") + global.name + "'.", line);
+    }
+    global.value = std::move(value);
+    return global.value;
+}
+
+inline void numbers(const Operands& operands, int line)
+{
+    if (operands.left.type != Value::Type::NUMBER
+        || operands.right.type != Value::Type::NUMBER) {
+        fail("Operands must be numbers.", line);
+    }
+}
+
+inline Value add(const Operands& operands, int line)
+{
+    auto& a = operands.left;
+    auto& b = operands.right;
+    if (a.type == Value::Type::NUMBER && b.type == Value::Type::NUMBER) {
+        return a.number + b.number;
+    }
+    if (a.type == Value::Type::STRING && b.type == Value::Type::STRING) {
+        return string(text(a) + text(b));
+    }
+    fail("Operands must be two numbers or two strings.", line);
+}
+
+#define LOX_RT_NUMERIC(name, op) \
+    inline Value name(const Operands& operands, int line) \
+    { \
+        numbers(operands, line); \
+        return operands.left.number op operands.right.number; \
+    }
+LOX_RT_NUMERIC(subtract, -)
+LOX_RT_NUMERIC(multiply, *)
+LOX_RT_NUMERIC(divide, /)
+LOX_RT_NUMERIC(greater, >)
+LOX_RT_NUMERIC(greaterEqual, >=)
+LOX_RT_NUMERIC(less, <)
+LOX_RT_NUMERIC(lessEqual, <=)
+#undef LOX_RT_NUMERIC
+
+inline Value equal(const Operands& operands, int)
+{
+    return same(operands.left, operands.right);
+}
+
+inline Value notEqual(const Operands& operands, int)
+{
+    return !same(operands.left, operands.right);
+}
+
+inline Value negate(const Value& value, int line)
+{
+    if (value.type != Value::Type::NUMBER) {
+        fail("Operand must be a number.", line);
+    }
+    return -value.number;
+}
+
+inline Value logicalNot(const Value& value)
+{
+    return !truthy(value);
+}
+
+inline Value klass(const char* name, std::shared_ptr<Env> closure,
+    std::initializer_list<Method> methods, const Class* superclass = nullptr)
+{
+    auto result = std::make_shared<Class>(name);
+    if (superclass != nullptr) result->methods = superclass->methods;
+    for (auto& method : methods) {
+        bool initializer = std::strcmp(method.name, "init") == 0;
+        result->methods[method.name] = std::make_shared<Function>(
+            method.name, method.arity, method.code, closure, initializer);
+    }
+    auto init = result->methods.find("init");
+    if (init != result->methods.end()) result->initializer = init->second;
+    return Value(Value::Type::CLASS, std::move(result));
+}
+
+// Methods of a subclass close over a scope binding 'super'.
+inline Value subclass(const char* name, const Value& superclass,
+    std::shared_ptr<Env> closure, std::initializer_list<Method> methods,
+    int line)
+{
+    if (superclass.type != Value::Type::CLASS) {
+        fail("Superclass must be a class.", line);
+    }
+    auto scope = std::make_shared<Env>(std::move(closure), 1);
+    scope->slots[0] = superclass;
+    return klass(name, std::move(scope), methods,
+        static_cast<Class*>(superclass.object.get()));
+}
+
+inline Value bind(const Function& method, const Value& instance)
+{
+    auto scope = std::make_shared<Env>(method.closure, 1);
+    scope->slots[0] = instance;
+    return Value(Value::Type::FUNCTION, std::make_shared<Function>(
+        method.name, method.arity, method.code, std::move(scope),
+        method.initializer));
+}
+
+inline Value getProperty(const Value& object, const char* name, int line)
+{
+    if (object.type != Value::Type::INSTANCE) {
+        fail("Only instances have properties.", line);
+    }
+    auto instance = static_cast<Instance*>(object.object.get());
+    auto field = instance->fields.find(name);
+    if (field != instance->fields.end()) return field->second;
+    auto method = instance->klass->methods.find(name);
+    if (method == instance->klass->methods.end()) {
+        fail(std::string("Undefined property '") + name + "'.", line);
+    }
+    return bind(*method->second, object);
+}
+
+inline const Value& fields(const Value& object, int line)
+{
+    if (object.type != Value::Type::INSTANCE) {
+        fail("Only instances have fields.", line);
+    }
+    return object;
+}
+
+inline Value setProperty(const Value& object, const char* name, Value value)
+{
+    static_cast<Instance*>(object.object.get())->fields[name] = value;
+    return value;
+}
+
+inline Value superMethod(const Value& superclass, const Value& instance,
+    const char* name, int line)
+{
+    auto& methods = static_cast<Class*>(superclass.object.get())->methods;
+    auto method = methods.find(name);
+    if (method == methods.end()) {
+        fail(std::string("Undefined property '") + name + "'.", line);
+    }
+    return bind(*method->second, instance);
+}
+
+class DepthGuard
+{
+public:
+    DepthGuard(int line)
+    {
+        if (callDepth == kMaxCallDepth) fail("Stack overflow.", line);
+        ++callDepth;
+    }
+    ~DepthGuard() { --callDepth; }
+};
+
+// values holds the callee followed by the arguments, evaluated in order.
+template <size_t N>
+Value call(std::array<Value, N>&& values, int line)
+{
+    auto& callee = values[0];
+    int count = N - 1;
+    int arity = 0;
+    if (callee.type == Value::Type::FUNCTION) {
+        arity = static_cast<Function*>(callee.object.get())->arity;
+    }
+    else if (callee.type == Value::Type::NATIVE) {
+        arity = static_cast<Native*>(callee.object.get())->arity;
+    }
+    else if (callee.type == Value::Type::CLASS) {
+        auto& initializer = static_cast<Class*>(callee.object.get())->initializer;
+        if (initializer != nullptr) arity = initializer->arity;
+    }
+    else {
+        fail("Can only call functions and classes.", line);
+    }
+    if (count != arity) {
+        fail("Expected " + std::to_string(arity) + " arguments but got "
+            + std::to_string(count) + ".", line);
+    }
+    DepthGuard depth(line);
+    if (callee.type == Value::Type::FUNCTION) {
+        auto function = static_cast<Function*>(callee.object.get());
+        auto result = function->code(function->closure, values.data() + 1);
+        if (function->initializer) return function->closure->slots[0];
+        return result;
+    }
+    if (callee.type == Value::Type::CLASS) {
+        auto klass = std::static_pointer_cast<Class>(callee.object);
+        Value instance(Value::Type::INSTANCE,
+            std::make_shared<Instance>(klass));
+        if (klass->initializer != nullptr) {
+            auto method = bind(*klass->initializer, instance);
+            auto function = static_cast<Function*>(method.object.get());
+            function->code(function->closure, values.data() + 1);
+        }
+        return instance;
+    }
+    return static_cast<Native*>(callee.object.get())->code(
+        values.data() + 1, line);
+}
+
+inline Value clockNative()
+{
+    return Value(Value::Type::NATIVE, std::make_shared<Native>(0,
+        [](Value*, int) -> Value {
+            auto now = std::chrono::steady_clock::now();
+            auto millis = std::chrono::duration_cast<std::chrono::milliseconds>(
+                now.time_since_epoch()).count();
+            return (double)millis / 1000.0;
+        }));
+}
+
+inline Value sqrtNative()
+{
+    return Value(Value::Type::NATIVE, std::make_shared<Native>(1,
+        [](Value* args, int line) -> Value {
+            if (args[0].type != Value::Type::NUMBER) {
+                fail("Argument 1 to 'sqrt' must be a number.", line);
+            }
+            return std::sqrt(args[0].number);
+        }));
+}
+
+inline int run(void (*script)())
+{
+    try {
+        script();
+    }
+    catch (const RuntimeError& error) {
+        std::printf("%s\n[line %d]\n", error.message.c_str(), error.line);
+        return 70;
+    }
+    return 0;
+}
+
+}
+)runtime";
+
+}
@@ -0,0 +1,141 @@
+#include "Embed.h"
+#include "Lox.h"
+#include "Channel.h"
+#include "Interpreter.h"
+#include "LoxCallable.h"
+#include "Vm.h"
+#include <fmt/format.h>
+
+namespace lox::embed {
+
+struct Program::Compiled
+{
+    std::vector<std::unique_ptr<Stmt>> statements;
+    // Literal nodes refer to these by index.
+    ConstantPool constants;
+};
+
+// What runtimeError() would have printed.
+static Error failure(const RuntimeError& error)
+{
+    return Error(70, fmt::format("{}\n[line {}]", error.what(),
+        error.token.line));
+}
+
+Program::Program(): compiled(std::make_unique<Compiled>()) {}
+
+Program::~Program() = default;
+
+std::shared_ptr<const Program> Program::compile(const std::string& source)
+{
+    // Only collects the literals and the errors.
+    Isolate isolate((Options()));
+    std::string errors;
+    isolate.output = [&errors](std::string_view text) { errors += text; };
+    auto statements = isolate.compile(source);
+    if (isolate.hadError) {
+        if (!errors.empty() && errors.back() == '\n') errors.pop_back();
+        throw Error(65, errors);
+    }
+
+    std::shared_ptr<Program> program(new Program());
+    program->compiled->statements = std::move(statements);
+    program->compiled->constants = isolate.interpreter->constantPool();
+    return program;
+}
+
+Context::Context(std::shared_ptr<const Program> program, Output output):
+    Context(std::move(program), Options(), std::move(output))
+{}
+
+Context::Context(std::shared_ptr<const Program> program,
+    const Options& options, Output output):
+    program(std::move(program))
+{
+    auto settings = options;
+    settings.jit = false;
+    settings.emitCpp = false;
+    settings.profileIn.clear();
+    settings.profileOut.clear();
+    settings.snapshotIn.clear();
+    settings.snapshotOut.clear();
+    isolate = std::make_unique<Isolate>(settings);
+    isolate->output = std::move(output);
+
+    Isolate::Scope scope(isolate.get());
+    auto& interpreter = *isolate->interpreter;
+    auto& compiled = *this->program->compiled;
+    interpreter.constantPool() = compiled.constants;
+    try {
+        Isolate::Watchdog watchdog(isolate.get());
+        interpreter.run(compiled.statements);
+    }
+    catch (const RuntimeError& error) {
+        throw failure(error);
+    }
+}
+
+Context::~Context()
+{
+    Isolate::Scope scope(isolate.get());
+    isolate.reset();
+}
+
+Value Context::apply(const std::string& name, std::vector<Value> arguments)
+{
+    Isolate::Scope scope(isolate.get());
+    auto& interpreter = *isolate->interpreter;
+    auto callee = interpreter.global(name);
+    int arity = -1;
+    if (auto function = std::any_cast<LoxFunction*>(&callee)) {
+        arity = (*function)->arity();
+    }
+    else if (auto closure = std::any_cast<Closure*>(&callee)) {
+        arity = (*closure)->function->arity;
+    }
+    if (!callee.has_value()) {
+        throw Error(70, fmt::format("Undefined function '{}'.", name));
+    }
+    if (arity < 0) {
+        throw Error(70, fmt::format("'{}' is not a function.", name));
+    }
+    if (arity != int(arguments.size())) {
+        throw Error(70, fmt::format("Expected {} arguments but got {}.",
+            arity, arguments.size()));
+    }
+
+    Limits limits;
+    limits.fuel = isolate->options.fuel;
+    limits.memory = isolate->options.maxMemory;
+    interpreter.useLimits(limits);
+
+    std::vector<std::any> values;
+    values.reserve(arguments.size());
+    for (auto& argument : arguments) {
+        values.push_back(Channel::copyIn(argument));
+    }
+    std::any result;
+    try {
+        Isolate::Watchdog watchdog(isolate.get());
+        result = interpreter.invoke(callee, values);
+    }
+    catch (const RuntimeError& error) {
+        throw failure(error);
+    }
+    if (!result.has_value()) return nullptr;
+    try {
+        return Channel::copyOut(result);
+    }
+    catch (const NativeError&) {
+        throw Error(70, fmt::format(
+            "Function '{}' must return nil, a boolean, a number or a string.",
+            name));
+    }
+}
+
+void Context::cancel()
+{
+    isolate->interpreter->cancel();
+}
+
+}
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+// The API of liblox, for programs that run Lox scripts themselves:
+//
+//     auto program = lox::embed::Program::compile(source);
+//     lox::embed::Context context(program, [](std::string_view text) {
+//         log(text);
+//     });
+//     double total = std::get<double>(context.call("total", 3, "items"));
+//
+// Nothing in the library exits the process. Compile errors and runtime
+// errors are thrown as lox::embed::Error.
+namespace lox {
+
+struct Options;
+class Isolate;
+class Stmt;
+
+namespace embed {
+
+// What values cross between the host and Lox as: nil, booleans, numbers
+// and strings.
+using Value = std::variant<std::nullptr_t, bool, double, std::string>;
+
+// A failed compile or call, with what the command line would have printed
+// and the status it would have exited with: 65 for compile errors, 70 for
+// runtime errors.
+class Error: public std::runtime_error
+{
+public:
+    Error(int status, const std::string& message):
+        std::runtime_error(message), status(status)
+    {}
+
+    int status;
+};
+
+// A script compiled once: its resolved statements and literals. It never
+// changes once compiled, and any number of contexts can run it.
+//
+// A program and its contexts belong to the thread that compiled it.
+class Program
+{
+public:
+    // Throws an Error listing the compile errors, if there are any.
+    static std::shared_ptr<const Program> compile(const std::string& source);
+
+    ~Program();
+    Program(const Program&) = delete;
+    Program& operator=(const Program&) = delete;
+
+private:
+    Program();
+
+    struct Compiled;
+    std::unique_ptr<Compiled> compiled;
+
+    friend class Context;
+};
+
+// One run of a program, with globals and a heap of its own. Making one
+// runs the program's top-level statements, which define the functions
+// call() can then invoke any number of times.
+class Context
+{
+public:
+    // Receives everything the program prints, newlines included.
+    using Output = std::function<void(std::string_view text)>;
+
+    // Without an output the program prints to stdout. Throws an Error if
+    // the top-level statements fail.
+    explicit Context(std::shared_ptr<const Program> program,
+        Output output = {});
+    // Runs the program with the given engine and collector settings. The
+    // JIT isn't available to contexts, as its code belongs to one
+    // interpreter, and the options about files are ignored. The limits
+    // of options (fuel, maxMemory and timeout) apply to the top-level
+    // statements and to each call on its own; a call that runs out fails
+    // with an Error.
+    Context(std::shared_ptr<const Program> program, const Options& options,
+        Output output = {});
+    ~Context();
+    Context(const Context&) = delete;
+    Context& operator=(const Context&) = delete;
+
+    // Calls the global function name with the given arguments: nil,
+    // booleans, numbers or strings. It must return one of those too, and
+    // must take as many arguments as it is given. Throws an Error for
+    // runtime errors.
+    template <typename... Arguments>
+    Value call(const std::string& name, Arguments&&... arguments)
+    {
+        return apply(name,
+            std::vector<Value>{toValue(std::forward<Arguments>(arguments))...});
+    }
+    // call() with the arguments in a vector.
+    Value apply(const std::string& name, std::vector<Value> arguments);
+
+    // Has the running call fail with "Script cancelled." once it reaches
+    // a loop iteration or a call. The only method that may be called from
+    // another thread; the context stays usable.
+    void cancel();
+
+private:
+    template <typename T>
+    static Value toValue(T&& value)
+    {
+        using Type = std::decay_t<T>;
+        if constexpr (std::is_same_v<Type, Value>
+            || std::is_same_v<Type, bool>
+            || std::is_same_v<Type, std::nullptr_t>) {
+            return Value(std::forward<T>(value));
+        }
+        else if constexpr (std::is_arithmetic_v<Type>) {
+            return Value(static_cast<double>(value));
+        }
+        else {
+            return Value(std::string(std::forward<T>(value)));
+        }
+    }
+
+    std::shared_ptr<const Program> program;
+    std::unique_ptr<Isolate> isolate;
+};
+
+}
+}
@@ -1,49 +1,100 @@
 #include "Environment.h"
 #include "Interpreter.h"
+#include "LoxClass.h"
+#include <atomic>
 #include <fmt/format.h>
 
 namespace lox {
 
-void Environment::define(const std::string& name, const std::any& value)
+static std::atomic<uint64_t> nextVersion{1};
+
+static_assert(sizeof(Environment) % alignof(std::any) == 0,
+    "slots must be aligned");
+
+Environment* Environment::create(Heap& heap, Environment* enclosing,
+    int slots, bool escapes)
 {
-    values.insert({name, value});
+    size_t bytes = sizeof(Environment) + slots * sizeof(std::any);
+    if (escapes) {
+        return heap.makeSized<Environment>(bytes, enclosing, slots);
+    }
+    return heap.makeScoped<Environment>(bytes, enclosing, slots);
 }
 
-std::any& Environment::get(const Token& name)
+Environment::Environment(Environment* enclosing, int count):
+    enclosing(enclosing), count(count)
 {
-    if (values.find(name.lexeme) != values.end()) {
-        return values.at(name.lexeme);
+    for (int i = 0; i < count; ++i) {
+        new (&values()[i]) std::any();
     }
+}
 
-    if (enclosing != nullptr) return enclosing->get(name);
-
-    throw RuntimeError(name,
-        fmt::format("Undefined variable '{}'.", name.lexeme));
+Environment::~Environment()
+{
+    for (int i = 0; i < count; ++i) {
+        values()[i].~any();
+    }
 }
 
-std::any& Environment::getAt(int distance, const std::string& name)
+std::any& Environment::getAt(int distance, int slot)
 {
-    return ancestor(distance)->values[name];
+    return ancestor(distance)->values()[slot];
 }
 
 Environment* Environment::ancestor(int distance)
 {
     auto env = this;
     for (int i = 0; i < distance; ++i) {
-        env = env->enclosing.get();
+        env = env->enclosing;
     }
     return env;
 }
 
-void Environment::assign(const Token& name, const std::any& value)
+void Environment::assignAt(int distance, int slot, const std::any& value)
 {
-    if (values.find(name.lexeme) != values.end()) {
-        values[name.lexeme] = value;
-        return;
+    ancestor(distance)->values()[slot] = value;
+}
+
+Environment* Environment::pop()
+{
+    return enclosing;
+}
+
+void Environment::trace(Heap& heap)
+{
+    heap.markObject(enclosing);
+    for (int i = 0; i < count; ++i) {
+        heap.markValue(values()[i]);
     }
+}
 
-    if (enclosing != nullptr) {
-        enclosing->assign(name, value);
+void GlobalEnvironment::define(const std::string& name,
+    const std::any& value)
+{
+    auto [iter, inserted] = values.try_emplace(name, value);
+    if (!inserted) rebind(iter->second, value);
+}
+
+std::any& GlobalEnvironment::get(const Token& name)
+{
+    auto iter = values.find(name.lexeme);
+    if (iter != values.end()) {
+        return iter->second;
+    }
+
+    throw RuntimeError(name,
+        fmt::format("Undefined variable '{}'.", name.lexeme));
+}
+
+GlobalEnvironment::GlobalEnvironment():
+    Environment(nullptr, 0), changes(nextVersion++)
+{}
+
+void GlobalEnvironment::assign(const Token& name, const std::any& value)
+{
+    auto iter = values.find(name.lexeme);
+    if (iter != values.end()) {
+        rebind(iter->second, value);
         return;
     }
 
@@ -51,15 +102,21 @@ void Environment::assign(const Token& name, const std::any& value)
         fmt::format("Undefined variable '{}'.", name.lexeme));
 }
 
-void Environment::assignAt(int distance,
-    const Token& name, const std::any& value)
+void GlobalEnvironment::rebind(std::any& binding, const std::any& value)
 {
-    ancestor(distance)->values[name.lexeme] = value;
+    if (binding.type() == typeid(LoxFunction*)
+        || binding.type() == typeid(NativeCallable*)
+        || binding.type() == typeid(LoxClass*)) {
+        changes = nextVersion++;
+    }
+    binding = value;
 }
 
-std::shared_ptr<Environment> Environment::pop()
+void GlobalEnvironment::trace(Heap& heap)
 {
-    return enclosing;
+    for (auto& [name, value] : values) {
+        heap.markValue(value);
+    }
 }
 
-}
\ No newline at end of file
+}
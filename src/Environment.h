@@ -3,52 +3,72 @@
 #include <unordered_map>
 #include <string>
 #include <any>
-#include <memory>
+#include <cstdint>
 #include "Scanner.h"
+#include "Heap.h"
 
 namespace lox {
 
-class Environment
+// A local scope. Variables live in slots numbered by the Resolver, stored
+// right after the object in the same pooled allocation.
+class Environment: public Obj
 {
 public:
-    Environment() = default;
-    Environment(std::shared_ptr<Environment> enclosing):
-        enclosing(enclosing) {}
+    // Scopes that no closure can capture are released as soon as they
+    // exit instead of waiting for the collector.
+    static Environment* create(Heap& heap, Environment* enclosing,
+        int slots, bool escapes);
 
-    void define(const std::string& name, const std::any& value);
-    std::any& get(const Token& name);
-    std::any& getAt(int distance, const std::string& name);
-    void assign(const Token& name, const std::any& value);
-    void assignAt(int distance, const Token& name, const std::any& value);
-    std::shared_ptr<Environment> pop();
+    Environment(Environment* enclosing, int count);
+    ~Environment() override;
+
+    std::any& slot(int index) { return values()[index]; }
+    std::any& getAt(int distance, int slot);
+    void assignAt(int distance, int slot, const std::any& value);
+    Environment* pop();
     Environment* ancestor(int distance);
 
+    void trace(Heap& heap) override;
+
 private:
-    std::unordered_map<std::string, std::any> values;
-    // memory leakage will occur.
-    std::shared_ptr<Environment> enclosing;
-};
+    std::any* values()
+    {
+        return reinterpret_cast<std::any*>(
+            reinterpret_cast<char*>(this) + sizeof(Environment));
+    }
 
-class EnvironmentGuard
-{
-public:
-    EnvironmentGuard(std::shared_ptr<Environment>& env): env(env) {}
-    ~EnvironmentGuard() { env = env->pop(); }
+    Environment* enclosing;
+    int count;
 
-private:
-    std::shared_ptr<Environment>& env;
+    friend class Snapshot;
 };
 
-class EnvironmentSwapGuard
+// The outermost scope. Globals are late bound, so they stay keyed by name.
+class GlobalEnvironment: public Environment
 {
 public:
-    EnvironmentSwapGuard(std::shared_ptr<Environment>& cur,
-        std::shared_ptr<Environment>& pre): cur(cur), pre(pre) {}
-    ~EnvironmentSwapGuard() { std::swap(cur, pre); }
+    GlobalEnvironment();
+    ~GlobalEnvironment() override = default;
+
+    void define(const std::string& name, const std::any& value);
+    std::any& get(const Token& name);
+    void assign(const Token& name, const std::any& value);
+    const std::unordered_map<std::string, std::any>& entries() const
+    { return values; }
+    // Changes whenever a global holding a function is rebound, which is
+    // what call sites' caches check. Versions are never reused, not even
+    // by the globals of another interpreter running the same program.
+    uint64_t version() const { return changes; }
+    // For machine code that checks the version itself.
+    const uint64_t* versionAddress() const { return &changes; }
+
+    void trace(Heap& heap) override;
 
 private:
-    std::shared_ptr<Environment>& cur;
-    std::shared_ptr<Environment>& pre;
+    void rebind(std::any& binding, const std::any& value);
+
+    std::unordered_map<std::string, std::any> values;
+    uint64_t changes;
 };
 
-}
\ No newline at end of file
+}
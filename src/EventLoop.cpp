@@ -0,0 +1,504 @@
+#include "EventLoop.h"
+#include "Interpreter.h"
+#include "LoxCallable.h"
+#include "Native.h"
+#include "Vm.h"
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <system_error>
+#include <unistd.h>
+#include <fmt/format.h>
+
+extern char** environ;
+
+namespace lox {
+
+// Threads that run file operations, started with the first one.
+static constexpr size_t kIoThreads = 4;
+static constexpr size_t kBufferSize = 64 * 1024;
+
+static std::string describe(int error)
+{
+    return std::error_code(error, std::generic_category()).message();
+}
+
+static Channel::Message failure(const std::string& path, int error)
+{
+    return fmt::format("{}: {}", path, describe(error));
+}
+
+EventLoop::EventLoop(Interpreter* interpreter): interpreter(interpreter)
+{
+    epoll = epoll_create1(EPOLL_CLOEXEC);
+    wakeup = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (epoll < 0 || wakeup < 0) {
+        throw NativeError("Can't start the event loop: " + describe(errno));
+    }
+    watch(wakeup, EPOLLIN, 0, COMPLETION);
+    // A child that stops reading its input makes writes fail with EPIPE
+    // instead of killing the process.
+    signal(SIGPIPE, SIG_IGN);
+}
+
+EventLoop::~EventLoop()
+{
+    clear();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    jobsReady.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    if (wakeup >= 0) ::close(wakeup);
+    if (epoll >= 0) ::close(epoll);
+}
+
+void EventLoop::run()
+{
+    while (pending()) {
+        int timeout = -1;
+        if (!ready.empty()) {
+            timeout = 0;
+        }
+        else if (!timers.empty()) {
+            auto left = std::chrono::ceil<std::chrono::milliseconds>(
+                timers.begin()->first.first - Clock::now()).count();
+            timeout = int(std::clamp<decltype(left)>(left, 0, INT_MAX));
+        }
+        wait(timeout);
+
+        // Timers that are due, in deadline order.
+        auto now = Clock::now();
+        while (!timers.empty() && timers.begin()->first.first <= now) {
+            auto timer = timers.begin();
+            ready.emplace_back(std::move(timer->second), Results());
+            deadlines.erase(timer->first.second);
+            timers.erase(timer);
+        }
+        // Callbacks that start operations of their own leave them to
+        // the next round.
+        while (!ready.empty()) {
+            auto [callback, results] = std::move(ready.front());
+            ready.pop_front();
+            call(std::move(callback), results);
+        }
+    }
+}
+
+void EventLoop::clear()
+{
+    for (auto& [id, process] : processes) {
+        close(process);
+    }
+    processes.clear();
+    timers.clear();
+    deadlines.clear();
+    // Operations already on an I/O thread complete unnoticed.
+    files.clear();
+    ready.clear();
+    running.reset();
+    std::lock_guard<std::mutex> lock(mutex);
+    jobs.clear();
+}
+
+// Closures of the bytecode engine aren't values the heap knows.
+static void markCallback(Heap& heap, const std::any& callback)
+{
+    if (auto closure = std::any_cast<Closure*>(&callback)) {
+        heap.markObject(*closure);
+    }
+    else {
+        heap.markValue(callback);
+    }
+}
+
+void EventLoop::markRoots(Heap& heap)
+{
+    for (auto& [key, callback] : timers) {
+        markCallback(heap, callback);
+    }
+    for (auto& [id, process] : processes) {
+        markCallback(heap, process.callback);
+    }
+    for (auto& [id, callback] : files) {
+        markCallback(heap, callback);
+    }
+    for (auto& [callback, results] : ready) {
+        markCallback(heap, callback);
+    }
+    markCallback(heap, running);
+}
+
+uint64_t EventLoop::setTimeout(std::any callback, double ms)
+{
+    auto id = nextId++;
+    auto deadline = Clock::now()
+        + std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double, std::milli>(std::max(ms, 0.0)));
+    timers.emplace(std::make_pair(deadline, id), std::move(callback));
+    deadlines.emplace(id, deadline);
+    return id;
+}
+
+void EventLoop::clearTimeout(uint64_t id)
+{
+    auto deadline = deadlines.find(id);
+    if (deadline == deadlines.end()) return;
+    timers.erase(std::make_pair(deadline->second, id));
+    deadlines.erase(deadline);
+}
+
+void EventLoop::readFile(std::string path, std::any callback)
+{
+    auto id = nextId++;
+    files.emplace(id, std::move(callback));
+    submit(id, [path = std::move(path)]() -> Results {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return {failure(path, errno), nullptr};
+        std::string contents;
+        char buffer[kBufferSize];
+        ssize_t count;
+        while ((count = ::read(fd, buffer, sizeof(buffer))) != 0) {
+            if (count > 0) {
+                contents.append(buffer, count);
+            }
+            else if (errno != EINTR) {
+                int error = errno;
+                ::close(fd);
+                return {failure(path, error), nullptr};
+            }
+        }
+        ::close(fd);
+        return {nullptr, std::move(contents)};
+    });
+}
+
+void EventLoop::writeFile(std::string path, std::string contents,
+    std::any callback)
+{
+    auto id = nextId++;
+    files.emplace(id, std::move(callback));
+    submit(id, [path = std::move(path), contents = std::move(contents)]()
+        -> Results {
+        int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+            0644);
+        if (fd < 0) return {failure(path, errno)};
+        size_t written = 0;
+        while (written < contents.size()) {
+            ssize_t count = ::write(fd, contents.data() + written,
+                contents.size() - written);
+            if (count >= 0) {
+                written += count;
+            }
+            else if (errno != EINTR) {
+                int error = errno;
+                ::close(fd);
+                return {failure(path, error)};
+            }
+        }
+        if (::close(fd) < 0) return {failure(path, errno)};
+        return {nullptr};
+    });
+}
+
+void EventLoop::exec(const std::string& command, std::string input,
+    std::any callback)
+{
+    int in[2];
+    int out[2];
+    if (pipe2(in, O_CLOEXEC) < 0) {
+        throw NativeError(fmt::format("Can't run '{}': {}", command,
+            describe(errno)));
+    }
+    if (pipe2(out, O_CLOEXEC) < 0) {
+        int error = errno;
+        ::close(in[0]);
+        ::close(in[1]);
+        throw NativeError(fmt::format("Can't run '{}': {}", command,
+            describe(error)));
+    }
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, in[0], STDIN_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, out[1], STDOUT_FILENO);
+    // The child gets the default SIGPIPE back, see the constructor.
+    posix_spawnattr_t attributes;
+    posix_spawnattr_init(&attributes);
+    sigset_t defaults;
+    sigemptyset(&defaults);
+    sigaddset(&defaults, SIGPIPE);
+    posix_spawnattr_setsigdefault(&attributes, &defaults);
+    posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETSIGDEF);
+
+    const char* argv[] = {"sh", "-c", command.c_str(), nullptr};
+    pid_t pid;
+    int error = posix_spawn(&pid, "/bin/sh", &actions, &attributes,
+        const_cast<char**>(argv), environ);
+    posix_spawnattr_destroy(&attributes);
+    posix_spawn_file_actions_destroy(&actions);
+    ::close(in[0]);
+    ::close(out[1]);
+    if (error != 0) {
+        ::close(in[1]);
+        ::close(out[0]);
+        throw NativeError(fmt::format("Can't run '{}': {}", command,
+            describe(error)));
+    }
+
+    auto id = nextId++;
+    auto& process = processes[id];
+    process.pid = pid;
+    process.in = in[1];
+    process.out = out[0];
+    process.input = std::move(input);
+    process.callback = std::move(callback);
+    fcntl(process.in, F_SETFL, O_NONBLOCK);
+    fcntl(process.out, F_SETFL, O_NONBLOCK);
+    watch(process.out, EPOLLIN, id, STDOUT);
+    if (process.input.empty()) {
+        ::close(process.in);
+        process.in = -1;
+    }
+    else {
+        watch(process.in, EPOLLOUT, id, STDIN);
+    }
+    process.pidfd = int(syscall(SYS_pidfd_open, pid, 0));
+    if (process.pidfd >= 0) {
+        watch(process.pidfd, EPOLLIN, id, EXIT);
+    }
+    else {
+        // Without pidfds, the child is waited for once its output ends.
+        process.exited = true;
+    }
+}
+
+void EventLoop::submit(uint64_t id, std::function<Results()> job)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        jobs.emplace_back(id, std::move(job));
+    }
+    if (workers.size() < kIoThreads) {
+        workers.emplace_back(&EventLoop::work, this);
+    }
+    jobsReady.notify_one();
+}
+
+void EventLoop::work()
+{
+    while (true) {
+        std::pair<uint64_t, std::function<Results()>> job;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            jobsReady.wait(lock, [this]() {
+                return stopping || !jobs.empty();
+            });
+            if (stopping) return;
+            job = std::move(jobs.front());
+            jobs.pop_front();
+        }
+        auto results = job.second();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            completions.emplace_back(job.first, std::move(results));
+        }
+        uint64_t one = 1;
+        ssize_t written = ::write(wakeup, &one, sizeof(one));
+        (void)written;
+    }
+}
+
+void EventLoop::wait(int timeout)
+{
+    epoll_event events[16];
+    int count = epoll_wait(epoll, events, 16, timeout);
+    for (int i = 0; i < count; ++i) {
+        uint64_t id = events[i].data.u64 >> 2;
+        auto source = Source(events[i].data.u64 & 3);
+        if (source != COMPLETION) {
+            onProcess(id, source);
+            continue;
+        }
+
+        uint64_t signals;
+        ssize_t drained = ::read(wakeup, &signals, sizeof(signals));
+        (void)drained;
+        std::deque<std::pair<uint64_t, Results>> done;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            done.swap(completions);
+        }
+        for (auto& [file, results] : done) {
+            auto callback = files.find(file);
+            // Abandoned by clear().
+            if (callback == files.end()) continue;
+            ready.emplace_back(std::move(callback->second), std::move(results));
+            files.erase(callback);
+        }
+    }
+}
+
+// Closing a descriptor also takes it out of the epoll set.
+void EventLoop::onProcess(uint64_t id, Source source)
+{
+    auto entry = processes.find(id);
+    if (entry == processes.end()) return;
+    auto& process = entry->second;
+
+    if (source == STDIN) {
+        while (process.written < process.input.size()) {
+            ssize_t count = ::write(process.in,
+                process.input.data() + process.written,
+                process.input.size() - process.written);
+            if (count >= 0) {
+                process.written += count;
+            }
+            else if (errno == EAGAIN) {
+                return;
+            }
+            else if (errno != EINTR) {
+                // The child stopped reading.
+                break;
+            }
+        }
+        ::close(process.in);
+        process.in = -1;
+    }
+    else if (source == STDOUT) {
+        char buffer[kBufferSize];
+        while (true) {
+            ssize_t count = ::read(process.out, buffer, sizeof(buffer));
+            if (count > 0) {
+                process.output.append(buffer, count);
+            }
+            else if (count < 0 && errno == EAGAIN) {
+                return;
+            }
+            else if (count == 0 || errno != EINTR) {
+                break;
+            }
+        }
+        ::close(process.out);
+        process.out = -1;
+    }
+    else {
+        ::close(process.pidfd);
+        process.pidfd = -1;
+        process.exited = true;
+    }
+    if (process.out < 0 && process.exited) finish(id, process);
+}
+
+void EventLoop::finish(uint64_t id, Process& process)
+{
+    int status = 0;
+    while (waitpid(process.pid, &status, 0) < 0 && errno == EINTR) {}
+    double code = WIFEXITED(status) ? WEXITSTATUS(status)
+        : 128 + WTERMSIG(status);
+    process.pid = -1;
+    if (process.in >= 0) ::close(process.in);
+    ready.emplace_back(std::move(process.callback),
+        Results{code, std::move(process.output)});
+    processes.erase(id);
+}
+
+void EventLoop::close(Process& process)
+{
+    if (process.pid > 0) {
+        kill(process.pid, SIGKILL);
+        while (waitpid(process.pid, nullptr, 0) < 0 && errno == EINTR) {}
+    }
+    if (process.in >= 0) ::close(process.in);
+    if (process.out >= 0) ::close(process.out);
+    if (process.pidfd >= 0) ::close(process.pidfd);
+}
+
+void EventLoop::watch(int fd, uint32_t events, uint64_t id, Source source)
+{
+    epoll_event event{};
+    event.events = events;
+    event.data.u64 = id << 2 | source;
+    epoll_ctl(epoll, EPOLL_CTL_ADD, fd, &event);
+}
+
+void EventLoop::call(std::any callback, const Results& results)
+{
+    std::vector<std::any> arguments;
+    for (auto& result : results) {
+        arguments.push_back(Channel::copyIn(result));
+    }
+    running = std::move(callback);
+    interpreter->callback(running, arguments);
+    running.reset();
+}
+
+bool EventLoop::pending() const
+{
+    return !timers.empty() || !files.empty() || !processes.empty()
+        || !ready.empty();
+}
+
+// Callbacks are Lox functions: the tree-walker's and the bytecode
+// engine's.
+static void checkCallback(const char* native, int position,
+    const std::any& callback, int arity)
+{
+    int actual = -1;
+    if (auto function = std::any_cast<LoxFunction*>(&callback)) {
+        actual = (*function)->arity();
+    }
+    else if (auto closure = std::any_cast<Closure*>(&callback)) {
+        actual = (*closure)->function->arity;
+    }
+    if (actual < 0) {
+        throw NativeError(fmt::format("Argument {} to '{}' must be a function.",
+            position, native));
+    }
+    if (actual != arity) {
+        throw NativeError(fmt::format(
+            "Callback passed to '{}' must take {} argument{}.",
+            native, arity, arity == 1 ? "" : "s"));
+    }
+}
+
+void registerEventLoopNatives(Interpreter& interpreter)
+{
+    registerNative(interpreter, "setTimeout",
+        [&interpreter](const std::any& callback, double ms) {
+            checkCallback("setTimeout", 1, callback, 0);
+            return double(interpreter.eventLoop().setTimeout(callback, ms));
+        });
+    registerNative(interpreter, "clearTimeout", [&interpreter](double id) {
+        if (id >= 0) interpreter.eventLoop().clearTimeout(uint64_t(id));
+    });
+    registerNative(interpreter, "readFile",
+        [&interpreter](const std::string& path, const std::any& callback) {
+            checkCallback("readFile", 2, callback, 2);
+            interpreter.eventLoop().readFile(path, callback);
+        });
+    registerNative(interpreter, "writeFile",
+        [&interpreter](const std::string& path, const std::string& contents,
+            const std::any& callback) {
+            checkCallback("writeFile", 3, callback, 1);
+            interpreter.eventLoop().writeFile(path, contents, callback);
+        });
+    registerNative(interpreter, "exec",
+        [&interpreter](const std::string& command, const std::string& input,
+            const std::any& callback) {
+            checkCallback("exec", 3, callback, 2);
+            interpreter.eventLoop().exec(command, input, callback);
+        });
+}
+
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include "Channel.h"
+#include <any>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <sys/types.h>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace lox {
+
+class Heap;
+class Interpreter;
+
+// Runs the callbacks of a program's asynchronous operations on the thread
+// of its interpreter, once the program's statements are done. Operations
+// overlap: the loop waits on all of them at once with epoll and calls back
+// for each one as it completes, until none is left.
+//
+// Timers are kept in deadline order and bound how long epoll waits. Child
+// processes are pipes and a pidfd in the epoll set. Regular files can't
+// be polled, so reads and writes run on a few I/O threads, which hand
+// their results back through an eventfd. Only the loop's thread ever
+// touches Lox values.
+class EventLoop
+{
+public:
+    explicit EventLoop(Interpreter* interpreter);
+    ~EventLoop();
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    // Calls back until nothing is pending. Runtime errors in callbacks are
+    // thrown, leaving the remaining operations to clear().
+    void run();
+    // Abandons every pending operation, killing child processes.
+    void clear();
+
+    void markRoots(Heap& heap);
+
+    // Callbacks are functions taking the arguments noted.
+
+    // callback() after at least ms milliseconds. Returns the timer's id.
+    uint64_t setTimeout(std::any callback, double ms);
+    void clearTimeout(uint64_t id);
+    // callback(error, contents), error is nil on success.
+    void readFile(std::string path, std::any callback);
+    // callback(error).
+    void writeFile(std::string path, std::string contents,
+        std::any callback);
+    // Runs command with sh, writes input to its stdin and calls
+    // callback(status, output) with its exit status and stdout.
+    void exec(const std::string& command, std::string input,
+        std::any callback);
+
+private:
+    using Clock = std::chrono::steady_clock;
+    using Results = std::vector<Channel::Message>;
+
+    struct Process
+    {
+        pid_t pid = -1;
+        int pidfd = -1;
+        int in = -1;
+        int out = -1;
+        std::string input;
+        size_t written = 0;
+        std::string output;
+        bool exited = false;
+        std::any callback;
+    };
+
+    // What epoll reports for, stored with the id in the event's data.
+    enum Source : uint64_t { COMPLETION, STDIN, STDOUT, EXIT };
+
+    void submit(uint64_t id, std::function<Results()> job);
+    void work();
+    void wait(int timeout);
+    void onProcess(uint64_t id, Source source);
+    void finish(uint64_t id, Process& process);
+    void close(Process& process);
+    void watch(int fd, uint32_t events, uint64_t id, Source source);
+    void call(std::any callback, const Results& results);
+    bool pending() const;
+
+    Interpreter* interpreter;
+    int epoll = -1;
+    int wakeup = -1;
+    uint64_t nextId = 1;
+
+    std::map<std::pair<Clock::time_point, uint64_t>, std::any> timers;
+    std::unordered_map<uint64_t, Clock::time_point> deadlines;
+    std::unordered_map<uint64_t, Process> processes;
+    // Callbacks of file operations on the I/O threads.
+    std::unordered_map<uint64_t, std::any> files;
+    // Operations that completed and whose callbacks are due.
+    std::deque<std::pair<std::any, Results>> ready;
+    // The callback being called.
+    std::any running;
+
+    // Shared with the I/O threads.
+    std::mutex mutex;
+    std::condition_variable jobsReady;
+    std::deque<std::pair<uint64_t, std::function<Results()>>> jobs;
+    std::deque<std::pair<uint64_t, Results>> completions;
+    bool stopping = false;
+    std::vector<std::thread> workers;
+};
+
+// Defines setTimeout(callback, ms), clearTimeout(id), readFile(path,
+// callback), writeFile(path, contents, callback) and exec(command, input,
+// callback) on the interpreter's event loop.
+void registerEventLoopNatives(Interpreter& interpreter);
+
+}
@@ -0,0 +1,389 @@
+#include "Generator.h"
+#include "ClosureCompiler.h"
+#include <sys/mman.h>
+#include <unistd.h>
+#include <cstdint>
+#include <new>
+#include <utility>
+
+#if defined(__SANITIZE_ADDRESS__)
+#define LOX_ASAN_FIBERS
+#elif defined(__SANITIZE_THREAD__)
+#define LOX_TSAN_FIBERS
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define LOX_ASAN_FIBERS
+#elif __has_feature(thread_sanitizer)
+#define LOX_TSAN_FIBERS
+#endif
+#endif
+
+#ifdef LOX_ASAN_FIBERS
+#include <sanitizer/asan_interface.h>
+#include <sanitizer/common_interface_defs.h>
+#endif
+#ifdef LOX_TSAN_FIBERS
+#include <sanitizer/tsan_interface.h>
+#endif
+
+#if defined(__x86_64__) && defined(__linux__)
+#define LOX_STACK_SWITCH_X64
+#else
+#include <ucontext.h>
+#endif
+
+namespace lox {
+
+// Lox calls the body may nest.
+static constexpr int kCallDepth = 256;
+// Calls stop this far above the end of the stack, as on threads' stacks.
+static constexpr size_t kStackReserve = 256 * 1024;
+// Room for the C++ frames of those calls, at a generous 8 KiB per call,
+// above the reserve. Only the pages a generator touches are ever backed
+// by memory.
+static constexpr size_t kStackBytes = kCallDepth * 8 * 1024 + kStackReserve;
+// Generators that may run on top of one another, each on its own stack.
+static constexpr size_t kMaxRunning = 256;
+// Slots of the body's value stack.
+static constexpr size_t kStackValues = 1024;
+// Stacks of finished generators, kept for the next ones.
+static constexpr size_t kSpareStacks = 16;
+
+#ifdef LOX_STACK_SWITCH_X64
+
+// Saves the callee-saved registers and the floating-point control words
+// on the running stack, stores its stack pointer in *from and resumes the
+// stack whose pointer is to.
+extern "C" void lox_switch_stack(void** from, void* to);
+// Where a new stack starts: calls r13(r12), which never returns.
+extern "C" void lox_stack_start();
+
+asm(R"(
+    .text
+    .globl lox_switch_stack
+    .hidden lox_switch_stack
+    .type lox_switch_stack, @function
+    .p2align 4
+lox_switch_stack:
+    pushq %rbp
+    pushq %rbx
+    pushq %r12
+    pushq %r13
+    pushq %r14
+    pushq %r15
+    subq $8, %rsp
+    stmxcsr (%rsp)
+    fnstcw 4(%rsp)
+    movq %rsp, (%rdi)
+    movq %rsi, %rsp
+    ldmxcsr (%rsp)
+    fldcw 4(%rsp)
+    addq $8, %rsp
+    popq %r15
+    popq %r14
+    popq %r13
+    popq %r12
+    popq %rbx
+    popq %rbp
+    ret
+    .size lox_switch_stack, .-lox_switch_stack
+
+    .globl lox_stack_start
+    .hidden lox_stack_start
+    .type lox_stack_start, @function
+    .p2align 4
+lox_stack_start:
+    movq %r12, %rdi
+    callq *%r13
+    ud2
+    .size lox_stack_start, .-lox_stack_start
+)");
+
+// Lays out the frame lox_switch_stack pops, returning into
+// lox_stack_start with entry and argument in r13 and r12.
+static void* prepareStack(void* memory, size_t bytes, void (*entry)(void*),
+    void* argument, void*& caller)
+{
+    auto top = reinterpret_cast<uint64_t*>(
+        static_cast<char*>(memory) + bytes);
+    auto frame = top - 10;
+    // Default MXCSR and x87 control word.
+    frame[0] = uint64_t(0x037f) << 32 | 0x1f80;
+    frame[1] = 0;
+    frame[2] = 0;
+    frame[3] = reinterpret_cast<uint64_t>(entry);
+    frame[4] = reinterpret_cast<uint64_t>(argument);
+    frame[5] = 0;
+    frame[6] = 0;
+    frame[7] = reinterpret_cast<uint64_t>(&lox_stack_start);
+    // Leaves the stack 16-byte aligned at the call in lox_stack_start.
+    frame[8] = 0;
+    frame[9] = 0;
+    caller = nullptr;
+    return frame;
+}
+
+static void switchStack(void** from, void* to)
+{
+    lox_switch_stack(from, to);
+}
+
+#else
+
+// Without a switch of our own, the contexts of both sides and what the
+// new stack starts with live at the bottom of the generator's stack.
+struct StackStart
+{
+    ucontext_t self;
+    ucontext_t caller;
+    void (*entry)(void*);
+    void* argument;
+};
+
+static void startContext(unsigned high, unsigned low)
+{
+    auto bits = uintptr_t(high) << 16 << 16 | low;
+    auto start = reinterpret_cast<StackStart*>(bits);
+    start->entry(start->argument);
+}
+
+static void* prepareStack(void* memory, size_t bytes, void (*entry)(void*),
+    void* argument, void*& caller)
+{
+    auto start = new (memory) StackStart;
+    auto base = reinterpret_cast<char*>(start + 1);
+    start->entry = entry;
+    start->argument = argument;
+    getcontext(&start->self);
+    start->self.uc_stack.ss_sp = base;
+    start->self.uc_stack.ss_size = static_cast<char*>(memory) + bytes - base;
+    start->self.uc_link = nullptr;
+    auto bits = reinterpret_cast<uintptr_t>(start);
+    makecontext(&start->self, reinterpret_cast<void (*)()>(startContext), 2,
+        unsigned(bits >> 16 >> 16), unsigned(bits));
+    caller = &start->caller;
+    return &start->self;
+}
+
+static void switchStack(void** from, void* to)
+{
+    swapcontext(static_cast<ucontext_t*>(*from), static_cast<ucontext_t*>(to));
+}
+
+#endif
+
+// The sanitizers must be told which stack is about to run, and that it
+// did. Both are no-ops in other builds.
+static void leavingStack([[maybe_unused]] void** fakeStack,
+    [[maybe_unused]] const void* bottom, [[maybe_unused]] size_t size)
+{
+#ifdef LOX_ASAN_FIBERS
+    __sanitizer_start_switch_fiber(fakeStack, bottom, size);
+#endif
+}
+
+static void enteredStack([[maybe_unused]] void* fakeStack,
+    [[maybe_unused]] const void** bottom, [[maybe_unused]] size_t* size)
+{
+#ifdef LOX_ASAN_FIBERS
+    __sanitizer_finish_switch_fiber(fakeStack, bottom, size);
+#endif
+}
+
+static size_t pageSize()
+{
+    static const size_t size = sysconf(_SC_PAGESIZE);
+    return size;
+}
+
+static thread_local std::vector<void*> spareStacks;
+
+// The lowest page stays inaccessible, so running off the end faults.
+static void* allocateStack()
+{
+    if (!spareStacks.empty()) {
+        void* memory = spareStacks.back();
+        spareStacks.pop_back();
+        return memory;
+    }
+    void* memory = mmap(nullptr, kStackBytes, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+    if (memory == MAP_FAILED) throw std::bad_alloc();
+    mprotect(memory, pageSize(), PROT_NONE);
+    return memory;
+}
+
+static void releaseStack(void* memory)
+{
+#ifdef LOX_ASAN_FIBERS
+    // Frames abandoned on the stack may have left it poisoned.
+    ASAN_UNPOISON_MEMORY_REGION(static_cast<char*>(memory) + pageSize(),
+        kStackBytes - pageSize());
+#endif
+    if (spareStacks.size() < kSpareStacks) {
+        spareStacks.push_back(memory);
+    }
+    else {
+        munmap(memory, kStackBytes);
+    }
+}
+
+Generator::Generator(Interpreter* interpreter, Function* declaration,
+    const CompiledBlock* compiled):
+    interpreter(interpreter), declaration(declaration), compiled(compiled),
+    // The stackless engine keeps the body's values itself.
+    context{nullptr, {}, ValueStack(interpreter->stackless != nullptr
+            ? 0 : kStackValues),
+        Interpreter::kMaxCallDepth - kCallDepth, 0, {}}
+{}
+
+void Generator::start(Environment* scope)
+{
+    this->scope = scope;
+    context.environment = scope;
+}
+
+Generator::~Generator()
+{
+    finish();
+}
+
+any Generator::call(Interpreter* interpreter, Arguments arguments)
+{
+    if (state == State::DONE) return nullptr;
+    if (state == State::RUNNING) {
+        throw NativeError("Generator is already running.");
+    }
+    if (interpreter->generators.size() == kMaxRunning) {
+        throw NativeError("Stack overflow.");
+    }
+    if (state == State::STARTING) {
+        memory = allocateStack();
+        context.stackLimit = reinterpret_cast<uintptr_t>(memory) + pageSize()
+            + kStackReserve;
+        self = prepareStack(static_cast<char*>(memory) + pageSize(),
+            kStackBytes - pageSize(), entry, this, caller);
+#ifdef LOX_TSAN_FIBERS
+        fiber = __tsan_create_fiber(0);
+#endif
+    }
+
+    state = State::RUNNING;
+    exchange();
+    // Rooted there while its context holds the caller's state.
+    interpreter->generators.push_back(this);
+    void* fakeStack = nullptr;
+    leavingStack(&fakeStack, static_cast<char*>(memory) + pageSize(),
+        kStackBytes - pageSize());
+#ifdef LOX_TSAN_FIBERS
+    callerFiber = __tsan_get_current_fiber();
+    __tsan_switch_to_fiber(fiber, 0);
+#endif
+    switchStack(&caller, self);
+    enteredStack(fakeStack, nullptr, nullptr);
+    interpreter->generators.pop_back();
+    exchange();
+
+    if (state == State::DONE) {
+        finish();
+        if (error != nullptr) std::rethrow_exception(std::exchange(error, {}));
+        return nullptr;
+    }
+    state = State::SUSPENDED;
+    return std::exchange(value, any());
+}
+
+void Generator::entry(void* self)
+{
+    static_cast<Generator*>(self)->run();
+}
+
+// The bottom of the coroutine. Errors are passed to the caller, since
+// they can't unwind past this frame.
+void Generator::run()
+{
+    enteredStack(nullptr, &callerBottom, &callerSize);
+    try {
+        if (compiled != nullptr) {
+            compiled->run(*interpreter);
+        }
+        else {
+            interpreter->executeBlock(declaration->body.get());
+        }
+    }
+    catch (...) {
+        error = std::current_exception();
+    }
+    state = State::DONE;
+    // Never resumed: the caller frees this stack.
+    leavingStack(nullptr, callerBottom, callerSize);
+#ifdef LOX_TSAN_FIBERS
+    __tsan_switch_to_fiber(callerFiber, 0);
+#endif
+    switchStack(&self, caller);
+}
+
+void Generator::yield(any result)
+{
+    value = std::move(result);
+    void* fakeStack = nullptr;
+    leavingStack(&fakeStack, callerBottom, callerSize);
+#ifdef LOX_TSAN_FIBERS
+    __tsan_switch_to_fiber(callerFiber, 0);
+#endif
+    switchStack(&self, caller);
+    // The caller that resumes it may run on another stack.
+    enteredStack(fakeStack, &callerBottom, &callerSize);
+}
+
+void Generator::exchange()
+{
+    std::swap(interpreter->environment, context.environment);
+    std::swap(interpreter->frames, context.frames);
+    std::swap(interpreter->stack, context.stack);
+    std::swap(interpreter->callDepth, context.callDepth);
+    std::swap(interpreter->stackLimit, context.stackLimit);
+    std::swap(interpreter->tempRoots, context.tempRoots);
+}
+
+// Drops the body's stack, whether it finished or was abandoned.
+void Generator::finish()
+{
+    if (memory != nullptr) {
+        releaseStack(memory);
+        memory = nullptr;
+    }
+#ifdef LOX_TSAN_FIBERS
+    if (fiber != nullptr) {
+        __tsan_destroy_fiber(fiber);
+        fiber = nullptr;
+    }
+#endif
+    tasks.clear();
+    values.clear();
+}
+
+void Generator::trace(Heap& heap)
+{
+    heap.markObject(scope);
+    heap.markObject(context.environment);
+    for (auto frame : context.frames) {
+        heap.markObject(frame);
+    }
+    for (auto slot = context.stack.begin(); slot != context.stack.current();
+        ++slot) {
+        heap.markValue(*slot);
+    }
+    for (auto root : context.tempRoots) {
+        heap.markValue(*root);
+    }
+    heap.markValue(value);
+    for (auto& task : tasks) {
+        heap.markObject(task.saved);
+    }
+    for (auto& slot : values) {
+        heap.markValue(slot);
+    }
+}
+
+}
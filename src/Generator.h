@@ -0,0 +1,107 @@
+#pragma once
+
+#include "LoxCallable.h"
+#include "Stackless.h"
+#include <cstdint>
+#include <exception>
+#include <vector>
+
+namespace lox {
+
+struct CompiledBlock;
+
+// What calling a generator function returns: the function's activation,
+// suspended at its start or at a yield. Each call of the generator runs
+// the body on to its next yield and returns the value yielded, or nil
+// once the body has finished:
+//
+//     fun count(n) { var i = 0; while (i < n) { yield i; i = i + 1; } }
+//     var next = count(2);
+//     print next();    // 0
+//     print next();    // 1
+//     print next();    // nil
+//
+// Resuming and suspending never copy the activation's scopes; they only
+// swap the interpreter's pointers to them. The tree-walker and compiled
+// closures run the body as a coroutine on a C++ stack of its own, so a
+// yield can suspend the nested calls of the statements around it. The
+// stackless engine keeps the body's tasks and values instead, see
+// Stackless.
+//
+// A generator that is never finished is freed without unwinding its
+// stack. Its scopes all escape, so the collector owns them, and
+// statements don't keep values in C++ locals while the statements they
+// contain run, so nothing else on that stack needs freeing.
+class Generator: public NativeCallable, public Obj
+{
+public:
+    Generator(Interpreter* interpreter, Function* declaration,
+        const CompiledBlock* compiled);
+    ~Generator() override;
+
+    // Sets the scope the body runs in, which holds the arguments of the
+    // call that made the generator.
+    void start(Environment* scope);
+
+    int arity() override { return 0; }
+    any call(Interpreter* interpreter, Arguments arguments) override;
+
+    // Hands value to the caller of the running generator and returns once
+    // it is resumed. Run by the body's yield statements.
+    void yield(any value);
+
+    void trace(Heap& heap) override;
+
+private:
+    enum class State { STARTING, SUSPENDED, RUNNING, DONE };
+
+    // The part of the interpreter's state that belongs to one C++ stack:
+    // the generator's own while it is suspended, its caller's while it
+    // runs.
+    struct Context
+    {
+        Environment* environment;
+        std::vector<Environment*> frames;
+        ValueStack stack;
+        int callDepth;
+        uintptr_t stackLimit;
+        std::vector<const any*> tempRoots;
+    };
+
+    static void entry(void* self);
+    void run();
+    void exchange();
+    void finish();
+
+    Interpreter* interpreter;
+    Function* declaration;
+    const CompiledBlock* compiled;
+    Environment* scope = nullptr;
+    State state = State::STARTING;
+
+    Context context;
+    // The coroutine's stack, and the stack pointers saved by the side
+    // that switched away last.
+    void* memory = nullptr;
+    void* self = nullptr;
+    void* caller = nullptr;
+    // Passed from the body to its caller.
+    any value;
+    std::exception_ptr error;
+
+    // Where the stackless engine keeps the body while it is suspended;
+    // task bases are relative to the first value.
+    std::vector<Stackless::Task> tasks;
+    std::vector<any> values;
+
+    // Sanitizer bookkeeping for the two stacks.
+    void* fakeStack = nullptr;
+    const void* callerBottom = nullptr;
+    size_t callerSize = 0;
+    void* fiber = nullptr;
+    void* callerFiber = nullptr;
+
+    friend class Stackless;
+};
+
+}
@@ -0,0 +1,132 @@
+#include "Heap.h"
+#include "LoxClass.h"
+#include <algorithm>
+#include <chrono>
+
+namespace lox {
+
+Heap::Heap(RootSet& roots, const GcOptions& options):
+    roots(roots), options(options), nextGC(options.initialHeap)
+{
+    stats.nextCollection = nextGC;
+}
+
+Heap::~Heap()
+{
+    while (objects != nullptr) {
+        Obj* next = objects->next;
+        destroy(objects);
+        objects = next;
+    }
+}
+
+void Heap::track(Obj* object, size_t bytes)
+{
+    object->bytes = bytes;
+    object->next = objects;
+    objects = object;
+    account(bytes);
+}
+
+void Heap::account(size_t bytes)
+{
+    stats.bytesLive += bytes;
+    stats.totalAllocated += bytes;
+    stats.peakBytes = std::max(stats.peakBytes, stats.bytesLive);
+    ++stats.objectsLive;
+}
+
+void Heap::destroy(Obj* object)
+{
+    size_t bytes = object->bytes;
+    stats.bytesLive -= bytes;
+    stats.totalFreed += bytes;
+    --stats.objectsLive;
+    ++stats.objectsFreed;
+    // Obj need not be the first base, the block starts at the most
+    // derived object.
+    void* memory = dynamic_cast<void*>(object);
+    object->~Obj();
+    pool.free(memory, bytes);
+}
+
+void Heap::release(Obj* object)
+{
+    destroy(object);
+}
+
+// Makes make() see a heap that never fills, so the allocation path
+// doesn't test for pauses.
+void Heap::pause()
+{
+    pausedGC = std::exchange(nextGC, SIZE_MAX);
+    pausedStress = std::exchange(options.stress, false);
+}
+
+void Heap::resume()
+{
+    nextGC = pausedGC;
+    options.stress = pausedStress;
+}
+
+void Heap::markObject(Obj* object)
+{
+    if (object == nullptr || object->mark == epoch) return;
+    object->mark = epoch;
+    grayStack.push_back(object);
+}
+
+void Heap::markValue(const std::any& value)
+{
+    if (auto ptr = std::any_cast<LoxFunction*>(&value)) {
+        markObject(*ptr);
+    }
+    else if (auto ptr = std::any_cast<LoxInstance*>(&value)) {
+        markObject(*ptr);
+    }
+    else if (auto ptr = std::any_cast<LoxClass*>(&value)) {
+        markObject(*ptr);
+    }
+    // Natives belong to their interpreter, except the few that are also
+    // heap objects, like the results of parallelMap.
+    else if (auto ptr = std::any_cast<NativeCallable*>(&value)) {
+        if (auto object = dynamic_cast<Obj*>(*ptr)) markObject(object);
+    }
+}
+
+void Heap::collect()
+{
+    auto start = std::chrono::steady_clock::now();
+
+    ++epoch;
+    roots.markRoots(*this);
+    while (!grayStack.empty()) {
+        Obj* object = grayStack.back();
+        grayStack.pop_back();
+        object->trace(*this);
+    }
+    sweep();
+
+    nextGC = std::max(options.initialHeap,
+        size_t(stats.bytesLive * options.growthFactor));
+    stats.nextCollection = nextGC;
+    ++stats.collections;
+    stats.pauseSeconds += std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+void Heap::sweep()
+{
+    Obj** link = &objects;
+    while (*link != nullptr) {
+        Obj* object = *link;
+        if (object->mark == epoch) {
+            link = &object->next;
+            continue;
+        }
+        *link = object->next;
+        destroy(object);
+    }
+}
+
+}
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <any>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <utility>
+#include <vector>
+#include "Pool.h"
+
+namespace lox {
+
+class Heap;
+
+// Base of every object owned by the garbage collector.
+class Obj
+{
+public:
+    virtual ~Obj() = default;
+
+    // Marks every collectable object directly referenced by this one.
+    virtual void trace(Heap& heap) = 0;
+
+private:
+    Obj* next = nullptr;
+    size_t bytes = 0;
+    // Equal to the heap's epoch once marked in the current collection,
+    // so marks never have to be cleared.
+    uint32_t mark = 0;
+
+    friend class Heap;
+};
+
+// Implemented by whoever holds references the collector can't see.
+class RootSet
+{
+public:
+    virtual ~RootSet() = default;
+    virtual void markRoots(Heap& heap) = 0;
+};
+
+struct GcOptions
+{
+    // Heap size that triggers the first collection.
+    size_t initialHeap = 1024 * 1024;
+    // After a collection, the next one runs once the heap has grown to
+    // this multiple of the surviving bytes.
+    double growthFactor = 2.0;
+    // Collect before every allocation, to shake out missing roots.
+    bool stress = false;
+};
+
+struct GcStats
+{
+    size_t collections = 0;
+    size_t bytesLive = 0;
+    size_t peakBytes = 0;
+    size_t objectsLive = 0;
+    size_t totalAllocated = 0;
+    size_t totalFreed = 0;
+    size_t objectsFreed = 0;
+    size_t nextCollection = 0;
+    double pauseSeconds = 0.0;
+};
+
+// Precise mark-and-sweep collector. Collections only start inside
+// make(), so anything not yet stored in a traced object must be
+// reachable from the RootSet at that point. Object memory comes from a
+// size-class Pool.
+class Heap
+{
+public:
+    Heap(RootSet& roots, const GcOptions& options);
+    ~Heap();
+    Heap(const Heap&) = delete;
+    Heap& operator=(const Heap&) = delete;
+
+    template <typename T, typename... Args>
+    T* make(Args&&... args)
+    {
+        return makeSized<T>(sizeof(T), std::forward<Args>(args)...);
+    }
+
+    // For objects with trailing storage after the C++ object.
+    template <typename T, typename... Args>
+    T* makeSized(size_t bytes, Args&&... args)
+    {
+        if (options.stress || stats.bytesLive + bytes > nextGC) {
+            collect();
+        }
+        T* object = new (pool.allocate(bytes)) T(std::forward<Args>(args)...);
+        track(object, bytes);
+        return object;
+    }
+
+    // An object whose lifetime ends at a point known in advance, such as
+    // a scope no closure can capture. It is traced like any other object
+    // but never swept; release() frees it.
+    template <typename T, typename... Args>
+    T* makeScoped(size_t bytes, Args&&... args)
+    {
+        T* object = new (pool.allocate(bytes)) T(std::forward<Args>(args)...);
+        object->bytes = bytes;
+        account(bytes);
+        return object;
+    }
+
+    void release(Obj* object);
+
+    // Holds off collections until resume(), for code that links up
+    // objects the roots can't reach yet.
+    void pause();
+    void resume();
+
+    void collect();
+    void markObject(Obj* object);
+    void markValue(const std::any& value);
+
+    const GcStats& statistics() const { return stats; }
+    const PoolStats& poolStatistics() const { return pool.statistics(); }
+
+private:
+    void track(Obj* object, size_t bytes);
+    void account(size_t bytes);
+    void destroy(Obj* object);
+    void sweep();
+
+    // Declared first so that it outlives the objects carved from it.
+    Pool pool;
+    RootSet& roots;
+    GcOptions options;
+    Obj* objects = nullptr;
+    std::vector<Obj*> grayStack;
+    uint32_t epoch = 1;
+    size_t nextGC;
+    // What pause() set aside.
+    size_t pausedGC = 0;
+    bool pausedStress = false;
+    GcStats stats;
+};
+
+}
@@ -1,30 +1,84 @@
 #include "Interpreter.h"
 #include "Lox.h"
 #include "LoxCallable.h"
+#include "LoxClass.h"
+#include "LoxString.h"
+#include "Native.h"
+#include "Stackless.h"
+#include "ClosureCompiler.h"
+#include "Jit.h"
+#include "Vm.h"
+#include "EventLoop.h"
+#include "Generator.h"
 #include <fmt/format.h>
+#include <algorithm>
+#include <chrono>
 #include <cmath>
+#include <optional>
+#include <pthread.h>
 
 namespace lox {
 
-std::map<std::string, std::unique_ptr<NativeCallable>> Interpreter::nativeFuncs;
+// What is left of a stack where calls stop, for the deepest callee, a
+// native or a collection.
+static constexpr size_t kStackReserve = 256 * 1024;
+
+// Where calls stop on the calling thread's stack, 0 if its extent is
+// unknown.
+static uintptr_t nativeStackLimit()
+{
+#ifdef __linux__
+    pthread_attr_t attributes;
+    if (pthread_getattr_np(pthread_self(), &attributes) != 0) return 0;
+    void* bottom = nullptr;
+    size_t size = 0;
+    pthread_attr_getstack(&attributes, &bottom, &size);
+    pthread_attr_destroy(&attributes);
+    if (size <= kStackReserve) return 0;
+    return reinterpret_cast<uintptr_t>(bottom) + kStackReserve;
+#else
+    return 0;
+#endif
+}
+
+Interpreter::Interpreter(const GcOptions& gcOptions):
+    heap(*this, gcOptions), stackLimit(nativeStackLimit())
+{
+    globals = heap.make<GlobalEnvironment>();
+    environment = globals;
+
+    registerNative(*this, "clock", []() {
+        auto now = std::chrono::steady_clock::now();
+        auto millis = std::chrono::duration_cast<std::chrono::milliseconds>(
+            now.time_since_epoch()).count();
+        return (double)millis / 1000.0;
+    });
+    registerNative(*this, "sqrt", [](double x) { return std::sqrt(x); });
+}
+
+Interpreter::~Interpreter() = default;
 
 any Interpreter::evaluate(Expr* expr)
 {
     return expr->accept(this);
 }
 
-void Interpreter::execute(Stmt* stmt)
+any Interpreter::execute(Stmt* stmt)
 {
-    stmt->accept(this);
+    return stmt->accept(this);
 }
 
-void Interpreter::executeBlock(vector<unique_ptr<Stmt>>* statements)
+// Stops at the first statement that doesn't complete normally and passes
+// its completion on.
+any Interpreter::executeBlock(vector<unique_ptr<Stmt>>* statements)
 {
     assert(statements != nullptr);
 
     for (auto& statement : *statements) {
-        execute(statement.get());
+        auto completion = execute(statement.get());
+        if (completion.has_value()) return completion;
     }
+    return any();
 }
 
 bool Interpreter::isTruthy(const any* obj)
@@ -40,6 +94,12 @@ bool Interpreter::isTruthy(const any* obj)
     return true;
 }
 
+bool Interpreter::test(Expr* condition)
+{
+    auto predict = evaluate(condition);
+    return isTruthy(&predict);
+}
+
 bool Interpreter::isEqual(const any& a, const any& b)
 {
     if (!a.has_value() && !b.has_value()) return true;
@@ -48,8 +108,8 @@ bool Interpreter::isEqual(const any& a, const any& b)
     if (std::any_cast<double>(&a)) {
         return std::any_cast<double>(a) == std::any_cast<double>(b);
     }
-    if (std::any_cast<std::string>(&a)) {
-        return std::any_cast<std::string>(a) == std::any_cast<std::string>(b);
+    if (auto ptr = std::any_cast<StringRef>(&a)) {
+        return *ptr == *std::any_cast<StringRef>(&b);
     }
     if (std::any_cast<bool>(&a)) {
         return std::any_cast<bool>(a) == std::any_cast<bool>(b);
@@ -57,6 +117,18 @@ bool Interpreter::isEqual(const any& a, const any& b)
     if (std::any_cast<nullptr_t>(&a)) {
         return std::any_cast<nullptr_t>(a) == std::any_cast<nullptr_t>(b);
     }
+    if (auto ptr = std::any_cast<LoxFunction*>(&a)) {
+        return *ptr == std::any_cast<LoxFunction*>(b);
+    }
+    if (auto ptr = std::any_cast<NativeCallable*>(&a)) {
+        return *ptr == std::any_cast<NativeCallable*>(b);
+    }
+    if (auto ptr = std::any_cast<LoxClass*>(&a)) {
+        return *ptr == std::any_cast<LoxClass*>(b);
+    }
+    if (auto ptr = std::any_cast<LoxInstance*>(&a)) {
+        return *ptr == std::any_cast<LoxInstance*>(b);
+    }
     // unreachable
     return false;
 }
@@ -93,14 +165,20 @@ std::string Interpreter::stringify(const any& obj)
         if (*ptr) return "true";
         else return "false";
     }
-    if (auto ptr = std::any_cast<std::string>(&obj)) {
-        return *ptr;
+    if (auto ptr = std::any_cast<StringRef>(&obj)) {
+        return ptr->str();
     }
     if (auto ptr = std::any_cast<NativeCallable*>(&obj)) {
         return "<native fn>";
     }
-    if (auto ptr = std::any_cast<LoxFunction>(&obj)) {
-        return fmt::format("<fn {} >", ptr->declaration->name->lexeme);
+    if (auto ptr = std::any_cast<LoxFunction*>(&obj)) {
+        return fmt::format("<fn {} >", (*ptr)->declaration->name->lexeme);
+    }
+    if (auto ptr = std::any_cast<LoxClass*>(&obj)) {
+        return (*ptr)->name;
+    }
+    if (auto ptr = std::any_cast<LoxInstance*>(&obj)) {
+        return fmt::format("{} instance", (*ptr)->shape->owner->name);
     }
     return std::string();
 }
@@ -108,22 +186,34 @@ std::string Interpreter::stringify(const any& obj)
 any Interpreter::visitAssignExpr(Assign* expr)
 {
     auto value = evaluate(expr->value.get());
-    auto iter = locals.find(expr);
-    if (iter != locals.end()) {
-        int distance = iter->second;
-        environment->assignAt(distance, *expr->name, value);
+    assign(expr, value);
+    return value;
+}
+
+void Interpreter::assign(Assign* expr, const any& value)
+{
+    if (expr->depth >= 0) {
+        environment->assignAt(expr->depth, expr->slot, value);
     }
     else {
         globals->assign(*expr->name, value);
     }
-    return value;
 }
 
 any Interpreter::visitBinaryExpr(Binary* expr)
 {
     auto left = evaluate(expr->left.get());
-    auto right = evaluate(expr->right.get());
+    any right;
+    {
+        TempRootGuard roots(this);
+        roots.push(&left);
+        right = evaluate(expr->right.get());
+    }
+    return binary(expr, left, right);
+}
 
+any Interpreter::binary(Binary* expr, const any& left, const any& right)
+{
     switch (expr->op->type) {
     case TokenType::GREATER:
         checkNumberOperands(*expr->op.get(), left, right);
@@ -144,10 +234,10 @@ any Interpreter::visitBinaryExpr(Binary* expr)
         if (std::any_cast<double>(&left) && std::any_cast<double>(&right)) {
             return std::any_cast<double>(left) + std::any_cast<double>(right);
         }
-        if (std::any_cast<std::string>(&left) &&
-            std::any_cast<std::string>(&right)) {
-            return std::any_cast<std::string>(left)
-                + std::any_cast<std::string>(right);
+        auto leftString = std::any_cast<StringRef>(&left);
+        auto rightString = std::any_cast<StringRef>(&right);
+        if (leftString && rightString) {
+            return LoxString::concat(leftString->get(), rightString->get());
         }
         throw RuntimeError(*expr->op.get(),
             "Operands must be two numbers or two strings.");
@@ -171,19 +261,100 @@ any Interpreter::visitBinaryExpr(Binary* expr)
 
 any Interpreter::visitCallExpr(Call* expr)
 {
-    auto callee = evaluate(expr->callee.get());
+    auto& cache = expr->cache;
+    if (cache.property) return invokeProperty(expr);
+    // Taken before the arguments run, since they may rebind the callee.
+    auto version = globals->version();
+    if (callCaches && cache.version == version) {
+        return cachedCall(expr);
+    }
 
-    std::vector<any> arguments;
-    arguments.reserve(expr->arguments->size());
+    // The callee and the arguments stay on the stack, where the collector
+    // sees them, until the call returns.
+    StackMark mark(this);
+    if (stack.full()) {
+        throw RuntimeError(*expr->paren, "Stack overflow.");
+    }
+    auto callee = stack.push(evaluate(expr->callee.get()));
     for (const auto& argument : *expr->arguments) {
-        arguments.push_back(evaluate(argument.get()));
+        auto value = evaluate(argument.get());
+        if (stack.full()) {
+            throw RuntimeError(*expr->paren, "Stack overflow.");
+        }
+        stack.push(std::move(value));
+    }
+
+    Arguments arguments(callee + 1, stack.current() - callee - 1);
+    if (cache.global && callCaches) {
+        ++callCacheStats.misses;
+        auto function = callable(expr, *callee, arguments.size());
+        cache.version = version;
+        cache.callee = *callee;
+        cache.function = function;
+    }
+    return invoke(expr, *callee, arguments);
+}
+
+// A call whose global callee is still the one in its cache, so it is
+// neither looked up nor checked again.
+any Interpreter::cachedCall(Call* expr)
+{
+    auto& cache = expr->cache;
+    ++callCacheStats.hits;
+    StackMark mark(this);
+    if (stack.full()) {
+        throw RuntimeError(*expr->paren, "Stack overflow.");
+    }
+    // Pushed like any callee: the arguments may rebind its global.
+    auto callee = stack.push(any(cache.callee));
+    for (const auto& argument : *expr->arguments) {
+        auto value = evaluate(argument.get());
+        if (stack.full()) {
+            throw RuntimeError(*expr->paren, "Stack overflow.");
+        }
+        stack.push(std::move(value));
     }
+    if (tooDeep()) {
+        throw RuntimeError(*expr->paren, "Stack overflow.");
+    }
+    CallDepthGuard depth(this);
+    try {
+        return cache.function->call(this,
+            Arguments(callee + 1, stack.current() - callee - 1));
+    }
+    catch (const NativeError& error) {
+        throw RuntimeError(*expr->paren, error.what());
+    }
+}
+
+// Calls callee once its arguments have been evaluated.
+any Interpreter::invoke(Call* expr, const any& callee, Arguments arguments)
+{
+    auto function = callable(expr, callee, arguments.size());
+    if (tooDeep()) {
+        throw RuntimeError(*expr->paren, "Stack overflow.");
+    }
+    CallDepthGuard depth(this);
+    try {
+        return function->call(this, arguments);
+    }
+    catch (const NativeError& error) {
+        throw RuntimeError(*expr->paren, error.what());
+    }
+}
 
+// Checks that callee can be called with count arguments.
+LoxCallable* Interpreter::callable(Call* expr, const any& callee, size_t count)
+{
     auto nativeFuncPtr = std::any_cast<NativeCallable*>(&callee);
-    auto loxFuncPtr = std::any_cast<LoxFunction>(&callee);
+    auto loxFuncPtr = std::any_cast<LoxFunction*>(&callee);
+    auto classPtr = std::any_cast<LoxClass*>(&callee);
     LoxCallable* function = nullptr;
     if (loxFuncPtr != nullptr) {
-        function = loxFuncPtr;
+        function = *loxFuncPtr;
+    }
+    else if (classPtr != nullptr) {
+        function = *classPtr;
     }
     else if (nativeFuncPtr != nullptr && *nativeFuncPtr != nullptr) {
         function = *nativeFuncPtr;
@@ -192,13 +363,173 @@ any Interpreter::visitCallExpr(Call* expr)
         throw RuntimeError(*expr->paren,
             "Can only call functions and classes.");
     }
-    if (arguments.size() != function->arity()) {
+    if (count != function->arity()) {
         throw RuntimeError(*expr->paren, fmt::format(
             "Expected {} arguments but got {}.",
-            function->arity(), arguments.size()
+            function->arity(), count
         ));
     }
-    return function->call(this, arguments);
+    return function;
+}
+
+// A call of obj.name(...). A method is called with 'this' bound for the
+// call only, without making a bound method.
+any Interpreter::invokeProperty(Call* expr)
+{
+    auto get = static_cast<Get*>(expr->callee.get());
+    StackMark mark(this);
+    if (stack.full()) {
+        throw RuntimeError(*expr->paren, "Stack overflow.");
+    }
+    // Holds the instance while a method runs, or else the field's value.
+    auto callee = stack.push(evaluate(get->object.get()));
+    auto instance = std::any_cast<LoxInstance*>(callee);
+    if (instance == nullptr) {
+        throw RuntimeError(*get->name, "Only instances have properties.");
+    }
+    auto method = lookUpProperty(get, *instance, *callee);
+    for (const auto& argument : *expr->arguments) {
+        auto value = evaluate(argument.get());
+        if (stack.full()) {
+            throw RuntimeError(*expr->paren, "Stack overflow.");
+        }
+        stack.push(std::move(value));
+    }
+    return callProperty(expr, method, callee);
+}
+
+any Interpreter::callProperty(Call* expr, LoxFunction* method, any* callee)
+{
+    Arguments arguments(callee + 1, stack.current() - callee - 1);
+    if (method == nullptr) return invoke(expr, *callee, arguments);
+    if (arguments.size() != method->arity()) {
+        throw RuntimeError(*expr->paren, fmt::format(
+            "Expected {} arguments but got {}.",
+            method->arity(), arguments.size()));
+    }
+    if (tooDeep()) {
+        throw RuntimeError(*expr->paren, "Stack overflow.");
+    }
+    CallDepthGuard depth(this);
+    return method->invoke(this, std::any_cast<LoxInstance*>(*callee),
+        arguments);
+}
+
+LoxFunction* Interpreter::lookUpProperty(Get* expr, LoxInstance* instance,
+    any& field)
+{
+    auto& cache = expr->cache;
+    auto shape = instance->shape;
+    if (cache.shape == shape->id) {
+        ++propertyCacheStats.hits;
+        if (cache.slot < 0) return cache.method;
+        field = instance->fields[cache.slot];
+        return nullptr;
+    }
+
+    ++propertyCacheStats.misses;
+    auto& name = expr->name->lexeme;
+    int slot = shape->find(name);
+    if (slot >= 0) {
+        cache = PropertyCache{shape->id, slot, nullptr, nullptr};
+        field = instance->fields[slot];
+        return nullptr;
+    }
+    auto method = shape->owner->findMethod(name);
+    if (method == nullptr) {
+        throw RuntimeError(*expr->name,
+            fmt::format("Undefined property '{}'.", name));
+    }
+    cache = PropertyCache{shape->id, -1, method, nullptr};
+    return method;
+}
+
+any Interpreter::getProperty(Get* expr, const any& object)
+{
+    auto instance = std::any_cast<LoxInstance*>(&object);
+    if (instance == nullptr) {
+        throw RuntimeError(*expr->name, "Only instances have properties.");
+    }
+    any field;
+    if (auto method = lookUpProperty(expr, *instance, field)) {
+        return method->bind(this, *instance);
+    }
+    return field;
+}
+
+void Interpreter::setProperty(Set* expr, const any& object, const any& value)
+{
+    auto instance = *std::any_cast<LoxInstance*>(&object);
+    auto& cache = expr->cache;
+    auto shape = instance->shape;
+    if (cache.shape == shape->id) {
+        ++propertyCacheStats.hits;
+        if (cache.transition != nullptr) {
+            instance->add(cache.transition, value);
+        }
+        else {
+            instance->fields[cache.slot] = value;
+        }
+        return;
+    }
+
+    ++propertyCacheStats.misses;
+    int slot = shape->find(expr->name->lexeme);
+    if (slot >= 0) {
+        cache = PropertyCache{shape->id, slot, nullptr, nullptr};
+        instance->fields[slot] = value;
+    }
+    else {
+        auto next = shape->transition(expr->name->lexeme);
+        cache = PropertyCache{shape->id, -1, nullptr, next};
+        instance->add(next, value);
+    }
+}
+
+any Interpreter::visitGetExpr(Get* expr)
+{
+    auto object = evaluate(expr->object.get());
+    TempRootGuard roots(this);
+    roots.push(&object);
+    return getProperty(expr, object);
+}
+
+any Interpreter::visitSetExpr(Set* expr)
+{
+    auto object = evaluate(expr->object.get());
+    if (std::any_cast<LoxInstance*>(&object) == nullptr) {
+        throw RuntimeError(*expr->name, "Only instances have fields.");
+    }
+    TempRootGuard roots(this);
+    roots.push(&object);
+    auto value = evaluate(expr->value.get());
+    setProperty(expr, object, value);
+    return value;
+}
+
+// The superclass sits in the scope just outside the one binding 'this'.
+any Interpreter::superMethod(Super* expr)
+{
+    auto superclass = std::any_cast<LoxClass*>(
+        environment->getAt(expr->depth, expr->slot));
+    auto instance = std::any_cast<LoxInstance*>(
+        environment->getAt(expr->depth - 1, 0));
+    auto method = superclass->findMethod(expr->method->lexeme);
+    if (method == nullptr) {
+        throw RuntimeError(*expr->method, fmt::format(
+            "Undefined property '{}'.", expr->method->lexeme));
+    }
+    return method->bind(this, instance);
+}
+
+any Interpreter::visitSuperExpr(Super* expr)
+{
+    return superMethod(expr);
+}
+
+any Interpreter::visitThisExpr(This* expr)
+{
+    return lookUpVariable(*expr->keyword, expr->depth, expr->slot);
 }
 
 any Interpreter::visitGroupingExpr(Grouping* expr)
@@ -208,7 +539,7 @@ any Interpreter::visitGroupingExpr(Grouping* expr)
 
 any Interpreter::visitLiteralExpr(Literal* expr)
 {
-    return expr->value->literal;
+    return constants.at(expr->constant);
 }
 
 any Interpreter::visitLogicalExpr(Logical* expr)
@@ -228,7 +559,11 @@ any Interpreter::visitLogicalExpr(Logical* expr)
 any Interpreter::visitUnaryExpr(Unary* expr)
 {
     auto right = evaluate(expr->right.get());
+    return unary(expr, right);
+}
 
+any Interpreter::unary(Unary* expr, const any& right)
+{
     switch (expr->op->type) {
     case TokenType::MINUS:
         checkNumberOperand(*expr->op.get(), right);
@@ -244,28 +579,36 @@ any Interpreter::visitUnaryExpr(Unary* expr)
 
 any Interpreter::visitVarExprExpr(VarExpr* expr)
 {
-    return lookUpVariable(*expr->name, expr);
+    return lookUpVariable(*expr->name, expr->depth, expr->slot);
 }
 
-any Interpreter::lookUpVariable(const Token& name, Expr* expr)
+any Interpreter::lookUpVariable(const Token& name, int depth, int slot)
 {
-    auto iter = locals.find(expr);
-    if (iter != locals.end()) {
-        int distance = iter->second;
-        return environment->getAt(distance, name.lexeme);
+    if (depth >= 0) {
+        return environment->getAt(depth, slot);
     }
     else {
         return globals->get(name);
     }
 }
 
+// Locals go to the slot the Resolver picked, globals by name.
+void Interpreter::define(int slot, const Token& name, const any& value)
+{
+    if (slot >= 0) {
+        environment->slot(slot) = value;
+    }
+    else {
+        globals->define(name.lexeme, value);
+    }
+}
+
 any Interpreter::visitBlockStmt(Block* stmt)
 {
-    environment = std::make_shared<Environment>(environment);
-    // make sure environment will be recovered even when exception is raised.
-    EnvironmentGuard guard(environment);
-    executeBlock(stmt->statements.get());
-    return any();
+    auto scope = Environment::create(heap, environment,
+        stmt->slots, stmt->escapes);
+    ScopeGuard guard(this, scope, stmt->escapes);
+    return executeBlock(stmt->statements.get());
 }
 
 any Interpreter::visitExpressionStmt(Expression* stmt)
@@ -276,19 +619,69 @@ any Interpreter::visitExpressionStmt(Expression* stmt)
 
 any Interpreter::visitFunctionStmt(Function* stmt)
 {
-    LoxFunction function(stmt, environment);
-    environment->define(stmt->name->lexeme, function);
+    auto function = heap.make<LoxFunction>(stmt, environment);
+    define(stmt->slot, *stmt->name, function);
     return any();
 }
 
+any Interpreter::visitClassStmt(Class* stmt)
+{
+    declareClass(stmt, nullptr);
+    return any();
+}
+
+void Interpreter::declareClass(Class* stmt, const CompiledBlock* const* bodies)
+{
+    any superclass;
+    LoxClass* parent = nullptr;
+    if (stmt->superclass != nullptr) {
+        auto& name = *stmt->superclass->name;
+        superclass = lookUpVariable(name, stmt->superclass->depth,
+            stmt->superclass->slot);
+        auto classPtr = std::any_cast<LoxClass*>(&superclass);
+        if (classPtr == nullptr) {
+            throw RuntimeError(name, "Superclass must be a class.");
+        }
+        parent = *classPtr;
+    }
+
+    any klass;
+    {
+        // Methods of a subclass see 'super' in a scope of their own.
+        std::optional<ScopeGuard> scope;
+        if (parent != nullptr) {
+            auto environment = Environment::create(heap, this->environment,
+                1, true);
+            environment->slot(0) = superclass;
+            scope.emplace(this, environment, true);
+        }
+
+        std::unordered_map<std::string, LoxFunction*> methods;
+        if (parent != nullptr) methods = parent->methods;
+        std::vector<any> declared;
+        declared.reserve(stmt->methods->size());
+        TempRootGuard roots(this);
+        for (size_t i = 0; i < stmt->methods->size(); ++i) {
+            auto method = stmt->methods->at(i).get();
+            auto function = heap.make<LoxFunction>(method, environment,
+                bodies != nullptr ? bodies[i] : nullptr, stmt);
+            declared.push_back(function);
+            roots.push(&declared.back());
+            methods[method->name->lexeme] = function;
+        }
+        klass = heap.make<LoxClass>(stmt->name->lexeme, parent,
+            std::move(methods), stmt->thisEscapes);
+    }
+    define(stmt->slot, *stmt->name, klass);
+}
+
 any Interpreter::visitIfStmt(If* stmt)
 {
-    auto predict = evaluate(stmt->condition.get());
-    if (isTruthy(&predict)) {
-        execute(stmt->thenBranch.get());
+    if (test(stmt->condition.get())) {
+        return execute(stmt->thenBranch.get());
     }
     else if (stmt->elseBranch != nullptr) {
-        execute(stmt->elseBranch.get());
+        return execute(stmt->elseBranch.get());
     }
     return any();
 }
@@ -296,16 +689,25 @@ any Interpreter::visitIfStmt(If* stmt)
 any Interpreter::visitPrintStmt(Print* stmt)
 {
     auto value = evaluate(stmt->expr.get());
-    fmt::println(stringify(value));
+    print(value);
     return any();
 }
 
+void Interpreter::print(const any& value)
+{
+    if (auto ptr = std::any_cast<StringRef>(&value)) {
+        printLine(ptr->view());
+    }
+    else {
+        printLine(stringify(value));
+    }
+}
+
 any Interpreter::visitReturnStmt(Return* stmt)
 {
-    any value;
-    if (stmt->value != nullptr) value = evaluate(stmt->value.get());
+    if (stmt->value != nullptr) returnValue = evaluate(stmt->value.get());
 
-    throw ReturnValue(value);
+    return Completion::RETURN;
 }
 
 any Interpreter::visitVarStmtStmt(VarStmt* stmt)
@@ -315,40 +717,204 @@ any Interpreter::visitVarStmtStmt(VarStmt* stmt)
         value = evaluate(stmt->initializer.get());
     }
 
-    environment->define(stmt->name->lexeme, value);
+    define(stmt->slot, *stmt->name, value);
     return any();
 }
 
 any Interpreter::visitWhileStmt(While* stmt)
 {
-    auto predict = evaluate(stmt->condition.get());
-    while (isTruthy(&predict)) {
-        execute(stmt->body.get());
-        predict = evaluate(stmt->condition.get());
+    while (test(stmt->condition.get())) {
+        tick(*stmt->keyword);
+        auto completion = execute(stmt->body.get());
+        if (completion.has_value()) return completion;
     }
     return any();
 }
 
+any Interpreter::visitYieldStmt(Yield* stmt)
+{
+    generators.back()->yield(evaluate(stmt->value.get()));
+    return any();
+}
+
 void Interpreter::interpret(std::vector<std::unique_ptr<Stmt>>& statements)
 {
     try {
-        for (auto& statement : statements) {
-            execute(statement.get());
-        }
+        run(statements);
     }
     catch (const RuntimeError& error) {
         runtimeError(error);
     }
 }
 
-std::shared_ptr<Environment> Interpreter::make_globals()
+void Interpreter::run(std::vector<std::unique_ptr<Stmt>>& statements)
 {
-    auto env = std::make_shared<Environment>();
-    if (nativeFuncs.find("clock") == nativeFuncs.end()) {
-        nativeFuncs["clock"] = std::make_unique<ClockCallable>();
+    try {
+        if (vm != nullptr) {
+            vm->interpret(statements);
+        }
+        else if (closures != nullptr) {
+            closures->compile(statements)->run(*this);
+        }
+        else if (stackless != nullptr) {
+            stackless->start(statements);
+            stackless->resume();
+        }
+        else {
+            for (auto& statement : statements) {
+                execute(statement.get());
+            }
+        }
+        // The callbacks of the operations the statements started.
+        if (loop != nullptr) loop->run();
+    }
+    catch (const RuntimeError&) {
+        if (loop != nullptr) loop->clear();
+        throw;
+    }
+}
+
+EventLoop& Interpreter::eventLoop()
+{
+    if (loop == nullptr) loop = std::make_unique<EventLoop>(this);
+    return *loop;
+}
+
+any Interpreter::callback(const any& callee, std::vector<any>& arguments)
+{
+    if (vm != nullptr) {
+        return vm->callback(std::any_cast<Closure*>(callee), arguments);
+    }
+    else if (stackless != nullptr) {
+        return stackless->callback(std::any_cast<LoxFunction*>(callee),
+            arguments);
+    }
+    else {
+        return std::any_cast<LoxFunction*>(callee)->call(this,
+            Arguments(arguments.data(), arguments.size()));
     }
-    env->define("clock", nativeFuncs["clock"].get());
-    return env;
+}
+
+any Interpreter::invoke(const any& callee, std::vector<any>& arguments)
+{
+    try {
+        auto result = callback(callee, arguments);
+        TempRootGuard roots(this);
+        roots.push(&result);
+        if (loop != nullptr) loop->run();
+        return result;
+    }
+    catch (const RuntimeError&) {
+        if (loop != nullptr) loop->clear();
+        throw;
+    }
+}
+
+any Interpreter::global(const std::string& name)
+{
+    if (vm != nullptr) return vm->global(name);
+    auto& entries = globals->entries();
+    auto found = entries.find(name);
+    return found != entries.end() ? found->second : any();
+}
+
+void Interpreter::useStackless(size_t budget)
+{
+    stackless = std::make_unique<Stackless>(this, budget);
+}
+
+void Interpreter::useVm()
+{
+    vm = std::make_unique<Vm>(this);
+}
+
+void Interpreter::useLimits(const Limits& limits)
+{
+    this->limits = limits;
+    fuel = limits.fuel;
+    ticks = 0;
+    cancelled.store(nullptr, std::memory_order_relaxed);
+}
+
+void Interpreter::safepoint(const Token& token)
+{
+    auto reason = cancelled.exchange(nullptr, std::memory_order_relaxed);
+    // The parent's cancel() is left for the parent to act on as well.
+    if (reason == nullptr && parent != nullptr) {
+        reason = parent->cancelled.load(std::memory_order_relaxed);
+    }
+    if (reason != nullptr) throw RuntimeError(token, reason);
+    if (limits.memory != 0) {
+        auto live = [this]() {
+            return heap.statistics().bytesLive + LoxString::liveBytes();
+        };
+        if (live() > limits.memory) heap.collect();
+        if (live() > limits.memory) {
+            throw RuntimeError(token, "Out of memory.");
+        }
+    }
+    // The slice starts with the safepoint that ran out of the last one.
+    int64_t slice = kSlice;
+    if (limits.fuel != 0) {
+        if (fuel == 0) throw RuntimeError(token, "Out of fuel.");
+        slice = int64_t(std::min<uint64_t>(fuel, kSlice));
+        fuel -= slice;
+    }
+    ticks = slice - 1;
+}
+
+void Interpreter::useClosures()
+{
+    closures = std::make_unique<ClosureCompiler>(this);
+}
+
+void Interpreter::useProfile(Profile* profile, bool record)
+{
+    if (closures != nullptr) closures->useProfile(profile, record);
+}
+
+void Interpreter::useJit()
+{
+    jit = std::make_unique<Jit>(this);
+}
+
+const JitStats* Interpreter::jitStats() const
+{
+    return jit != nullptr ? &jit->statistics() : nullptr;
+}
+
+const QuickeningStats* Interpreter::quickeningStats() const
+{
+    return closures != nullptr ? &closures->statistics() : nullptr;
+}
+
+void Interpreter::markRoots(Heap& heap)
+{
+    if (vm != nullptr) vm->markRoots(heap);
+    if (stackless != nullptr) stackless->markRoots(heap);
+    if (loop != nullptr) loop->markRoots(heap);
+    heap.markObject(globals);
+    heap.markObject(environment);
+    for (auto frame : frames) {
+        heap.markObject(frame);
+    }
+    heap.markValue(returnValue);
+    for (auto generator : generators) {
+        heap.markObject(generator);
+    }
+    for (auto value = stack.begin(); value != stack.current(); ++value) {
+        heap.markValue(*value);
+    }
+    for (auto value : tempRoots) {
+        heap.markValue(*value);
+    }
+}
+
+void Interpreter::defineNative(const std::string& name,
+    std::unique_ptr<NativeCallable> native)
+{
+    globals->define(name, native.get());
+    natives.push_back(std::move(native));
 }
 
 }
\ No newline at end of file
@@ -3,8 +3,16 @@
 #include "autogen/Expr.h"
 #include "autogen/Stmt.h"
 #include "Environment.h"
+#include "ConstantPool.h"
+#include "Heap.h"
+#include <atomic>
+#include <cstdint>
 #include <stdexcept>
-#include <map>
+#include <string>
+#include <vector>
+#include <memory>
+#include <new>
+#include <utility>
 
 namespace lox {
 
@@ -17,70 +25,385 @@ public:
     Token token;
 };
 
-class ReturnValue: public std::runtime_error
+// What a statement visitor returns when control leaves the enclosing
+// function early. Statements that complete normally return an empty any.
+enum class Completion { RETURN };
+
+class LoxCallable;
+class Arguments;
+class NativeCallable;
+class LoxFunction;
+class LoxInstance;
+struct CompiledBlock;
+class Stackless;
+class Vm;
+class ClosureCompiler;
+class Jit;
+class EventLoop;
+class Generator;
+class Profile;
+struct QuickeningStats;
+struct JitStats;
+
+struct CallCacheStats
 {
-public:
-    ReturnValue(const any& value): std::runtime_error(""), value(value) {}
+    // Calls made through a call site's cache.
+    uint64_t hits = 0;
+    // Calls of a global that had to look it up and check it.
+    uint64_t misses = 0;
+};
 
-    any value;
+struct PropertyCacheStats
+{
+    // Property accesses that found the shape in their cache.
+    uint64_t hits = 0;
+    // Accesses that had to look the property up.
+    uint64_t misses = 0;
 };
 
-class NativeCallable;
-class LoxFunction;
+// What a program may use before it is stopped with a runtime error.
+// Safepoints check them: each iteration of a loop and each call of a Lox
+// function is one.
+struct Limits
+{
+    // Safepoints the program may pass, 0 for no limit.
+    uint64_t fuel = 0;
+    // Bytes of objects and strings the program may keep alive, 0 for no
+    // limit. Checked once per kSlice safepoints, after a collection.
+    size_t memory = 0;
+};
+
+// Interpreter-owned stack that calls evaluate their callee and arguments
+// into. It never reallocates, so callees can keep pointers into it, and
+// slots above the top are raw memory, so a stack costs nothing for the
+// pages it hasn't grown into yet.
+class ValueStack
+{
+public:
+    static constexpr size_t kCapacity = 64 * 1024;
+
+    explicit ValueStack(size_t capacity = kCapacity):
+        values(static_cast<any*>(::operator new(capacity * sizeof(any)))),
+        top(values), end(values + capacity) {}
+    ValueStack(ValueStack&& other) noexcept:
+        values(std::exchange(other.values, nullptr)),
+        top(std::exchange(other.top, nullptr)),
+        end(std::exchange(other.end, nullptr)) {}
+    ValueStack& operator=(ValueStack&& other) noexcept
+    {
+        std::swap(values, other.values);
+        std::swap(top, other.top);
+        std::swap(end, other.end);
+        return *this;
+    }
+    ~ValueStack()
+    {
+        truncate(values);
+        ::operator delete(values);
+    }
+
+    bool full() const { return top == end; }
+    any* current() const { return top; }
+    any* begin() const { return values; }
+
+    any* push(any&& value)
+    {
+        return new (top++) any(std::move(value));
+    }
 
-class Interpreter: public ExprVisitor, public StmtVisitor
+    // Pops everything above mark, dropping the references it held.
+    void truncate(any* mark)
+    {
+        while (top != mark) {
+            (--top)->~any();
+        }
+    }
+
+private:
+    any* values;
+    any* top;
+    any* end;
+};
+
+class Interpreter: public ExprVisitor, public StmtVisitor, public RootSet
 {
 public:
-    Interpreter(): globals(make_globals()), environment(globals) {}
-    ~Interpreter() override = default;
+    explicit Interpreter(const GcOptions& gcOptions = GcOptions());
+    ~Interpreter() override;
 
     any visitAssignExpr(Assign* expr) override;
     any visitBinaryExpr(Binary* expr) override;
     any visitCallExpr(Call* expr) override;
+    any visitGetExpr(Get* expr) override;
     any visitGroupingExpr(Grouping* expr) override;
     any visitLiteralExpr(Literal* expr) override;
     any visitLogicalExpr(Logical* expr) override;
+    any visitSetExpr(Set* expr) override;
+    any visitSuperExpr(Super* expr) override;
+    any visitThisExpr(This* expr) override;
     any visitUnaryExpr(Unary* expr) override;
     any visitVarExprExpr(VarExpr* expr) override;
 
     any visitBlockStmt(Block* stmt) override;
     any visitExpressionStmt(Expression* stmt) override;
     any visitFunctionStmt(Function* stmt) override;
+    any visitClassStmt(Class* stmt) override;
     any visitIfStmt(If* stmt) override;
     any visitPrintStmt(Print* stmt) override;
     any visitReturnStmt(Return* stmt) override;
     any visitVarStmtStmt(VarStmt* stmt) override;
     any visitWhileStmt(While* stmt) override;
+    any visitYieldStmt(Yield* stmt) override;
 
+    // Runs a resolved program and reports a runtime error.
     void interpret(std::vector<std::unique_ptr<Stmt>>& statements);
+    // Runs a resolved program, then the callbacks of the operations it
+    // started. Runtime errors are thrown, abandoning those operations.
+    void run(std::vector<std::unique_ptr<Stmt>>& statements);
+
+    // Runs later programs on the Stackless engine instead of recursing,
+    // with at most budget bytes of work and value stacks.
+    void useStackless(size_t budget);
+    // Runs later programs compiled to bytecode on a Vm.
+    void useVm();
+    // Runs later programs compiled to closures by ClosureCompiler.
+    void useClosures();
+    // Has the closure engine start from profile and record into it if
+    // record is set, see ClosureCompiler. Other engines ignore it.
+    void useProfile(Profile* profile, bool record);
+    // Compiles hot numeric functions to machine code, see Jit.
+    void useJit();
+    // Leaves call sites' caches alone, for an interpreter that runs the
+    // program of another one on a thread of its own, see Parallel.cpp.
+    void skipCallCaches() { callCaches = false; }
+    // Starts metering the program against limits, with all of its fuel,
+    // and forgets an earlier cancel().
+    void useLimits(const Limits& limits);
+    // Has the running program stop at its next safepoint with a runtime
+    // error saying reason, a string literal. Safe to call from any thread.
+    void cancel(const char* reason = "Script cancelled.")
+    {
+        cancelled.store(reason, std::memory_order_relaxed);
+    }
+    // Takes the reason of a cancel() not acted on yet, or null, for natives
+    // that wait and must stop the program themselves.
+    const char* takeCancel()
+    {
+        return cancelled.exchange(nullptr, std::memory_order_relaxed);
+    }
+
+    // Safepoints pass between checks of the limits and of cancel().
+    static constexpr int64_t kSlice = 1024;
+    // A safepoint. Errors name token's line.
+    void tick(const Token& token)
+    {
+        if (--ticks < 0) safepoint(token);
+    }
 
-    void resolve(Expr* expr, int depth)
-    { locals[expr] = depth; }
+    ConstantPool& constantPool() { return constants; }
+    const GcStats& gcStats() const { return heap.statistics(); }
+    const PoolStats& poolStats() const { return heap.poolStatistics(); }
+    // Null unless programs run on compiled closures.
+    const QuickeningStats* quickeningStats() const;
+    const CallCacheStats& callStats() const { return callCacheStats; }
+    const PropertyCacheStats& propertyStats() const
+    { return propertyCacheStats; }
+    // Null unless the JIT is on.
+    const JitStats* jitStats() const;
 
-    static std::shared_ptr<Environment> make_globals();
+    void markRoots(Heap& heap) override;
+
+    // Created by the first asynchronous operation. interpret() runs it
+    // once the program's statements are done.
+    EventLoop& eventLoop();
+    // Calls a function value from outside any Lox code, as the event loop
+    // does, and returns its result. The callee must take as many
+    // arguments as it is given.
+    any callback(const any& callee, std::vector<any>& arguments);
+    // callback() from a host program, then the callbacks of the
+    // operations the call started. Runtime errors are thrown as in run().
+    any invoke(const any& callee, std::vector<any>& arguments);
+    // The global variable name, or nothing if there is none.
+    any global(const std::string& name);
+
+    // Takes ownership of a native and binds it to a global. See Native.h
+    // for registerNative(), which builds one from a C++ function.
+    void defineNative(const std::string& name,
+        std::unique_ptr<NativeCallable> native);
 
 private:
     any evaluate(Expr* expr);
-    void execute(Stmt* stmt);
-    void executeBlock(vector<unique_ptr<Stmt>>* statements);
+    any execute(Stmt* stmt);
+    any executeBlock(vector<unique_ptr<Stmt>>* statements);
     bool isTruthy(const any* obj);
+    // Evaluates a condition. Its value is dropped before the statement
+    // it guards runs, since a generator may never finish that statement.
+    bool test(Expr* condition);
     bool isEqual(const any& a, const any& b);
     void checkNumberOperand(const Token& op, const any& operand);
     void checkNumberOperands(const Token& op,
         const any& left, const any& right);
-    std::string stringify(const any& obj);
-
-    any lookUpVariable(const Token& name, Expr* expr);
+    static std::string stringify(const any& obj);
 
-    // Use shared_ptr to support closure, even though this cound cause
-    // memory leakage. C++ doesn't have GC like JAVA.
-    std::shared_ptr<Environment> globals;
-    std::shared_ptr<Environment> environment;
-    std::unordered_map<Expr*, int> locals;
+    // The parts of evaluation shared with the other engines.
+    any lookUpVariable(const Token& name, int depth, int slot);
+    void assign(Assign* expr, const any& value);
+    any binary(Binary* expr, const any& left, const any& right);
+    any unary(Unary* expr, const any& right);
+    LoxCallable* callable(Call* expr, const any& callee, size_t count);
+    any invoke(Call* expr, const any& callee, Arguments arguments);
+    any cachedCall(Call* expr);
+    // Calls a property of an instance, a method without binding it.
+    any invokeProperty(Call* expr);
+    // The call once lookUpProperty gave method and the arguments follow
+    // callee on the stack. callee holds the instance, or the field if
+    // method is null.
+    any callProperty(Call* expr, LoxFunction* method, any* callee);
+    // Through the access's cache: returns the method if the property is
+    // one, otherwise stores the field's value in field.
+    LoxFunction* lookUpProperty(Get* expr, LoxInstance* instance, any& field);
+    // object must stay reachable.
+    any getProperty(Get* expr, const any& object);
+    void setProperty(Set* expr, const any& object, const any& value);
+    any superMethod(Super* expr);
+    // Methods run bodies[i] for the ith method if bodies isn't null.
+    void declareClass(Class* stmt, const CompiledBlock* const* bodies);
+    void print(const any& value);
+    void define(int slot, const Token& name, const any& value);
+    // Checks the limits once a slice of safepoints is used up, and hands
+    // out the next one.
+    void safepoint(const Token& token);
 
-    static std::map<std::string, std::unique_ptr<NativeCallable>> nativeFuncs;
+    // Declared first so that it outlives everything it owns.
+    Heap heap;
+    GlobalEnvironment* globals = nullptr;
+    Environment* environment = nullptr;
+    // Environments of the callers of the running function.
+    std::vector<Environment*> frames;
+    ValueStack stack;
+    // Nested Lox calls in progress, bounded so that deep recursion is a
+    // runtime error rather than a crash.
+    int callDepth = 0;
+    static constexpr int kMaxCallDepth = 10000;
+    // Calls also stop below this address on the native stack, which runs
+    // out before kMaxCallDepth on small stacks. Swapped by generators,
+    // which run on stacks of their own.
+    uintptr_t stackLimit = 0;
+    // Whether a call made now would nest too deep.
+    bool tooDeep() const
+    {
+        auto frame = reinterpret_cast<uintptr_t>(__builtin_frame_address(0));
+        return callDepth >= kMaxCallDepth || frame < stackLimit;
+    }
+    // Safepoints left in the current slice. Counting down one integer is
+    // all a safepoint costs until the slice runs out.
+    int64_t ticks = 0;
+    Limits limits;
+    // Fuel not handed out to a slice yet.
+    uint64_t fuel = 0;
+    // Why cancel() was called, if it was.
+    std::atomic<const char*> cancelled{nullptr};
+    // An interpreter whose cancel() stops this one too: the one that a
+    // parallel worker runs a call for.
+    const Interpreter* parent = nullptr;
+    bool callCaches = true;
+    CallCacheStats callCacheStats;
+    PropertyCacheStats propertyCacheStats;
+    // Values held only by C++ locals while the collector may run.
+    std::vector<const any*> tempRoots;
+    // Set by a return statement, taken by the function it returns from.
+    any returnValue;
+    // Generators running on top of one another, innermost last.
+    std::vector<Generator*> generators;
+    // Literals of every program this interpreter has run.
+    ConstantPool constants;
+    std::vector<std::unique_ptr<NativeCallable>> natives;
+    std::unique_ptr<Stackless> stackless;
+    std::unique_ptr<Vm> vm;
+    std::unique_ptr<ClosureCompiler> closures;
+    std::unique_ptr<Jit> jit;
+    std::unique_ptr<EventLoop> loop;
 
     friend class LoxFunction;
+    friend class LoxClass;
+    friend class Stackless;
+    friend class Vm;
+    friend class ClosureCompiler;
+    friend class Jit;
+    friend class FunctionCompiler;
+    friend class TempRootGuard;
+    friend class ScopeGuard;
+    friend class StackMark;
+    friend class CallDepthGuard;
+    friend class Parallel;
+    friend class Generator;
+    friend class Snapshot;
+};
+
+// Pops the temporary roots pushed while it was alive.
+class TempRootGuard
+{
+public:
+    TempRootGuard(Interpreter* interpreter):
+        roots(interpreter->tempRoots), size(roots.size()) {}
+    ~TempRootGuard() { roots.resize(size); }
+
+    void push(const any* value) { roots.push_back(value); }
+
+private:
+    std::vector<const any*>& roots;
+    size_t size;
+};
+
+// Pops a call's callee and arguments off the value stack on exit.
+class StackMark
+{
+public:
+    StackMark(Interpreter* interpreter):
+        stack(interpreter->stack), mark(stack.current()) {}
+    ~StackMark() { stack.truncate(mark); }
+
+    any* base() const { return mark; }
+
+private:
+    ValueStack& stack;
+    any* mark;
+};
+
+class CallDepthGuard
+{
+public:
+    CallDepthGuard(Interpreter* interpreter): depth(interpreter->callDepth)
+    { ++depth; }
+    ~CallDepthGuard() { --depth; }
+
+private:
+    int& depth;
+};
+
+// Enters a block or function scope and restores the previous one on
+// exit, even when an exception unwinds through it. A scope that can't
+// escape is released right away.
+class ScopeGuard
+{
+public:
+    ScopeGuard(Interpreter* interpreter, Environment* scope, bool escapes):
+        interpreter(interpreter), scope(scope), escapes(escapes)
+    {
+        interpreter->frames.push_back(interpreter->environment);
+        interpreter->environment = scope;
+    }
+    ~ScopeGuard()
+    {
+        interpreter->environment = interpreter->frames.back();
+        interpreter->frames.pop_back();
+        if (!escapes) interpreter->heap.release(scope);
+    }
+
+private:
+    Interpreter* interpreter;
+    Environment* scope;
+    bool escapes;
 };
 
 }
\ No newline at end of file
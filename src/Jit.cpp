@@ -0,0 +1,660 @@
+#include "Jit.h"
+#include "Interpreter.h"
+#include "LoxCallable.h"
+#include <array>
+#include <cstring>
+#include <initializer_list>
+
+#if defined(__x86_64__) && defined(__linux__)
+#define LOX_JIT_X64 1
+#include <sys/mman.h>
+#endif
+
+namespace lox {
+
+namespace {
+
+// Thrown while compiling a function the JIT doesn't handle.
+struct Unsupported {};
+
+// A jump target. Jumps to it before it is bound are patched by bind().
+struct Label
+{
+    long position = -1;
+    std::vector<size_t> uses;
+};
+
+// Condition codes of the jcc instructions used after ucomisd, and NS
+// after the subtraction at safepoints.
+enum class Cond : uint8_t
+{
+    B = 0x2, AE = 0x3, E = 0x4, NE = 0x5, BE = 0x6, A = 0x7, NS = 0x9, P = 0xa
+};
+
+enum Xmm : uint8_t { XMM0 = 0, XMM1 = 1 };
+
+// Just the x86-64 instructions the code generator needs. Frame slots are
+// addressed relative to rsp, which stays put between the prologue and
+// the epilogue.
+class Assembler
+{
+public:
+    std::vector<uint8_t> code;
+
+    size_t position() const { return code.size(); }
+
+    void emit(std::initializer_list<uint8_t> bytes)
+    {
+        code.insert(code.end(), bytes);
+    }
+
+    void imm32(int32_t value)
+    {
+        auto bits = static_cast<uint32_t>(value);
+        for (int i = 0; i < 4; ++i) code.push_back((bits >> (8 * i)) & 0xff);
+    }
+
+    void imm64(uint64_t value)
+    {
+        for (int i = 0; i < 8; ++i) code.push_back((value >> (8 * i)) & 0xff);
+    }
+
+    void patch32(size_t at, int32_t value)
+    {
+        auto bits = static_cast<uint32_t>(value);
+        for (int i = 0; i < 4; ++i) code[at + i] = (bits >> (8 * i)) & 0xff;
+    }
+
+    // movsd xmm, [rsp + 8 * slot]
+    void load(Xmm reg, int slot) { sseFrame(0x10, reg, slot); }
+    // movsd [rsp + 8 * slot], xmm
+    void store(int slot, Xmm reg) { sseFrame(0x11, reg, slot); }
+
+    // movsd xmm0, [rsi + 8 * index]
+    void loadArgument(int index)
+    {
+        emit({0xf2, 0x0f, 0x10, 0x86});
+        imm32(8 * index);
+    }
+
+    // movsd [r12], xmm0
+    void storeResult() { emit({0xf2, 0x41, 0x0f, 0x11, 0x04, 0x24}); }
+
+    // xmm0 = bits, through rax.
+    void loadConstant(double value)
+    {
+        uint64_t bits = 0;
+        std::memcpy(&bits, &value, sizeof(bits));
+        movRax(bits);
+        emit({0x66, 0x48, 0x0f, 0x6e, 0xc0});
+    }
+
+    // xmm0 = -xmm0, flipping the sign bit so that 0 becomes -0.
+    void negate()
+    {
+        movRax(0x8000000000000000ull);
+        emit({0x66, 0x48, 0x0f, 0x6e, 0xc8});
+        emit({0x66, 0x0f, 0x57, 0xc1});
+    }
+
+    void moveXmm1FromXmm0() { emit({0xf2, 0x0f, 0x10, 0xc8}); }
+    // addsd, subsd, mulsd or divsd xmm0, xmm1.
+    void arithmetic(uint8_t opcode) { emit({0xf2, 0x0f, opcode, 0xc1}); }
+    // ucomisd a, b
+    void compare(Xmm a, Xmm b)
+    {
+        emit({0x66, 0x0f, 0x2e, static_cast<uint8_t>(0xc0 | (a << 3) | b)});
+    }
+
+    void movRax(uint64_t value) { emit({0x48, 0xb8}); imm64(value); }
+
+    void jump(Label& label) { emit({0xe9}); target(label); }
+    void jumpIf(Cond cond, Label& label)
+    {
+        emit({0x0f, static_cast<uint8_t>(0x80 | static_cast<uint8_t>(cond))});
+        target(label);
+    }
+
+    void bind(Label& label)
+    {
+        label.position = position();
+        for (auto use : label.uses) {
+            patch32(use, label.position - (use + 4));
+        }
+        label.uses.clear();
+    }
+
+private:
+    void sseFrame(uint8_t opcode, Xmm reg, int slot)
+    {
+        emit({0xf2, 0x0f, opcode, static_cast<uint8_t>(0x84 | (reg << 3)),
+            0x24});
+        imm32(8 * slot);
+    }
+
+    void target(Label& label)
+    {
+        if (label.position >= 0) {
+            imm32(label.position - (position() + 4));
+        }
+        else {
+            label.uses.push_back(position());
+            imm32(0);
+        }
+    }
+};
+
+}
+
+// Generates the code of one function. Every value it handles is a
+// number, kept in xmm0 while it is computed and in a frame slot while
+// something else is; comparisons and logic only ever decide branches.
+class FunctionCompiler
+{
+public:
+    FunctionCompiler(Jit& jit, Function* function):
+        jit(jit), interpreter(*jit.interpreter), function(function) {}
+
+    std::vector<uint8_t> compile();
+
+private:
+    struct Scope
+    {
+        // First frame slot of the scope's variables.
+        int base;
+    };
+
+    void statement(Stmt* stmt);
+    void block(vector<unique_ptr<Stmt>>& statements, int slots);
+    void value(Expr* expr);
+    void branch(Expr* expr, bool sense, Label& target);
+    void call(Call* expr);
+    void tick(const Token* token);
+    int variable(int depth, int slot);
+    int allocate(int count = 1);
+    void release(int count = 1) { top -= count; }
+    static bool returns(Stmt* stmt);
+    static bool returns(vector<unique_ptr<Stmt>>& statements);
+
+    Jit& jit;
+    Interpreter& interpreter;
+    Function* function;
+    Assembler a;
+    std::vector<Scope> scopes;
+    // Frame slots in use and the most ever used.
+    int top = 0;
+    int frameSlots = 0;
+    Label epilogue;
+    Label bailout;
+    // Where code goes once Jit::safepoint() says to stop.
+    Label stopped;
+};
+
+std::vector<uint8_t> FunctionCompiler::compile()
+{
+    // Falling off the end would return nothing, which isn't a number.
+    if (!returns(*function->body)) throw Unsupported();
+
+    // push rbp; mov rbp, rsp; push rbx; push r12; sub rsp, frame
+    a.emit({0x55, 0x48, 0x89, 0xe5, 0x53, 0x41, 0x54});
+    a.emit({0x48, 0x81, 0xec});
+    size_t frameSize = a.position();
+    a.imm32(0);
+    // mov rbx, rdi (the call depth); mov r12, rdx (the result)
+    a.emit({0x48, 0x89, 0xfb, 0x49, 0x89, 0xd4});
+
+    // Parameters take the first slots of the function's scope.
+    scopes.push_back(Scope{allocate(function->slots)});
+    for (int i = 0; i < function->params->size(); ++i) {
+        a.loadArgument(i);
+        a.store(scopes.back().base + i, XMM0);
+    }
+    // After the arguments, as the safepoint call doesn't keep rsi.
+    tick(function->name.get());
+    for (auto& stmt : *function->body) {
+        statement(stmt.get());
+    }
+
+    a.bind(stopped);
+    // mov eax, 2
+    a.emit({0xb8, 0x02, 0x00, 0x00, 0x00});
+    a.jump(epilogue);
+    a.bind(bailout);
+    // mov eax, 1
+    a.emit({0xb8, 0x01, 0x00, 0x00, 0x00});
+    a.bind(epilogue);
+    // add rsp, frame; pop r12; pop rbx; pop rbp; ret
+    a.emit({0x48, 0x81, 0xc4});
+    size_t frameRestore = a.position();
+    a.imm32(0);
+    a.emit({0x41, 0x5c, 0x5b, 0x5d, 0xc3});
+
+    // Keeps rsp 16-byte aligned at calls: the return address and the
+    // three saved registers already take 32 bytes.
+    int bytes = (frameSlots * 8 + 15) & ~15;
+    a.patch32(frameSize, bytes);
+    a.patch32(frameRestore, bytes);
+    return std::move(a.code);
+}
+
+int FunctionCompiler::allocate(int count)
+{
+    int slot = top;
+    top += count;
+    if (top > frameSlots) frameSlots = top;
+    return slot;
+}
+
+// Frame slot of a variable the Resolver placed at depth and slot, as long
+// as it belongs to this function.
+int FunctionCompiler::variable(int depth, int slot)
+{
+    if (depth < 0 || depth >= scopes.size()) throw Unsupported();
+    return scopes[scopes.size() - 1 - depth].base + slot;
+}
+
+bool FunctionCompiler::returns(Stmt* stmt)
+{
+    if (dynamic_cast<Return*>(stmt)) return true;
+    if (auto block = dynamic_cast<Block*>(stmt)) {
+        return returns(*block->statements);
+    }
+    if (auto branch = dynamic_cast<If*>(stmt)) {
+        return branch->elseBranch != nullptr
+            && returns(branch->thenBranch.get())
+            && returns(branch->elseBranch.get());
+    }
+    return false;
+}
+
+bool FunctionCompiler::returns(vector<unique_ptr<Stmt>>& statements)
+{
+    for (auto& stmt : statements) {
+        if (returns(stmt.get())) return true;
+    }
+    return false;
+}
+
+void FunctionCompiler::block(vector<unique_ptr<Stmt>>& statements, int slots)
+{
+    scopes.push_back(Scope{allocate(slots)});
+    for (auto& stmt : statements) {
+        statement(stmt.get());
+    }
+    release(slots);
+    scopes.pop_back();
+}
+
+void FunctionCompiler::statement(Stmt* stmt)
+{
+    if (auto expression = dynamic_cast<Expression*>(stmt)) {
+        value(expression->expr.get());
+    }
+    else if (auto var = dynamic_cast<VarStmt*>(stmt)) {
+        if (var->initializer == nullptr || var->slot < 0) throw Unsupported();
+        value(var->initializer.get());
+        a.store(variable(0, var->slot), XMM0);
+    }
+    else if (auto nested = dynamic_cast<Block*>(stmt)) {
+        block(*nested->statements, nested->slots);
+    }
+    else if (auto branchStmt = dynamic_cast<If*>(stmt)) {
+        Label otherwise;
+        Label end;
+        branch(branchStmt->condition.get(), false, otherwise);
+        statement(branchStmt->thenBranch.get());
+        if (branchStmt->elseBranch != nullptr) {
+            a.jump(end);
+            a.bind(otherwise);
+            statement(branchStmt->elseBranch.get());
+        }
+        else {
+            a.bind(otherwise);
+        }
+        a.bind(end);
+    }
+    else if (auto loop = dynamic_cast<While*>(stmt)) {
+        Label start;
+        Label exit;
+        a.bind(start);
+        branch(loop->condition.get(), false, exit);
+        tick(loop->keyword.get());
+        statement(loop->body.get());
+        a.jump(start);
+        a.bind(exit);
+    }
+    else if (auto ret = dynamic_cast<Return*>(stmt)) {
+        if (ret->value == nullptr) throw Unsupported();
+        value(ret->value.get());
+        a.storeResult();
+        // xor eax, eax
+        a.emit({0x31, 0xc0});
+        a.jump(epilogue);
+    }
+    else {
+        throw Unsupported();
+    }
+}
+
+// Computes a number into xmm0.
+void FunctionCompiler::value(Expr* expr)
+{
+    if (auto literal = dynamic_cast<Literal*>(expr)) {
+        auto number = std::any_cast<double>(
+            &interpreter.constants.at(literal->constant));
+        if (number == nullptr) throw Unsupported();
+        a.loadConstant(*number);
+    }
+    else if (auto grouping = dynamic_cast<Grouping*>(expr)) {
+        value(grouping->expression.get());
+    }
+    else if (auto var = dynamic_cast<VarExpr*>(expr)) {
+        a.load(XMM0, variable(var->depth, var->slot));
+    }
+    else if (auto assign = dynamic_cast<Assign*>(expr)) {
+        int slot = variable(assign->depth, assign->slot);
+        value(assign->value.get());
+        a.store(slot, XMM0);
+    }
+    else if (auto unary = dynamic_cast<Unary*>(expr)) {
+        if (unary->op->type != TokenType::MINUS) throw Unsupported();
+        value(unary->right.get());
+        a.negate();
+    }
+    else if (auto binary = dynamic_cast<Binary*>(expr)) {
+        uint8_t opcode = 0;
+        switch (binary->op->type) {
+        case TokenType::PLUS: opcode = 0x58; break;
+        case TokenType::STAR: opcode = 0x59; break;
+        case TokenType::MINUS: opcode = 0x5c; break;
+        case TokenType::SLASH: opcode = 0x5e; break;
+        default:
+            throw Unsupported();
+        }
+        int left = allocate();
+        value(binary->left.get());
+        a.store(left, XMM0);
+        value(binary->right.get());
+        a.moveXmm1FromXmm0();
+        a.load(XMM0, left);
+        a.arithmetic(opcode);
+        release();
+    }
+    else if (auto callExpr = dynamic_cast<Call*>(expr)) {
+        call(callExpr);
+    }
+    else {
+        throw Unsupported();
+    }
+}
+
+// Jumps to target if expr's truthiness is sense.
+void FunctionCompiler::branch(Expr* expr, bool sense, Label& target)
+{
+    if (auto grouping = dynamic_cast<Grouping*>(expr)) {
+        branch(grouping->expression.get(), sense, target);
+        return;
+    }
+    if (auto literal = dynamic_cast<Literal*>(expr)) {
+        auto& constant = interpreter.constants.at(literal->constant);
+        if (interpreter.isTruthy(&constant) == sense) a.jump(target);
+        return;
+    }
+    if (auto unary = dynamic_cast<Unary*>(expr)) {
+        if (unary->op->type == TokenType::BANG) {
+            branch(unary->right.get(), !sense, target);
+            return;
+        }
+    }
+    if (auto logical = dynamic_cast<Logical*>(expr)) {
+        // The value that decides an or early, and the opposite for and.
+        bool decides = logical->op->type == TokenType::OR;
+        if (sense == decides) {
+            branch(logical->left.get(), sense, target);
+            branch(logical->right.get(), sense, target);
+        }
+        else {
+            Label skip;
+            branch(logical->left.get(), decides, skip);
+            branch(logical->right.get(), sense, target);
+            a.bind(skip);
+        }
+        return;
+    }
+    if (auto binary = dynamic_cast<Binary*>(expr)) {
+        auto type = binary->op->type;
+        bool ordered = type == TokenType::LESS || type == TokenType::LESS_EQUAL
+            || type == TokenType::GREATER || type == TokenType::GREATER_EQUAL;
+        bool equality = type == TokenType::EQUAL_EQUAL
+            || type == TokenType::BANG_EQUAL;
+        if (ordered || equality) {
+            int left = allocate();
+            value(binary->left.get());
+            a.store(left, XMM0);
+            value(binary->right.get());
+            a.moveXmm1FromXmm0();
+            a.load(XMM0, left);
+            release();
+
+            // Unordered operands (NaN) leave CF and PF set, which every
+            // jump below treats as false, as the interpreter does.
+            if (ordered) {
+                bool less = type == TokenType::LESS
+                    || type == TokenType::LESS_EQUAL;
+                bool strict = type == TokenType::LESS
+                    || type == TokenType::GREATER;
+                if (less) a.compare(XMM1, XMM0);
+                else a.compare(XMM0, XMM1);
+                if (strict) a.jumpIf(sense ? Cond::A : Cond::BE, target);
+                else a.jumpIf(sense ? Cond::AE : Cond::B, target);
+            }
+            else {
+                a.compare(XMM0, XMM1);
+                bool equal = (type == TokenType::EQUAL_EQUAL) == sense;
+                if (equal) {
+                    Label skip;
+                    a.jumpIf(Cond::P, skip);
+                    a.jumpIf(Cond::E, target);
+                    a.bind(skip);
+                }
+                else {
+                    a.jumpIf(Cond::P, target);
+                    a.jumpIf(Cond::NE, target);
+                }
+            }
+            return;
+        }
+    }
+
+    // Any number is true.
+    value(expr);
+    if (sense) a.jump(target);
+}
+
+// Calls another compiled function directly. The callee's global must
+// still hold the function the code was compiled against.
+void FunctionCompiler::call(Call* expr)
+{
+    auto name = dynamic_cast<VarExpr*>(expr->callee.get());
+    if (name == nullptr || name->depth >= 0) throw Unsupported();
+    auto globals = interpreter.globals;
+    auto iter = globals->entries().find(name->name->lexeme);
+    if (iter == globals->entries().end()) throw Unsupported();
+    auto callee = std::any_cast<LoxFunction*>(&iter->second);
+    if (callee == nullptr) throw Unsupported();
+    auto declaration = (*callee)->declaration;
+    if (declaration->params->size() != expr->arguments->size()) {
+        throw Unsupported();
+    }
+    if (!jit.prepare(declaration)) throw Unsupported();
+
+    // mov rax, &version; mov rcx, version; cmp [rax], rcx; jne bailout
+    a.movRax(reinterpret_cast<uint64_t>(globals->versionAddress()));
+    a.emit({0x48, 0xb9});
+    a.imm64(globals->version());
+    a.emit({0x48, 0x39, 0x08});
+    a.jumpIf(Cond::NE, bailout);
+
+    int count = expr->arguments->size();
+    int arguments = allocate(count);
+    for (int i = 0; i < count; ++i) {
+        value((*expr->arguments)[i].get());
+        a.store(arguments + i, XMM0);
+    }
+    int result = allocate();
+
+    // cmp dword [rbx], max; jae bailout
+    a.emit({0x81, 0x3b});
+    a.imm32(Interpreter::kMaxCallDepth);
+    a.jumpIf(Cond::AE, bailout);
+    // mov rax, &stackLimit; cmp rsp, [rax]; jb bailout; inc dword [rbx]
+    a.movRax(reinterpret_cast<uint64_t>(&interpreter.stackLimit));
+    a.emit({0x48, 0x3b, 0x20});
+    a.jumpIf(Cond::B, bailout);
+    a.emit({0xff, 0x03});
+    // The callee may not have its code yet while it is being compiled
+    // itself; if it never gets any, the call gives up.
+    // mov rax, &entry; mov rax, [rax]; test rax, rax
+    a.movRax(reinterpret_cast<uint64_t>(&declaration->jit.entry));
+    a.emit({0x48, 0x8b, 0x00, 0x48, 0x85, 0xc0});
+    Label missing;
+    a.jumpIf(Cond::E, missing);
+    // mov rdi, rbx; lea rsi, [rsp + arguments]; lea rdx, [rsp + result]
+    a.emit({0x48, 0x89, 0xdf});
+    a.emit({0x48, 0x8d, 0xb4, 0x24});
+    a.imm32(8 * arguments);
+    a.emit({0x48, 0x8d, 0x94, 0x24});
+    a.imm32(8 * result);
+    // call rax; dec dword [rbx]; test eax, eax; jne epilogue, returning
+    // the callee's bailout or stop.
+    a.emit({0xff, 0xd0, 0xff, 0x0b, 0x85, 0xc0});
+    a.jumpIf(Cond::NE, epilogue);
+    Label done;
+    a.jump(done);
+    a.bind(missing);
+    a.emit({0xff, 0x0b});
+    a.jump(bailout);
+    a.bind(done);
+    a.load(XMM0, result);
+    release(count + 1);
+}
+
+// A safepoint. Frame slots hold all the values between statements, so
+// nothing needs saving around the call.
+void FunctionCompiler::tick(const Token* token)
+{
+    // mov rax, &ticks; sub qword [rax], 1; jns done
+    a.movRax(reinterpret_cast<uint64_t>(&interpreter.ticks));
+    a.emit({0x48, 0x83, 0x28, 0x01});
+    Label done;
+    a.jumpIf(Cond::NS, done);
+    // mov rdi, jit; mov rsi, token; mov rax, &Jit::safepoint; call rax
+    a.emit({0x48, 0xbf});
+    a.imm64(reinterpret_cast<uint64_t>(&jit));
+    a.emit({0x48, 0xbe});
+    a.imm64(reinterpret_cast<uint64_t>(token));
+    a.movRax(reinterpret_cast<uint64_t>(&Jit::safepoint));
+    a.emit({0xff, 0xd0});
+    // test eax, eax; jne stopped
+    a.emit({0x85, 0xc0});
+    a.jumpIf(Cond::NE, stopped);
+    a.bind(done);
+}
+
+Jit::~Jit()
+{
+#ifdef LOX_JIT_X64
+    for (auto [address, size] : regions) {
+        munmap(address, size);
+    }
+#endif
+}
+
+bool Jit::call(Function* declaration, Arguments arguments, double& result)
+{
+    auto& state = declaration->jit;
+    if (state.status == JitState::Status::COUNTING) {
+        if (++state.calls < kHotCalls) return false;
+        prepare(declaration);
+    }
+    if (state.status != JitState::Status::COMPILED) return false;
+
+    // Lox functions take at most 255 parameters.
+    std::array<double, 256> values;
+    for (int i = 0; i < arguments.size(); ++i) {
+        auto number = std::any_cast<double>(&arguments[i]);
+        if (number == nullptr) return false;
+        values[i] = *number;
+    }
+    int status = state.entry(&interpreter->callDepth, values.data(), &result);
+    if (status == 0) return true;
+    if (status == 2) std::rethrow_exception(std::exchange(stopped, nullptr));
+    // Whatever made it give up is likely to again.
+    ++stats.bailouts;
+    state.status = JitState::Status::REJECTED;
+    return false;
+}
+
+int Jit::safepoint(Jit* jit, const Token* token)
+{
+    try {
+        jit->interpreter->safepoint(*token);
+        return 0;
+    }
+    catch (...) {
+        jit->stopped = std::current_exception();
+        return 1;
+    }
+}
+
+bool Jit::prepare(Function* declaration)
+{
+    auto& state = declaration->jit;
+    switch (state.status) {
+    case JitState::Status::COMPILING:
+    case JitState::Status::COMPILED:
+        return true;
+    case JitState::Status::REJECTED:
+        return false;
+    case JitState::Status::COUNTING:
+        break;
+    }
+
+#ifdef LOX_JIT_X64
+    state.status = JitState::Status::COMPILING;
+    try {
+        auto code = FunctionCompiler(*this, declaration).compile();
+        state.entry = install(code);
+    }
+    catch (const Unsupported&) {}
+#endif
+    if (state.entry == nullptr) {
+        ++stats.rejected;
+        state.status = JitState::Status::REJECTED;
+        return false;
+    }
+    ++stats.compiled;
+    state.status = JitState::Status::COMPILED;
+    return true;
+}
+
+JitEntry Jit::install(const std::vector<uint8_t>& code)
+{
+#ifdef LOX_JIT_X64
+    size_t size = code.size();
+    void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) return nullptr;
+    std::memcpy(memory, code.data(), size);
+    if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(memory, size);
+        return nullptr;
+    }
+    regions.emplace_back(memory, size);
+    return reinterpret_cast<JitEntry>(memory);
+#else
+    return nullptr;
+#endif
+}
+
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "autogen/Stmt.h"
+#include "JitState.h"
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <utility>
+#include <vector>
+
+namespace lox {
+
+class Interpreter;
+class Arguments;
+
+struct JitStats
+{
+    uint64_t compiled = 0;
+    uint64_t rejected = 0;
+    // Compiled calls that gave up and ran again in the interpreter.
+    uint64_t bailouts = 0;
+};
+
+// Baseline compiler from hot Lox functions to x86-64 machine code.
+//
+// LoxFunction::call counts the calls of every function. After kHotCalls
+// the function is compiled if its body uses nothing but numbers, its own
+// locals, arithmetic, comparisons, if, while, returns of numbers and
+// calls of global functions that qualify too; anything else leaves it
+// to the interpreter for good. Compiled code keeps numbers unboxed in
+// its native stack frame and calls other compiled code directly.
+//
+// Such code has no effects outside its own frames, so when a guard fails
+// (a global callee was rebound, or the calls nest too deep) it abandons
+// the whole call and the interpreter runs it again from the start. Loop
+// iterations and function entries are safepoints, as in the interpreter;
+// a limit hit there unwinds the compiled frames and is thrown by call().
+//
+// Only x86-64 Linux has a code generator; elsewhere nothing compiles.
+class Jit
+{
+public:
+    static constexpr uint32_t kHotCalls = 50;
+
+    explicit Jit(Interpreter* interpreter): interpreter(interpreter) {}
+    ~Jit();
+
+    // Counts a call of declaration and runs its machine code if it has
+    // any. Returns false when the interpreter has to run the call.
+    bool call(Function* declaration, Arguments arguments, double& result);
+
+    const JitStats& statistics() const { return stats; }
+
+private:
+    // Compiles declaration unless that was tried already. Returns whether
+    // machine code for it exists or is being generated.
+    bool prepare(Function* declaration);
+    JitEntry install(const std::vector<uint8_t>& code);
+    // Called by machine code when the interpreter's slice of safepoints
+    // runs out. Returns 1 if the program has to stop, keeping the error
+    // for call() to throw once the compiled frames are gone.
+    static int safepoint(Jit* jit, const Token* token);
+
+    Interpreter* interpreter;
+    std::exception_ptr stopped;
+    // Executable mappings and their sizes.
+    std::vector<std::pair<void*, size_t>> regions;
+    JitStats stats;
+
+    friend class FunctionCompiler;
+};
+
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstdint>
+
+namespace lox {
+
+// Machine code compiled from a function. It reads its arguments, counts
+// nested calls in *depth and stores the return value. Returns 0, or 1
+// when it gave up and the call has to run in the interpreter instead.
+using JitEntry = int (*)(int* depth, const double* arguments, double* result);
+
+// What the JIT knows about a function declaration.
+struct JitState
+{
+    enum class Status : uint8_t { COUNTING, COMPILING, COMPILED, REJECTED };
+
+    Status status = Status::COUNTING;
+    // Calls counted while the function isn't hot yet.
+    uint32_t calls = 0;
+    JitEntry entry = nullptr;
+};
+
+}
@@ -3,51 +3,249 @@
 #include "AstPrinter.h"
 #include "Interpreter.h"
 #include "Resolver.h"
+#include "ClosureCompiler.h"
+#include "Jit.h"
+#include "CppEmitter.h"
+#include "Profile.h"
+#include "Channel.h"
+#include "Parallel.h"
+#include "EventLoop.h"
+#include "Native.h"
+#include "Snapshot.h"
 #include <fstream>
 #include <sstream>
+#include <chrono>
 #include <iostream>
 #include <fmt/format.h>
 
 namespace lox {
 
-bool hadError = false;
-bool hadRuntimeError = false;
-std::unique_ptr<Interpreter> interpreter;
+Options options;
 
-void run(const std::string& source)
+static thread_local Isolate* running = nullptr;
+
+Isolate::Isolate(const Options& options): options(options)
+{
+    interpreter = std::make_unique<Interpreter>(options.gc);
+    // Before the engine, which may take its own copy of the natives.
+    registerChannelNatives(*interpreter);
+    registerParallelNatives(*interpreter, options);
+    registerEventLoopNatives(*interpreter);
+    registerNative(*interpreter, "argumentCount", []() {
+        return double(Isolate::current()->arguments.size());
+    });
+    registerNative(*interpreter, "argument", [](double index) {
+        auto& arguments = Isolate::current()->arguments;
+        if (index < 0 || index >= arguments.size() || index != int(index)) {
+            throw NativeError(fmt::format("No argument {}.", index));
+        }
+        return arguments[size_t(index)];
+    });
+    if (options.engine == Engine::STACKLESS) {
+        interpreter->useStackless(options.stackBudget);
+    }
+    else if (options.engine == Engine::VM) {
+        interpreter->useVm();
+    }
+    else if (options.engine == Engine::CLOSURE) {
+        interpreter->useClosures();
+    }
+    if (options.jit) interpreter->useJit();
+    Limits limits;
+    limits.fuel = options.fuel;
+    limits.memory = options.maxMemory;
+    interpreter->useLimits(limits);
+}
+
+Isolate::~Isolate()
+{
+    join();
+    interpreter.reset();
+}
+
+Isolate::Scope::Scope(Isolate* isolate): previous(running)
 {
+    running = isolate;
+}
+
+Isolate::Scope::~Scope()
+{
+    running = previous;
+}
+
+Isolate* Isolate::current()
+{
+    return running;
+}
+
+std::vector<std::unique_ptr<Stmt>> Isolate::compile(
+    const std::string& source)
+{
+    return compile(source, interpreter->constantPool());
+}
+
+std::vector<std::unique_ptr<Stmt>> Isolate::compile(
+    const std::string& source, ConstantPool& constants)
+{
+    Scope scope(this);
     Scanner scanner(source);
     auto tokens = scanner.scanTokens();
-    Parser parser(std::move(tokens));
+    Parser parser(std::move(tokens), constants);
     auto statements = parser.parse();
 
     // Stop if there was a syntax error.
-    if (hadError) return;
+    if (hadError) return {};
 
-    if (interpreter.get() == nullptr) {
-        interpreter = std::make_unique<Interpreter>();
-    }
-
-    Resolver resolver(interpreter.get());
+    Resolver resolver;
     resolver.resolve(statements);
     // Stop if there was a resolution error.
+    if (hadError) return {};
+    return statements;
+}
+
+void Isolate::run(const std::string& source)
+{
+    auto statements = compile(source);
     if (hadError) return;
 
-    interpreter->interpret(statements);
+    if (options.emitCpp) {
+        CppEmitter emitter;
+        auto code = emitter.emit(statements);
+        if (!hadError) fmt::print("{}", code);
+        return;
+    }
+
+    {
+        Watchdog watchdog(this);
+        interpreter->interpret(statements);
+    }
+    if (options.snapshotOut.empty() || hadError || hadRuntimeError) return;
+    try {
+        Snapshot::save(options.snapshotOut, *interpreter, source, statements);
+    }
+    catch (const SnapshotError& error) {
+        fmt::print(stderr, "snapshot: can't save {}: {}\n",
+            options.snapshotOut, error.what());
+        snapshotFailed = true;
+    }
+}
+
+Isolate::Watchdog::Watchdog(Isolate* isolate)
+{
+    auto timeout = std::chrono::milliseconds(isolate->options.timeout);
+    if (timeout.count() == 0) return;
+    // The interpreter notices at its next safepoint.
+    auto interpreter = isolate->interpreter.get();
+    thread = std::thread([this, timeout, interpreter]() {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (!changed.wait_for(lock, timeout, [this]() { return done; })) {
+            interpreter->cancel("Script timed out.");
+        }
+    });
+}
+
+Isolate::Watchdog::~Watchdog()
+{
+    if (!thread.joinable()) return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        done = true;
+    }
+    changed.notify_one();
+    thread.join();
+}
+
+bool Isolate::restore(const std::string& path)
+{
+    try {
+        Snapshot snapshot(path);
+        prelude = compile(std::string(snapshot.source()));
+        if (hadError) {
+            throw SnapshotError("its prelude doesn't compile");
+        }
+        snapshot.restore(*interpreter, prelude);
+        return true;
+    }
+    catch (const SnapshotError& error) {
+        fmt::print(stderr, "snapshot: can't restore {}: {}\n", path,
+            error.what());
+        snapshotFailed = true;
+        return false;
+    }
 }
 
-void runFile(const std::string& path)
+int Isolate::runFile(const std::string& path,
+    std::vector<std::string> arguments)
 {
+    Scope scope(this);
     std::ifstream input(path);
     std::stringstream buffer;
     buffer << input.rdbuf();
-    run(buffer.str());
-    if (hadError) std::exit(65);
-    if (hadRuntimeError) std::exit(70);
+    auto source = buffer.str();
+    setScript(path, std::move(arguments));
+
+    auto hash = Profile::hash(source);
+    if (!options.profileIn.empty()) {
+        profile = Profile::load(options.profileIn, hash);
+        if (profile == nullptr) {
+            fmt::print(stderr, "profile: ignoring {}, not a profile of {}\n",
+                options.profileIn, path);
+        }
+    }
+    if (profile == nullptr && !options.profileOut.empty()) {
+        profile = std::make_unique<Profile>(hash);
+    }
+    if (profile != nullptr) {
+        interpreter->useProfile(profile.get(), !options.profileOut.empty());
+    }
+
+    if (!options.snapshotIn.empty() && !restore(options.snapshotIn)) {
+        return finish();
+    }
+    run(source);
+    if (!options.profileOut.empty() && !hadError
+        && !profile->save(options.profileOut)) {
+        fmt::print(stderr, "profile: can't write {}\n", options.profileOut);
+    }
+    return finish();
+}
+
+int Isolate::runCompiled(std::vector<std::unique_ptr<Stmt>>& statements,
+    const ConstantPool& constants, const std::string& path,
+    std::vector<std::string> arguments)
+{
+    Scope scope(this);
+    interpreter->constantPool() = constants;
+    setScript(path, std::move(arguments));
+    {
+        Watchdog watchdog(this);
+        interpreter->interpret(statements);
+    }
+    return finish();
 }
 
-void runPrompt()
+void Isolate::setScript(const std::string& path,
+    std::vector<std::string> arguments)
 {
+    auto slash = path.find_last_of('/');
+    directory = slash == std::string::npos ? "" : path.substr(0, slash + 1);
+    this->arguments = std::move(arguments);
+}
+
+int Isolate::finish()
+{
+    if (!join()) hadRuntimeError = true;
+    if (options.gcStats) printGcStats();
+    if (options.engineStats) printEngineStats();
+    if (hadError) return 65;
+    if (hadRuntimeError) return 70;
+    if (snapshotFailed) return 74;
+    return 0;
+}
+
+void Isolate::runPrompt()
+{
+    Scope scope(this);
     while (true) {
         std::cout << "> ";
         std::string line;
@@ -56,13 +254,82 @@ void runPrompt()
         run(line);
         hadError = false;
     }
+    join();
+    if (options.gcStats) printGcStats();
+    if (options.engineStats) printEngineStats();
+}
+
+void Isolate::spawn(const std::string& path)
+{
+    auto script = path.empty() || path[0] == '/' ? path : directory + path;
+    if (!std::ifstream(script)) {
+        throw NativeError(fmt::format("Can't read script '{}'.", path));
+    }
+    // A spawned script has no profile or snapshot of its own.
+    auto child = options;
+    child.profileIn.clear();
+    child.profileOut.clear();
+    child.snapshotIn.clear();
+    child.snapshotOut.clear();
+    children.push_back(std::async(std::launch::async, [script, child]() {
+        Isolate isolate(child);
+        return isolate.runFile(script);
+    }));
+}
+
+const char* Isolate::starved() const
+{
+    if (children.empty()) return nullptr;
+    bool running = false;
+    for (auto& child : children) {
+        if (child.wait_for(std::chrono::seconds(0)) !=
+            std::future_status::ready) {
+            running = true;
+        }
+        else if (child.get() != 0) {
+            return "a spawned script failed.";
+        }
+    }
+    return running ? nullptr : "every spawned script has finished.";
+}
+
+bool Isolate::join()
+{
+    bool succeeded = true;
+    for (auto& child : children) {
+        if (child.get() != 0) succeeded = false;
+    }
+    children.clear();
+    return succeeded;
+}
+
+void Isolate::printGcStats()
+{
+    const GcStats& stats = interpreter->gcStats();
+    fmt::print(stderr,
+        "gc: {} collections, {:.3f} ms paused\n"
+        "gc: {} bytes live in {} objects, peak {} bytes, next at {}\n"
+        "gc: {} bytes allocated, {} bytes in {} objects freed\n",
+        stats.collections, stats.pauseSeconds * 1000.0,
+        stats.bytesLive, stats.objectsLive, stats.peakBytes,
+        stats.nextCollection,
+        stats.totalAllocated, stats.totalFreed, stats.objectsFreed);
+
+    const PoolStats& pool = interpreter->poolStats();
+    double reuse = pool.allocations == 0 ? 0.0 :
+        100.0 * pool.reused / pool.allocations;
+    fmt::print(stderr,
+        "pool: {} allocations, {} reused ({:.1f}%), {} freed, {} oversized, "
+        "{} bytes reserved\n",
+        pool.allocations, pool.reused, reuse, pool.frees, pool.oversized,
+        pool.bytesReserved);
 }
 
 static void report(int line, const std::string& where,
     const std::string& message)
 {
-    fmt::println("[line {}] Error{}: {}", line, where, message);
-    hadError = true;
+    printLine(fmt::format("[line {}] Error{}: {}", line, where, message));
+    Isolate::current()->hadError = true;
 }
 
 void error(int line, const std::string& message)
@@ -82,8 +349,44 @@ void error(const Token& token, const std::string& message)
 
 void runtimeError(const RuntimeError& error)
 {
-    fmt::println("{}\n[line {}]", error.what(), error.token.line);
-    hadRuntimeError = true;
+    printLine(fmt::format("{}\n[line {}]", error.what(), error.token.line));
+    Isolate::current()->hadRuntimeError = true;
+}
+
+void printLine(std::string_view line)
+{
+    auto isolate = Isolate::current();
+    if (isolate == nullptr || !isolate->output) {
+        fmt::println("{}", line);
+        return;
+    }
+    std::string text(line);
+    text += '\n';
+    isolate->output(text);
 }
 
-}
\ No newline at end of file
+void Isolate::printEngineStats()
+{
+    if (options.engine == Engine::TREE) {
+        const CallCacheStats& calls = interpreter->callStats();
+        fmt::print(stderr, "calls: {} through inline caches, {} missed\n",
+            calls.hits, calls.misses);
+    }
+    if (options.engine != Engine::VM) {
+        const PropertyCacheStats& properties = interpreter->propertyStats();
+        fmt::print(stderr,
+            "properties: {} through inline caches, {} missed\n",
+            properties.hits, properties.misses);
+    }
+    if (auto stats = interpreter->jitStats()) {
+        fmt::print(stderr, "jit: {} compiled, {} rejected, {} bailouts\n",
+            stats->compiled, stats->rejected, stats->bailouts);
+    }
+    if (auto stats = interpreter->quickeningStats()) {
+        fmt::print(stderr, "quicken: {} specializations, {} deoptimizations, "
+            "{} from the profile\n",
+            stats->specializations, stats->deoptimizations, stats->profiled);
+    }
+}
+
+}
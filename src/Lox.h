@@ -1,17 +1,191 @@
 #pragma once
 
 #include "Scanner.h"
+#include "Heap.h"
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
 
 namespace lox {
 
-extern bool hadError;
-extern bool hadRuntimeError;
+enum class Engine
+{
+    // Recursive AST walk, the default.
+    TREE,
+    // AST evaluation with explicit heap stacks, see Stackless.
+    STACKLESS,
+    // Bytecode compiled by Compiler, run by Vm.
+    VM,
+    // The AST compiled to C++ closures by ClosureCompiler.
+    CLOSURE
+};
+
+struct Options
+{
+    Engine engine = Engine::TREE;
+    // Bytes the stackless engine's stacks may grow to.
+    size_t stackBudget = 64 * 1024 * 1024;
+    GcOptions gc;
+    // Print collector statistics to stderr when the program ends.
+    bool gcStats = false;
+    // Compile hot numeric functions to machine code.
+    bool jit = false;
+    // Print the engine's own counters to stderr when the program ends.
+    bool engineStats = false;
+    // Print the program translated to C++ instead of running it.
+    bool emitCpp = false;
+    // Type profiles of the closure engine to start from and to write.
+    std::string profileIn;
+    std::string profileOut;
+    // Worker threads of parallelMap and parallelReduce, 0 for one per core.
+    int threads = 0;
+    // Unix socket to run scripts for clients on, see Server.
+    std::string serve;
+    // Where to save the heap the script leaves, and a saved heap to
+    // start the script from, see Snapshot.
+    std::string snapshotOut;
+    std::string snapshotIn;
+    // Limits of the script, 0 for none, see Limits: loop iterations and
+    // calls it may make, bytes its heap may hold, and milliseconds it may
+    // run for.
+    uint64_t fuel = 0;
+    size_t maxMemory = 0;
+    uint64_t timeout = 0;
+};
+
+// Set from the command line before any isolate starts, read-only after.
+extern Options options;
+
+class ConstantPool;
 class Interpreter;
-extern std::unique_ptr<Interpreter> interpreter;
+class Profile;
+class Stmt;
+
+namespace embed {
+class Program;
+class Context;
+}
+
+// Everything one running program owns: its interpreter with the heap,
+// globals and natives, its type profile and whether it failed. Isolates
+// share no mutable state, so each one can run on a thread of its own and
+// they exchange values only through the copying channels of Channel.h.
+//
+// An isolate belongs to the thread that creates it. While one of its
+// methods runs it is the thread's current isolate, which error(),
+// runtimeError() and printLine() report to.
+class Isolate
+{
+public:
+    // Makes an isolate the current one for as long as it lives.
+    class Scope
+    {
+    public:
+        explicit Scope(Isolate* isolate);
+        ~Scope();
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        Isolate* previous;
+    };
+
+    explicit Isolate(const Options& options);
+    ~Isolate();
+    Isolate(const Isolate&) = delete;
+    Isolate& operator=(const Isolate&) = delete;
+
+    // Returns the exit status: 65 after a compile error, 70 after a
+    // runtime error, in the script or in an isolate it spawned, and 74
+    // if a snapshot couldn't be saved or restored. The script reads its
+    // arguments with argument(i) and argumentCount().
+    int runFile(const std::string& path,
+        std::vector<std::string> arguments = {});
+    void runPrompt();
 
-void runFile(const std::string& path);
-void runPrompt();
+    // Scans, parses and resolves source, reporting any errors. The
+    // statements are empty if there were some.
+    std::vector<std::unique_ptr<Stmt>> compile(const std::string& source);
+    // compile() with the literals added to constants instead of the
+    // interpreter's own pool, so that they go when the caller drops them.
+    std::vector<std::unique_ptr<Stmt>> compile(const std::string& source,
+        ConstantPool& constants);
+    // Runs statements compiled into constants from the script at path as
+    // runFile() would, returning the exit status.
+    int runCompiled(std::vector<std::unique_ptr<Stmt>>& statements,
+        const ConstantPool& constants, const std::string& path,
+        std::vector<std::string> arguments);
+
+    // Starts the script at path, relative to this isolate's script, in a
+    // new isolate on a new thread. It is waited for before this isolate's
+    // own script counts as finished. Throws a NativeError if the script
+    // can't be read.
+    void spawn(const std::string& path);
+    // Why no message may ever arrive for this isolate, or null: a script
+    // it spawned failed, or it spawned some and all of them finished.
+    const char* starved() const;
+
+    // The isolate running on the calling thread, if any.
+    static Isolate* current();
+
+    // Set by error() and runtimeError().
+    bool hadError = false;
+    bool hadRuntimeError = false;
+    // Where printed text goes instead of stdout, if set.
+    std::function<void(std::string_view)> output;
+
+private:
+    // Cancels whatever the isolate runs while it lives with "Script timed
+    // out." once options.timeout passes, from a thread of its own. Does
+    // nothing without a timeout.
+    class Watchdog
+    {
+    public:
+        explicit Watchdog(Isolate* isolate);
+        ~Watchdog();
+        Watchdog(const Watchdog&) = delete;
+        Watchdog& operator=(const Watchdog&) = delete;
+
+    private:
+        std::mutex mutex;
+        std::condition_variable changed;
+        bool done = false;
+        std::thread thread;
+    };
+
+    void run(const std::string& source);
+    // Restores the snapshot at path; false if it couldn't.
+    bool restore(const std::string& path);
+    void setScript(const std::string& path,
+        std::vector<std::string> arguments);
+    // Waits for the spawned isolates and returns the exit status.
+    int finish();
+    // Waits for the spawned isolates; true if all of them succeeded.
+    bool join();
+    void printGcStats();
+    void printEngineStats();
+
+    Options options;
+    std::unique_ptr<Interpreter> interpreter;
+    std::unique_ptr<Profile> profile;
+    // Directory of the running script, where spawn() looks for scripts.
+    std::string directory;
+    std::vector<std::string> arguments;
+    std::vector<std::shared_future<int>> children;
+    // The prelude restored from a snapshot, which its functions run.
+    std::vector<std::unique_ptr<Stmt>> prelude;
+    bool snapshotFailed = false;
+
+    friend class embed::Program;
+    friend class embed::Context;
+};
 
 void error(int line, const std::string& message);
 void error(const Token& token, const std::string& message);
@@ -19,4 +193,7 @@ void error(const Token& token, const std::string& message);
 class RuntimeError;
 void runtimeError(const RuntimeError& error);
 
+// Prints line and a newline to the current isolate's output.
+void printLine(std::string_view line);
+
 }
@@ -1,27 +1,102 @@
 #include "LoxCallable.h"
+#include "LoxClass.h"
+#include "ClosureCompiler.h"
+#include "Jit.h"
+#include "Generator.h"
+#include <utility>
 
 namespace lox {
 
+LoxFunction::LoxFunction(Function* declaration, Environment* closure,
+    const CompiledBlock* compiled, Class* owner):
+    declaration(declaration), closure(closure), compiled(compiled),
+    owner(owner),
+    initializer(owner != nullptr && declaration->name->lexeme == "init")
+{}
+
 int LoxFunction::arity()
 {
     return declaration->params->size();
 }
 
-any LoxFunction::call(Interpreter* interpreter, std::vector<any>& arguments)
+any LoxFunction::call(Interpreter* interpreter, Arguments arguments)
 {
-    auto environment = std::make_shared<Environment>(closure);
-    for (int i = 0; i < declaration->params->size(); ++i) {
-        environment->define(declaration->params->at(i).lexeme, arguments.at(i));
+    if (interpreter->jit != nullptr && !initializer) {
+        double result = 0.0;
+        if (interpreter->jit->call(declaration, arguments, result)) {
+            return result;
+        }
     }
-    std::swap(environment, interpreter->environment);
-    EnvironmentSwapGuard guard(interpreter->environment, environment);
-    try {
-        interpreter->executeBlock(declaration->body.get());
+    return run(interpreter, closure, arguments);
+}
+
+LoxFunction* LoxFunction::bind(Interpreter* interpreter, LoxInstance* self)
+{
+    auto& heap = interpreter->heap;
+    // Made first and rooted, so the scope is reachable once it exists.
+    auto method = heap.make<LoxFunction>(declaration, nullptr, compiled, owner);
+    any bound(method);
+    TempRootGuard roots(interpreter);
+    roots.push(&bound);
+    method->closure = Environment::create(heap, closure, 1, true);
+    method->closure->slot(0) = self;
+    return method;
+}
+
+any LoxFunction::invoke(Interpreter* interpreter, LoxInstance* self,
+    Arguments arguments)
+{
+    // The scope binding 'this', entered so that the collector sees it.
+    auto scope = Environment::create(interpreter->heap, closure, 1,
+        owner->thisEscapes);
+    scope->slot(0) = self;
+    ScopeGuard guard(interpreter, scope, owner->thisEscapes);
+    return run(interpreter, scope, arguments);
+}
+
+// Runs the body in a new scope enclosed by closure.
+any LoxFunction::run(Interpreter* interpreter, Environment* closure,
+    Arguments arguments)
+{
+    if (declaration->generator) return generate(interpreter, closure, arguments);
+    interpreter->tick(*declaration->name);
+
+    // Parameters take the first slots of the function's scope.
+    auto environment = Environment::create(interpreter->heap, closure,
+        declaration->slots, declaration->escapes);
+    for (int i = 0; i < arguments.size(); ++i) {
+        environment->slot(i) = std::move(arguments[i]);
     }
-    catch (const ReturnValue& returnValue) {
-        return returnValue.value;
+    ScopeGuard guard(interpreter, environment, declaration->escapes);
+    bool returned = compiled != nullptr
+        ? compiled->run(*interpreter)
+        : interpreter->executeBlock(declaration->body.get()).has_value();
+    if (initializer) {
+        interpreter->returnValue.reset();
+        return closure->slot(0);
+    }
+    if (returned) {
+        return std::exchange(interpreter->returnValue, any());
     }
     return any();
 }
 
-}
\ No newline at end of file
+// A generator function's body waits for the generator's first call.
+any LoxFunction::generate(Interpreter* interpreter, Environment* closure,
+    Arguments arguments)
+{
+    auto& heap = interpreter->heap;
+    // Rooted first, so its scope is reachable once it exists.
+    auto generator = heap.make<Generator>(interpreter, declaration, compiled);
+    any result(static_cast<NativeCallable*>(generator));
+    TempRootGuard roots(interpreter);
+    roots.push(&result);
+    auto scope = Environment::create(heap, closure, declaration->slots, true);
+    for (int i = 0; i < arguments.size(); ++i) {
+        scope->slot(i) = std::move(arguments[i]);
+    }
+    generator->start(scope);
+    return result;
+}
+
+}
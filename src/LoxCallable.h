@@ -1,52 +1,88 @@
 #pragma once
 
-#include <chrono>
 #include "Interpreter.h"
 
 namespace lox {
 
+struct CompiledBlock;
+
+// The arguments of a call, a view of the interpreter's value stack. Valid
+// until the call returns; callees may move values out of it.
+class Arguments
+{
+public:
+    Arguments(any* values, size_t count): values(values), count(count) {}
+
+    size_t size() const { return count; }
+    any& operator[](size_t index) const { return values[index]; }
+    any* begin() const { return values; }
+    any* end() const { return values + count; }
+
+private:
+    any* values;
+    size_t count;
+};
+
 class LoxCallable
 {
 public:
     virtual ~LoxCallable() = default;
     virtual int arity() = 0;
-    virtual any call(Interpreter* interpreter, std::vector<any>& arguments) = 0;
+    virtual any call(Interpreter* interpreter, Arguments arguments) = 0;
 };
 
 class NativeCallable: public LoxCallable
 {};
 
-class ClockCallable: public NativeCallable
+// Thrown by a native; reported as a runtime error at the call.
+class NativeError: public std::runtime_error
 {
 public:
-    ~ClockCallable() override = default;
-    int arity() override { return 0; }
-    any call(Interpreter* interpreter, std::vector<any>& arguments) override
-    {
-        auto now = std::chrono::steady_clock::now();
-        auto duration = now.time_since_epoch();
-        auto millis = std::chrono::duration_cast<std::chrono::milliseconds>(
-            duration).count();
-        return (double)millis / 1000.0;
-    }
+    explicit NativeError(const std::string& message):
+        std::runtime_error(message) {}
 };
 
-class LoxFunction: public LoxCallable
+class LoxInstance;
+
+class LoxFunction: public LoxCallable, public Obj
 {
 public:
-    explicit LoxFunction(Function* declaration,
-        std::shared_ptr<Environment> closure)
-        : declaration(declaration), closure(closure) {}
+    // A function declared by compiled code runs its compiled body. The
+    // methods of a class know its declaration.
+    explicit LoxFunction(Function* declaration, Environment* closure,
+        const CompiledBlock* compiled = nullptr, Class* owner = nullptr);
     ~LoxFunction() override = default;
 
     int arity() override;
-    any call(Interpreter* interpreter, std::vector<any>& arguments) override;
+    any call(Interpreter* interpreter, Arguments arguments) override;
+
+    // The method with 'this' bound to self, which must stay reachable.
+    LoxFunction* bind(Interpreter* interpreter, LoxInstance* self);
+    // Calls the method on self without making a bound method first.
+    any invoke(Interpreter* interpreter, LoxInstance* self,
+        Arguments arguments);
+
+    void trace(Heap& heap) override { heap.markObject(closure); }
 
 private:
+    any run(Interpreter* interpreter, Environment* closure,
+        Arguments arguments);
+    any generate(Interpreter* interpreter, Environment* closure,
+        Arguments arguments);
+
     Function* declaration;
-    std::shared_ptr<Environment> closure;
+    Environment* closure;
+    const CompiledBlock* compiled;
+    Class* owner;
+    // An initializer returns 'this', whatever its body returns.
+    bool initializer;
 
     friend class Interpreter;
+    friend class Stackless;
+    friend class FunctionCompiler;
+    friend class PurityCheck;
+    friend class Parallel;
+    friend class Snapshot;
 };
 
 }
\ No newline at end of file
@@ -0,0 +1,81 @@
+#include "LoxClass.h"
+#include <atomic>
+
+namespace lox {
+
+// Shared by every isolate, so that ids stay unique in the process.
+static std::atomic<uint64_t> nextShapeId{1};
+
+Shape::Shape(LoxClass* owner): owner(owner), id(nextShapeId++) {}
+
+int Shape::find(const std::string& name) const
+{
+    auto iter = slots.find(name);
+    return iter != slots.end() ? iter->second : -1;
+}
+
+Shape* Shape::transition(const std::string& name)
+{
+    auto& next = transitions[name];
+    if (next == nullptr) {
+        next = std::make_unique<Shape>(owner);
+        next->slots = slots;
+        next->slots.emplace(name, slots.size());
+    }
+    return next.get();
+}
+
+void LoxInstance::add(Shape* next, const any& value)
+{
+    shape = next;
+    fields.push_back(value);
+}
+
+void LoxInstance::trace(Heap& heap)
+{
+    heap.markObject(shape->owner);
+    for (auto& field : fields) {
+        heap.markValue(field);
+    }
+}
+
+LoxClass::LoxClass(const std::string& name, LoxClass* superclass,
+    std::unordered_map<std::string, LoxFunction*> methods, bool thisEscapes):
+    name(name), superclass(superclass), thisEscapes(thisEscapes),
+    root(this), methods(std::move(methods))
+{
+    initializer = findMethod("init");
+}
+
+int LoxClass::arity()
+{
+    return initializer != nullptr ? initializer->arity() : 0;
+}
+
+any LoxClass::call(Interpreter* interpreter, Arguments arguments)
+{
+    any instance = interpreter->heap.make<LoxInstance>(&root);
+    if (initializer != nullptr) {
+        TempRootGuard roots(interpreter);
+        roots.push(&instance);
+        initializer->invoke(interpreter,
+            std::any_cast<LoxInstance*>(instance), arguments);
+    }
+    return instance;
+}
+
+LoxFunction* LoxClass::findMethod(const std::string& name) const
+{
+    auto iter = methods.find(name);
+    return iter != methods.end() ? iter->second : nullptr;
+}
+
+void LoxClass::trace(Heap& heap)
+{
+    heap.markObject(superclass);
+    for (auto& [name, method] : methods) {
+        heap.markObject(method);
+    }
+}
+
+}
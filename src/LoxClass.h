@@ -0,0 +1,94 @@
+#pragma once
+
+#include "LoxCallable.h"
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace lox {
+
+class LoxClass;
+
+// A hidden class: which fields an instance has and the slot each one
+// lives in. Instances of a class that got the same fields in the same
+// order share one shape, so a property access can remember the shape it
+// saw and skip the lookup when it meets it again.
+//
+// Shapes form a tree rooted at their class. Adding a field moves an
+// instance to a child shape, which is created the first time any
+// instance takes that transition.
+class Shape
+{
+public:
+    explicit Shape(LoxClass* owner);
+    Shape(const Shape&) = delete;
+    Shape& operator=(const Shape&) = delete;
+
+    // The slot of a field, or -1 if instances of this shape have none.
+    int find(const std::string& name) const;
+    // The shape of an instance of this shape that gets the field name.
+    Shape* transition(const std::string& name);
+
+    size_t size() const { return slots.size(); }
+
+    LoxClass* const owner;
+    // Unique over the life of the process, see PropertyCache.
+    const uint64_t id;
+
+private:
+    std::unordered_map<std::string, int> slots;
+    std::unordered_map<std::string, std::unique_ptr<Shape>> transitions;
+
+    friend class Snapshot;
+};
+
+class LoxInstance: public Obj
+{
+public:
+    explicit LoxInstance(Shape* shape): shape(shape) {}
+    ~LoxInstance() override = default;
+
+    // Adds a field that the instance's shape doesn't have.
+    void add(Shape* next, const any& value);
+
+    void trace(Heap& heap) override;
+
+    Shape* shape;
+    // Indexed by the slots of shape.
+    std::vector<any> fields;
+};
+
+class LoxClass: public LoxCallable, public Obj
+{
+public:
+    // Methods include the ones inherited from superclass, so a lookup
+    // never walks the class chain.
+    LoxClass(const std::string& name, LoxClass* superclass,
+        std::unordered_map<std::string, LoxFunction*> methods,
+        bool thisEscapes);
+    ~LoxClass() override = default;
+
+    int arity() override;
+    any call(Interpreter* interpreter, Arguments arguments) override;
+
+    LoxFunction* findMethod(const std::string& name) const;
+
+    void trace(Heap& heap) override;
+
+    const std::string name;
+    LoxClass* const superclass;
+    // Whether a closure in a method can capture the scope binding 'this'.
+    // If not, calling a method can release that scope on return.
+    const bool thisEscapes;
+    // Shape of new instances.
+    Shape root;
+    const std::unordered_map<std::string, LoxFunction*> methods;
+
+private:
+    LoxFunction* initializer;
+
+    friend class Stackless;
+};
+
+}
@@ -0,0 +1,303 @@
+#include "LoxString.h"
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <vector>
+
+namespace lox {
+
+// Open-addressing set of interned strings. The table holds weak
+// references: a string removes itself when its last handle goes away.
+class StringTable
+{
+public:
+    LoxString* find(std::string_view chars, uint32_t hash) const
+    {
+        if (entries.empty()) return nullptr;
+        size_t mask = entries.size() - 1;
+        for (size_t index = hash & mask; ; index = (index + 1) & mask) {
+            LoxString* entry = entries[index];
+            if (entry == nullptr) return nullptr;
+            if (entry != tombstone() && entry->hashCode == hash &&
+                entry->view() == chars) {
+                return entry;
+            }
+        }
+    }
+
+    void insert(LoxString* string)
+    {
+        if ((count + 1) * 4 > entries.size() * 3) grow();
+        LoxString** slot = findSlot(entries, string->hashCode);
+        if (*slot == nullptr) ++count;
+        *slot = string;
+        ++live;
+    }
+
+    void remove(LoxString* string)
+    {
+        size_t mask = entries.size() - 1;
+        for (size_t index = string->hashCode & mask; ;
+             index = (index + 1) & mask) {
+            if (entries[index] == string) {
+                // Keep the probe chain intact for the strings after it.
+                entries[index] = tombstone();
+                --live;
+                return;
+            }
+        }
+    }
+
+private:
+    static LoxString* tombstone()
+    { return reinterpret_cast<LoxString*>(uintptr_t(1)); }
+
+    static LoxString** findSlot(std::vector<LoxString*>& entries,
+        uint32_t hash)
+    {
+        size_t mask = entries.size() - 1;
+        LoxString** firstTombstone = nullptr;
+        for (size_t index = hash & mask; ; index = (index + 1) & mask) {
+            LoxString*& entry = entries[index];
+            if (entry == nullptr) {
+                return firstTombstone != nullptr ? firstTombstone : &entry;
+            }
+            if (entry == tombstone() && firstTombstone == nullptr) {
+                firstTombstone = &entry;
+            }
+        }
+    }
+
+    // Rehashes into a table sized for the live entries, at most half
+    // full, dropping the tombstones. When those are most of the load the
+    // table keeps its size, or even shrinks.
+    void grow()
+    {
+        size_t size = 64;
+        while (size < (live + 1) * 2) size *= 2;
+        std::vector<LoxString*> resized(size, nullptr);
+        count = 0;
+        for (LoxString* entry : entries) {
+            if (entry == nullptr || entry == tombstone()) continue;
+            *findSlot(resized, entry->hashCode) = entry;
+            ++count;
+        }
+        entries.swap(resized);
+    }
+
+    std::vector<LoxString*> entries;
+    // Live entries plus tombstones, the load that matters for probing.
+    size_t count = 0;
+    size_t live = 0;
+};
+
+// One table per thread, since strings never leave the isolate that made
+// them and an isolate runs on one thread. The reference counts aren't
+// atomic for the same reason.
+static StringTable& strings()
+{
+    static thread_local StringTable table;
+    return table;
+}
+
+// Strings are counted per thread for the same reason.
+static thread_local size_t stringBytes = 0;
+
+size_t LoxString::liveBytes()
+{
+    return stringBytes;
+}
+
+uint32_t LoxString::hashChars(std::string_view chars)
+{
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (char c : chars) {
+        hash ^= static_cast<uint8_t>(c);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+LoxString* LoxString::allocate(size_t size)
+{
+    size_t bytes = offsetof(LoxString, data) + size + 1;
+    void* memory = ::operator new(bytes);
+    stringBytes += bytes;
+    auto string = new (memory) LoxString(Kind::FLAT, size, 0, false);
+    static_cast<char*>(memory)[offsetof(LoxString, data) + size] = '\0';
+    return string;
+}
+
+LoxString* LoxString::allocate(std::string_view chars, uint32_t hash,
+    bool interned)
+{
+    auto string = allocate(chars.size());
+    std::memcpy(string->data, chars.data(), chars.size());
+    string->hashCode = hash;
+    string->interned = interned;
+    return string;
+}
+
+LoxString* LoxString::makeRope(LoxString* left, LoxString* right,
+    bool complete)
+{
+    auto string = new (::operator new(sizeof(LoxString))) LoxString(
+        Kind::CONCAT, left->size + right->size, 0, false);
+    stringBytes += sizeof(LoxString);
+    string->rope.left = left;
+    string->rope.right = right;
+    ++left->refCount;
+    ++right->refCount;
+    string->complete = complete;
+    string->depth = std::max(left->depth, right->depth) + 1;
+    return string;
+}
+
+void LoxString::release(LoxString* string)
+{
+    if (--string->refCount != 0) return;
+    if (string->interned) strings().remove(string);
+    if (string->kind == Kind::CONCAT) {
+        release(string->rope.left);
+        release(string->rope.right);
+    }
+    else if (string->kind == Kind::FORWARD) {
+        release(string->rope.left);
+    }
+    stringBytes -= string->kind == Kind::FLAT
+        ? offsetof(LoxString, data) + string->size + 1 : sizeof(LoxString);
+    string->~LoxString();
+    ::operator delete(string);
+}
+
+const LoxString* LoxString::flatten()
+{
+    LoxString* flat = allocate(size);
+
+    // Walk the leaves left to right without recursing, ropes can be deep.
+    char* out = flat->data;
+    std::vector<const LoxString*> pending{this};
+    while (!pending.empty()) {
+        const LoxString* node = pending.back();
+        pending.pop_back();
+        if (node->kind == Kind::CONCAT) {
+            pending.push_back(node->rope.right);
+            pending.push_back(node->rope.left);
+            continue;
+        }
+        auto chars = node->flat()->flatView();
+        std::memcpy(out, chars.data(), chars.size());
+        out += chars.size();
+    }
+    flat->hashCode = hashChars(flat->flatView());
+
+    ++flat->refCount;
+    release(rope.left);
+    release(rope.right);
+    kind = Kind::FORWARD;
+    rope.left = flat;
+    rope.right = nullptr;
+    depth = 0;
+    return flat;
+}
+
+StringRef LoxString::intern(std::string_view chars)
+{
+    uint32_t hash = hashChars(chars);
+    if (auto string = strings().find(chars, hash)) {
+        return StringRef(string);
+    }
+    auto string = allocate(chars, hash, true);
+    strings().insert(string);
+    return StringRef(string);
+}
+
+StringRef LoxString::make(std::string_view chars)
+{
+    if (chars.size() <= kInternLimit) return intern(chars);
+    return StringRef(allocate(chars, hashChars(chars), false));
+}
+
+StringRef LoxString::concatFlat(const LoxString* a, const LoxString* b)
+{
+    size_t length = a->length() + b->length();
+    if (length <= kInternLimit) {
+        char buffer[kInternLimit];
+        std::memcpy(buffer, a->chars(), a->length());
+        std::memcpy(buffer + a->length(), b->chars(), b->length());
+        return intern(std::string_view(buffer, length));
+    }
+
+    auto string = allocate(length);
+    std::memcpy(string->data, a->chars(), a->length());
+    std::memcpy(string->data + a->length(), b->chars(), b->length());
+    string->hashCode = hashChars(string->flatView());
+    return StringRef(string);
+}
+
+// Appends a complete unit to a spine. Like carrying in a binary counter,
+// trailing units that are no deeper than the new one are merged into it
+// first, so the spine stays logarithmic and each append allocates O(1)
+// nodes amortized.
+StringRef LoxString::carry(StringRef spine, StringRef unit)
+{
+    while (true) {
+        LoxString* node = spine.get();
+        if (node->kind == Kind::CONCAT && !node->complete &&
+            node->rope.right->isComplete() &&
+            node->rope.right->depth <= unit->depth) {
+            unit = StringRef(makeRope(node->rope.right, unit.get(), true));
+            spine = StringRef(node->rope.left);
+            continue;
+        }
+        bool complete = node->isComplete() && node->depth <= unit->depth;
+        return StringRef(makeRope(node, unit.get(), complete));
+    }
+}
+
+StringRef LoxString::concat(const LoxString* left, const LoxString* right)
+{
+    auto a = const_cast<LoxString*>(left);
+    auto b = const_cast<LoxString*>(right);
+    if (a->size == 0) return StringRef(b);
+    if (b->size == 0) return StringRef(a);
+    // Every rope is longer than kRopeChunk, so both sides are flat here.
+    if (a->size + b->size <= kRopeChunk) return concatFlat(a, b);
+
+    StringRef result;
+    if (b->kind != Kind::CONCAT && b->size < kRopeChunk) {
+        // A short piece goes into the open leaf at the end of the spine
+        // while it fits; once full, that leaf is carried into the spine.
+        StringRef spine(a);
+        if (a->kind == Kind::CONCAT && !a->complete &&
+            a->rope.right->kind != Kind::CONCAT) {
+            LoxString* tail = a->rope.right;
+            if (tail->size + b->size <= kRopeChunk) {
+                auto grown = concatFlat(tail, b);
+                return StringRef(makeRope(a->rope.left, grown.get(), false));
+            }
+            spine = carry(StringRef(a->rope.left), StringRef(tail));
+        }
+        result = StringRef(makeRope(spine.get(), b, false));
+    }
+    else if (b->isComplete()) {
+        result = carry(StringRef(a), StringRef(b));
+    }
+    else {
+        result = StringRef(makeRope(a, b, false));
+    }
+
+    if (result->depth > kMaxRopeDepth) result->flatten();
+    return result;
+}
+
+bool operator==(const StringRef& a, const StringRef& b)
+{
+    if (a.get() == b.get()) return true;
+    if (a->isInterned() && b->isInterned()) return false;
+    if (a->length() != b->length()) return false;
+    return a->hash() == b->hash() && a.view() == b.view();
+}
+
+}
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <utility>
+
+namespace lox {
+
+class StringRef;
+
+// Immutable, reference-counted string object. The runtime never copies
+// the characters once a string exists; values hold a StringRef handle.
+// Literals and short strings are interned, so two interned strings are
+// equal if and only if they are the same object.
+//
+// Strings belong to the thread that made them, see Isolate.
+//
+// Concatenation builds a rope: a CONCAT node only references its two
+// halves and is flattened lazily, the first time its characters or hash
+// are needed (printing, equality) or when it grows past kMaxRopeDepth.
+class LoxString
+{
+public:
+    // Strings up to this length are always interned.
+    static constexpr size_t kInternLimit = 32;
+    // Adjacent pieces shorter than this are copied into one flat leaf.
+    static constexpr size_t kRopeChunk = 128;
+    static constexpr uint16_t kMaxRopeDepth = 96;
+
+    static StringRef make(std::string_view chars);
+    static StringRef intern(std::string_view chars);
+    static StringRef concat(const LoxString* a, const LoxString* b);
+
+    size_t length() const { return size; }
+    uint32_t hash() const { return flat()->hashCode; }
+    bool isInterned() const { return interned; }
+    bool isRope() const { return kind != Kind::FLAT; }
+    uint16_t ropeDepth() const { return depth; }
+    const char* chars() const { return flat()->data; }
+    std::string_view view() const { return flat()->flatView(); }
+
+    static uint32_t hashChars(std::string_view chars);
+    // Bytes of the strings alive on the calling thread.
+    static size_t liveBytes();
+
+private:
+    enum class Kind : uint8_t
+    {
+        FLAT,
+        CONCAT,
+        // A CONCAT that has been flattened; rope.left is the flat copy.
+        FORWARD
+    };
+
+    struct Rope
+    {
+        LoxString* left;
+        LoxString* right;
+    };
+
+    LoxString(Kind kind, size_t size, uint32_t hash, bool interned):
+        size(size), hashCode(hash), kind(kind), interned(interned) {}
+    LoxString(const LoxString&) = delete;
+    LoxString& operator=(const LoxString&) = delete;
+
+    static LoxString* allocate(size_t size);
+    static LoxString* allocate(std::string_view chars, uint32_t hash,
+        bool interned);
+    static LoxString* makeRope(LoxString* left, LoxString* right,
+        bool complete);
+    static StringRef concatFlat(const LoxString* a, const LoxString* b);
+    static StringRef carry(StringRef spine, StringRef unit);
+    static void release(LoxString* string);
+
+    bool isComplete() const { return kind != Kind::CONCAT || complete; }
+
+    const LoxString* flat() const
+    {
+        if (kind == Kind::FLAT) return this;
+        if (kind == Kind::FORWARD) return rope.left;
+        return const_cast<LoxString*>(this)->flatten();
+    }
+    const LoxString* flatten();
+    std::string_view flatView() const
+    { return std::string_view(data, size); }
+
+    uint32_t refCount = 0;
+    size_t size;
+    uint32_t hashCode;
+    Kind kind;
+    bool interned;
+    // Set on CONCAT nodes that will never be restructured by an append.
+    bool complete = false;
+    uint16_t depth = 0;
+    union
+    {
+        Rope rope;
+        // Characters of a FLAT string follow the header in the same
+        // allocation, NUL-terminated.
+        char data[sizeof(Rope)];
+    };
+
+    friend class StringRef;
+    friend class StringTable;
+};
+
+// Intrusive handle to a LoxString. Copying a handle only touches the
+// reference count, so it fits in std::any's small-object storage.
+class StringRef
+{
+public:
+    StringRef() = default;
+    explicit StringRef(LoxString* string): string(string) { retain(); }
+    StringRef(const StringRef& other): string(other.string) { retain(); }
+    StringRef(StringRef&& other) noexcept: string(other.string)
+    { other.string = nullptr; }
+    ~StringRef() { if (string) LoxString::release(string); }
+
+    StringRef& operator=(const StringRef& other)
+    {
+        StringRef(other).swap(*this);
+        return *this;
+    }
+    StringRef& operator=(StringRef&& other) noexcept
+    {
+        StringRef(std::move(other)).swap(*this);
+        return *this;
+    }
+
+    void swap(StringRef& other) noexcept { std::swap(string, other.string); }
+
+    LoxString* get() const { return string; }
+    LoxString* operator->() const { return string; }
+    std::string_view view() const { return string->view(); }
+    std::string str() const { return std::string(view()); }
+
+private:
+    void retain() { if (string) ++string->refCount; }
+
+    LoxString* string = nullptr;
+};
+
+bool operator==(const StringRef& a, const StringRef& b);
+inline bool operator!=(const StringRef& a, const StringRef& b)
+{ return !(a == b); }
+
+}
@@ -0,0 +1,163 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <fmt/format.h>
+#include "LoxCallable.h"
+#include "LoxString.h"
+
+namespace lox {
+
+// Conversions between Lox values and the C++ types a native can take or
+// return. Unsupported types fail to compile.
+template <typename T, typename Enable = void>
+struct NativeType;
+
+template <typename T>
+struct NativeType<T, std::enable_if_t<std::is_arithmetic_v<T> &&
+    !std::is_same_v<T, bool>>>
+{
+    static constexpr const char* name = "number";
+    static bool is(const any& value)
+    { return std::any_cast<double>(&value) != nullptr; }
+    static T from(const any& value)
+    { return static_cast<T>(*std::any_cast<double>(&value)); }
+    static any to(T value) { return static_cast<double>(value); }
+};
+
+template <>
+struct NativeType<bool>
+{
+    static constexpr const char* name = "boolean";
+    static bool is(const any& value)
+    { return std::any_cast<bool>(&value) != nullptr; }
+    static bool from(const any& value) { return *std::any_cast<bool>(&value); }
+    static any to(bool value) { return value; }
+};
+
+template <>
+struct NativeType<StringRef>
+{
+    static constexpr const char* name = "string";
+    static bool is(const any& value)
+    { return std::any_cast<StringRef>(&value) != nullptr; }
+    static const StringRef& from(const any& value)
+    { return *std::any_cast<StringRef>(&value); }
+    static any to(StringRef value) { return value; }
+};
+
+// Views stay valid for the call, the argument lives on the value stack.
+template <>
+struct NativeType<std::string_view>
+{
+    static constexpr const char* name = "string";
+    static bool is(const any& value) { return NativeType<StringRef>::is(value); }
+    static std::string_view from(const any& value)
+    { return std::any_cast<StringRef>(&value)->view(); }
+    static any to(std::string_view value) { return LoxString::make(value); }
+};
+
+template <>
+struct NativeType<std::string>
+{
+    static constexpr const char* name = "string";
+    static bool is(const any& value) { return NativeType<StringRef>::is(value); }
+    static std::string from(const any& value)
+    { return std::any_cast<StringRef>(&value)->str(); }
+    static any to(const std::string& value) { return LoxString::make(value); }
+};
+
+// Any value at all, unchecked.
+template <>
+struct NativeType<any>
+{
+    static constexpr const char* name = "value";
+    static bool is(const any&) { return true; }
+    static const any& from(const any& value) { return value; }
+    static any to(any value) { return value; }
+};
+
+// Splits a function pointer or lambda type into its signature.
+template <typename Fn>
+struct NativeSignature: NativeSignature<decltype(&Fn::operator())> {};
+
+template <typename R, typename... Args>
+struct NativeSignature<R (*)(Args...)>
+{
+    using Result = R;
+    using Params = std::tuple<std::decay_t<Args>...>;
+};
+
+template <typename C, typename R, typename... Args>
+struct NativeSignature<R (C::*)(Args...) const>: NativeSignature<R (*)(Args...)> {};
+
+template <typename C, typename R, typename... Args>
+struct NativeSignature<R (C::*)(Args...)>: NativeSignature<R (*)(Args...)> {};
+
+// A C++ function exposed to Lox. Arity, argument checks and conversions
+// are all generated from the function's signature, and the function is
+// called directly with the converted arguments.
+template <typename Fn>
+class TypedNative final: public NativeCallable
+{
+    using Signature = NativeSignature<Fn>;
+    using Params = typename Signature::Params;
+    static constexpr size_t kArity = std::tuple_size_v<Params>;
+
+public:
+    TypedNative(std::string name, Fn fn): name(std::move(name)), fn(fn) {}
+
+    int arity() override { return kArity; }
+
+    any call(Interpreter* interpreter, Arguments arguments) override
+    {
+        return invoke(arguments, std::make_index_sequence<kArity>());
+    }
+
+private:
+    template <size_t... I>
+    any invoke(Arguments& arguments, std::index_sequence<I...>)
+    {
+        (check<I>(arguments[I]), ...);
+        using R = typename Signature::Result;
+        if constexpr (std::is_void_v<R>) {
+            fn(NativeType<std::tuple_element_t<I, Params>>::from(
+                arguments[I])...);
+            return nullptr;
+        }
+        else {
+            return NativeType<std::decay_t<R>>::to(
+                fn(NativeType<std::tuple_element_t<I, Params>>::from(
+                    arguments[I])...));
+        }
+    }
+
+    template <size_t I>
+    void check(const any& value)
+    {
+        using Type = NativeType<std::tuple_element_t<I, Params>>;
+        if (Type::is(value)) return;
+        throw NativeError(fmt::format("Argument {} to '{}' must be a {}.",
+            I + 1, name, Type::name));
+    }
+
+    std::string name;
+    Fn fn;
+};
+
+// Defines a global function backed by fn, which may be a function pointer
+// or a lambda:
+//
+//     registerNative(interpreter, "sqrt", [](double x) { return std::sqrt(x); });
+template <typename Fn>
+void registerNative(Interpreter& interpreter, const std::string& name, Fn fn)
+{
+    interpreter.defineNative(name,
+        std::make_unique<TypedNative<Fn>>(name, std::move(fn)));
+}
+
+}
@@ -0,0 +1,633 @@
+#include "Parallel.h"
+#include "Channel.h"
+#include "Lox.h"
+#include "Native.h"
+#include "Vm.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <deque>
+#include <limits>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace lox {
+
+using Message = Channel::Message;
+
+// Indices are split into at most this many chunks of equal size. Chunk
+// bounds depend only on the range, so a reduction adds up the same partial
+// sums in the same order whatever the number of threads.
+static constexpr size_t kMaxChunks = 256;
+
+// Larger counts are refused before anything is converted or allocated:
+// beyond this a map would not fit in memory, and a count above SIZE_MAX
+// can't be converted at all.
+static constexpr size_t kMaxCount = size_t(1) << 32;
+
+// Proves that a function can run on another thread, in any order with
+// other calls of it, without anyone telling the difference: it doesn't
+// print, assign to or capture variables outside itself, use classes or
+// call natives other than sqrt. Global functions it uses are checked the
+// same way, and the global values it reads are collected so that the
+// workers can have copies.
+class PurityCheck: public ExprVisitor, public StmtVisitor
+{
+public:
+    PurityCheck(const std::string& native, const GlobalEnvironment& globals,
+        NativeCallable* sqrt):
+        native(native), globals(globals), sqrt(sqrt) {}
+    ~PurityCheck() override = default;
+
+    // Throws a NativeError saying why if function isn't pure.
+    void check(LoxFunction* function);
+
+    any visitAssignExpr(Assign* expr) override;
+    any visitBinaryExpr(Binary* expr) override;
+    any visitCallExpr(Call* expr) override;
+    any visitGetExpr(Get* expr) override;
+    any visitGroupingExpr(Grouping* expr) override;
+    any visitLiteralExpr(Literal* expr) override;
+    any visitLogicalExpr(Logical* expr) override;
+    any visitSetExpr(Set* expr) override;
+    any visitSuperExpr(Super* expr) override;
+    any visitThisExpr(This* expr) override;
+    any visitUnaryExpr(Unary* expr) override;
+    any visitVarExprExpr(VarExpr* expr) override;
+
+    any visitBlockStmt(Block* stmt) override;
+    any visitExpressionStmt(Expression* stmt) override;
+    any visitFunctionStmt(Function* stmt) override;
+    any visitClassStmt(Class* stmt) override;
+    any visitIfStmt(If* stmt) override;
+    any visitPrintStmt(Print* stmt) override;
+    any visitReturnStmt(Return* stmt) override;
+    any visitVarStmtStmt(VarStmt* stmt) override;
+    any visitWhileStmt(While* stmt) override;
+    any visitYieldStmt(Yield* stmt) override;
+
+    // The globals the function uses, by the names it uses them under.
+    std::vector<std::pair<std::string, Function*>> functions;
+    std::vector<std::pair<std::string, Message>> values;
+    // Names bound to sqrt.
+    std::vector<std::string> natives;
+
+private:
+    void checkBody(Function* declaration);
+    void checkGlobal(const std::string& name);
+    [[noreturn]] void reject(const std::string& reason);
+
+    const std::string& native;
+    const GlobalEnvironment& globals;
+    NativeCallable* sqrt;
+    // Scopes of the function being checked that enclose the node.
+    int scopes = 0;
+    std::unordered_set<std::string> seen;
+};
+
+void PurityCheck::check(LoxFunction* function)
+{
+    if (function->owner != nullptr) reject("use classes");
+    checkBody(function->declaration);
+}
+
+void PurityCheck::checkBody(Function* declaration)
+{
+    int enclosing = std::exchange(scopes, 1);
+    for (auto& statement : *declaration->body) {
+        statement->accept(this);
+    }
+    scopes = enclosing;
+}
+
+void PurityCheck::checkGlobal(const std::string& name)
+{
+    if (!seen.insert(name).second) return;
+    auto& entries = globals.entries();
+    auto entry = entries.find(name);
+    // Then it is undefined on the workers too.
+    if (entry == entries.end()) return;
+
+    auto& value = entry->second;
+    if (auto function = std::any_cast<LoxFunction*>(&value)) {
+        if ((*function)->owner != nullptr) reject("use classes");
+        functions.emplace_back(name, (*function)->declaration);
+        checkBody((*function)->declaration);
+    }
+    else if (auto callable = std::any_cast<NativeCallable*>(&value)) {
+        if (*callable != sqrt) reject(fmt::format("use '{}'", name));
+        natives.push_back(name);
+    }
+    else {
+        try {
+            values.emplace_back(name, Channel::copyOut(value));
+        }
+        catch (const NativeError&) {
+            reject(fmt::format("use '{}'", name));
+        }
+    }
+}
+
+void PurityCheck::reject(const std::string& reason)
+{
+    throw NativeError(fmt::format("Function passed to '{}' must not {}.",
+        native, reason));
+}
+
+any PurityCheck::visitAssignExpr(Assign* expr)
+{
+    expr->value->accept(this);
+    if (expr->depth < 0 || expr->depth >= scopes) {
+        reject(fmt::format("assign to '{}'", expr->name->lexeme));
+    }
+    return any();
+}
+
+any PurityCheck::visitBinaryExpr(Binary* expr)
+{
+    expr->left->accept(this);
+    expr->right->accept(this);
+    return any();
+}
+
+any PurityCheck::visitCallExpr(Call* expr)
+{
+    expr->callee->accept(this);
+    for (auto& argument : *expr->arguments) {
+        argument->accept(this);
+    }
+    return any();
+}
+
+any PurityCheck::visitGetExpr(Get* expr)
+{
+    reject("use classes");
+}
+
+any PurityCheck::visitGroupingExpr(Grouping* expr)
+{
+    return expr->expression->accept(this);
+}
+
+any PurityCheck::visitLiteralExpr(Literal* expr)
+{
+    return any();
+}
+
+any PurityCheck::visitLogicalExpr(Logical* expr)
+{
+    expr->left->accept(this);
+    expr->right->accept(this);
+    return any();
+}
+
+any PurityCheck::visitSetExpr(Set* expr)
+{
+    reject("use classes");
+}
+
+any PurityCheck::visitSuperExpr(Super* expr)
+{
+    reject("use classes");
+}
+
+any PurityCheck::visitThisExpr(This* expr)
+{
+    reject("use classes");
+}
+
+any PurityCheck::visitUnaryExpr(Unary* expr)
+{
+    return expr->right->accept(this);
+}
+
+any PurityCheck::visitVarExprExpr(VarExpr* expr)
+{
+    if (expr->depth < 0) {
+        checkGlobal(expr->name->lexeme);
+    }
+    else if (expr->depth >= scopes) {
+        reject(fmt::format("capture '{}'", expr->name->lexeme));
+    }
+    return any();
+}
+
+any PurityCheck::visitBlockStmt(Block* stmt)
+{
+    ++scopes;
+    for (auto& statement : *stmt->statements) {
+        statement->accept(this);
+    }
+    --scopes;
+    return any();
+}
+
+any PurityCheck::visitExpressionStmt(Expression* stmt)
+{
+    return stmt->expr->accept(this);
+}
+
+any PurityCheck::visitFunctionStmt(Function* stmt)
+{
+    ++scopes;
+    for (auto& statement : *stmt->body) {
+        statement->accept(this);
+    }
+    --scopes;
+    return any();
+}
+
+any PurityCheck::visitClassStmt(Class* stmt)
+{
+    reject("use classes");
+}
+
+any PurityCheck::visitIfStmt(If* stmt)
+{
+    stmt->condition->accept(this);
+    stmt->thenBranch->accept(this);
+    if (stmt->elseBranch != nullptr) stmt->elseBranch->accept(this);
+    return any();
+}
+
+any PurityCheck::visitPrintStmt(Print* stmt)
+{
+    reject("print");
+}
+
+any PurityCheck::visitReturnStmt(Return* stmt)
+{
+    if (stmt->value != nullptr) stmt->value->accept(this);
+    return any();
+}
+
+any PurityCheck::visitVarStmtStmt(VarStmt* stmt)
+{
+    if (stmt->initializer != nullptr) stmt->initializer->accept(this);
+    return any();
+}
+
+any PurityCheck::visitWhileStmt(While* stmt)
+{
+    stmt->condition->accept(this);
+    stmt->body->accept(this);
+    return any();
+}
+
+any PurityCheck::visitYieldStmt(Yield* stmt)
+{
+    reject("yield");
+}
+
+// Adds value to sum the way + does.
+static void accumulate(Message& sum, const Message& value)
+{
+    if (auto a = std::get_if<double>(&sum)) {
+        if (auto b = std::get_if<double>(&value)) {
+            *a += *b;
+            return;
+        }
+    }
+    else if (auto a = std::get_if<std::string>(&sum)) {
+        if (auto b = std::get_if<std::string>(&value)) {
+            *a += *b;
+            return;
+        }
+    }
+    throw NativeError("Operands must be two numbers or two strings.");
+}
+
+// What parallelMap returns: a native that takes an index and returns the
+// result for it. Unlike other natives it lives on the heap.
+class MapResults: public NativeCallable, public Obj
+{
+public:
+    explicit MapResults(std::vector<any> values): values(std::move(values)) {}
+    ~MapResults() override = default;
+
+    int arity() override { return 1; }
+
+    any call(Interpreter* interpreter, Arguments arguments) override
+    {
+        auto index = std::any_cast<double>(&arguments[0]);
+        if (index == nullptr || *index < 0 || *index >= values.size()
+            || *index != std::floor(*index)) {
+            throw NativeError("Index out of range.");
+        }
+        return values[size_t(*index)];
+    }
+
+    // Results are never objects.
+    void trace(Heap& heap) override {}
+
+private:
+    std::vector<any> values;
+};
+
+// One call of parallelMap or parallelReduce. Each worker has an
+// interpreter of its own, with copies of the literals and of the globals
+// the function uses, and runs the chunks in its own queue first. Once
+// that is empty it steals from the back of the others'.
+class Parallel
+{
+public:
+    static void registerNatives(Interpreter& interpreter,
+        const Options& options);
+
+    Parallel(Interpreter& interpreter, PurityCheck& check, Function* function,
+        size_t count, bool reduce);
+
+    // Returns one result per index, or one sum per chunk if reducing.
+    std::vector<Message> run(size_t threads, const GcOptions& gcOptions);
+
+private:
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<size_t> chunks;
+    };
+
+    static LoxFunction* functionArgument(const std::string& native,
+        const any& value);
+    static size_t countArgument(const std::string& native, int position,
+        double count);
+
+    bool next(size_t worker, size_t& chunk);
+    void work(size_t worker, const GcOptions& gcOptions);
+    void runChunk(Interpreter& interpreter, LoxFunction* function,
+        size_t chunk);
+    // line is zero for errors that aren't in the function's code.
+    void fail(size_t chunk, const std::string& message, int line);
+
+    Interpreter& caller;
+    PurityCheck& check;
+    Function* function;
+    size_t count;
+    bool reduce;
+    size_t chunkSize;
+    size_t chunks;
+    std::vector<Message> literals;
+    std::vector<Message> results;
+    std::vector<Queue> queues;
+
+    // The first failing chunk. Later ones are skipped, earlier ones still
+    // run, so the error reported is the one a loop would have hit.
+    std::atomic<size_t> failed{std::numeric_limits<size_t>::max()};
+    std::mutex failureMutex;
+    std::string failure;
+    int failureLine = 0;
+};
+
+Parallel::Parallel(Interpreter& interpreter, PurityCheck& check,
+    Function* function, size_t count, bool reduce):
+    caller(interpreter), check(check), function(function), count(count),
+    reduce(reduce)
+{
+    chunkSize = std::max<size_t>(1, (count + kMaxChunks - 1) / kMaxChunks);
+    chunks = (count + chunkSize - 1) / chunkSize;
+    auto& constants = interpreter.constantPool();
+    for (size_t i = 0; i < constants.size(); ++i) {
+        literals.push_back(Channel::copyOut(constants.at(i)));
+    }
+    results.resize(reduce ? chunks : count);
+}
+
+std::vector<Message> Parallel::run(size_t threads, const GcOptions& gcOptions)
+{
+    threads = std::max<size_t>(1, std::min(threads, chunks));
+    // Contiguous runs of chunks, so that workers start far apart.
+    queues = std::vector<Queue>(threads);
+    for (size_t chunk = 0; chunk < chunks; ++chunk) {
+        queues[chunk * threads / chunks].chunks.push_back(chunk);
+    }
+
+    std::vector<std::thread> workers;
+    for (size_t worker = 0; worker < threads; ++worker) {
+        workers.emplace_back(&Parallel::work, this, worker,
+            std::cref(gcOptions));
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    // The workers have stopped for it, and now so does the caller.
+    if (auto reason = caller.takeCancel()) throw NativeError(reason);
+
+    if (failed != std::numeric_limits<size_t>::max()) {
+        if (failureLine == 0) throw NativeError(failure);
+        throw RuntimeError(Token(TokenType::IDENTIFIER, "", any(),
+            failureLine), failure);
+    }
+    return std::move(results);
+}
+
+bool Parallel::next(size_t worker, size_t& chunk)
+{
+    for (size_t i = 0; i < queues.size(); ++i) {
+        auto& queue = queues[(worker + i) % queues.size()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.chunks.empty()) continue;
+        if (i == 0) {
+            chunk = queue.chunks.front();
+            queue.chunks.pop_front();
+        }
+        else {
+            chunk = queue.chunks.back();
+            queue.chunks.pop_back();
+        }
+        return true;
+    }
+    return false;
+}
+
+void Parallel::work(size_t worker, const GcOptions& gcOptions)
+{
+    Interpreter interpreter(gcOptions);
+    interpreter.skipCallCaches();
+    // Each worker gets the caller's limits, and the caller's cancel(), from
+    // a timeout or an embedder, stops all of them.
+    interpreter.useLimits(caller.limits);
+    interpreter.parent = &caller;
+    // Literals keep their indices, which the nodes refer to.
+    for (auto& literal : literals) {
+        interpreter.constantPool().add(Channel::copyIn(literal));
+    }
+    auto globals = interpreter.globals;
+    auto sqrt = globals->entries().at("sqrt");
+    for (auto& name : check.natives) {
+        globals->define(name, sqrt);
+    }
+    for (auto& [name, value] : check.values) {
+        globals->define(name, Channel::copyIn(value));
+    }
+    for (auto& [name, declaration] : check.functions) {
+        globals->define(name,
+            interpreter.heap.make<LoxFunction>(declaration, globals));
+    }
+    any callee = interpreter.heap.make<LoxFunction>(function, globals);
+    TempRootGuard roots(&interpreter);
+    roots.push(&callee);
+
+    size_t chunk;
+    while (next(worker, chunk)) {
+        if (chunk > failed) continue;
+        try {
+            runChunk(interpreter, std::any_cast<LoxFunction*>(callee), chunk);
+        }
+        catch (const RuntimeError& error) {
+            fail(chunk, error.what(), error.token.line);
+        }
+        catch (const NativeError& error) {
+            fail(chunk, error.what(), 0);
+        }
+        catch (const std::bad_alloc&) {
+            fail(chunk, "Out of memory.", 0);
+        }
+    }
+}
+
+void Parallel::runChunk(Interpreter& interpreter, LoxFunction* function,
+    size_t chunk)
+{
+    size_t begin = chunk * chunkSize;
+    size_t end = std::min(count, begin + chunkSize);
+    for (size_t index = begin; index < end; ++index) {
+        any argument = double(index);
+        auto value = function->call(&interpreter, Arguments(&argument, 1));
+        if (!value.has_value()) value = nullptr;
+        Message result;
+        try {
+            result = Channel::copyOut(value);
+        }
+        catch (const NativeError&) {
+            throw NativeError(fmt::format("Function passed to '{}' must "
+                "return nil, a boolean, a number or a string.",
+                reduce ? "parallelReduce" : "parallelMap"));
+        }
+        if (!reduce) {
+            results[index] = std::move(result);
+        }
+        else if (index == begin) {
+            results[chunk] = std::move(result);
+        }
+        else {
+            accumulate(results[chunk], result);
+        }
+    }
+}
+
+void Parallel::fail(size_t chunk, const std::string& message, int line)
+{
+    std::lock_guard<std::mutex> lock(failureMutex);
+    if (chunk >= failed) return;
+    failed = chunk;
+    failure = message;
+    failureLine = line;
+}
+
+LoxFunction* Parallel::functionArgument(const std::string& native,
+    const any& value)
+{
+    if (std::any_cast<Closure*>(&value)) {
+        throw NativeError(fmt::format(
+            "'{}' is not supported by the bytecode engine.", native));
+    }
+    auto function = std::any_cast<LoxFunction*>(&value);
+    if (function == nullptr) {
+        throw NativeError(fmt::format(
+            "Argument 1 to '{}' must be a function.", native));
+    }
+    if ((*function)->arity() != 1) {
+        throw NativeError(fmt::format(
+            "Function passed to '{}' must take one argument.", native));
+    }
+    return *function;
+}
+
+size_t Parallel::countArgument(const std::string& native, int position,
+    double count)
+{
+    if (count < 0 || count != std::floor(count)) {
+        throw NativeError(fmt::format(
+            "Argument {} to '{}' must be a whole number.", position, native));
+    }
+    if (count > double(kMaxCount)) {
+        throw NativeError(fmt::format("Argument {} to '{}' must be at most "
+            "{}.", position, native, kMaxCount));
+    }
+    return size_t(count);
+}
+
+void Parallel::registerNatives(Interpreter& interpreter,
+    const Options& options)
+{
+    size_t threads = options.threads > 0 ? options.threads
+        : std::max(1u, std::thread::hardware_concurrency());
+    auto sqrt = *std::any_cast<NativeCallable*>(
+        &interpreter.globals->entries().at("sqrt"));
+    auto gc = options.gc;
+
+    registerNative(interpreter, "parallelMap",
+        [&interpreter, threads, sqrt, gc](const any& f, double n) -> any {
+            static const std::string name = "parallelMap";
+            auto function = functionArgument(name, f);
+            auto count = countArgument(name, 2, n);
+            PurityCheck check(name, *interpreter.globals, sqrt);
+            check.check(function);
+
+            // A count within kMaxCount can still be more than fits.
+            try {
+                Parallel parallel(interpreter, check, function->declaration,
+                    count, false);
+                std::vector<any> values;
+                for (auto& result : parallel.run(threads, gc)) {
+                    values.push_back(Channel::copyIn(result));
+                }
+                NativeCallable* results =
+                    interpreter.heap.make<MapResults>(std::move(values));
+                return results;
+            }
+            catch (const std::bad_alloc&) {
+                throw NativeError("Out of memory.");
+            }
+        });
+
+    registerNative(interpreter, "parallelReduce",
+        [&interpreter, threads, sqrt, gc](const any& f, const any& init,
+            double n) -> any {
+            static const std::string name = "parallelReduce";
+            auto function = functionArgument(name, f);
+            if (!std::any_cast<double>(&init)
+                && !std::any_cast<StringRef>(&init)) {
+                throw NativeError("Argument 2 to 'parallelReduce' must be "
+                    "a number or a string.");
+            }
+            auto count = countArgument(name, 3, n);
+            PurityCheck check(name, *interpreter.globals, sqrt);
+            check.check(function);
+
+            try {
+                Parallel parallel(interpreter, check, function->declaration,
+                    count, true);
+                // Chunk sums are added in index order on this thread.
+                auto sum = Channel::copyOut(init);
+                for (auto& partial : parallel.run(threads, gc)) {
+                    accumulate(sum, partial);
+                }
+                return Channel::copyIn(sum);
+            }
+            catch (const std::bad_alloc&) {
+                throw NativeError("Out of memory.");
+            }
+        });
+}
+
+void registerParallelNatives(Interpreter& interpreter, const Options& options)
+{
+    Parallel::registerNatives(interpreter, options);
+}
+
+}
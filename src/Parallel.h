@@ -0,0 +1,20 @@
+#pragma once
+
+namespace lox {
+
+class Interpreter;
+struct Options;
+
+// Defines the natives parallelMap(f, n) and parallelReduce(f, init, n),
+// which call a function without side effects on every index below n on a
+// pool of worker threads:
+//
+//     fun square(i) { return i * i; }
+//     var squares = parallelMap(square, 1000);
+//     print squares(12);                          // 144
+//     print parallelReduce(square, 0, 1000);      // 0 + square(0) + ...
+//
+// Results are the same for any number of threads, options.threads.
+void registerParallelNatives(Interpreter& interpreter, const Options& options);
+
+}
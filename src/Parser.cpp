@@ -1,6 +1,7 @@
 #include "Parser.h"
 #include "Lox.h"
 #include <fmt/format.h>
+#include <utility>
 
 namespace lox {
 
@@ -70,6 +71,7 @@ void Parser::synchronize()
             case TokenType::WHILE:
             case TokenType::PRINT:
             case TokenType::RETURN:
+            case TokenType::YIELD:
                 return;
             default:
                 break;
@@ -82,6 +84,7 @@ void Parser::synchronize()
 std::unique_ptr<Stmt> Parser::declaration()
 {
     try {
+        if (match({TokenType::CLASS})) return classDeclaration();
         if (match({TokenType::FUN})) return function("function");
         if (match({TokenType::VAR})) return varDeclaration();
         return statement();
@@ -92,6 +95,28 @@ std::unique_ptr<Stmt> Parser::declaration()
     }
 }
 
+std::unique_ptr<Stmt> Parser::classDeclaration()
+{
+    auto name = consume(TokenType::IDENTIFIER, "Expect class name.");
+
+    std::unique_ptr<VarExpr> superclass;
+    if (match({TokenType::LESS})) {
+        consume(TokenType::IDENTIFIER, "Expect superclass name.");
+        superclass = std::make_unique<VarExpr>(
+            std::make_unique<Token>(previous()));
+    }
+
+    consume(TokenType::LEFT_BRACE, "Expect '{' before class body.");
+    auto methods = std::make_unique<vector<unique_ptr<Function>>>();
+    while (!check(TokenType::RIGHT_BRACE) && !isAtEnd()) {
+        methods->push_back(function("method"));
+    }
+    consume(TokenType::RIGHT_BRACE, "Expect '}' after class body.");
+
+    return std::make_unique<Class>(std::make_unique<Token>(name),
+        std::move(superclass), std::move(methods));
+}
+
 std::unique_ptr<Stmt> Parser::varDeclaration()
 {
     auto name = consume(TokenType::IDENTIFIER, "Expect variable name.");
@@ -113,6 +138,7 @@ std::unique_ptr<Stmt> Parser::statement()
     if (match({TokenType::PRINT})) return printStatement();
     if (match({TokenType::RETURN})) return returnStatement();
     if (match({TokenType::WHILE})) return whileStatement();
+    if (match({TokenType::YIELD})) return yieldStatement();
     if (match({TokenType::LEFT_BRACE})) {
         return std::make_unique<Block>(block());
     }
@@ -121,6 +147,7 @@ std::unique_ptr<Stmt> Parser::statement()
 
 std::unique_ptr<Stmt> Parser::forStatement()
 {
+    auto keyword = std::make_unique<Token>(previous());
     consume(TokenType::LEFT_PAREN, "Expect '(' after 'for'.");
     std::unique_ptr<Stmt> initializer;
     if (match({TokenType::SEMICOLON})) {
@@ -157,11 +184,10 @@ std::unique_ptr<Stmt> Parser::forStatement()
     }
 
     if (condition == nullptr) {
-        auto trueToken = std::make_unique<Token>(
-            TokenType::TRUE, "true", true, 0);
-        condition = std::make_unique<Literal>(std::move(trueToken));
+        condition = literal(Token(TokenType::TRUE, "true", true, 0));
     }
-    body = std::make_unique<While>(std::move(condition), std::move(body));
+    body = std::make_unique<While>(std::move(keyword), std::move(condition),
+        std::move(body));
 
     if (initializer != nullptr) {
         auto statements = std::make_unique<vector<unique_ptr<Stmt>>>();
@@ -210,12 +236,23 @@ std::unique_ptr<Stmt> Parser::returnStatement()
 
 std::unique_ptr<Stmt> Parser::whileStatement()
 {
+    auto keyword = std::make_unique<Token>(previous());
     consume(TokenType::LEFT_PAREN, "Expect '(' after 'while'.");
     auto condition = expression();
     consume(TokenType::RIGHT_PAREN, "Expect ')' after condition.");
     auto body = statement();
 
-    return std::make_unique<While>(std::move(condition), std::move(body));
+    return std::make_unique<While>(std::move(keyword), std::move(condition),
+        std::move(body));
+}
+
+std::unique_ptr<Stmt> Parser::yieldStatement()
+{
+    auto keyword = std::make_unique<Token>(previous());
+    auto value = expression();
+    consume(TokenType::SEMICOLON, "Expect ';' after yield value.");
+    yields = true;
+    return std::make_unique<Yield>(std::move(keyword), std::move(value));
 }
 
 std::unique_ptr<vector<unique_ptr<Stmt>>> Parser::block()
@@ -255,6 +292,10 @@ std::unique_ptr<Expr> Parser::assignment()
             return std::make_unique<Assign>(
                 std::make_unique<Token>(name), std::move(value)); 
         }
+        if (auto get = dynamic_cast<Get*>(expr.get())) {
+            return std::make_unique<Set>(std::move(get->object),
+                std::move(get->name), std::move(value));
+        }
 
         error(equals, "Invalid assignment target");
     }
@@ -366,6 +407,12 @@ std::unique_ptr<Expr> Parser::call()
         if (match({TokenType::LEFT_PAREN})) {
             expr = finishCall(std::move(expr));
         }
+        else if (match({TokenType::DOT})) {
+            auto name = consume(TokenType::IDENTIFIER,
+                "Expect property name after '.'.");
+            expr = std::make_unique<Get>(std::move(expr),
+                std::make_unique<Token>(name));
+        }
         else {
             break;
         }
@@ -394,9 +441,14 @@ std::unique_ptr<Function> Parser::function(const std::string& kind)
 
     consume(TokenType::LEFT_BRACE, fmt::format(
         "Expect '{{' before {} body.", kind));
+    // A yield anywhere in the body, outside nested functions, makes the
+    // function a generator.
+    bool enclosing = std::exchange(yields, false);
     auto body = block();
-    return std::make_unique<Function>(std::move(name),
+    auto function = std::make_unique<Function>(std::move(name),
         std::move(parameters), std::move(body));
+    function->generator = std::exchange(yields, enclosing);
+    return function;
 }
 
 std::unique_ptr<Expr> Parser::finishCall(std::unique_ptr<Expr> callee)
@@ -417,11 +469,31 @@ std::unique_ptr<Expr> Parser::finishCall(std::unique_ptr<Expr> callee)
         std::make_unique<Token>(paren), std::move(arguments));
 }
 
+std::unique_ptr<Literal> Parser::literal(const Token& token)
+{
+    auto expr = std::make_unique<Literal>(std::make_unique<Token>(token));
+    expr->constant = constants.add(token.literal);
+    return expr;
+}
+
 std::unique_ptr<Expr> Parser::primary()
 {
     if (match({TokenType::FALSE, TokenType::TRUE, TokenType::NIL,
                TokenType::NUMBER, TokenType::STRING})) {
-        return std::make_unique<Literal>(std::make_unique<Token>(previous()));
+        return literal(previous());
+    }
+
+    if (match({TokenType::SUPER})) {
+        auto keyword = previous();
+        consume(TokenType::DOT, "Expect '.' after 'super'.");
+        auto method = consume(TokenType::IDENTIFIER,
+            "Expect superclass method name.");
+        return std::make_unique<Super>(std::make_unique<Token>(keyword),
+            std::make_unique<Token>(method));
+    }
+
+    if (match({TokenType::THIS})) {
+        return std::make_unique<This>(std::make_unique<Token>(previous()));
     }
 
     if (match({TokenType::IDENTIFIER})) {
@@ -3,6 +3,7 @@
 #include "Scanner.h"
 #include "autogen/Expr.h"
 #include "autogen/Stmt.h"
+#include "ConstantPool.h"
 #include <stdexcept>
 
 namespace lox {
@@ -17,7 +18,8 @@ public:
 class Parser
 {
 public:
-    Parser(std::vector<Token>&& tokens): tokens(std::move(tokens)) {}
+    Parser(std::vector<Token>&& tokens, ConstantPool& constants):
+        tokens(std::move(tokens)), constants(constants) {}
 
     std::vector<std::unique_ptr<Stmt>> parse();
 
@@ -36,9 +38,12 @@ private:
 
     /* parsing functions for grammar:
      * program        → declaration* EOF ;
-     * declaration    → funDecl
+     * declaration    → classDecl
+     *                | funDecl
      *                | varDecl
      *                | statement ;
+     * classDecl      → "class" IDENTIFIER ( "<" IDENTIFIER )?
+     *                  "{" function* "}" ;
      * funDecl        → "fun" function ;
      * function       → IDENTIFIER "(" parameters? ")" block ;
      * parameters     → IDENTIFIER ( "," IDENTIFIER )* ;
@@ -49,6 +54,7 @@ private:
      *                | printStmt
      *                | returnStmt
      *                | whileStmt
+     *                | yieldStmt
      *                | block;
      * exprStmt       → expression ";" ;
      * forStmt        → "for" "(" ( varDecl | exprStmt | ";" )
@@ -59,9 +65,10 @@ private:
      * printStmt      → "print" expression ";" ;
      * returnStmt     → "return" expression? ";" ;
      * whileStmt      → "while" "(" expression ")" statement ;
+     * yieldStmt      → "yield" expression ";" ;
      * block          → "{" declaration* "}" ;
      * expression     → assignment ;
-     * assignment     → IDENTIFIER "=" assignment
+     * assignment     → ( call "." )? IDENTIFIER "=" assignment
      *                | logical_or ;
      * logic_or       → logic_and ( "or" logic_and )* ;
      * logic_and      → equality ( "and" equality )* ;
@@ -71,12 +78,14 @@ private:
      * factor         → unary ( ( "/" | "*" ) unary )* ;
      * unary          → ( "!" | "-" ) unary
      *                | call ;
-     * call           → primary ( "(" arguments? ")" )* ;
+     * call           → primary ( "(" arguments? ")" | "." IDENTIFIER )* ;
      * arguments      → expression ( "," expression )* ;
      * primary        → NUMBER | STRING | "true" | "false" | "nil"
-     *                | "(" expression ")" | IDENTIFIER;
+     *                | "(" expression ")" | IDENTIFIER | "this"
+     *                | "super" "." IDENTIFIER ;
      * */
     std::unique_ptr<Stmt> declaration();
+    std::unique_ptr<Stmt> classDeclaration();
     std::unique_ptr<Stmt> varDeclaration();
     std::unique_ptr<Stmt> statement();
     std::unique_ptr<Stmt> forStatement();
@@ -84,6 +93,7 @@ private:
     std::unique_ptr<Stmt> printStatement();
     std::unique_ptr<Stmt> returnStatement();
     std::unique_ptr<Stmt> whileStatement();
+    std::unique_ptr<Stmt> yieldStatement();
     std::unique_ptr<vector<unique_ptr<Stmt>>> block();
     std::unique_ptr<Stmt> expressionStatement();
     std::unique_ptr<Expr> expression();
@@ -100,9 +110,13 @@ private:
 
     std::unique_ptr<Function> function(const std::string& kind);
     std::unique_ptr<Expr> finishCall(std::unique_ptr<Expr> callee);
+    std::unique_ptr<Literal> literal(const Token& token);
 
     std::vector<Token> tokens;
     int current = 0;
+    ConstantPool& constants;
+    // Set by a yield statement in the function being parsed.
+    bool yields = false;
 };
 
 }
\ No newline at end of file
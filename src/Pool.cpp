@@ -0,0 +1,55 @@
+#include "Pool.h"
+#include <new>
+
+namespace lox {
+
+Pool::~Pool()
+{
+    for (void* chunk : chunks) {
+        ::operator delete(chunk);
+    }
+}
+
+void* Pool::allocate(size_t bytes)
+{
+    ++stats.allocations;
+    if (bytes > kMaxBlock) {
+        ++stats.oversized;
+        return ::operator new(bytes);
+    }
+
+    size_t index = sizeClass(bytes);
+    if (FreeBlock* block = freeLists[index]) {
+        freeLists[index] = block->next;
+        ++stats.reused;
+        return block;
+    }
+
+    size_t blockSize = (index + 1) * kGranularity;
+    if (cursor == nullptr || size_t(limit - cursor) < blockSize) {
+        // The tail of the previous chunk is simply abandoned.
+        cursor = static_cast<char*>(::operator new(kChunkSize));
+        limit = cursor + kChunkSize;
+        chunks.push_back(cursor);
+        stats.bytesReserved += kChunkSize;
+    }
+    void* memory = cursor;
+    cursor += blockSize;
+    return memory;
+}
+
+void Pool::free(void* memory, size_t bytes)
+{
+    ++stats.frees;
+    if (bytes > kMaxBlock) {
+        ::operator delete(memory);
+        return;
+    }
+
+    size_t index = sizeClass(bytes);
+    auto block = static_cast<FreeBlock*>(memory);
+    block->next = freeLists[index];
+    freeLists[index] = block;
+}
+
+}
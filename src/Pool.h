@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+namespace lox {
+
+struct PoolStats
+{
+    size_t allocations = 0;
+    // Allocations served from a free list instead of fresh memory.
+    size_t reused = 0;
+    size_t frees = 0;
+    // Requests too large for any size class.
+    size_t oversized = 0;
+    size_t bytesReserved = 0;
+};
+
+// Size-class allocator for small runtime objects. Freed blocks go on a
+// per-class free list and are handed out again last-in first-out, so a
+// scope that is entered right after another one exits reuses its memory.
+class Pool
+{
+public:
+    static constexpr size_t kGranularity = 16;
+    static constexpr size_t kMaxBlock = 1024;
+
+    Pool() = default;
+    ~Pool();
+    Pool(const Pool&) = delete;
+    Pool& operator=(const Pool&) = delete;
+
+    void* allocate(size_t bytes);
+    void free(void* memory, size_t bytes);
+
+    const PoolStats& statistics() const { return stats; }
+
+private:
+    static constexpr size_t kChunkSize = 64 * 1024;
+    static constexpr size_t kClasses = kMaxBlock / kGranularity;
+
+    struct FreeBlock
+    {
+        FreeBlock* next;
+    };
+
+    static size_t sizeClass(size_t bytes)
+    { return (bytes + kGranularity - 1) / kGranularity - 1; }
+
+    FreeBlock* freeLists[kClasses] = {};
+    std::vector<void*> chunks;
+    char* cursor = nullptr;
+    char* limit = nullptr;
+    PoolStats stats;
+};
+
+}
@@ -0,0 +1,113 @@
+#include "Profile.h"
+#include "LoxCallable.h"
+#include "LoxString.h"
+#include <cstring>
+#include <fstream>
+
+namespace lox {
+
+// Files start with the magic and the source hash, then the number of
+// sites and each site's fields, all in the host's byte order.
+static const char kMagic[8] = {'L', 'O', 'X', 'P', 'R', 'O', 'F', '1'};
+
+void SiteProfile::observe(const std::any& value)
+{
+    left |= Profile::typeOf(value);
+}
+
+void SiteProfile::observe(const std::any& a, const std::any& b)
+{
+    left |= Profile::typeOf(a);
+    right |= Profile::typeOf(b);
+}
+
+// FNV-1a.
+uint64_t Profile::hash(const std::string& source)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (unsigned char c : source) {
+        hash ^= c;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+uint8_t Profile::typeOf(const std::any& value)
+{
+    if (!value.has_value()) return NONE;
+    if (std::any_cast<double>(&value)) return NUMBER;
+    if (std::any_cast<StringRef>(&value)) return STRING;
+    if (std::any_cast<bool>(&value)) return BOOLEAN;
+    if (std::any_cast<LoxFunction*>(&value)) return FUNCTION;
+    if (std::any_cast<NativeCallable*>(&value)) return NATIVE;
+    if (std::any_cast<std::nullptr_t>(&value)) return NIL;
+    return OBJECT;
+}
+
+template <typename T>
+static bool read(std::istream& input, T& value)
+{
+    return bool(input.read(reinterpret_cast<char*>(&value), sizeof(value)));
+}
+
+template <typename T>
+static void write(std::ostream& output, const T& value)
+{
+    output.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+std::unique_ptr<Profile> Profile::load(const std::string& path,
+    uint64_t source)
+{
+    std::ifstream input(path, std::ios::binary);
+    char magic[sizeof(kMagic)];
+    uint64_t hash = 0;
+    uint64_t count = 0;
+    if (!input.read(magic, sizeof(magic))
+        || std::memcmp(magic, kMagic, sizeof(kMagic)) != 0
+        || !read(input, hash) || hash != source || !read(input, count)) {
+        return nullptr;
+    }
+
+    auto profile = std::make_unique<Profile>(source);
+    for (uint64_t i = 0; i < count; ++i) {
+        SiteProfile site;
+        if (!read(input, site.left) || !read(input, site.right)
+            || !read(input, site.taken) || !read(input, site.skipped)) {
+            return nullptr;
+        }
+        profile->sites.push_back(site);
+    }
+    return profile;
+}
+
+bool Profile::save(const std::string& path) const
+{
+    std::ofstream output(path, std::ios::binary | std::ios::trunc);
+    output.write(kMagic, sizeof(kMagic));
+    write(output, source);
+    write(output, uint64_t(sites.size()));
+    for (auto& site : sites) {
+        write(output, site.left);
+        write(output, site.right);
+        write(output, site.taken);
+        write(output, site.skipped);
+    }
+    return bool(output.flush());
+}
+
+SiteProfile& Profile::site(size_t index)
+{
+    if (index >= sites.size()) sites.resize(index + 1);
+    return sites[index];
+}
+
+const SiteProfile* Profile::find(size_t index) const
+{
+    if (index >= sites.size()) return nullptr;
+    auto& site = sites[index];
+    if (site.left == 0 && site.taken == 0 && site.skipped == 0) return nullptr;
+    return &site;
+}
+
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <any>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+
+namespace lox {
+
+// What one profiled node of a program saw while it ran.
+struct SiteProfile
+{
+    // Bits of the value types a node saw, see Profile::typeOf. Binary
+    // nodes fill both; unary and logical nodes and calls (their callee)
+    // only left.
+    uint8_t left = 0;
+    uint8_t right = 0;
+    // How often an if statement's condition held, and how often not.
+    uint64_t taken = 0;
+    uint64_t skipped = 0;
+
+    void observe(const std::any& value);
+    void observe(const std::any& a, const std::any& b);
+};
+
+// Type and branch profiles of one script, written by --profile-out and
+// read back by --profile-in so that the closure engine starts out with
+// its nodes specialized as an earlier run left them.
+//
+// Sites are numbered in the order ClosureCompiler visits the nodes, so a
+// profile only fits the exact source it was recorded for. It carries a
+// hash of that source, and load() turns down a profile of any other.
+class Profile
+{
+public:
+    enum Type : uint8_t
+    {
+        NUMBER = 1 << 0,
+        STRING = 1 << 1,
+        BOOLEAN = 1 << 2,
+        NIL = 1 << 3,
+        FUNCTION = 1 << 4,
+        NATIVE = 1 << 5,
+        // A function's missing return value.
+        NONE = 1 << 6,
+        // Classes and instances.
+        OBJECT = 1 << 7
+    };
+
+    explicit Profile(uint64_t source): source(source) {}
+
+    static uint64_t hash(const std::string& source);
+    static uint8_t typeOf(const std::any& value);
+
+    // Null if the file can't be read, is damaged or belongs to another
+    // source.
+    static std::unique_ptr<Profile> load(const std::string& path,
+        uint64_t source);
+    bool save(const std::string& path) const;
+
+    // The site to record into. References stay valid as sites are added.
+    SiteProfile& site(size_t index);
+    // Null unless the site saw anything.
+    const SiteProfile* find(size_t index) const;
+
+private:
+    uint64_t source;
+    std::deque<SiteProfile> sites;
+};
+
+}
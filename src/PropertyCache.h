@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstdint>
+
+namespace lox {
+
+class LoxFunction;
+class Shape;
+
+// What a property access remembers about the shape of the instance it
+// saw last. It holds for any instance of that shape.
+struct PropertyCache
+{
+    // Id of the shape, zero while empty. Ids are never reused, so the
+    // entry can't match an instance once its shape is gone.
+    uint64_t shape = 0;
+    // The field's slot, or -1 if the property is a method of the class.
+    int slot = -1;
+    LoxFunction* method = nullptr;
+    // For a Set that adds the field, the shape the instance moves to.
+    Shape* transition = nullptr;
+};
+
+}
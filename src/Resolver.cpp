@@ -1,12 +1,12 @@
 #include "Resolver.h"
-#include "Interpreter.h"
 #include "Lox.h"
+#include <utility>
 
 namespace lox {
 
 any Resolver::visitBlockStmt(Block* stmt)
 {
-    beginScope();
+    beginScope(stmt->slots, stmt->escapes);
     resolve(*stmt->statements);
     endScope();
     return any();
@@ -35,9 +35,11 @@ void Resolver::resolve(Expr* expr)
     expr->accept(this);
 }
 
-void Resolver::beginScope()
+void Resolver::beginScope(int& slots, bool& escapes)
 {
-    scopes.push_back(std::unordered_map<std::string, bool>());
+    slots = 0;
+    escapes = generator;
+    scopes.push_back(Scope{{}, &slots, &escapes});
 }
 
 void Resolver::endScope()
@@ -47,7 +49,7 @@ void Resolver::endScope()
 
 any Resolver::visitVarStmtStmt(VarStmt* stmt)
 {
-    declare(*stmt->name);
+    stmt->slot = declare(*stmt->name);
     if (stmt->initializer != nullptr) {
         resolve(stmt->initializer.get());
     }
@@ -55,45 +57,52 @@ any Resolver::visitVarStmtStmt(VarStmt* stmt)
     return any();
 }
 
-void Resolver::declare(Token& name)
+int Resolver::declare(Token& name)
 {
-    if (scopes.empty()) return;
+    if (scopes.empty()) return -1;
 
     auto& scope = scopes.back();
-    if (scope.find(name.lexeme) != scope.end()) {
+    auto iter = scope.variables.find(name.lexeme);
+    if (iter != scope.variables.end()) {
         error(name, "Already a variable with this name in this scope.");
+        iter->second.defined = false;
+        return iter->second.slot;
     }
-    scope[name.lexeme] = false;
+    int slot = (*scope.slots)++;
+    scope.variables[name.lexeme] = Variable{false, slot};
+    return slot;
 }
 
 void Resolver::define(Token& name)
 {
     if (scopes.empty()) return;
-    scopes.back()[name.lexeme] = true;
+    scopes.back().variables[name.lexeme].defined = true;
 }
 
 any Resolver::visitVarExprExpr(VarExpr* expr)
 {
     if (!scopes.empty()) {
-        auto& scope = scopes.back();
-        if (scope.find(expr->name->lexeme) != scope.end()) {
-            if (scope.at(expr->name->lexeme) == false) {
-                error(*expr->name,
-                    "Can't read local variable in its own initializer.");
-            }
+        auto& variables = scopes.back().variables;
+        auto iter = variables.find(expr->name->lexeme);
+        if (iter != variables.end() && !iter->second.defined) {
+            error(*expr->name,
+                "Can't read local variable in its own initializer.");
         }
     }
 
-    resolveLocal(expr, *expr->name);
+    resolveLocal(*expr->name, expr->depth, expr->slot);
     return any();
 }
 
-void Resolver::resolveLocal(Expr* expr, Token& name)
+// Leaves depth at -1 for globals.
+void Resolver::resolveLocal(Token& name, int& depth, int& slot)
 {
     for (int i = scopes.size() - 1; i >= 0; --i) {
-        auto& scope = scopes.at(i);
-        if (scope.find(name.lexeme) != scope.end()) {
-            interpreter->resolve(expr, scopes.size() - 1 - i);
+        auto& variables = scopes.at(i).variables;
+        auto iter = variables.find(name.lexeme);
+        if (iter != variables.end()) {
+            depth = scopes.size() - 1 - i;
+            slot = iter->second.slot;
             return;
         }
     }
@@ -102,7 +111,7 @@ void Resolver::resolveLocal(Expr* expr, Token& name)
 any Resolver::visitAssignExpr(Assign* expr)
 {
     resolve(expr->value.get());
-    resolveLocal(expr, *expr->name);
+    resolveLocal(*expr->name, expr->depth, expr->slot);
     return any();
 }
 
@@ -116,6 +125,10 @@ any Resolver::visitBinaryExpr(Binary* expr)
 any Resolver::visitCallExpr(Call* expr)
 {
     resolve(expr->callee.get());
+    if (auto variable = dynamic_cast<VarExpr*>(expr->callee.get())) {
+        expr->cache.global = variable->depth < 0;
+    }
+    expr->cache.property = dynamic_cast<Get*>(expr->callee.get()) != nullptr;
 
     for (auto& argument : *expr->arguments) {
         resolve(argument.get());
@@ -124,6 +137,12 @@ any Resolver::visitCallExpr(Call* expr)
     return any();
 }
 
+any Resolver::visitGetExpr(Get* expr)
+{
+    resolve(expr->object.get());
+    return any();
+}
+
 any Resolver::visitGroupingExpr(Grouping* expr)
 {
     resolve(expr->expression.get());
@@ -132,13 +151,68 @@ any Resolver::visitGroupingExpr(Grouping* expr)
 
 any Resolver::visitFunctionStmt(Function* stmt)
 {
-    declare(*stmt->name);
+    stmt->slot = declare(*stmt->name);
     define(*stmt->name);
 
+    // The new closure captures every scope it is nested in.
+    for (auto& scope : scopes) {
+        *scope.escapes = true;
+    }
+
     resolveFunction(stmt, FUNCTION);
     return any();
 }
 
+// Methods close over a scope holding 'super' in subclasses, and are
+// bound to a scope of their own holding 'this'.
+any Resolver::visitClassStmt(Class* stmt)
+{
+    auto enclosingClass = currentClass;
+    currentClass = CLASS;
+
+    stmt->slot = declare(*stmt->name);
+    define(*stmt->name);
+
+    // Like a function, each method captures every scope it is nested in.
+    for (auto& scope : scopes) {
+        *scope.escapes = true;
+    }
+
+    int superSlots = 0;
+    bool superEscapes = false;
+    if (stmt->superclass != nullptr) {
+        if (stmt->name->lexeme == stmt->superclass->name->lexeme) {
+            error(*stmt->superclass->name,
+                "A class can't inherit from itself.");
+        }
+        currentClass = SUBCLASS;
+        resolve(stmt->superclass.get());
+
+        beginScope(superSlots, superEscapes);
+        Token super(TokenType::SUPER, "super", std::any(),
+            stmt->name->line);
+        declare(super);
+        define(super);
+    }
+
+    int thisSlots = 0;
+    beginScope(thisSlots, stmt->thisEscapes);
+    Token self(TokenType::THIS, "this", std::any(), stmt->name->line);
+    declare(self);
+    define(self);
+
+    for (auto& method : *stmt->methods) {
+        auto type = method->name->lexeme == "init" ? INITIALIZER : METHOD;
+        resolveFunction(method.get(), type);
+    }
+
+    endScope();
+    if (stmt->superclass != nullptr) endScope();
+
+    currentClass = enclosingClass;
+    return any();
+}
+
 any Resolver::visitLiteralExpr(Literal* expr)
 {
     return any();
@@ -151,6 +225,36 @@ any Resolver::visitLogicalExpr(Logical* expr)
     return any();
 }
 
+any Resolver::visitSetExpr(Set* expr)
+{
+    resolve(expr->value.get());
+    resolve(expr->object.get());
+    return any();
+}
+
+any Resolver::visitSuperExpr(Super* expr)
+{
+    if (currentClass == NO_CLASS) {
+        error(*expr->keyword, "Can't use 'super' outside of a class.");
+    }
+    else if (currentClass != SUBCLASS) {
+        error(*expr->keyword,
+            "Can't use 'super' in a class with no superclass.");
+    }
+    resolveLocal(*expr->keyword, expr->depth, expr->slot);
+    return any();
+}
+
+any Resolver::visitThisExpr(This* expr)
+{
+    if (currentClass == NO_CLASS) {
+        error(*expr->keyword, "Can't use 'this' outside of a class.");
+        return any();
+    }
+    resolveLocal(*expr->keyword, expr->depth, expr->slot);
+    return any();
+}
+
 any Resolver::visitUnaryExpr(Unary* expr)
 {
     resolve(expr->right.get());
@@ -161,8 +265,16 @@ void Resolver::resolveFunction(Function* function, FunctionType type)
 {
     auto enclosingFunction = currentFunction;
     currentFunction = type;
+    bool enclosingGenerator = std::exchange(generator, function->generator);
+    // Like a closure, a suspended generator keeps the scopes it is nested
+    // in, including the one a method binds 'this' in.
+    if (generator) {
+        for (auto& scope : scopes) {
+            *scope.escapes = true;
+        }
+    }
 
-    beginScope();
+    beginScope(function->slots, function->escapes);
     for (auto& param : *function->params) {
         declare(param);
         define(param);
@@ -171,6 +283,7 @@ void Resolver::resolveFunction(Function* function, FunctionType type)
     endScope();
 
     currentFunction = enclosingFunction;
+    generator = enclosingGenerator;
 }
 
 any Resolver::visitIfStmt(If* stmt)
@@ -195,6 +308,12 @@ any Resolver::visitReturnStmt(Return* stmt)
         error(*stmt->keyword, "Can't return from top-level code.");
     }
     if (stmt->value != nullptr) {
+        if (currentFunction == INITIALIZER) {
+            error(*stmt->keyword, "Can't return a value from an initializer.");
+        }
+        if (generator) {
+            error(*stmt->keyword, "Can't return a value from a generator.");
+        }
         resolve(stmt->value.get());
     }
     return any();
@@ -207,4 +326,16 @@ any Resolver::visitWhileStmt(While* stmt)
     return any();
 }
 
+any Resolver::visitYieldStmt(Yield* stmt)
+{
+    if (currentFunction == NONE) {
+        error(*stmt->keyword, "Can't yield from top-level code.");
+    }
+    else if (currentFunction == INITIALIZER) {
+        error(*stmt->keyword, "Can't yield from an initializer.");
+    }
+    resolve(stmt->value.get());
+    return any();
+}
+
 }
\ No newline at end of file
@@ -8,50 +8,74 @@
 
 namespace lox {
 
-class Interpreter;
-
+// Binds every local variable to a (depth, slot) pair stored in the AST,
+// and records for each scope how many slots it needs and whether a
+// closure can capture it.
 class Resolver: public ExprVisitor, public StmtVisitor
 {
-    enum FunctionType {NONE, FUNCTION};
+    enum FunctionType {NONE, FUNCTION, INITIALIZER, METHOD};
+    enum ClassType {NO_CLASS, CLASS, SUBCLASS};
+
+    struct Variable
+    {
+        bool defined;
+        int slot;
+    };
+
+    struct Scope
+    {
+        std::unordered_map<std::string, Variable> variables;
+        int* slots;
+        bool* escapes;
+    };
 
 public:
-    explicit Resolver(Interpreter* interpreter): interpreter(interpreter) {}
+    Resolver() = default;
     ~Resolver() override = default;
 
     any visitAssignExpr(Assign* expr) override;
     any visitBinaryExpr(Binary* expr) override;
     any visitCallExpr(Call* expr) override;
+    any visitGetExpr(Get* expr) override;
     any visitGroupingExpr(Grouping* expr) override;
     any visitLiteralExpr(Literal* expr) override;
     any visitLogicalExpr(Logical* expr) override;
+    any visitSetExpr(Set* expr) override;
+    any visitSuperExpr(Super* expr) override;
+    any visitThisExpr(This* expr) override;
     any visitUnaryExpr(Unary* expr) override;
     any visitVarExprExpr(VarExpr* expr) override;
 
     any visitBlockStmt(Block* stmt) override;
     any visitExpressionStmt(Expression* stmt) override;
     any visitFunctionStmt(Function* stmt) override;
+    any visitClassStmt(Class* stmt) override;
     any visitIfStmt(If* stmt) override;
     any visitPrintStmt(Print* stmt) override;
     any visitReturnStmt(Return* stmt) override;
     any visitVarStmtStmt(VarStmt* stmt) override;
     any visitWhileStmt(While* stmt) override;
+    any visitYieldStmt(Yield* stmt) override;
 
     void resolve(std::vector<std::unique_ptr<Stmt>>& statements);
 
 private:
     void resolve(Stmt* stmt);
     void resolve(Expr* expr);
-    void beginScope();
+    void beginScope(int& slots, bool& escapes);
     void endScope();
-    void declare(Token& name);
+    int declare(Token& name);
     void define(Token& name);
-    void resolveLocal(Expr* expr, Token& name);
+    void resolveLocal(Token& name, int& depth, int& slot);
     void resolveFunction(Function* function, FunctionType type);
 
 private:
-    Interpreter* interpreter = nullptr;
-    std::vector<std::unordered_map<std::string, bool>> scopes;
+    std::vector<Scope> scopes;
     FunctionType currentFunction = NONE;
+    ClassType currentClass = NO_CLASS;
+    // Whether the function being resolved is a generator. Its scopes
+    // outlive the call that creates them, so they always escape.
+    bool generator = false;
 };
 
 }
\ No newline at end of file
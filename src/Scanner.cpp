@@ -1,5 +1,6 @@
 #include "Scanner.h"
 #include "Lox.h"
+#include "LoxString.h"
 
 namespace lox {
 
@@ -19,7 +20,8 @@ const std::map<std::string, TokenType> Scanner::sKeywords {
     {"this", TokenType::THIS},
     {"true", TokenType::TRUE},
     {"var", TokenType::VAR},
-    {"while", TokenType::WHILE}
+    {"while", TokenType::WHILE},
+    {"yield", TokenType::YIELD}
 };
 
 std::vector<Token> Scanner::scanTokens()
@@ -109,9 +111,10 @@ void Scanner::string()
     // The closing ".
     advance();
 
-    // Trim the surrounding quotes.
-    std::string value = mSource.substr(mStart + 1, mCurrent - mStart - 2);
-    addToken(TokenType::STRING, value);
+    // Trim the surrounding quotes. Literals are always interned.
+    auto value = std::string_view(mSource).substr(
+        mStart + 1, mCurrent - mStart - 2);
+    addToken(TokenType::STRING, LoxString::intern(value));
 }
 
 void Scanner::number()
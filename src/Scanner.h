@@ -26,7 +26,7 @@ enum class TokenType
 
     // Keywords.
     AND, CLASS, ELSE, FALSE, FUN, FOR, IF, NIL, OR,
-    PRINT, RETURN, SUPER, THIS, TRUE, VAR, WHILE,
+    PRINT, RETURN, SUPER, THIS, TRUE, VAR, WHILE, YIELD,
 
     // EOF is defined as a macro expanded to (-1) by standard library.
     // So we use TOKEN_EOF here.
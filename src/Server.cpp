@@ -0,0 +1,293 @@
+#include "Server.h"
+#include "Lox.h"
+#include "ConstantPool.h"
+#include "Profile.h"
+#include "autogen/Stmt.h"
+#include <cerrno>
+#include <cstdio>
+#include <fcntl.h>
+#include <fstream>
+#include <list>
+#include <memory>
+#include <poll.h>
+#include <signal.h>
+#include <sstream>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <system_error>
+#include <unistd.h>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <fmt/format.h>
+
+namespace lox {
+
+// Compiled scripts kept for the requests that run them again.
+static constexpr size_t kCachedScripts = 64;
+// Longer requests are dropped unanswered.
+static constexpr size_t kMaxRequest = 1024 * 1024;
+
+namespace {
+
+struct Script
+{
+    uint64_t hash;
+    std::string source;
+    std::vector<std::unique_ptr<Stmt>> statements;
+    // The script's literals, which its Literal nodes refer to by index.
+    // Kept apart from the server's isolate so that they go with it.
+    ConstantPool constants;
+};
+
+// A client whose request is still arriving.
+struct Connection
+{
+    int fd;
+    std::string request;
+};
+
+class Server
+{
+public:
+    Server(int listener, const Options& options);
+    void run();
+
+private:
+    void accept();
+    // False once the connection is done with, answered or not.
+    bool receive(Connection& connection);
+    void answer(int fd, const std::string& request);
+    // Null after a compile error, which is written to output.
+    Script* compile(const std::string& source, int output);
+
+    int listener;
+    Isolate isolate;
+    std::vector<Connection> connections;
+    // Most recently run first.
+    std::list<Script> scripts;
+    std::unordered_map<uint64_t, std::list<Script>::iterator> index;
+};
+
+}
+
+static std::string describe(int error)
+{
+    return std::error_code(error, std::generic_category()).message();
+}
+
+static bool sendAll(int fd, const char* data, size_t size)
+{
+    while (size > 0) {
+        auto sent = send(fd, data, size, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += sent;
+        size -= size_t(sent);
+    }
+    return true;
+}
+
+// Sends the exit status and everything written to output.
+static void respond(int fd, int status, int output)
+{
+    auto length = lseek(output, 0, SEEK_END);
+    auto header = fmt::format("{} {}\n", status, length);
+    if (!sendAll(fd, header.data(), header.size())) return;
+    char buffer[64 * 1024];
+    off_t offset = 0;
+    while (offset < length) {
+        auto bytes = pread(output, buffer, sizeof(buffer), offset);
+        if (bytes < 0 && errno == EINTR) continue;
+        if (bytes <= 0 || !sendAll(fd, buffer, size_t(bytes))) return;
+        offset += bytes;
+    }
+}
+
+Server::Server(int listener, const Options& options):
+    listener(listener), isolate(options)
+{}
+
+void Server::run()
+{
+    // SIGCHLD only interrupts ppoll, so finished requests are reaped
+    // without a race against the wait.
+    struct sigaction action = {};
+    action.sa_handler = [](int) {};
+    action.sa_flags = SA_NOCLDSTOP;
+    sigaction(SIGCHLD, &action, nullptr);
+    sigset_t blocked, waiting;
+    sigemptyset(&blocked);
+    sigaddset(&blocked, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &blocked, &waiting);
+    sigdelset(&waiting, SIGCHLD);
+
+    std::vector<pollfd> fds;
+    while (true) {
+        fds.clear();
+        fds.push_back({listener, POLLIN, 0});
+        for (auto& connection : connections) {
+            fds.push_back({connection.fd, POLLIN, 0});
+        }
+        int ready = ppoll(fds.data(), fds.size(), nullptr, &waiting);
+        while (waitpid(-1, nullptr, WNOHANG) > 0) {}
+        if (ready <= 0) continue;
+
+        // From the back, as finished connections are removed.
+        for (size_t i = connections.size(); i-- > 0;) {
+            if (fds[i + 1].revents == 0) continue;
+            if (!receive(connections[i])) {
+                close(connections[i].fd);
+                connections.erase(connections.begin() + i);
+            }
+        }
+        if (fds[0].revents & POLLIN) accept();
+    }
+}
+
+void Server::accept()
+{
+    int fd = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd >= 0) connections.push_back({fd, {}});
+}
+
+bool Server::receive(Connection& connection)
+{
+    char buffer[4096];
+    auto bytes = recv(connection.fd, buffer, sizeof(buffer), 0);
+    if (bytes < 0) return errno == EINTR;
+    if (bytes > 0) {
+        connection.request.append(buffer, size_t(bytes));
+        return connection.request.size() <= kMaxRequest;
+    }
+    answer(connection.fd, connection.request);
+    return false;
+}
+
+void Server::answer(int fd, const std::string& request)
+{
+    // The script's path, then its arguments.
+    std::vector<std::string> fields;
+    size_t start = 0;
+    while (start < request.size()) {
+        auto end = request.find('\0', start);
+        if (end == std::string::npos) return;
+        fields.push_back(request.substr(start, end - start));
+        start = end + 1;
+    }
+    if (fields.empty()) return;
+    auto path = std::move(fields[0]);
+    fields.erase(fields.begin());
+
+    int output = memfd_create("lox-output", MFD_CLOEXEC);
+    if (output < 0) {
+        fmt::print(stderr, "serve: can't answer {}: {}\n", path,
+            describe(errno));
+        return;
+    }
+    std::ifstream input(path);
+    std::stringstream buffer;
+    buffer << input.rdbuf();
+    auto script = compile(buffer.str(), output);
+    if (script == nullptr) {
+        respond(fd, 65, output);
+        close(output);
+        return;
+    }
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        // Only this request's connection stays open.
+        close(listener);
+        for (auto& connection : connections) {
+            if (connection.fd != fd) close(connection.fd);
+        }
+        signal(SIGCHLD, SIG_DFL);
+        sigset_t none;
+        sigemptyset(&none);
+        sigprocmask(SIG_SETMASK, &none, nullptr);
+
+        dup2(output, STDOUT_FILENO);
+        int status = isolate.runCompiled(script->statements,
+            script->constants, path, std::move(fields));
+        fflush(stdout);
+        respond(fd, status, output);
+        _exit(0);
+    }
+    if (pid < 0) {
+        fmt::print(stderr, "serve: can't run {}: {}\n", path,
+            describe(errno));
+    }
+    close(output);
+}
+
+Script* Server::compile(const std::string& source, int output)
+{
+    auto hash = Profile::hash(source);
+    auto found = index.find(hash);
+    if (found != index.end() && found->second->source == source) {
+        scripts.splice(scripts.begin(), scripts, found->second);
+        return &scripts.front();
+    }
+
+    // Compile errors are printed, so they go to the request's output.
+    fflush(stdout);
+    int saved = dup(STDOUT_FILENO);
+    dup2(output, STDOUT_FILENO);
+    ConstantPool constants;
+    auto statements = isolate.compile(source, constants);
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+    if (std::exchange(isolate.hadError, false)) return nullptr;
+
+    if (found != index.end()) {
+        scripts.erase(found->second);
+        index.erase(found);
+    }
+    scripts.push_front({hash, source, std::move(statements),
+        std::move(constants)});
+    index[hash] = scripts.begin();
+    if (scripts.size() > kCachedScripts) {
+        index.erase(scripts.back().hash);
+        scripts.pop_back();
+    }
+    return &scripts.front();
+}
+
+int serve(const std::string& path, const Options& options)
+{
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) {
+        fmt::print(stderr, "serve: socket path too long: {}\n", path);
+        return 64;
+    }
+    path.copy(address.sun_path, path.size());
+
+    // A socket left behind by an earlier server.
+    struct stat status;
+    if (stat(path.c_str(), &status) == 0 && S_ISSOCK(status.st_mode)) {
+        unlink(path.c_str());
+    }
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listener < 0
+        || bind(listener, reinterpret_cast<sockaddr*>(&address),
+            sizeof(address)) < 0
+        || listen(listener, SOMAXCONN) < 0) {
+        fmt::print(stderr, "serve: can't listen on {}: {}\n", path,
+            describe(errno));
+        return 74;
+    }
+
+    Server server(listener, options);
+    server.run();
+    return 0;
+}
+
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <string>
+
+namespace lox {
+
+struct Options;
+
+// lox --serve: runs scripts for clients of the Unix socket at path,
+// saving them the start of a process, the making of the globals and the
+// compiling of scripts they ran before.
+//
+// A client connects, sends the script's path and its arguments, each
+// ending in a NUL byte, and shuts down its side of the connection. The
+// server answers with the exit status and the length of the output in
+// decimal, a newline and the output, then closes the connection:
+//
+//     /home/me/job.lox\0--fast\0        0 6\nready\n
+//
+// The server keeps one isolate that never runs anything, and the scripts
+// it compiled keyed by a hash of their source, so a script is read on
+// every request but compiled again only when it changed. Each request
+// runs in a fork of the server: it starts from the isolate's globals, its
+// state is gone when it exits, and it runs while the server goes on
+// reading and answering other requests. Scripts run in the server's
+// working directory.
+//
+// tools/lox_client.py is a client. Returns the exit status if the socket
+// can't be set up, and otherwise answers until the process is killed.
+int serve(const std::string& path, const Options& options);
+
+}
@@ -0,0 +1,577 @@
+#include "Snapshot.h"
+#include "ClosureCompiler.h"
+#include "LoxClass.h"
+#include "LoxString.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <system_error>
+#include <unistd.h>
+#include <unordered_map>
+#include <fmt/format.h>
+
+namespace lox {
+
+// Files start with the magic, the number of natives and the source. Then
+// come the scopes, functions, classes and instances, each section with
+// its count, and last the values: the scopes' slots, the instances'
+// fields and the globals.
+static const char kMagic[8] = {'L', 'O', 'X', 'S', 'N', 'A', 'P', '1'};
+// A scope enclosed by the globals, or no superclass or owner.
+static constexpr uint32_t kNone = UINT32_MAX;
+
+namespace {
+
+enum class Tag: uint8_t
+{
+    // A variable declared but not yet assigned.
+    EMPTY,
+    NIL,
+    FALSE,
+    TRUE,
+    NUMBER,
+    STRING,
+    // Followed by the native's index in the interpreter.
+    NATIVE,
+    // Followed by the index of a function, class or instance, numbered
+    // in that order.
+    OBJECT
+};
+
+// The function and class declarations of a program in the order they
+// appear in its source.
+struct Declarations
+{
+    explicit Declarations(std::vector<std::unique_ptr<Stmt>>& statements)
+    {
+        for (auto& statement : statements) add(statement.get());
+    }
+
+    void add(Stmt* stmt)
+    {
+        if (auto block = dynamic_cast<Block*>(stmt)) {
+            for (auto& statement : *block->statements) add(statement.get());
+        }
+        else if (auto function = dynamic_cast<Function*>(stmt)) {
+            numbers[function] = uint32_t(functions.size());
+            functions.push_back(function);
+            for (auto& statement : *function->body) add(statement.get());
+        }
+        else if (auto klass = dynamic_cast<Class*>(stmt)) {
+            numbers[klass] = uint32_t(classes.size());
+            classes.push_back(klass);
+            for (auto& method : *klass->methods) add(method.get());
+        }
+        else if (auto branch = dynamic_cast<If*>(stmt)) {
+            add(branch->thenBranch.get());
+            if (branch->elseBranch != nullptr) add(branch->elseBranch.get());
+        }
+        else if (auto loop = dynamic_cast<While*>(stmt)) {
+            add(loop->body.get());
+        }
+    }
+
+    std::vector<Function*> functions;
+    std::vector<Class*> classes;
+    // Each declaration's index in its list.
+    std::unordered_map<const Stmt*, uint32_t> numbers;
+};
+
+}
+
+// Numbers the objects reachable from the globals, then writes them out.
+class Snapshot::Writer
+{
+public:
+    Writer(Interpreter& interpreter,
+        std::vector<std::unique_ptr<Stmt>>& statements);
+
+    std::string write(const std::string& source);
+
+private:
+    // Numbers what value refers to, failing for what can't be saved.
+    void collect(const any& value);
+    void collect(LoxFunction* function);
+    // Scopes and classes come after the ones they extend.
+    void collect(Environment* environment);
+    void collect(LoxClass* klass);
+
+    template <typename T>
+    void put(const T& value)
+    {
+        out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+    void putString(std::string_view string);
+    void putValue(const any& value);
+    uint32_t scope(Environment* environment) const;
+    uint32_t declaration(const Stmt* node) const;
+
+    Interpreter& interpreter;
+    Declarations declarations;
+    std::unordered_map<NativeCallable*, uint32_t> natives;
+    // The global being collected, for errors.
+    std::string root;
+    // Values whose objects are still to be collected.
+    std::vector<const any*> pending;
+
+    std::vector<Environment*> environments;
+    std::vector<LoxFunction*> functions;
+    std::vector<LoxClass*> classes;
+    std::vector<LoxInstance*> instances;
+    std::unordered_map<const void*, uint32_t> index;
+    std::string out;
+};
+
+namespace {
+
+class Reader
+{
+public:
+    Reader(const char* data, size_t size): data(data), size(size) {}
+
+    template <typename T>
+    T get()
+    {
+        if (size - offset < sizeof(T)) damaged();
+        T value;
+        std::memcpy(&value, data + offset, sizeof(T));
+        offset += sizeof(T);
+        return value;
+    }
+    std::string_view string()
+    {
+        auto length = get<uint32_t>();
+        if (size - offset < length) damaged();
+        std::string_view view(data + offset, length);
+        offset += length;
+        return view;
+    }
+    // An index below count, or kNone if none is allowed.
+    uint32_t index(size_t count, bool none = false)
+    {
+        auto value = get<uint32_t>();
+        if (value >= count && !(none && value == kNone)) damaged();
+        return value;
+    }
+    size_t position() const { return offset; }
+
+    [[noreturn]] static void damaged()
+    {
+        throw SnapshotError("it is damaged");
+    }
+
+private:
+    const char* data;
+    size_t size;
+    size_t offset = 0;
+};
+
+// Holds off collections while objects aren't reachable yet.
+class PauseGuard
+{
+public:
+    explicit PauseGuard(Heap& heap): heap(heap) { heap.pause(); }
+    ~PauseGuard() { heap.resume(); }
+
+private:
+    Heap& heap;
+};
+
+}
+
+static std::string describe(int error)
+{
+    return std::error_code(error, std::generic_category()).message();
+}
+
+Snapshot::Writer::Writer(Interpreter& interpreter,
+    std::vector<std::unique_ptr<Stmt>>& statements):
+    interpreter(interpreter), declarations(statements)
+{
+    for (size_t i = 0; i < interpreter.natives.size(); ++i) {
+        natives[interpreter.natives[i].get()] = uint32_t(i);
+    }
+}
+
+void Snapshot::Writer::collect(const any& value)
+{
+    if (auto function = std::any_cast<LoxFunction*>(&value)) {
+        collect(*function);
+    }
+    else if (auto klass = std::any_cast<LoxClass*>(&value)) {
+        collect(*klass);
+    }
+    else if (auto pointer = std::any_cast<LoxInstance*>(&value)) {
+        auto instance = *pointer;
+        if (!index.emplace(instance, uint32_t(instances.size())).second) {
+            return;
+        }
+        instances.push_back(instance);
+        collect(instance->shape->owner);
+        for (auto& field : instance->fields) pending.push_back(&field);
+    }
+    else if (auto native = std::any_cast<NativeCallable*>(&value)) {
+        if (natives.count(*native) == 0) {
+            throw SnapshotError(fmt::format("'{}' holds a generator or "
+                "another native object, which can't be saved", root));
+        }
+    }
+    else if (value.has_value() && !std::any_cast<double>(&value)
+        && !std::any_cast<bool>(&value)
+        && !std::any_cast<std::nullptr_t>(&value)
+        && !std::any_cast<StringRef>(&value)) {
+        throw SnapshotError(fmt::format("'{}' holds a value that can't be "
+            "saved", root));
+    }
+}
+
+void Snapshot::Writer::collect(LoxFunction* function)
+{
+    if (!index.emplace(function, uint32_t(functions.size())).second) return;
+    functions.push_back(function);
+    declaration(function->declaration);
+    collect(function->closure);
+}
+
+void Snapshot::Writer::collect(Environment* environment)
+{
+    // The scopes not collected yet, innermost first.
+    std::vector<Environment*> chain;
+    for (auto scope = environment;
+        scope != interpreter.globals && index.count(scope) == 0;
+        scope = scope->enclosing) {
+        chain.push_back(scope);
+    }
+    for (auto scope = chain.rbegin(); scope != chain.rend(); ++scope) {
+        index[*scope] = uint32_t(environments.size());
+        environments.push_back(*scope);
+        for (int i = 0; i < (*scope)->count; ++i) {
+            pending.push_back(&(*scope)->slot(i));
+        }
+    }
+}
+
+void Snapshot::Writer::collect(LoxClass* klass)
+{
+    std::vector<LoxClass*> chain;
+    for (auto scope = klass; scope != nullptr && index.count(scope) == 0;
+        scope = scope->superclass) {
+        chain.push_back(scope);
+    }
+    for (auto scope = chain.rbegin(); scope != chain.rend(); ++scope) {
+        index[*scope] = uint32_t(classes.size());
+        classes.push_back(*scope);
+        for (auto& method : (*scope)->methods) collect(method.second);
+    }
+}
+
+uint32_t Snapshot::Writer::declaration(const Stmt* node) const
+{
+    if (node == nullptr) return kNone;
+    auto found = declarations.numbers.find(node);
+    if (found == declarations.numbers.end()) {
+        throw SnapshotError(fmt::format("'{}' holds a function declared "
+            "outside the prelude", root));
+    }
+    return found->second;
+}
+
+uint32_t Snapshot::Writer::scope(Environment* environment) const
+{
+    if (environment == interpreter.globals) return kNone;
+    return index.at(environment);
+}
+
+void Snapshot::Writer::putString(std::string_view string)
+{
+    put(uint32_t(string.size()));
+    out.append(string);
+}
+
+void Snapshot::Writer::putValue(const any& value)
+{
+    if (!value.has_value()) {
+        put(Tag::EMPTY);
+    }
+    else if (auto number = std::any_cast<double>(&value)) {
+        put(Tag::NUMBER);
+        put(*number);
+    }
+    else if (auto boolean = std::any_cast<bool>(&value)) {
+        put(*boolean ? Tag::TRUE : Tag::FALSE);
+    }
+    else if (std::any_cast<std::nullptr_t>(&value)) {
+        put(Tag::NIL);
+    }
+    else if (auto string = std::any_cast<StringRef>(&value)) {
+        put(Tag::STRING);
+        putString(string->view());
+    }
+    else if (auto native = std::any_cast<NativeCallable*>(&value)) {
+        put(Tag::NATIVE);
+        put(natives.at(*native));
+    }
+    else {
+        uint32_t object = 0;
+        if (auto function = std::any_cast<LoxFunction*>(&value)) {
+            object = index.at(*function);
+        }
+        else if (auto klass = std::any_cast<LoxClass*>(&value)) {
+            object = uint32_t(functions.size()) + index.at(*klass);
+        }
+        else {
+            object = uint32_t(functions.size() + classes.size())
+                + index.at(std::any_cast<LoxInstance*>(value));
+        }
+        put(Tag::OBJECT);
+        put(object);
+    }
+}
+
+std::string Snapshot::Writer::write(const std::string& source)
+{
+    // Sorted, so that the same heap always makes the same file.
+    std::vector<const std::pair<const std::string, any>*> globals;
+    for (auto& entry : interpreter.globals->entries()) {
+        globals.push_back(&entry);
+    }
+    std::sort(globals.begin(), globals.end(),
+        [](auto a, auto b) { return a->first < b->first; });
+    for (auto global : globals) {
+        root = global->first;
+        collect(global->second);
+        while (!pending.empty()) {
+            auto value = pending.back();
+            pending.pop_back();
+            collect(*value);
+        }
+    }
+
+    out.append(kMagic, sizeof(kMagic));
+    put(uint32_t(natives.size()));
+    putString(source);
+
+    put(uint32_t(environments.size()));
+    for (auto environment : environments) {
+        put(scope(environment->enclosing));
+        put(uint32_t(environment->count));
+    }
+    put(uint32_t(functions.size()));
+    for (auto function : functions) {
+        put(declaration(function->declaration));
+        put(scope(function->closure));
+        put(declaration(function->owner));
+    }
+    put(uint32_t(classes.size()));
+    for (auto klass : classes) {
+        putString(klass->name);
+        put(klass->superclass == nullptr ? kNone
+            : index.at(klass->superclass));
+        put(uint8_t(klass->thisEscapes));
+        // Sorted, as the order of an unordered map isn't reproducible.
+        std::vector<const std::pair<const std::string, LoxFunction*>*>
+            methods;
+        for (auto& method : klass->methods) methods.push_back(&method);
+        std::sort(methods.begin(), methods.end(),
+            [](auto a, auto b) { return a->first < b->first; });
+        put(uint32_t(methods.size()));
+        for (auto method : methods) {
+            putString(method->first);
+            put(index.at(method->second));
+        }
+    }
+    put(uint32_t(instances.size()));
+    for (auto instance : instances) {
+        put(index.at(instance->shape->owner));
+        std::vector<const std::string*> fields(instance->fields.size());
+        for (auto& slot : instance->shape->slots) {
+            fields[slot.second] = &slot.first;
+        }
+        put(uint32_t(fields.size()));
+        for (auto field : fields) putString(*field);
+    }
+
+    for (auto environment : environments) {
+        for (int i = 0; i < environment->count; ++i) {
+            putValue(environment->slot(i));
+        }
+    }
+    for (auto instance : instances) {
+        for (auto& field : instance->fields) putValue(field);
+    }
+    put(uint32_t(globals.size()));
+    for (auto global : globals) {
+        putString(global->first);
+        putValue(global->second);
+    }
+    return std::move(out);
+}
+
+void Snapshot::save(const std::string& path, Interpreter& interpreter,
+    const std::string& source, std::vector<std::unique_ptr<Stmt>>& statements)
+{
+    if (interpreter.vm != nullptr) {
+        throw SnapshotError("the vm engine keeps its heap to itself");
+    }
+    auto contents = Writer(interpreter, statements).write(source);
+    std::ofstream output(path, std::ios::binary | std::ios::trunc);
+    output.write(contents.data(), contents.size());
+    if (!output.flush()) {
+        throw SnapshotError("the file can't be written");
+    }
+}
+
+Snapshot::Snapshot(const std::string& path)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat status = {};
+    if (fd < 0 || fstat(fd, &status) < 0) {
+        auto error = errno;
+        if (fd >= 0) close(fd);
+        throw SnapshotError(describe(error));
+    }
+    size = size_t(status.st_size);
+    auto memory = size == 0 ? MAP_FAILED
+        : mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (size < sizeof(kMagic) || memory == MAP_FAILED
+        || std::memcmp(memory, kMagic, sizeof(kMagic)) != 0) {
+        if (memory != MAP_FAILED) munmap(memory, size);
+        throw SnapshotError("it isn't a snapshot");
+    }
+    data = static_cast<const char*>(memory);
+
+    Reader reader(data + sizeof(kMagic), size - sizeof(kMagic));
+    try {
+        reader.get<uint32_t>();
+        prelude = reader.string();
+    }
+    catch (const SnapshotError&) {
+        munmap(memory, size);
+        throw;
+    }
+    heap = sizeof(kMagic) + reader.position();
+}
+
+Snapshot::~Snapshot()
+{
+    munmap(const_cast<char*>(data), size);
+}
+
+std::string_view Snapshot::source() const
+{
+    return prelude;
+}
+
+void Snapshot::restore(Interpreter& interpreter,
+    std::vector<std::unique_ptr<Stmt>>& statements) const
+{
+    if (interpreter.vm != nullptr) {
+        throw SnapshotError("the vm engine keeps its heap to itself");
+    }
+    Reader header(data + sizeof(kMagic), size - sizeof(kMagic));
+    if (header.get<uint32_t>() != interpreter.natives.size()) {
+        throw SnapshotError("it was written by another build");
+    }
+
+    Declarations declarations(statements);
+    auto closures = interpreter.closures.get();
+    // The bodies of the prelude's functions, without running it.
+    if (closures != nullptr) closures->compile(statements);
+
+    Reader reader(data + heap, size - heap);
+    auto& objects = interpreter.heap;
+    PauseGuard pause(objects);
+
+    std::vector<Environment*> environments(reader.get<uint32_t>());
+    for (size_t i = 0; i < environments.size(); ++i) {
+        auto enclosing = reader.index(i, true);
+        auto count = reader.get<uint32_t>();
+        if (count > size) Reader::damaged();
+        environments[i] = Environment::create(objects,
+            enclosing == kNone ? interpreter.globals : environments[enclosing],
+            int(count), true);
+    }
+    auto scope = [&](uint32_t index) -> Environment* {
+        return index == kNone ? interpreter.globals : environments[index];
+    };
+
+    std::vector<any> values;
+    std::vector<LoxFunction*> functions(reader.get<uint32_t>());
+    for (auto& function : functions) {
+        auto declaration = declarations.functions[
+            reader.index(declarations.functions.size())];
+        auto closure = scope(reader.index(environments.size(), true));
+        auto owner = reader.index(declarations.classes.size(), true);
+        function = objects.make<LoxFunction>(declaration, closure,
+            closures != nullptr ? closures->body(declaration) : nullptr,
+            owner == kNone ? nullptr : declarations.classes[owner]);
+        values.push_back(function);
+    }
+
+    std::vector<LoxClass*> classes(reader.get<uint32_t>());
+    for (size_t i = 0; i < classes.size(); ++i) {
+        std::string name(reader.string());
+        auto superclass = reader.index(i, true);
+        bool thisEscapes = reader.get<uint8_t>() != 0;
+        std::unordered_map<std::string, LoxFunction*> methods;
+        auto count = reader.get<uint32_t>();
+        for (uint32_t j = 0; j < count; ++j) {
+            std::string method(reader.string());
+            methods[method] = functions[reader.index(functions.size())];
+        }
+        classes[i] = objects.make<LoxClass>(name,
+            superclass == kNone ? nullptr : classes[superclass],
+            std::move(methods), thisEscapes);
+        values.push_back(classes[i]);
+    }
+
+    std::vector<LoxInstance*> instances(reader.get<uint32_t>());
+    for (auto& instance : instances) {
+        auto klass = classes[reader.index(classes.size())];
+        auto shape = &klass->root;
+        auto count = reader.get<uint32_t>();
+        for (uint32_t j = 0; j < count; ++j) {
+            shape = shape->transition(std::string(reader.string()));
+        }
+        if (shape->size() != count) Reader::damaged();
+        instance = objects.make<LoxInstance>(shape);
+        instance->fields.resize(count);
+        values.push_back(instance);
+    }
+
+    auto value = [&]() -> any {
+        switch (reader.get<Tag>()) {
+        case Tag::EMPTY: return any();
+        case Tag::NIL: return nullptr;
+        case Tag::FALSE: return false;
+        case Tag::TRUE: return true;
+        case Tag::NUMBER: return reader.get<double>();
+        case Tag::STRING: return LoxString::make(reader.string());
+        case Tag::NATIVE:
+            return static_cast<NativeCallable*>(interpreter.natives[
+                reader.index(interpreter.natives.size())].get());
+        case Tag::OBJECT: return values[reader.index(values.size())];
+        }
+        Reader::damaged();
+    };
+    for (auto environment : environments) {
+        for (int i = 0; i < environment->count; ++i) {
+            environment->slot(i) = value();
+        }
+    }
+    for (auto instance : instances) {
+        for (auto& field : instance->fields) field = value();
+    }
+    auto count = reader.get<uint32_t>();
+    for (uint32_t i = 0; i < count; ++i) {
+        std::string name(reader.string());
+        interpreter.globals->define(name, value());
+    }
+}
+
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace lox {
+
+class Interpreter;
+class Stmt;
+
+// A file it couldn't write, or a snapshot it couldn't read.
+class SnapshotError: public std::runtime_error
+{
+public:
+    explicit SnapshotError(const std::string& message):
+        std::runtime_error(message) {}
+};
+
+// The heap of a program that has finished, written by --snapshot-out and
+// read back by --snapshot-in, so that a script can start from the
+// globals a prelude left instead of running the prelude again.
+//
+// A snapshot holds the prelude's source and everything reachable from
+// its globals: scopes, functions, classes, instances and their values.
+// Functions refer to their declarations by their place in the prelude,
+// which is compiled again before the snapshot is restored. Nodes carry
+// caches and compiled code that only make sense in the process that
+// made them, and parsing the source is cheap next to running it.
+//
+// Numbers and lengths are in the host's byte order, and natives are
+// saved by the order they were defined in, so a snapshot only fits the
+// build that wrote it. Generators and the results of parallel
+// operations can't be saved.
+class Snapshot
+{
+public:
+    // Writes the heap of interpreter, which ran the statements compiled
+    // from source. Throws SnapshotError.
+    static void save(const std::string& path, Interpreter& interpreter,
+        const std::string& source,
+        std::vector<std::unique_ptr<Stmt>>& statements);
+
+    // Maps the snapshot at path. Throws SnapshotError if it can't be read
+    // or isn't a snapshot at all.
+    explicit Snapshot(const std::string& path);
+    ~Snapshot();
+    Snapshot(const Snapshot&) = delete;
+    Snapshot& operator=(const Snapshot&) = delete;
+
+    // The prelude the snapshot was taken of.
+    std::string_view source() const;
+    // Defines the saved globals in interpreter, which must not have run
+    // anything yet. statements must be source() compiled into its
+    // constant pool. Throws SnapshotError if the snapshot is damaged or
+    // doesn't fit the interpreter's natives or statements.
+    void restore(Interpreter& interpreter,
+        std::vector<std::unique_ptr<Stmt>>& statements) const;
+
+private:
+    class Writer;
+
+    const char* data = nullptr;
+    size_t size = 0;
+    // Where the heap starts, after the header and the source.
+    size_t heap = 0;
+    std::string_view prelude;
+};
+
+}
@@ -0,0 +1,682 @@
+#include "Stackless.h"
+#include "LoxClass.h"
+#include "Generator.h"
+#include <utility>
+
+namespace lox {
+
+void Stackless::start(std::vector<std::unique_ptr<Stmt>>& statements)
+{
+    push(Kind::PROGRAM, &statements);
+}
+
+bool Stackless::resume(uint64_t maxSteps)
+{
+    try {
+        for (uint64_t steps = 0; steps < maxSteps; ++steps) {
+            if (tasks.empty()) return true;
+            step();
+        }
+        return tasks.empty();
+    }
+    catch (const RuntimeError&) {
+        unwindAll();
+        throw;
+    }
+}
+
+any Stackless::callback(LoxFunction* function, std::vector<any>& arguments)
+{
+    auto declaration = function->declaration;
+    if (declaration->generator) {
+        return function->call(interpreter,
+            Arguments(arguments.data(), arguments.size()));
+    }
+    auto environment = Environment::create(interpreter->heap,
+        function->closure, declaration->slots, declaration->escapes);
+    for (size_t i = 0; i < arguments.size(); ++i) {
+        environment->slot(i) = std::move(arguments[i]);
+    }
+    uint32_t state = function->initializer ? 1 : 0;
+    tasks.push_back(Task{Kind::FRAME, state, declaration, 0, values.size(),
+        nullptr});
+    enterScope(tasks.back(), environment);
+    resume();
+    // The frame's result.
+    auto result = std::move(values.back());
+    values.clear();
+    return result;
+}
+
+void Stackless::markRoots(Heap& heap)
+{
+    for (auto& task : tasks) {
+        heap.markObject(task.saved);
+        if (task.kind == Kind::GENERATOR) {
+            heap.markObject(static_cast<Generator*>(task.node));
+        }
+    }
+    for (auto& value : values) {
+        heap.markValue(value);
+    }
+}
+
+void Stackless::push(Kind kind, void* node)
+{
+    tasks.push_back(Task{kind, 0, node, 0, 0, nullptr});
+}
+
+any Stackless::visitAssignExpr(Assign* expr)
+{
+    push(Kind::ASSIGN, expr);
+    return any();
+}
+
+any Stackless::visitBinaryExpr(Binary* expr)
+{
+    push(Kind::BINARY, expr);
+    return any();
+}
+
+any Stackless::visitCallExpr(Call* expr)
+{
+    push(Kind::CALL, expr);
+    return any();
+}
+
+any Stackless::visitGetExpr(Get* expr)
+{
+    push(Kind::GET, expr);
+    return any();
+}
+
+any Stackless::visitGroupingExpr(Grouping* expr)
+{
+    schedule(expr->expression.get());
+    return any();
+}
+
+any Stackless::visitLiteralExpr(Literal* expr)
+{
+    values.push_back(interpreter->constants.at(expr->constant));
+    return any();
+}
+
+any Stackless::visitLogicalExpr(Logical* expr)
+{
+    push(Kind::LOGICAL, expr);
+    return any();
+}
+
+any Stackless::visitSetExpr(Set* expr)
+{
+    push(Kind::SET, expr);
+    return any();
+}
+
+any Stackless::visitSuperExpr(Super* expr)
+{
+    values.push_back(interpreter->superMethod(expr));
+    return any();
+}
+
+any Stackless::visitThisExpr(This* expr)
+{
+    values.push_back(interpreter->lookUpVariable(
+        *expr->keyword, expr->depth, expr->slot));
+    return any();
+}
+
+any Stackless::visitUnaryExpr(Unary* expr)
+{
+    push(Kind::UNARY, expr);
+    return any();
+}
+
+any Stackless::visitVarExprExpr(VarExpr* expr)
+{
+    values.push_back(interpreter->lookUpVariable(
+        *expr->name, expr->depth, expr->slot));
+    return any();
+}
+
+any Stackless::visitBlockStmt(Block* stmt)
+{
+    push(Kind::BLOCK, stmt);
+    return any();
+}
+
+any Stackless::visitExpressionStmt(Expression* stmt)
+{
+    push(Kind::EXPRESSION, stmt);
+    return any();
+}
+
+any Stackless::visitFunctionStmt(Function* stmt)
+{
+    return interpreter->visitFunctionStmt(stmt);
+}
+
+any Stackless::visitClassStmt(Class* stmt)
+{
+    return interpreter->visitClassStmt(stmt);
+}
+
+any Stackless::visitIfStmt(If* stmt)
+{
+    push(Kind::IF, stmt);
+    return any();
+}
+
+any Stackless::visitPrintStmt(Print* stmt)
+{
+    push(Kind::PRINT, stmt);
+    return any();
+}
+
+any Stackless::visitReturnStmt(Return* stmt)
+{
+    push(Kind::RETURN, stmt);
+    return any();
+}
+
+any Stackless::visitVarStmtStmt(VarStmt* stmt)
+{
+    if (stmt->initializer == nullptr) {
+        interpreter->define(stmt->slot, *stmt->name, nullptr);
+    }
+    else {
+        push(Kind::VAR, stmt);
+    }
+    return any();
+}
+
+any Stackless::visitWhileStmt(While* stmt)
+{
+    push(Kind::WHILE, stmt);
+    return any();
+}
+
+any Stackless::visitYieldStmt(Yield* stmt)
+{
+    push(Kind::YIELD, stmt);
+    return any();
+}
+
+// Advances the task on top by one state. Anything that schedules a node
+// may grow the task stack, so task is not used after scheduling.
+void Stackless::step()
+{
+    Task& task = tasks.back();
+    switch (task.kind) {
+    case Kind::PROGRAM: {
+        auto statements = static_cast<vector<unique_ptr<Stmt>>*>(task.node);
+        if (task.index < statements->size()) {
+            schedule(statements->at(task.index++).get());
+        }
+        else {
+            tasks.pop_back();
+        }
+        break;
+    }
+    case Kind::FRAME: {
+        auto function = static_cast<Function*>(task.node);
+        if (task.index < function->body->size()) {
+            schedule(function->body->at(task.index++).get());
+        }
+        else {
+            // Fell off the end of the body without a return.
+            values.push_back(frameResult(task, any()));
+            leaveScope(task);
+            tasks.pop_back();
+        }
+        break;
+    }
+    case Kind::GENERATOR: {
+        // The body returned, and nil is the call's result.
+        auto generator = static_cast<Generator*>(task.node);
+        generator->state = Generator::State::DONE;
+        generator->finish();
+        values.back() = nullptr;
+        tasks.pop_back();
+        break;
+    }
+    case Kind::ASSIGN: {
+        auto expr = static_cast<Assign*>(task.node);
+        if (task.state == 0) {
+            task.state = 1;
+            schedule(expr->value.get());
+        }
+        else {
+            interpreter->assign(expr, values.back());
+            tasks.pop_back();
+        }
+        break;
+    }
+    case Kind::BINARY: {
+        auto expr = static_cast<Binary*>(task.node);
+        if (task.state == 0) {
+            task.state = 1;
+            schedule(expr->left.get());
+        }
+        else if (task.state == 1) {
+            task.state = 2;
+            schedule(expr->right.get());
+        }
+        else {
+            size_t size = values.size();
+            auto result = interpreter->binary(expr,
+                values[size - 2], values[size - 1]);
+            values.pop_back();
+            values.back() = std::move(result);
+            tasks.pop_back();
+        }
+        break;
+    }
+    case Kind::CALL: {
+        auto expr = static_cast<Call*>(task.node);
+        if (task.state == 0) {
+            task.base = values.size();
+            task.state = 1;
+            schedule(expr->callee.get());
+        }
+        else if (task.state - 1 < expr->arguments->size()) {
+            size_t argument = task.state++ - 1;
+            schedule(expr->arguments->at(argument).get());
+        }
+        else {
+            call();
+        }
+        break;
+    }
+    case Kind::GET: {
+        auto expr = static_cast<Get*>(task.node);
+        if (task.state == 0) {
+            task.state = 1;
+            schedule(expr->object.get());
+        }
+        else {
+            values.back() = interpreter->getProperty(expr, values.back());
+            tasks.pop_back();
+        }
+        break;
+    }
+    case Kind::SET: {
+        auto expr = static_cast<Set*>(task.node);
+        if (task.state == 0) {
+            task.state = 1;
+            schedule(expr->object.get());
+        }
+        else if (task.state == 1) {
+            if (std::any_cast<LoxInstance*>(&values.back()) == nullptr) {
+                throw RuntimeError(*expr->name, "Only instances have fields.");
+            }
+            task.state = 2;
+            schedule(expr->value.get());
+        }
+        else {
+            size_t size = values.size();
+            interpreter->setProperty(expr, values[size - 2], values[size - 1]);
+            values[size - 2] = std::move(values[size - 1]);
+            values.pop_back();
+            tasks.pop_back();
+        }
+        break;
+    }
+    case Kind::LOGICAL: {
+        auto expr = static_cast<Logical*>(task.node);
+        if (task.state == 0) {
+            task.state = 1;
+            schedule(expr->left.get());
+            break;
+        }
+        bool truthy = interpreter->isTruthy(&values.back());
+        tasks.pop_back();
+        if (expr->op->type == TokenType::OR ? !truthy : truthy) {
+            // The right operand's value is the result.
+            values.pop_back();
+            schedule(expr->right.get());
+        }
+        break;
+    }
+    case Kind::UNARY: {
+        auto expr = static_cast<Unary*>(task.node);
+        if (task.state == 0) {
+            task.state = 1;
+            schedule(expr->right.get());
+        }
+        else {
+            values.back() = interpreter->unary(expr, values.back());
+            tasks.pop_back();
+        }
+        break;
+    }
+    case Kind::BLOCK: {
+        auto stmt = static_cast<Block*>(task.node);
+        if (task.state == 0) {
+            task.state = 1;
+            enterScope(task, Environment::create(interpreter->heap,
+                interpreter->environment, stmt->slots, stmt->escapes));
+        }
+        if (task.index < stmt->statements->size()) {
+            schedule(stmt->statements->at(task.index++).get());
+        }
+        else {
+            leaveScope(task);
+            tasks.pop_back();
+        }
+        break;
+    }
+    case Kind::EXPRESSION: {
+        auto stmt = static_cast<Expression*>(task.node);
+        if (task.state == 0) {
+            task.state = 1;
+            schedule(stmt->expr.get());
+        }
+        else {
+            values.pop_back();
+            tasks.pop_back();
+        }
+        break;
+    }
+    case Kind::IF: {
+        auto stmt = static_cast<If*>(task.node);
+        if (task.state == 0) {
+            task.state = 1;
+            schedule(stmt->condition.get());
+            break;
+        }
+        bool truthy = interpreter->isTruthy(&values.back());
+        values.pop_back();
+        tasks.pop_back();
+        if (truthy) {
+            schedule(stmt->thenBranch.get());
+        }
+        else if (stmt->elseBranch != nullptr) {
+            schedule(stmt->elseBranch.get());
+        }
+        break;
+    }
+    case Kind::PRINT: {
+        auto stmt = static_cast<Print*>(task.node);
+        if (task.state == 0) {
+            task.state = 1;
+            schedule(stmt->expr.get());
+        }
+        else {
+            interpreter->print(values.back());
+            values.pop_back();
+            tasks.pop_back();
+        }
+        break;
+    }
+    case Kind::RETURN: {
+        auto stmt = static_cast<Return*>(task.node);
+        if (task.state == 0 && stmt->value != nullptr) {
+            task.state = 1;
+            schedule(stmt->value.get());
+        }
+        else {
+            if (stmt->value == nullptr) values.push_back(any());
+            unwindReturn();
+        }
+        break;
+    }
+    case Kind::VAR: {
+        auto stmt = static_cast<VarStmt*>(task.node);
+        if (task.state == 0) {
+            task.state = 1;
+            schedule(stmt->initializer.get());
+        }
+        else {
+            interpreter->define(stmt->slot, *stmt->name, values.back());
+            values.pop_back();
+            tasks.pop_back();
+        }
+        break;
+    }
+    case Kind::WHILE: {
+        auto stmt = static_cast<While*>(task.node);
+        if (task.state == 0) {
+            task.state = 1;
+            schedule(stmt->condition.get());
+            break;
+        }
+        bool truthy = interpreter->isTruthy(&values.back());
+        values.pop_back();
+        if (truthy) {
+            interpreter->tick(*stmt->keyword);
+            // Evaluate the condition again once the body is done.
+            task.state = 0;
+            schedule(stmt->body.get());
+        }
+        else {
+            tasks.pop_back();
+        }
+        break;
+    }
+    case Kind::YIELD: {
+        auto stmt = static_cast<Yield*>(task.node);
+        if (task.state == 0) {
+            task.state = 1;
+            schedule(stmt->value.get());
+        }
+        else {
+            suspendGenerator();
+        }
+        break;
+    }
+    }
+}
+
+// The callee and its arguments are on top of the value stack.
+void Stackless::call()
+{
+    Task& task = tasks.back();
+    auto expr = static_cast<Call*>(task.node);
+    size_t base = task.base;
+    size_t count = values.size() - base - 1;
+    auto function = interpreter->callable(expr, values[base], count);
+
+    auto loxFuncPtr = std::any_cast<LoxFunction*>(&values[base]);
+    // A class with an initializer runs it as a frame on a new instance.
+    if (auto classPtr = std::any_cast<LoxClass*>(&values[base])) {
+        auto klass = *classPtr;
+        values[base] = interpreter->heap.make<LoxInstance>(&klass->root);
+        if (klass->initializer == nullptr) {
+            values.resize(base + 1);
+            tasks.pop_back();
+            return;
+        }
+        // Stays on the stack below the bound initializer.
+        values.insert(values.begin() + base + 1, klass->initializer->bind(
+            interpreter, std::any_cast<LoxInstance*>(values[base])));
+        ++base;
+        loxFuncPtr = std::any_cast<LoxFunction*>(&values[base]);
+    }
+    if (auto nativePtr = std::any_cast<NativeCallable*>(&values[base])) {
+        if (auto generator = dynamic_cast<Generator*>(*nativePtr)) {
+            resumeGenerator(task, generator);
+            return;
+        }
+    }
+    // Calling a generator function only makes the generator.
+    if (loxFuncPtr == nullptr || (*loxFuncPtr)->declaration->generator) {
+        any result;
+        try {
+            result = function->call(interpreter,
+                Arguments(values.data() + base + 1, count));
+        }
+        catch (const NativeError& error) {
+            throw RuntimeError(*expr->paren, error.what());
+        }
+        values.resize(base);
+        values.push_back(std::move(result));
+        tasks.pop_back();
+        return;
+    }
+
+    size_t bytes = tasks.size() * sizeof(Task) + values.size() * sizeof(any);
+    if (bytes > budget) {
+        throw RuntimeError(*expr->paren, "Stack overflow.");
+    }
+
+    // The call task becomes the frame of the function's body.
+    auto declaration = (*loxFuncPtr)->declaration;
+    interpreter->tick(*declaration->name);
+    auto environment = Environment::create(interpreter->heap,
+        (*loxFuncPtr)->closure, declaration->slots, declaration->escapes);
+    for (size_t i = 0; i < count; ++i) {
+        environment->slot(i) = std::move(values[base + 1 + i]);
+    }
+    bool initializer = (*loxFuncPtr)->initializer;
+    values.resize(task.base);
+    task.kind = Kind::FRAME;
+    task.state = initializer ? 1 : 0;
+    task.node = declaration;
+    task.index = 0;
+    enterScope(task, environment);
+}
+
+// Moves the tasks and values of the generator's body back on top of the
+// call, which becomes a GENERATOR task below them.
+void Stackless::resumeGenerator(Task& task, Generator* generator)
+{
+    auto expr = static_cast<Call*>(task.node);
+    size_t base = task.base;
+    values.resize(base);
+    if (generator->state == Generator::State::DONE) {
+        values.push_back(nullptr);
+        tasks.pop_back();
+        return;
+    }
+    if (generator->state == Generator::State::RUNNING) {
+        throw RuntimeError(*expr->paren, "Generator is already running.");
+    }
+    if (generator->state == Generator::State::STARTING) {
+        generator->tasks.push_back(Task{Kind::FRAME, 0,
+            generator->declaration, 0, 0, nullptr});
+    }
+    size_t bytes = (tasks.size() + generator->tasks.size()) * sizeof(Task)
+        + (values.size() + generator->values.size()) * sizeof(any);
+    if (bytes > budget) {
+        throw RuntimeError(*expr->paren, "Stack overflow.");
+    }
+
+    generator->state = Generator::State::RUNNING;
+    task.kind = Kind::GENERATOR;
+    task.node = generator;
+    task.saved = interpreter->environment;
+    // The body's frame returns to this caller.
+    generator->tasks.front().saved = interpreter->environment;
+    for (auto& suspended : generator->tasks) {
+        if (suspended.kind == Kind::FRAME || suspended.kind == Kind::CALL) {
+            suspended.base += base;
+        }
+        tasks.push_back(suspended);
+    }
+    for (auto& value : generator->values) {
+        values.push_back(std::move(value));
+    }
+    generator->tasks.clear();
+    generator->values.clear();
+    interpreter->environment = generator->context.environment;
+}
+
+// Moves everything above the innermost GENERATOR task into its generator
+// and leaves the yielded value as the result of the call that resumed it.
+void Stackless::suspendGenerator()
+{
+    auto value = std::move(values.back());
+    values.pop_back();
+    tasks.pop_back();
+    size_t index = tasks.size() - 1;
+    while (tasks[index].kind != Kind::GENERATOR) --index;
+    Task& owner = tasks[index];
+    auto generator = static_cast<Generator*>(owner.node);
+    size_t base = owner.base;
+
+    for (size_t i = index + 1; i < tasks.size(); ++i) {
+        auto& suspended = generator->tasks.emplace_back(tasks[i]);
+        if (suspended.kind == Kind::FRAME || suspended.kind == Kind::CALL) {
+            suspended.base -= base;
+        }
+    }
+    for (size_t i = base; i < values.size(); ++i) {
+        generator->values.push_back(std::move(values[i]));
+    }
+    generator->context.environment = interpreter->environment;
+    generator->state = Generator::State::SUSPENDED;
+    interpreter->environment = owner.saved;
+    tasks.resize(index);
+    values.resize(base);
+    values.push_back(std::move(value));
+}
+
+// What a frame returns: an initializer's is always 'this', which its
+// closure binds.
+any Stackless::frameResult(Task& task, any value)
+{
+    if (task.state == 0) return value;
+    return interpreter->environment->ancestor(1)->slot(0);
+}
+
+void Stackless::enterScope(Task& task, Environment* scope)
+{
+    task.saved = interpreter->environment;
+    interpreter->environment = scope;
+}
+
+void Stackless::leaveScope(Task& task)
+{
+    bool escapes = task.kind == Kind::FRAME ?
+        static_cast<Function*>(task.node)->escapes :
+        static_cast<Block*>(task.node)->escapes;
+    auto scope = interpreter->environment;
+    interpreter->environment = task.saved;
+    if (!escapes) interpreter->heap.release(scope);
+}
+
+// Pops every task up to and including the enclosing function's frame,
+// leaving the returned value in place of the call.
+void Stackless::unwindReturn()
+{
+    auto value = std::move(values.back());
+    values.pop_back();
+    while (true) {
+        Task& task = tasks.back();
+        if (task.kind == Kind::BLOCK && task.state != 0) {
+            leaveScope(task);
+        }
+        else if (task.kind == Kind::FRAME) {
+            value = frameResult(task, std::move(value));
+            leaveScope(task);
+            values.resize(task.base);
+            values.push_back(std::move(value));
+            tasks.pop_back();
+            return;
+        }
+        tasks.pop_back();
+    }
+}
+
+// Abandons the program after an error, leaving every scope it was in.
+void Stackless::unwindAll()
+{
+    while (!tasks.empty()) {
+        Task& task = tasks.back();
+        if (task.kind == Kind::FRAME ||
+            (task.kind == Kind::BLOCK && task.state != 0)) {
+            leaveScope(task);
+        }
+        else if (task.kind == Kind::GENERATOR) {
+            auto generator = static_cast<Generator*>(task.node);
+            generator->state = Generator::State::DONE;
+            generator->finish();
+        }
+        tasks.pop_back();
+    }
+    values.clear();
+}
+
+}
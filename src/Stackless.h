@@ -0,0 +1,115 @@
+#pragma once
+
+#include "Interpreter.h"
+#include <cstdint>
+#include <vector>
+
+namespace lox {
+
+class Generator;
+
+// Evaluates the resolved AST without recursing on the C++ stack. Every
+// node in progress is a Task on an explicit work stack and every
+// intermediate value sits on an explicit value stack, both on the heap.
+// Recursion is limited only by the bytes those stacks may take, and since
+// the whole execution state lives in them, running can stop after any
+// number of steps and pick up again later.
+//
+// Values, variables, natives and errors are shared with the Interpreter,
+// so programs behave exactly as they do on the tree-walker.
+class Stackless: public ExprVisitor, public StmtVisitor
+{
+public:
+    static constexpr size_t kDefaultBudget = 64 * 1024 * 1024;
+
+    Stackless(Interpreter* interpreter, size_t budget):
+        interpreter(interpreter), budget(budget) {}
+    ~Stackless() override = default;
+
+    void start(std::vector<std::unique_ptr<Stmt>>& statements);
+    // Runs up to maxSteps tasks. Returns true once the program has
+    // finished, false if it is suspended and resume() should be called
+    // again.
+    bool resume(uint64_t maxSteps = UINT64_MAX);
+
+    // Runs function to completion outside any program, see
+    // Interpreter::callback().
+    any callback(LoxFunction* function, std::vector<any>& arguments);
+
+    void markRoots(Heap& heap);
+
+    // Scheduling a node pushes the task that evaluates it; nodes that
+    // need no further steps are evaluated on the spot.
+    any visitAssignExpr(Assign* expr) override;
+    any visitBinaryExpr(Binary* expr) override;
+    any visitCallExpr(Call* expr) override;
+    any visitGetExpr(Get* expr) override;
+    any visitGroupingExpr(Grouping* expr) override;
+    any visitLiteralExpr(Literal* expr) override;
+    any visitLogicalExpr(Logical* expr) override;
+    any visitSetExpr(Set* expr) override;
+    any visitSuperExpr(Super* expr) override;
+    any visitThisExpr(This* expr) override;
+    any visitUnaryExpr(Unary* expr) override;
+    any visitVarExprExpr(VarExpr* expr) override;
+
+    any visitBlockStmt(Block* stmt) override;
+    any visitExpressionStmt(Expression* stmt) override;
+    any visitFunctionStmt(Function* stmt) override;
+    any visitClassStmt(Class* stmt) override;
+    any visitIfStmt(If* stmt) override;
+    any visitPrintStmt(Print* stmt) override;
+    any visitReturnStmt(Return* stmt) override;
+    any visitVarStmtStmt(VarStmt* stmt) override;
+    any visitWhileStmt(While* stmt) override;
+    any visitYieldStmt(Yield* stmt) override;
+
+    // Public for the generators that keep a suspended body's tasks.
+    enum class Kind : uint8_t
+    {
+        PROGRAM,
+        // The body of a running Lox function. Its state is 1 if the
+        // function is an initializer.
+        FRAME,
+        // A call that resumed a generator, below the tasks of its body.
+        // Its saved environment is the caller's.
+        GENERATOR,
+        ASSIGN, BINARY, CALL, GET, LOGICAL, SET, UNARY,
+        BLOCK, EXPRESSION, IF, PRINT, RETURN, VAR, WHILE, YIELD
+    };
+
+    struct Task
+    {
+        Kind kind;
+        // How far the node has got, its meaning depends on the kind.
+        uint32_t state;
+        void* node;
+        // Next statement of a statement list.
+        size_t index;
+        // Height of the value stack when a call started.
+        size_t base;
+        // Environment to restore when a BLOCK or FRAME exits.
+        Environment* saved;
+    };
+
+private:
+    void push(Kind kind, void* node);
+    void schedule(Expr* expr) { expr->accept(this); }
+    void schedule(Stmt* stmt) { stmt->accept(this); }
+    void step();
+    void call();
+    void resumeGenerator(Task& task, Generator* generator);
+    void suspendGenerator();
+    void enterScope(Task& task, Environment* scope);
+    void leaveScope(Task& task);
+    any frameResult(Task& task, any value);
+    void unwindReturn();
+    void unwindAll();
+
+    Interpreter* interpreter;
+    size_t budget;
+    std::vector<Task> tasks;
+    std::vector<any> values;
+};
+
+}
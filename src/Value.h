@@ -0,0 +1,138 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <utility>
+#include "LoxString.h"
+
+namespace lox {
+
+class NativeCallable;
+class Closure;
+
+// A value on the bytecode VM: a type tag next to an unboxed payload.
+// Strings hold a reference on their LoxString; everything else is copied
+// bit for bit.
+class Value
+{
+public:
+    enum class Type : uint8_t
+    {
+        // What a function without a return value produces, printed as
+        // nothing. Distinct from nil, as on the tree-walker.
+        NONE,
+        NIL, BOOL, NUMBER, STRING, CLOSURE, NATIVE
+    };
+
+    Value(): type(Type::NONE) {}
+    Value(std::nullptr_t): type(Type::NIL) {}
+    Value(bool boolean): type(Type::BOOL) { as.boolean = boolean; }
+    Value(double number): type(Type::NUMBER) { as.number = number; }
+    Value(StringRef string): type(Type::STRING)
+    { new (&as.string) StringRef(std::move(string)); }
+    Value(Closure* closure): type(Type::CLOSURE) { as.closure = closure; }
+    Value(NativeCallable* native): type(Type::NATIVE) { as.native = native; }
+
+    Value(const Value& other): type(other.type)
+    {
+        if (type == Type::STRING) {
+            new (&as.string) StringRef(other.as.string);
+        }
+        else {
+            std::memcpy(static_cast<void*>(&as), &other.as, sizeof(as));
+        }
+    }
+    Value(Value&& other) noexcept: type(other.type)
+    {
+        // Takes over the string reference, if any.
+        std::memcpy(static_cast<void*>(&as), &other.as, sizeof(as));
+        other.type = Type::NONE;
+    }
+    ~Value() { reset(); }
+
+    Value& operator=(const Value& other)
+    {
+        if (this != &other) {
+            reset();
+            new (this) Value(other);
+        }
+        return *this;
+    }
+    Value& operator=(Value&& other) noexcept
+    {
+        if (this != &other) {
+            reset();
+            new (this) Value(std::move(other));
+        }
+        return *this;
+    }
+
+    void reset()
+    {
+        if (type == Type::STRING) as.string.~StringRef();
+        type = Type::NONE;
+    }
+
+    Type kind() const { return type; }
+    bool isNone() const { return type == Type::NONE; }
+    bool isNil() const { return type == Type::NIL; }
+    bool isBool() const { return type == Type::BOOL; }
+    bool isNumber() const { return type == Type::NUMBER; }
+    bool isString() const { return type == Type::STRING; }
+    bool isClosure() const { return type == Type::CLOSURE; }
+    bool isNative() const { return type == Type::NATIVE; }
+
+    bool asBool() const { return as.boolean; }
+    double asNumber() const { return as.number; }
+    double& number() { return as.number; }
+    const StringRef& asString() const { return as.string; }
+    Closure* asClosure() const { return as.closure; }
+    NativeCallable* asNative() const { return as.native; }
+
+    bool isTruthy() const
+    {
+        if (type == Type::BOOL) return as.boolean;
+        return type != Type::NONE && type != Type::NIL;
+    }
+
+    friend bool operator==(const Value& a, const Value& b)
+    {
+        if (a.type != b.type) return false;
+        switch (a.type) {
+        case Type::NONE:
+        case Type::NIL:
+            return true;
+        case Type::BOOL:
+            return a.as.boolean == b.as.boolean;
+        case Type::NUMBER:
+            return a.as.number == b.as.number;
+        case Type::STRING:
+            return a.as.string == b.as.string;
+        case Type::CLOSURE:
+            return a.as.closure == b.as.closure;
+        case Type::NATIVE:
+            return a.as.native == b.as.native;
+        }
+        return false;
+    }
+
+private:
+    union Payload
+    {
+        Payload(): number(0.0) {}
+        ~Payload() {}
+
+        bool boolean;
+        double number;
+        StringRef string;
+        Closure* closure;
+        NativeCallable* native;
+    };
+
+    Type type;
+    Payload as;
+};
+
+}
@@ -0,0 +1,500 @@
+#include "Vm.h"
+#include "Compiler.h"
+#include "Interpreter.h"
+#include "LoxCallable.h"
+#include "Lox.h"
+#include <fmt/format.h>
+
+#if defined(__GNUC__) || defined(__clang__)
+#define LOX_COMPUTED_GOTO 1
+#endif
+
+namespace lox {
+
+static_assert(sizeof(Closure) % alignof(Upvalue*) == 0,
+    "upvalues must be aligned");
+
+void Closure::trace(Heap& heap)
+{
+    for (int i = 0; i < function->upvalueCount; ++i) {
+        heap.markObject(upvalues()[i]);
+    }
+}
+
+void Upvalue::trace(Heap& heap)
+{
+    if (closed.isClosure()) heap.markObject(closed.asClosure());
+}
+
+// Natives take and return std::any, as on the tree-walker.
+static std::any toAny(const Value& value)
+{
+    switch (value.kind()) {
+    case Value::Type::NONE: return std::any();
+    case Value::Type::NIL: return nullptr;
+    case Value::Type::BOOL: return value.asBool();
+    case Value::Type::NUMBER: return value.asNumber();
+    case Value::Type::STRING: return value.asString();
+    case Value::Type::CLOSURE: return value.asClosure();
+    case Value::Type::NATIVE: return value.asNative();
+    }
+    return std::any();
+}
+
+static Value fromAny(const std::any& value)
+{
+    if (!value.has_value()) return Value();
+    if (auto ptr = std::any_cast<double>(&value)) return *ptr;
+    if (auto ptr = std::any_cast<bool>(&value)) return *ptr;
+    if (auto ptr = std::any_cast<StringRef>(&value)) return *ptr;
+    if (auto ptr = std::any_cast<Closure*>(&value)) return *ptr;
+    if (auto ptr = std::any_cast<NativeCallable*>(&value)) return *ptr;
+    return nullptr;
+}
+
+Vm::Vm(Interpreter* interpreter):
+    interpreter(interpreter), heap(interpreter->heap),
+    stack(new Value[kStackSize]), top(stack.get())
+{
+    for (auto& [name, value] : interpreter->globals->entries()) {
+        if (auto native = std::any_cast<NativeCallable*>(&value)) {
+            auto key = LoxString::intern(name);
+            globals[key.get()] = Global{key, *native};
+        }
+    }
+}
+
+void Vm::interpret(std::vector<std::unique_ptr<Stmt>>& statements)
+{
+    Compiler compiler(interpreter->constants, functions);
+    auto script = compiler.compile(statements);
+    if (script == nullptr) return;
+
+    auto closure = heap.make<Closure>(script);
+    push(closure);
+    frames[0] = CallFrame{closure, script->chunk.code.data(), stack.get()};
+    frameCount = 1;
+    try {
+        run();
+    }
+    catch (const RuntimeError&) {
+        reset();
+        throw;
+    }
+    drop();
+}
+
+std::any Vm::callback(Closure* closure, std::vector<std::any>& arguments)
+{
+    push(closure);
+    for (auto& argument : arguments) {
+        push(fromAny(argument));
+    }
+    frames[0] = CallFrame{closure, closure->function->chunk.code.data(),
+        stack.get()};
+    frameCount = 1;
+    try {
+        run();
+    }
+    catch (const RuntimeError&) {
+        reset();
+        throw;
+    }
+    auto result = toAny(top[-1]);
+    drop();
+    return result;
+}
+
+std::any Vm::global(const std::string& name)
+{
+    auto iter = globals.find(LoxString::intern(name).get());
+    if (iter == globals.end()) return std::any();
+    return toAny(iter->second.value);
+}
+
+void Vm::reset()
+{
+    while (top != stack.get()) drop();
+    frameCount = 0;
+    openUpvalues = nullptr;
+}
+
+void Vm::runtimeError(const std::string& message)
+{
+    throw RuntimeError(location(), message);
+}
+
+Token Vm::location() const
+{
+    auto& frame = frames[frameCount - 1];
+    auto& chunk = frame.closure->function->chunk;
+    int line = chunk.lines[frame.ip - chunk.code.data() - 1];
+    return Token(TokenType::TOKEN_EOF, "", std::any(), line);
+}
+
+void Vm::markRoots(Heap& heap)
+{
+    for (auto value = stack.get(); value != top; ++value) {
+        markValue(heap, *value);
+    }
+    for (int i = 0; i < frameCount; ++i) {
+        heap.markObject(frames[i].closure);
+    }
+    for (auto upvalue = openUpvalues; upvalue; upvalue = upvalue->next) {
+        heap.markObject(upvalue);
+    }
+    for (auto& [name, global] : globals) {
+        markValue(heap, global.value);
+    }
+}
+
+void Vm::markValue(Heap& heap, const Value& value)
+{
+    if (value.isClosure()) heap.markObject(value.asClosure());
+}
+
+Upvalue* Vm::captureUpvalue(Value* slot)
+{
+    // The open list is sorted from the top of the stack down.
+    Upvalue* previous = nullptr;
+    Upvalue* upvalue = openUpvalues;
+    while (upvalue != nullptr && upvalue->location > slot) {
+        previous = upvalue;
+        upvalue = upvalue->next;
+    }
+    if (upvalue != nullptr && upvalue->location == slot) return upvalue;
+
+    auto created = heap.make<Upvalue>(slot);
+    created->next = upvalue;
+    if (previous == nullptr) {
+        openUpvalues = created;
+    }
+    else {
+        previous->next = created;
+    }
+    return created;
+}
+
+void Vm::closeUpvalues(Value* last)
+{
+    while (openUpvalues != nullptr && openUpvalues->location >= last) {
+        Upvalue* upvalue = openUpvalues;
+        upvalue->closed = std::move(*upvalue->location);
+        upvalue->location = &upvalue->closed;
+        openUpvalues = upvalue->next;
+    }
+}
+
+Value Vm::callNative(NativeCallable* native, int count)
+{
+    nativeArguments.clear();
+    for (int i = count; i > 0; --i) {
+        nativeArguments.push_back(toAny(top[-i]));
+    }
+    std::any result;
+    try {
+        result = native->call(interpreter,
+            Arguments(nativeArguments.data(), count));
+    }
+    catch (const NativeError& error) {
+        runtimeError(error.what());
+    }
+    nativeArguments.clear();
+    return fromAny(result);
+}
+
+void Vm::run()
+{
+    CallFrame* frame = &frames[frameCount - 1];
+    const uint8_t* ip = frame->ip;
+    Value* slots = frame->slots;
+    const Value* constants = frame->closure->function->chunk.constants.data();
+
+#define READ_BYTE() (*ip++)
+#define READ_SHORT() (ip += 2, uint16_t((ip[-2] << 8) | ip[-1]))
+#define LOAD_FRAME() \
+    do { \
+        frame = &frames[frameCount - 1]; \
+        ip = frame->ip; \
+        slots = frame->slots; \
+        constants = frame->closure->function->chunk.constants.data(); \
+    } while (false)
+#define ERROR(...) \
+    do { \
+        frame->ip = ip; \
+        runtimeError(fmt::format(__VA_ARGS__)); \
+    } while (false)
+#define TICK() \
+    do { \
+        if (--interpreter->ticks < 0) { \
+            frame->ip = ip; \
+            interpreter->safepoint(location()); \
+        } \
+    } while (false)
+#define NUMBER_OPERANDS() \
+    if (!top[-2].isNumber() || !top[-1].isNumber()) { \
+        ERROR("Operands must be numbers."); \
+    }
+#define COMPARE(op) \
+    { \
+        NUMBER_OPERANDS(); \
+        bool result = top[-2].asNumber() op top[-1].asNumber(); \
+        --top; \
+        top[-1] = Value(result); \
+        DISPATCH(); \
+    }
+#define ARITHMETIC(op) \
+    { \
+        NUMBER_OPERANDS(); \
+        top[-2].number() = top[-2].asNumber() op top[-1].asNumber(); \
+        --top; \
+        DISPATCH(); \
+    }
+
+#ifdef LOX_COMPUTED_GOTO
+    static void* dispatchTable[] = {
+#define LOX_OPCODE_LABEL(name) &&op_##name,
+        LOX_OPCODES(LOX_OPCODE_LABEL)
+#undef LOX_OPCODE_LABEL
+    };
+#define DISPATCH() goto *dispatchTable[READ_BYTE()]
+#define CASE(name) op_##name:
+    DISPATCH();
+#else
+#define DISPATCH() continue
+#define CASE(name) case OpCode::name:
+    for (;;) {
+    switch (static_cast<OpCode>(READ_BYTE())) {
+#endif
+
+    CASE(CONSTANT) {
+        push(constants[READ_SHORT()]);
+        DISPATCH();
+    }
+    CASE(NONE) {
+        push(Value());
+        DISPATCH();
+    }
+    CASE(NIL) {
+        push(nullptr);
+        DISPATCH();
+    }
+    CASE(TRUE) {
+        push(true);
+        DISPATCH();
+    }
+    CASE(FALSE) {
+        push(false);
+        DISPATCH();
+    }
+    CASE(POP) {
+        drop();
+        DISPATCH();
+    }
+    CASE(GET_LOCAL) {
+        push(slots[READ_BYTE()]);
+        DISPATCH();
+    }
+    CASE(SET_LOCAL) {
+        slots[READ_BYTE()] = top[-1];
+        DISPATCH();
+    }
+    CASE(GET_GLOBAL) {
+        auto name = constants[READ_SHORT()].asString().get();
+        auto iter = globals.find(name);
+        if (iter == globals.end()) {
+            ERROR("Undefined variable '{}'.", name->view());
+        }
+        push(iter->second.value);
+        DISPATCH();
+    }
+    CASE(DEFINE_GLOBAL) {
+        auto& name = constants[READ_SHORT()].asString();
+        globals.insert_or_assign(name.get(), Global{name, std::move(top[-1])});
+        drop();
+        DISPATCH();
+    }
+    CASE(SET_GLOBAL) {
+        auto name = constants[READ_SHORT()].asString().get();
+        auto iter = globals.find(name);
+        if (iter == globals.end()) {
+            ERROR("Undefined variable '{}'.", name->view());
+        }
+        iter->second.value = top[-1];
+        DISPATCH();
+    }
+    CASE(GET_UPVALUE) {
+        push(*frame->closure->upvalues()[READ_BYTE()]->location);
+        DISPATCH();
+    }
+    CASE(SET_UPVALUE) {
+        *frame->closure->upvalues()[READ_BYTE()]->location = top[-1];
+        DISPATCH();
+    }
+    CASE(EQUAL) {
+        bool result = top[-2] == top[-1];
+        drop();
+        top[-1] = Value(result);
+        DISPATCH();
+    }
+    CASE(NOT_EQUAL) {
+        bool result = !(top[-2] == top[-1]);
+        drop();
+        top[-1] = Value(result);
+        DISPATCH();
+    }
+    CASE(GREATER) COMPARE(>)
+    CASE(GREATER_EQUAL) COMPARE(>=)
+    CASE(LESS) COMPARE(<)
+    CASE(LESS_EQUAL) COMPARE(<=)
+    CASE(ADD) {
+        if (top[-2].isNumber() && top[-1].isNumber()) {
+            top[-2].number() += top[-1].asNumber();
+            --top;
+        }
+        else if (top[-2].isString() && top[-1].isString()) {
+            auto result = LoxString::concat(top[-2].asString().get(),
+                top[-1].asString().get());
+            drop();
+            top[-1] = Value(std::move(result));
+        }
+        else {
+            ERROR("Operands must be two numbers or two strings.");
+        }
+        DISPATCH();
+    }
+    CASE(SUBTRACT) ARITHMETIC(-)
+    CASE(MULTIPLY) ARITHMETIC(*)
+    CASE(DIVIDE) ARITHMETIC(/)
+    CASE(NOT) {
+        top[-1] = Value(!top[-1].isTruthy());
+        DISPATCH();
+    }
+    CASE(NEGATE) {
+        if (!top[-1].isNumber()) {
+            ERROR("Operand must be a number.");
+        }
+        top[-1].number() = -top[-1].asNumber();
+        DISPATCH();
+    }
+    CASE(PRINT) {
+        if (top[-1].isString()) {
+            printLine(top[-1].asString().view());
+        }
+        else if (top[-1].isClosure()) {
+            printLine(fmt::format("<fn {} >",
+                top[-1].asClosure()->function->name));
+        }
+        else {
+            printLine(Interpreter::stringify(toAny(top[-1])));
+        }
+        drop();
+        DISPATCH();
+    }
+    CASE(JUMP) {
+        uint16_t offset = READ_SHORT();
+        ip += offset;
+        DISPATCH();
+    }
+    CASE(JUMP_IF_FALSE) {
+        uint16_t offset = READ_SHORT();
+        if (!top[-1].isTruthy()) ip += offset;
+        DISPATCH();
+    }
+    CASE(LOOP) {
+        uint16_t offset = READ_SHORT();
+        TICK();
+        ip -= offset;
+        DISPATCH();
+    }
+    CASE(CALL) {
+        int count = READ_BYTE();
+        Value& callee = top[-count - 1];
+        if (callee.isClosure()) {
+            auto function = callee.asClosure()->function;
+            if (count != function->arity) {
+                ERROR("Expected {} arguments but got {}.",
+                    function->arity, count);
+            }
+            if (frameCount - 1 == kMaxFrames
+                || stack.get() + kStackSize - top < kFrameSlots) {
+                ERROR("Stack overflow.");
+            }
+            TICK();
+            frame->ip = ip;
+            frames[frameCount++] = CallFrame{callee.asClosure(),
+                function->chunk.code.data(), top - count - 1};
+            LOAD_FRAME();
+        }
+        else if (callee.isNative()) {
+            auto native = callee.asNative();
+            if (count != native->arity()) {
+                ERROR("Expected {} arguments but got {}.",
+                    native->arity(), count);
+            }
+            if (frameCount - 1 == kMaxFrames) {
+                ERROR("Stack overflow.");
+            }
+            frame->ip = ip;
+            auto result = callNative(native, count);
+            for (int i = 0; i <= count; ++i) drop();
+            push(std::move(result));
+        }
+        else {
+            ERROR("Can only call functions and classes.");
+        }
+        DISPATCH();
+    }
+    CASE(CLOSURE) {
+        auto function = frame->closure->function->chunk.functions[READ_SHORT()];
+        auto closure = heap.makeSized<Closure>(
+            sizeof(Closure) + function->upvalueCount * sizeof(Upvalue*),
+            function);
+        // Rooted on the stack before capturing, which may collect.
+        push(closure);
+        for (int i = 0; i < function->upvalueCount; ++i) {
+            bool isLocal = READ_BYTE();
+            int index = READ_BYTE();
+            closure->upvalues()[i] = isLocal ?
+                captureUpvalue(slots + index) :
+                frame->closure->upvalues()[index];
+        }
+        DISPATCH();
+    }
+    CASE(CLOSE_UPVALUE) {
+        closeUpvalues(top - 1);
+        drop();
+        DISPATCH();
+    }
+    CASE(RETURN) {
+        auto result = std::move(top[-1]);
+        drop();
+        closeUpvalues(slots);
+        --frameCount;
+        while (top != slots) drop();
+        // The outermost frame leaves its result for interpret() and
+        // callback().
+        push(std::move(result));
+        if (frameCount == 0) return;
+        LOAD_FRAME();
+        DISPATCH();
+    }
+
+#ifndef LOX_COMPUTED_GOTO
+    }
+    }
+#endif
+
+#undef READ_BYTE
+#undef READ_SHORT
+#undef LOAD_FRAME
+#undef ERROR
+#undef TICK
+#undef NUMBER_OPERANDS
+#undef COMPARE
+#undef ARITHMETIC
+#undef DISPATCH
+#undef CASE
+}
+
+}
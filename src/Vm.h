@@ -0,0 +1,128 @@
+#pragma once
+
+#include "autogen/Stmt.h"
+#include "Chunk.h"
+#include "Heap.h"
+#include "Value.h"
+#include <any>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace lox {
+
+class Interpreter;
+class Upvalue;
+
+// A function value on the VM: compiled code plus the variables it
+// captured, stored after the object.
+class Closure: public Obj
+{
+public:
+    Closure(FunctionProto* function): function(function)
+    {
+        for (int i = 0; i < function->upvalueCount; ++i) {
+            upvalues()[i] = nullptr;
+        }
+    }
+    ~Closure() override = default;
+
+    Upvalue** upvalues()
+    {
+        return reinterpret_cast<Upvalue**>(
+            reinterpret_cast<char*>(this) + sizeof(Closure));
+    }
+
+    void trace(Heap& heap) override;
+
+    FunctionProto* function;
+};
+
+// A captured variable. While its scope is active it points at the
+// variable's stack slot; when the scope exits the value moves in here.
+class Upvalue: public Obj
+{
+public:
+    explicit Upvalue(Value* slot): location(slot) {}
+    ~Upvalue() override = default;
+
+    void trace(Heap& heap) override;
+
+    Value* location;
+    Value closed;
+    // Next open upvalue further down the stack.
+    Upvalue* next = nullptr;
+};
+
+// Stack-based bytecode interpreter for programs compiled by Compiler.
+// It shares the Interpreter's heap, literals and natives; globals are
+// kept in a table of its own keyed by interned name.
+class Vm
+{
+public:
+    static constexpr int kMaxFrames = 10000;
+    // Slots one frame may use for its locals and temporaries.
+    static constexpr int kFrameSlots = 256;
+    // Room for kMaxFrames small frames, but fewer of the largest: a call
+    // fails unless kFrameSlots are left above its arguments.
+    static constexpr int kStackSize = 1024 * kFrameSlots;
+
+    explicit Vm(Interpreter* interpreter);
+
+    // Compiles and runs a resolved program. Runtime errors are thrown as
+    // RuntimeError after the VM has been reset.
+    void interpret(std::vector<std::unique_ptr<Stmt>>& statements);
+
+    // Runs closure to completion once the program has finished and
+    // returns its result, see Interpreter::callback().
+    std::any callback(Closure* closure, std::vector<std::any>& arguments);
+    // The global variable name, or nothing if there is none.
+    std::any global(const std::string& name);
+
+    void markRoots(Heap& heap);
+
+private:
+    struct Global
+    {
+        // Keeps the key alive.
+        StringRef name;
+        Value value;
+    };
+
+    struct CallFrame
+    {
+        Closure* closure;
+        const uint8_t* ip;
+        // First slot of the frame, holding the closure being run.
+        Value* slots;
+    };
+
+    void run();
+    void reset();
+    [[noreturn]] void runtimeError(const std::string& message);
+    // A token on the line of the running instruction, for errors.
+    Token location() const;
+    void push(Value value) { *top++ = std::move(value); }
+    void drop() { (--top)->reset(); }
+    Upvalue* captureUpvalue(Value* slot);
+    void closeUpvalues(Value* last);
+    Value callNative(NativeCallable* native, int count);
+    void markValue(Heap& heap, const Value& value);
+
+    Interpreter* interpreter;
+    Heap& heap;
+    std::unique_ptr<Value[]> stack;
+    Value* top;
+    CallFrame frames[kMaxFrames + 1];
+    int frameCount = 0;
+    Upvalue* openUpvalues = nullptr;
+    std::unordered_map<const LoxString*, Global> globals;
+    // Every function compiled so far; programs run in the REPL can keep
+    // calling functions from earlier lines.
+    std::vector<std::unique_ptr<FunctionProto>> functions;
+    // Arguments converted for a native call, reused between calls.
+    std::vector<std::any> nativeArguments;
+};
+
+}
@@ -5,6 +5,8 @@
 #include <any>
 
 #include "Scanner.h"
+#include "CallCache.h"
+#include "PropertyCache.h"
 
 namespace lox {
 
@@ -16,9 +18,13 @@ class Expr;
 class Assign;
 class Binary;
 class Call;
+class Get;
 class Grouping;
 class Literal;
 class Logical;
+class Set;
+class Super;
+class This;
 class Unary;
 class VarExpr;
 
@@ -30,9 +36,13 @@ public:
     virtual any visitAssignExpr(Assign* expr) = 0;
     virtual any visitBinaryExpr(Binary* expr) = 0;
     virtual any visitCallExpr(Call* expr) = 0;
+    virtual any visitGetExpr(Get* expr) = 0;
     virtual any visitGroupingExpr(Grouping* expr) = 0;
     virtual any visitLiteralExpr(Literal* expr) = 0;
     virtual any visitLogicalExpr(Logical* expr) = 0;
+    virtual any visitSetExpr(Set* expr) = 0;
+    virtual any visitSuperExpr(Super* expr) = 0;
+    virtual any visitThisExpr(This* expr) = 0;
     virtual any visitUnaryExpr(Unary* expr) = 0;
     virtual any visitVarExprExpr(VarExpr* expr) = 0;
 };
@@ -56,6 +66,8 @@ public:
 
     std::unique_ptr<Token> name;
     std::unique_ptr<Expr> value;
+    int depth = -1;
+    int slot = -1;
 };
 
 class Binary: public Expr
@@ -84,6 +96,21 @@ public:
     std::unique_ptr<Expr> callee;
     std::unique_ptr<Token> paren;
     std::unique_ptr<vector<unique_ptr<Expr>>> arguments;
+    CallCache cache;
+};
+
+class Get: public Expr
+{
+public:
+    Get(std::unique_ptr<Expr> object, std::unique_ptr<Token> name): Expr(), object(std::move(object)), name(std::move(name)) {}
+    ~Get() override = default;
+
+    any accept(ExprVisitor* visitor) override
+    { return visitor->visitGetExpr(this); }
+
+    std::unique_ptr<Expr> object;
+    std::unique_ptr<Token> name;
+    PropertyCache cache;
 };
 
 class Grouping: public Expr
@@ -108,6 +135,7 @@ public:
     { return visitor->visitLiteralExpr(this); }
 
     std::unique_ptr<Token> value;
+    int constant = -1;
 };
 
 class Logical: public Expr
@@ -124,6 +152,50 @@ public:
     std::unique_ptr<Expr> right;
 };
 
+class Set: public Expr
+{
+public:
+    Set(std::unique_ptr<Expr> object, std::unique_ptr<Token> name, std::unique_ptr<Expr> value): Expr(), object(std::move(object)), name(std::move(name)), value(std::move(value)) {}
+    ~Set() override = default;
+
+    any accept(ExprVisitor* visitor) override
+    { return visitor->visitSetExpr(this); }
+
+    std::unique_ptr<Expr> object;
+    std::unique_ptr<Token> name;
+    std::unique_ptr<Expr> value;
+    PropertyCache cache;
+};
+
+class Super: public Expr
+{
+public:
+    Super(std::unique_ptr<Token> keyword, std::unique_ptr<Token> method): Expr(), keyword(std::move(keyword)), method(std::move(method)) {}
+    ~Super() override = default;
+
+    any accept(ExprVisitor* visitor) override
+    { return visitor->visitSuperExpr(this); }
+
+    std::unique_ptr<Token> keyword;
+    std::unique_ptr<Token> method;
+    int depth = -1;
+    int slot = -1;
+};
+
+class This: public Expr
+{
+public:
+    This(std::unique_ptr<Token> keyword): Expr(), keyword(std::move(keyword)) {}
+    ~This() override = default;
+
+    any accept(ExprVisitor* visitor) override
+    { return visitor->visitThisExpr(this); }
+
+    std::unique_ptr<Token> keyword;
+    int depth = -1;
+    int slot = -1;
+};
+
 class Unary: public Expr
 {
 public:
@@ -147,6 +219,8 @@ public:
     { return visitor->visitVarExprExpr(this); }
 
     std::unique_ptr<Token> name;
+    int depth = -1;
+    int slot = -1;
 };
 
 }
\ No newline at end of file
@@ -5,6 +5,7 @@
 #include <any>
 
 #include "autogen/Expr.h"
+#include "JitState.h"
 
 namespace lox {
 
@@ -16,11 +17,13 @@ class Stmt;
 class Block;
 class Expression;
 class Function;
+class Class;
 class If;
 class Print;
 class Return;
 class VarStmt;
 class While;
+class Yield;
 
 class StmtVisitor
 {
@@ -30,11 +33,13 @@ public:
     virtual any visitBlockStmt(Block* stmt) = 0;
     virtual any visitExpressionStmt(Expression* stmt) = 0;
     virtual any visitFunctionStmt(Function* stmt) = 0;
+    virtual any visitClassStmt(Class* stmt) = 0;
     virtual any visitIfStmt(If* stmt) = 0;
     virtual any visitPrintStmt(Print* stmt) = 0;
     virtual any visitReturnStmt(Return* stmt) = 0;
     virtual any visitVarStmtStmt(VarStmt* stmt) = 0;
     virtual any visitWhileStmt(While* stmt) = 0;
+    virtual any visitYieldStmt(Yield* stmt) = 0;
 };
 
 class Stmt
@@ -55,6 +60,8 @@ public:
     { return visitor->visitBlockStmt(this); }
 
     std::unique_ptr<vector<unique_ptr<Stmt>>> statements;
+    int slots = 0;
+    bool escapes = true;
 };
 
 class Expression: public Stmt
@@ -81,6 +88,27 @@ public:
     std::unique_ptr<Token> name;
     std::unique_ptr<vector<Token>> params;
     std::unique_ptr<vector<unique_ptr<Stmt>>> body;
+    int slot = -1;
+    int slots = 0;
+    bool escapes = true;
+    JitState jit;
+    bool generator = false;
+};
+
+class Class: public Stmt
+{
+public:
+    Class(std::unique_ptr<Token> name, std::unique_ptr<VarExpr> superclass, std::unique_ptr<vector<unique_ptr<Function>>> methods): Stmt(), name(std::move(name)), superclass(std::move(superclass)), methods(std::move(methods)) {}
+    ~Class() override = default;
+
+    any accept(StmtVisitor* visitor) override
+    { return visitor->visitClassStmt(this); }
+
+    std::unique_ptr<Token> name;
+    std::unique_ptr<VarExpr> superclass;
+    std::unique_ptr<vector<unique_ptr<Function>>> methods;
+    int slot = -1;
+    bool thisEscapes = true;
 };
 
 class If: public Stmt
@@ -133,19 +161,34 @@ public:
 
     std::unique_ptr<Token> name;
     std::unique_ptr<Expr> initializer;
+    int slot = -1;
 };
 
 class While: public Stmt
 {
 public:
-    While(std::unique_ptr<Expr> condition, std::unique_ptr<Stmt> body): Stmt(), condition(std::move(condition)), body(std::move(body)) {}
+    While(std::unique_ptr<Token> keyword, std::unique_ptr<Expr> condition, std::unique_ptr<Stmt> body): Stmt(), keyword(std::move(keyword)), condition(std::move(condition)), body(std::move(body)) {}
     ~While() override = default;
 
     any accept(StmtVisitor* visitor) override
     { return visitor->visitWhileStmt(this); }
 
+    std::unique_ptr<Token> keyword;
     std::unique_ptr<Expr> condition;
     std::unique_ptr<Stmt> body;
 };
 
+class Yield: public Stmt
+{
+public:
+    Yield(std::unique_ptr<Token> keyword, std::unique_ptr<Expr> value): Stmt(), keyword(std::move(keyword)), value(std::move(value)) {}
+    ~Yield() override = default;
+
+    any accept(StmtVisitor* visitor) override
+    { return visitor->visitYieldStmt(this); }
+
+    std::unique_ptr<Token> keyword;
+    std::unique_ptr<Expr> value;
+};
+
 }
\ No newline at end of file
@@ -1,20 +1,181 @@
 #include "Lox.h"
 #include "AstPrinter.h"
+#include "Server.h"
 #include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
 #include <fmt/format.h>
 
-int main(int argc, const char* argv[])
+static void usage()
 {
-    if (argc > 2) {
-        std::cout << "Usage: lox [script]" << std::endl;
-        std::exit(64);
+    std::cout << "Usage: lox [options] [script [arguments...]]\n"
+        "Options:\n"
+        "  --engine=tree|stackless|vm|closure\n"
+        "                           how to run the program (default: tree)\n"
+        "  --stack-budget=BYTES     stack memory of the stackless engine\n"
+        "  --jit                    compile hot numeric functions to machine\n"
+        "                           code (tree and closure engines)\n"
+        "  --profile-out=FILE       record the script's type profile\n"
+        "  --profile-in=FILE        start from a recorded type profile\n"
+        "                           (both need --engine=closure)\n"
+        "  --snapshot-out=FILE      save the heap the script leaves\n"
+        "  --snapshot-in=FILE       start the script from a saved heap\n"
+        "                           (not with --engine=vm)\n"
+        "  --emit-cpp               print the program as a C++ translation\n"
+        "                           unit instead of running it\n"
+        "  --threads=N              worker threads of parallelMap and\n"
+        "                           parallelReduce (default: one per core)\n"
+        "  --gc-stats               print collector statistics on exit\n"
+        "  --engine-stats           print the engine's counters on exit\n"
+        "  --gc-initial-heap=BYTES  heap size of the first collection\n"
+        "  --gc-growth=FACTOR       heap growth between collections\n"
+        "  --gc-stress              collect before every allocation\n"
+        "  --fuel=N                 stop after N loop iterations and calls\n"
+        "  --max-memory=BYTES       stop once the heap holds more\n"
+        "  --timeout=MS             stop after MS milliseconds\n"
+        "  --serve=SOCKET           run scripts for clients of a Unix socket\n"
+        "                           instead, see tools/lox_client.py"
+        << std::endl;
+    std::exit(64);
+}
+
+static bool parseOption(const std::string& arg)
+{
+    auto value = [&arg](const std::string& name) -> const char* {
+        if (arg.compare(0, name.size(), name) != 0) return nullptr;
+        if (arg.size() <= name.size() || arg[name.size()] != '=') return nullptr;
+        return arg.c_str() + name.size() + 1;
+    };
+
+    if (auto engine = value("--engine")) {
+        if (std::string(engine) == "tree") {
+            lox::options.engine = lox::Engine::TREE;
+        }
+        else if (std::string(engine) == "stackless") {
+            lox::options.engine = lox::Engine::STACKLESS;
+        }
+        else if (std::string(engine) == "vm") {
+            lox::options.engine = lox::Engine::VM;
+        }
+        else if (std::string(engine) == "closure") {
+            lox::options.engine = lox::Engine::CLOSURE;
+        }
+        else {
+            return false;
+        }
+    }
+    else if (auto bytes = value("--stack-budget")) {
+        lox::options.stackBudget = std::stoul(bytes);
+    }
+    else if (auto count = value("--threads")) {
+        lox::options.threads = std::stoi(count);
+        if (lox::options.threads < 1) return false;
+    }
+    else if (arg == "--gc-stats") {
+        lox::options.gcStats = true;
+    }
+    else if (arg == "--jit") {
+        lox::options.jit = true;
+    }
+    else if (auto path = value("--profile-in")) {
+        lox::options.profileIn = path;
+    }
+    else if (auto path = value("--profile-out")) {
+        lox::options.profileOut = path;
+    }
+    else if (auto path = value("--snapshot-out")) {
+        lox::options.snapshotOut = path;
+    }
+    else if (auto path = value("--snapshot-in")) {
+        lox::options.snapshotIn = path;
+    }
+    else if (arg == "--emit-cpp") {
+        lox::options.emitCpp = true;
+    }
+    else if (arg == "--engine-stats") {
+        lox::options.engineStats = true;
+    }
+    else if (arg == "--gc-stress") {
+        lox::options.gc.stress = true;
+    }
+    else if (auto bytes = value("--gc-initial-heap")) {
+        lox::options.gc.initialHeap = std::stoul(bytes);
     }
-    else if (argc == 2) {
-        lox::runFile(argv[1]);
+    else if (auto count = value("--fuel")) {
+        lox::options.fuel = std::stoull(count);
+    }
+    else if (auto bytes = value("--max-memory")) {
+        lox::options.maxMemory = std::stoul(bytes);
+    }
+    else if (auto ms = value("--timeout")) {
+        lox::options.timeout = std::stoull(ms);
+    }
+    else if (auto path = value("--serve")) {
+        lox::options.serve = path;
+    }
+    else if (auto factor = value("--gc-growth")) {
+        lox::options.gc.growthFactor = std::stod(factor);
+        if (lox::options.gc.growthFactor <= 1.0) return false;
     }
     else {
-        lox::runPrompt();
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, const char* argv[])
+{
+    std::string script;
+    std::vector<std::string> arguments;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (!script.empty()) {
+            arguments.push_back(arg);
+        }
+        else if (arg.compare(0, 2, "--") == 0) {
+            bool valid = false;
+            try {
+                valid = parseOption(arg);
+            }
+            catch (const std::exception&) {}
+            if (!valid) usage();
+        }
+        else {
+            script = arg;
+        }
+    }
+
+    // Profiles describe the closure engine's nodes of one script.
+    bool profiles = !lox::options.profileIn.empty()
+        || !lox::options.profileOut.empty();
+    if (profiles && (script.empty()
+        || lox::options.engine != lox::Engine::CLOSURE)) {
+        usage();
+    }
+
+    // The vm keeps a heap of its own, and a restored prelude would be
+    // compiled into the first sites of the script's profile.
+    bool snapshots = !lox::options.snapshotIn.empty()
+        || !lox::options.snapshotOut.empty();
+    if (snapshots && (script.empty() || profiles || lox::options.emitCpp
+        || lox::options.engine == lox::Engine::VM)) {
+        usage();
+    }
+
+    if (!lox::options.serve.empty()) {
+        if (!script.empty() || profiles || snapshots
+            || lox::options.emitCpp) {
+            usage();
+        }
+        return lox::serve(lox::options.serve, lox::options);
+    }
+
+    lox::Isolate isolate(lox::options);
+    if (!script.empty()) {
+        return isolate.runFile(script, std::move(arguments));
     }
+    isolate.runPrompt();
     return 0;
 }
 
@@ -22,4 +183,4 @@ int main(int argc, const char* argv[])
 // {
 //     lox::printAst(nullptr);
 //     return 0;
-// }
\ No newline at end of file
+// }
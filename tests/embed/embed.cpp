@@ -0,0 +1,233 @@
+// Runs liblox through its embedding API, see src/Embed.h. Exits with 1
+// and says why at the first check that fails.
+#include "Embed.h"
+#include "Lox.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+
+using lox::embed::Context;
+using lox::embed::Error;
+using lox::embed::Program;
+using lox::embed::Value;
+
+static int failures = 0;
+
+static void check(bool ok, const char* what)
+{
+    if (!ok) {
+        std::printf("FAIL %s\n", what);
+        ++failures;
+    }
+}
+
+static const char* const kSource = R"(
+var calls = 0;
+print "loaded";
+
+fun greet(name, times) {
+    calls = calls + 1;
+    var text = "";
+    for (var i = 0; i < times; i = i + 1) text = text + "hi ";
+    print text + name;
+    return calls;
+}
+
+fun add(a, b) { return a + b; }
+fun negate(flag) { return !flag; }
+fun nothing() {}
+fun broken() { return nope; }
+fun closure() { fun inner() {} return inner; }
+)";
+
+static void runs(const lox::Options& options)
+{
+    auto program = Program::compile(kSource);
+
+    std::string output;
+    Context first(program, options,
+        [&output](std::string_view text) { output += text; });
+    check(output == "loaded\n", "top-level statements print");
+
+    check(first.call("greet", "Ann", 2) == Value(1.0), "call counts");
+    check(output == "loaded\nhi hi Ann\n", "calls print");
+    check(first.call("greet", std::string("Bo"), 0) == Value(2.0),
+        "globals persist between calls");
+    check(first.call("add", 1, 2.5) == Value(3.5), "numbers");
+    check(first.call("add", "a", "b") == Value(std::string("ab")),
+        "strings");
+    check(first.call("negate", false) == Value(true), "booleans");
+    check(first.call("nothing") == Value(nullptr), "no return value");
+
+    // A second context of the same program starts over.
+    std::string other;
+    Context second(program, options,
+        [&other](std::string_view text) { other += text; });
+    check(second.call("greet", "Cy", 1) == Value(1.0), "contexts are apart");
+    check(first.call("greet", "Di", 1) == Value(3.0), "contexts are apart");
+    check(other == "loaded\nhi Cy\n", "outputs are apart");
+
+    try {
+        first.call("broken");
+        check(false, "runtime errors throw");
+    }
+    catch (const Error& error) {
+        check(error.status == 70
+            && std::string(error.what()) == "Undefined variable 'nope'.\n"
+                "[line 16]", "runtime error message");
+    }
+    check(first.call("add", 2, 2) == Value(4.0), "usable after an error");
+
+    auto fails = [&first](const std::string& name, std::vector<Value> args) {
+        try {
+            first.apply(name, std::move(args));
+        }
+        catch (const Error& error) {
+            return error.status == 70;
+        }
+        return false;
+    };
+    check(fails("missing", {}), "undefined function");
+    check(fails("calls", {}), "not a function");
+    check(fails("add", {1.0}), "arity");
+    check(fails("closure", {}), "unconvertible result");
+}
+
+static const char* const kForever = "while (true) {}";
+
+static const char* const kLimited = R"(
+fun spin() { while (true) {} }
+fun count(n) {
+    var total = 0;
+    for (var i = 0; i < n; i = i + 1) total = total + 1;
+    return total;
+}
+fun hoard(n) {
+    var kept = nil;
+    for (var i = 0; i < n; i = i + 1) {
+        var previous = kept;
+        fun link() { return previous; }
+        kept = link;
+    }
+    return n;
+}
+fun spinning(i) { while (true) {} }
+fun spinAll() { return parallelReduce(spinning, 0, 4); }
+fun wait() { return receive("nobody"); }
+)";
+
+// Whether call fails with message.
+static bool stops(Context& context, const char* message,
+    const std::string& name, std::vector<Value> arguments)
+{
+    try {
+        context.apply(name, std::move(arguments));
+    }
+    catch (const Error& error) {
+        return error.status == 70
+            && std::string(error.what()).rfind(message, 0) == 0;
+    }
+    return false;
+}
+
+static void limits(lox::Options options)
+{
+    auto program = Program::compile(kLimited);
+
+    options.fuel = 10000;
+    Context fueled(program, options);
+    check(stops(fueled, "Out of fuel.", "spin", {}), "fuel runs out");
+    check(fueled.call("count", 9000) == Value(9000.0),
+        "fuel is per call");
+    check(stops(fueled, "Out of fuel.", "count", {20000.0}),
+        "fuel counts iterations");
+    // The bytecode engine has no parallel operations.
+    if (options.engine != lox::Engine::VM) {
+        check(stops(fueled, "Out of fuel.", "spinAll", {}),
+            "parallel workers have the caller's fuel");
+    }
+
+    options.fuel = 0;
+    options.maxMemory = 4 * 1024 * 1024;
+    Context quota(program, options);
+    check(stops(quota, "Out of memory.", "hoard", {1e7}), "memory quota");
+    check(quota.call("hoard", 100) == Value(100.0),
+        "garbage doesn't count against the quota");
+
+    options.maxMemory = 0;
+    Context cancelled(program, options);
+    std::atomic<bool> done{false};
+    // Until the call notices, in case the first cancel() comes before it
+    // starts.
+    std::thread canceller([&]() {
+        while (!done) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            cancelled.cancel();
+        }
+    });
+    check(stops(cancelled, "Script cancelled.", "spin", {}),
+        "cancel from another thread");
+    check(stops(cancelled, "Script cancelled.", "wait", {}),
+        "cancel while receiving");
+    if (options.engine != lox::Engine::VM) {
+        check(stops(cancelled, "Script cancelled.", "spinAll", {}),
+            "cancel stops parallel workers");
+    }
+    done = true;
+    canceller.join();
+    check(cancelled.call("count", 3) == Value(3.0), "usable after cancel");
+
+    options.timeout = 50;
+    Context timed(program, options);
+    check(stops(timed, "Script timed out.", "spin", {}), "timeout");
+    check(timed.call("count", 3) == Value(3.0), "usable after a timeout");
+    check(stops(timed, "Script timed out.", "wait", {}),
+        "timeout while receiving");
+    if (options.engine != lox::Engine::VM) {
+        check(stops(timed, "Script timed out.", "spinAll", {}),
+            "timeout stops parallel workers");
+    }
+    try {
+        Context forever(Program::compile(kForever), options);
+        check(false, "top-level statements time out");
+    }
+    catch (const Error& error) {
+        check(error.status == 70 && std::string(error.what()).rfind(
+            "Script timed out.", 0) == 0, "top-level timeout message");
+    }
+}
+
+int main()
+{
+    lox::Options options;
+    runs(options);
+    options.engine = lox::Engine::STACKLESS;
+    runs(options);
+    options.engine = lox::Engine::CLOSURE;
+    runs(options);
+    options.engine = lox::Engine::VM;
+    runs(options);
+
+    for (auto engine : {lox::Engine::TREE, lox::Engine::STACKLESS,
+        lox::Engine::CLOSURE, lox::Engine::VM}) {
+        options.engine = engine;
+        limits(options);
+    }
+
+    try {
+        Program::compile("print 1 +;\nvar;");
+        check(false, "compile errors throw");
+    }
+    catch (const Error& error) {
+        check(error.status == 65
+            && std::string(error.what()) ==
+                "[line 1] Error at ';': Expect expression.\n"
+                "[line 2] Error at ';': Expect variable name.",
+            "compile error messages");
+    }
+
+    if (failures == 0) std::printf("ok\n");
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,81 @@
+#!/usr/bin/env python3
+"""Runs every script in tests/ on the tree engine and on each of the others,
+and fails unless they print the same output and exit with the same status.
+Scripts run from their own directory, where they spawn their helpers.
+Where an engine differs from the tree engine by design, its output is
+compared with EXPECTED instead.
+
+Usage: test_engines.py LOX [SCRIPT...]
+"""
+import subprocess
+import sys
+from pathlib import Path
+
+ENGINES = [["--engine=stackless"], ["--engine=vm"], ["--engine=closure"],
+           ["--engine=closure", "--jit"], ["--jit"]]
+
+# Only run when other scripts spawn them; alone they wait for messages or
+# fail.
+HELPERS = {"isolates/echo.lox", "isolates/square.lox", "isolates/quiet.lox",
+           "isolates/fails.lox"}
+
+# What an engine prints where it differs from the tree engine by design,
+# and the exit status.
+EXPECTED = {
+    # Recursion is bounded only by --stack-budget.
+    ("call_depth.lox", "--engine=stackless"):
+        ("10\n13\n1000\n5000\n100000\n", 0),
+    ("stackless_recursion.lox", "--engine=stackless"):
+        ("100000\nfalse\nStack overflow.\n[line 20]\n", 70),
+}
+
+# Scripts an engine can't run, and why.
+SKIP = {
+    "--engine=vm": {
+        # The bytecode engine has no classes, generators or parallel
+        # operations.
+        "classes.lox", "generators/pipelines.lox", "parallel/counts.lox",
+        "parallel/map_reduce.lox",
+        "snapshot/main.lox", "snapshot/prelude.lox",
+        "snapshot/unsaveable.lox",
+    },
+}
+
+
+def run(command, directory):
+    result = subprocess.run(command, capture_output=True, text=True,
+                            cwd=directory, timeout=120)
+    return result.stdout, result.returncode
+
+
+def main():
+    if len(sys.argv) < 2:
+        print(__doc__)
+        return 64
+    lox = str(Path(sys.argv[1]).resolve())
+    root = Path(__file__).resolve().parent
+    scripts = [Path(s).resolve() for s in sys.argv[2:]] or sorted(
+        list(root.glob("*.lox")) + list(root.glob("*/*.lox")))
+
+    failures = 0
+    for script in scripts:
+        name = (script.relative_to(root).as_posix()
+                if root in script.parents else script.name)
+        if name in HELPERS:
+            continue
+        expected = run([lox, script.name], script.parent)
+        for options in ENGINES:
+            if name in SKIP.get(options[0], set()):
+                continue
+            wanted = EXPECTED.get((name, options[0]), expected)
+            actual = run([lox, *options, script.name], script.parent)
+            ok = actual == wanted
+            print(f"{'ok  ' if ok else 'FAIL'} {name} {' '.join(options)}")
+            if not ok:
+                print(f"     expected {wanted!r}, got {actual!r}")
+                failures += 1
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -21,6 +21,7 @@ public:
 """
 PARAM_TEMPLATE = "std::unique_ptr<{type}> {name}, "
 FIELD_TEMPLATE = "    std::unique_ptr<{type}> {name};\n"
+PLAIN_FIELD_TEMPLATE = "    {declaration};\n"
 INIT_TEMPLATE = "{name}(std::move({name})), "
 CTOR_TEMPLATE = "    {sub}({params}): {base}(), {initializer} {{}}"
 SUB_TEMPLATE = """class {sub}: public {base}
@@ -58,7 +59,7 @@ using std::unique_ptr;
 
 
 def defineType(className: str, baseName: str,
-               fields: list[tuple[str, ...]]) -> str:
+               fields: list[tuple[str, ...]], plainFields: list[str]) -> str:
     fieldLines = ""
     params = ""
     initializer = ""
@@ -66,6 +67,9 @@ def defineType(className: str, baseName: str,
         fieldLines += FIELD_TEMPLATE.format(type=type, name=name)
         params += PARAM_TEMPLATE.format(type=type, name=name)
         initializer += INIT_TEMPLATE.format(name=name)
+    # Plain fields are not constructor parameters; later passes fill them.
+    for declaration in plainFields:
+        fieldLines += PLAIN_FIELD_TEMPLATE.format(declaration=declaration)
     if fields:
         fieldLines = fieldLines[:-1]
         params = params[:-2]
@@ -86,10 +90,12 @@ def defineAst(outputDir: Path, baseName: str, types: list[str],
     forwards = FORWARD_TEMPLATE.format(name=baseName)
     for type in types:
         className = type.split(":")[0].strip()
-        fields = type.split(":")[1].split(",")
+        fields, _, plainFields = type.split(":", 1)[1].partition("|")
+        fields = fields.split(",")
         fields = list(map(lambda x: tuple(x.strip().split()), fields))
+        plainFields = [x.strip() for x in plainFields.split(";") if x.strip()]
         forwards += FORWARD_TEMPLATE.format(name=className)
-        subclasses += defineType(className, baseName, fields)
+        subclasses += defineType(className, baseName, fields, plainFields)
         visitFuncs += VISIT_FUNC_TEMPLATE.format(
             base=baseName, sub=className, lowerBase=baseName.lower())
     visitor = VISITOR_TEMPLATE.format(baseName=baseName, functions=visitFuncs)
@@ -109,25 +115,36 @@ def main():
         sys.exit(64)
     outputDir = Path(sys.argv[1])
     defineAst(outputDir, "Expr", [
-        "Assign   : Token name, Expr value",
+        "Assign   : Token name, Expr value | int depth = -1; int slot = -1",
         "Binary   : Expr left, Token op, Expr right",
-        "Call     : Expr callee, Token paren, vector<unique_ptr<Expr>> arguments",
+        "Call     : Expr callee, Token paren, vector<unique_ptr<Expr>> arguments"
+        " | CallCache cache",
+        "Get      : Expr object, Token name | PropertyCache cache",
         "Grouping : Expr expression",
-        "Literal  : Token value",
+        "Literal  : Token value | int constant = -1",
         "Logical  : Expr left, Token op, Expr right",
+        "Set      : Expr object, Token name, Expr value | PropertyCache cache",
+        "Super    : Token keyword, Token method | int depth = -1; int slot = -1",
+        "This     : Token keyword | int depth = -1; int slot = -1",
         "Unary    : Token op, Expr right",
-        "VarExpr  : Token name"
-    ], ["Scanner.h"])
+        "VarExpr  : Token name | int depth = -1; int slot = -1"
+    ], ["Scanner.h", "CallCache.h", "PropertyCache.h"])
     defineAst(outputDir, "Stmt", [
-        "Block      : vector<unique_ptr<Stmt>> statements",
+        "Block      : vector<unique_ptr<Stmt>> statements"
+        " | int slots = 0; bool escapes = true",
         "Expression : Expr expr",
-        "Function   : Token name, vector<Token> params, vector<unique_ptr<Stmt>> body",
+        "Function   : Token name, vector<Token> params, vector<unique_ptr<Stmt>> body"
+        " | int slot = -1; int slots = 0; bool escapes = true; JitState jit;"
+        " bool generator = false",
+        "Class      : Token name, VarExpr superclass, vector<unique_ptr<Function>> methods"
+        " | int slot = -1; bool thisEscapes = true",
         "If         : Expr condition, Stmt thenBranch, Stmt elseBranch",
         "Print      : Expr expr",
         "Return     : Token keyword, Expr value",
-        "VarStmt    : Token name, Expr initializer",
-        "While      : Expr condition, Stmt body"
-    ], ["autogen/Expr.h"])
+        "VarStmt    : Token name, Expr initializer | int slot = -1",
+        "While      : Token keyword, Expr condition, Stmt body",
+        "Yield      : Token keyword, Expr value"
+    ], ["autogen/Expr.h", "JitState.h"])
 
 
 if __name__ == "__main__":
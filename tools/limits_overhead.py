@@ -0,0 +1,73 @@
+#!/usr/bin/env python3
+"""Measures what metering costs: runs benchmarks with no limits and with
+--fuel and --max-memory set too high to be reached, on each engine, and
+prints the median times and the difference. Both runs must print the same.
+
+Usage: limits_overhead.py LOX [RUNS [BENCHMARK...]]
+
+RUNS defaults to 5, and the benchmarks to loop, calls, fib and numeric in
+benchmarks/. Pass a second LOX as BASELINE=PATH to compare against another
+build instead, e.g. one without safepoints.
+"""
+import statistics
+import subprocess
+import sys
+import time
+from pathlib import Path
+
+ENGINES = [["--engine=tree"], ["--engine=stackless"], ["--engine=vm"],
+           ["--engine=closure"], ["--engine=closure", "--jit"]]
+LIMITS = ["--fuel=1000000000000", "--max-memory=100000000000"]
+
+
+def measure(command, runs):
+    times = []
+    for _ in range(runs):
+        start = time.perf_counter()
+        result = subprocess.run(command, capture_output=True, text=True)
+        times.append(time.perf_counter() - start)
+    # Benchmarks print timings after a label ending in a colon, and those
+    # differ between runs.
+    lines = result.stdout.splitlines()
+    output = [line for i, line in enumerate(lines)
+              if i == 0 or not lines[i - 1].endswith(":")]
+    return (output, result.returncode), statistics.median(times)
+
+
+def main():
+    arguments = sys.argv[1:]
+    baseline = None
+    for argument in list(arguments):
+        if argument.startswith("BASELINE="):
+            baseline = argument[len("BASELINE="):]
+            arguments.remove(argument)
+    if not arguments:
+        print(__doc__)
+        return 64
+    lox = arguments[0]
+    runs = int(arguments[1]) if len(arguments) > 1 else 5
+    root = Path(__file__).resolve().parent.parent / "benchmarks"
+    names = arguments[2:] or ["loop", "calls", "fib", "numeric"]
+
+    failures = 0
+    for name in names:
+        script = str(root / f"{name}.lox")
+        for engine in ENGINES:
+            if baseline is None:
+                plain = [lox, *engine, script]
+            else:
+                plain = [baseline, *engine, script]
+            limited = [lox, *engine, *LIMITS, script]
+            expected, off = measure(plain, runs)
+            actual, on = measure(limited, runs)
+            label = f"{name} {' '.join(engine)}"
+            print(f"{label:32} {off * 1000:9.1f} ms {on * 1000:9.1f} ms "
+                  f"{(on / off - 1) * 100:+6.1f}%")
+            if actual != expected:
+                print(f"     expected {expected!r}, got {actual!r}")
+                failures += 1
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,46 @@
+#!/usr/bin/env python3
+"""Runs a script on a server started with lox --serve=SOCKET, printing its
+output and exiting with its exit status.
+
+Usage: lox_client.py SOCKET SCRIPT [ARGUMENT...]
+"""
+import os
+import socket
+import sys
+
+
+def request(path, script, arguments):
+    """Returns the exit status and output of script run by the server at
+    path. The server reads the script itself, so it must see the same file
+    system."""
+    fields = [os.path.abspath(script)] + list(arguments)
+    with socket.socket(socket.AF_UNIX, socket.SOCK_STREAM) as connection:
+        connection.connect(path)
+        connection.sendall(b"".join(os.fsencode(f) + b"\0" for f in fields))
+        connection.shutdown(socket.SHUT_WR)
+        response = bytearray()
+        while True:
+            data = connection.recv(65536)
+            if not data:
+                break
+            response += data
+    header, _, output = bytes(response).partition(b"\n")
+    if not header:
+        raise ConnectionError("the server closed the connection unanswered")
+    status, length = map(int, header.split())
+    if len(output) != length:
+        raise ConnectionError("the server's answer was cut short")
+    return status, output
+
+
+def main():
+    if len(sys.argv) < 3:
+        print(__doc__)
+        return 64
+    status, output = request(sys.argv[1], sys.argv[2], sys.argv[3:])
+    sys.stdout.buffer.write(output)
+    return status
+
+
+if __name__ == "__main__":
+    sys.exit(main())
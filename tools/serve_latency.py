@@ -0,0 +1,77 @@
+#!/usr/bin/env python3
+"""Measures how long a script takes from request to answer when run as a
+fresh process and when run by lox --serve, and checks both give the same
+output and exit status.
+
+Usage: serve_latency.py LOX [SCRIPT [RUNS [LOX-OPTION...]]]
+
+SCRIPT defaults to benchmarks/serve/job.lox and RUNS to 200. The options
+are passed to both the process and the server.
+"""
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+from pathlib import Path
+
+from lox_client import request
+
+
+def measure(run, runs):
+    times = []
+    for i in range(runs):
+        start = time.perf_counter()
+        result = run(str(i))
+        times.append(time.perf_counter() - start)
+    return result, times
+
+
+def report(name, times):
+    times = sorted(times)
+    p95 = times[int(len(times) * 0.95)]
+    print(f"{name:>8}: median {statistics.median(times) * 1000:7.3f} ms, "
+          f"p95 {p95 * 1000:7.3f} ms")
+
+
+def main():
+    if len(sys.argv) < 2:
+        print(__doc__)
+        return 64
+    lox = sys.argv[1]
+    root = Path(__file__).resolve().parent.parent
+    script = sys.argv[2] if len(sys.argv) > 2 else str(
+        root / "benchmarks" / "serve" / "job.lox")
+    runs = int(sys.argv[3]) if len(sys.argv) > 3 else 200
+    options = sys.argv[4:]
+
+    def spawn(argument):
+        result = subprocess.run([lox, *options, script, argument],
+                                capture_output=True)
+        return result.returncode, result.stdout
+
+    with tempfile.TemporaryDirectory() as directory:
+        socket = str(Path(directory) / "lox.sock")
+        server = subprocess.Popen([lox, *options, "--serve=" + socket])
+        try:
+            while not Path(socket).exists():
+                if server.poll() is not None:
+                    return 1
+                time.sleep(0.01)
+            served, served_times = measure(
+                lambda argument: request(socket, script, [argument]), runs)
+        finally:
+            server.kill()
+            server.wait()
+    spawned, spawned_times = measure(spawn, runs)
+
+    report("process", spawned_times)
+    report("server", served_times)
+    if served != spawned:
+        print(f"outputs differ: {spawned!r} run directly, {served!r} served")
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
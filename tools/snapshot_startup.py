@@ -0,0 +1,73 @@
+#!/usr/bin/env python3
+"""Measures how long a script takes to start and finish when it runs its
+prelude itself and when it starts from a snapshot of the prelude's heap,
+and checks both give the same output and exit status.
+
+Usage: snapshot_startup.py LOX [PRELUDE MAIN [RUNS [LOX-OPTION...]]]
+
+PRELUDE and MAIN default to benchmarks/snapshot/prelude.lox and main.lox,
+and RUNS to 20. The options are passed to every run.
+"""
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+from pathlib import Path
+
+
+def measure(command, runs):
+    times = []
+    for _ in range(runs):
+        start = time.perf_counter()
+        result = subprocess.run(command, capture_output=True, text=True)
+        times.append(time.perf_counter() - start)
+    return (result.stdout, result.returncode), times
+
+
+def report(name, times):
+    times = sorted(times)
+    p95 = times[int(len(times) * 0.95)]
+    print(f"{name:>9}: median {statistics.median(times) * 1000:8.3f} ms, "
+          f"p95 {p95 * 1000:8.3f} ms")
+
+
+def main():
+    if len(sys.argv) < 2 or len(sys.argv) == 3:
+        print(__doc__)
+        return 64
+    lox = sys.argv[1]
+    root = Path(__file__).resolve().parent.parent
+    prelude = Path(sys.argv[2]) if len(sys.argv) > 2 else (
+        root / "benchmarks" / "snapshot" / "prelude.lox")
+    script = Path(sys.argv[3]) if len(sys.argv) > 3 else (
+        root / "benchmarks" / "snapshot" / "main.lox")
+    runs = int(sys.argv[4]) if len(sys.argv) > 4 else 20
+    options = sys.argv[5:]
+
+    with tempfile.TemporaryDirectory() as directory:
+        combined = Path(directory) / "combined.lox"
+        combined.write_text(prelude.read_text() + script.read_text())
+        snapshot = Path(directory) / "prelude.snap"
+        saved = subprocess.run([lox, *options, f"--snapshot-out={snapshot}",
+                                str(prelude)], capture_output=True, text=True)
+        if saved.returncode != 0:
+            print(saved.stderr, end="")
+            return 1
+
+        expected, full = measure([lox, *options, str(combined)], runs)
+        actual, restored = measure([lox, *options,
+                                    f"--snapshot-in={snapshot}", str(script)],
+                                   runs)
+        actual = (saved.stdout + actual[0], actual[1])
+        report("prelude", full)
+        report("snapshot", restored)
+        print(f"{snapshot.stat().st_size} bytes of snapshot")
+        if actual != expected:
+            print(f"expected {expected!r}, got {actual!r}")
+            return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
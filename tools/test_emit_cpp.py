@@ -0,0 +1,58 @@
+#!/usr/bin/env python3
+"""Runs every tests/*.lox script through the interpreter and through
+--emit-cpp plus the C++ compiler, and fails unless both print the same
+output and exit with the same status.
+
+Usage: test_emit_cpp.py LOX CXX [SCRIPT...]
+"""
+import subprocess
+import sys
+import tempfile
+from pathlib import Path
+
+
+def run(command, **kwargs):
+    result = subprocess.run(command, capture_output=True, text=True, **kwargs)
+    return result.stdout, result.returncode
+
+
+def check(lox, cxx, script, workdir):
+    expected = run([lox, script])
+
+    source, status = run([lox, "--emit-cpp", script])
+    if status != 0:
+        # Scripts that don't compile report it the same way either way.
+        return (source, status) == expected, "emit failed"
+
+    cpp = workdir / (script.stem + ".cpp")
+    binary = workdir / script.stem
+    cpp.write_text(source)
+    output, status = run([cxx, "-std=c++17", "-O1", "-o", str(binary), str(cpp)])
+    if status != 0:
+        return False, "compile failed"
+
+    actual = run([str(binary)])
+    return actual == expected, f"expected {expected!r}, got {actual!r}"
+
+
+def main():
+    if len(sys.argv) < 3:
+        print(__doc__)
+        return 64
+    lox, cxx = sys.argv[1], sys.argv[2]
+    root = Path(__file__).resolve().parent.parent
+    scripts = [Path(s) for s in sys.argv[3:]] or sorted(root.glob("tests/*.lox"))
+
+    failures = 0
+    with tempfile.TemporaryDirectory() as directory:
+        for script in scripts:
+            ok, detail = check(lox, cxx, script, Path(directory))
+            print(f"{'ok  ' if ok else 'FAIL'} {script.name}")
+            if not ok:
+                print(f"     {detail}")
+                failures += 1
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,96 @@
+#!/usr/bin/env python3
+"""Records a closure-engine profile of tests/profile/typed.lox run on
+numbers and replays it on strings, which must deoptimize the nodes the
+profile set up and still print what the tree engine prints. Also checks
+that a profile of another source and a truncated profile are ignored
+with a note on stderr.
+
+Usage: test_profile.py LOX
+"""
+import re
+import subprocess
+import sys
+import tempfile
+from pathlib import Path
+
+
+def run(command):
+    result = subprocess.run(command, capture_output=True, text=True)
+    return result.stdout, result.returncode, result.stderr
+
+
+def stats(stderr):
+    """The deoptimizations and the nodes set up from the profile that
+    --engine-stats reports."""
+    found = re.search(r"(\d+) deoptimizations, (\d+) from the profile",
+                      stderr)
+    return (int(found.group(1)), int(found.group(2))) if found else (0, 0)
+
+
+def check(lox, script, workdir):
+    expected = run([lox, str(script), "strings"])[:2]
+    profile = workdir / "typed.prof"
+    *_, status, _ = run([lox, "--engine=closure",
+                         f"--profile-out={profile}", str(script)])
+    if status != 0 or not profile.exists():
+        yield "record", f"recording exited with {status}"
+        return
+
+    output, status, stderr = run([lox, "--engine=closure", "--engine-stats",
+                                  f"--profile-in={profile}", str(script),
+                                  "strings"])
+    deoptimizations, preset = stats(stderr)
+    if (output, status) != expected:
+        yield "replay", f"expected {expected!r}, got {(output, status)!r}"
+    elif preset == 0 or deoptimizations == 0:
+        yield "replay", (f"{preset} nodes from the profile, "
+                         f"{deoptimizations} deoptimizations")
+    else:
+        yield "replay", None
+
+    # Another source: the same script with a comment added.
+    other = workdir / "other.lox"
+    other.write_text(script.read_text() + "// Changed.\n")
+    output, status, stderr = run([lox, "--engine=closure", "--engine-stats",
+                                  f"--profile-in={profile}", str(other),
+                                  "strings"])
+    if (output, status) != expected or "ignoring" not in stderr:
+        yield "other source", f"got {(output, status, stderr)!r}"
+    elif stats(stderr)[1] != 0:
+        yield "other source", "nodes were set up from the profile"
+    else:
+        yield "other source", None
+
+    truncated = workdir / "truncated.prof"
+    truncated.write_bytes(profile.read_bytes()[:profile.stat().st_size // 2])
+    output, status, stderr = run([lox, "--engine=closure", "--engine-stats",
+                                  f"--profile-in={truncated}", str(script),
+                                  "strings"])
+    if (output, status) != expected or "ignoring" not in stderr:
+        yield "truncated", f"got {(output, status, stderr)!r}"
+    elif stats(stderr)[1] != 0:
+        yield "truncated", "nodes were set up from the profile"
+    else:
+        yield "truncated", None
+
+
+def main():
+    if len(sys.argv) != 2:
+        print(__doc__)
+        return 64
+    lox = sys.argv[1]
+    script = (Path(__file__).resolve().parent.parent / "tests" / "profile"
+              / "typed.lox")
+
+    failures = 0
+    with tempfile.TemporaryDirectory() as directory:
+        for name, detail in check(lox, script, Path(directory)):
+            print(f"{'ok  ' if detail is None else 'FAIL'} {name}")
+            if detail is not None:
+                print(f"     {detail}")
+                failures += 1
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
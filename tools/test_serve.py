@@ -0,0 +1,91 @@
+#!/usr/bin/env python3
+"""Starts lox --serve=SOCKET in a temporary directory and runs scripts on
+it through lox_client.py: one with arguments, one with a runtime error,
+one with a compile error, and one run again unchanged, from the
+server's cache, and then changed. The server is stopped at the end.
+
+Usage: test_serve.py LOX
+"""
+import subprocess
+import sys
+import tempfile
+import time
+from pathlib import Path
+
+from lox_client import request
+
+
+def start(lox, socket):
+    server = subprocess.Popen([lox, f"--serve={socket}"],
+                              stdout=subprocess.DEVNULL,
+                              stderr=subprocess.PIPE)
+    deadline = time.monotonic() + 10
+    while not socket.exists():
+        if server.poll() is not None or time.monotonic() > deadline:
+            raise RuntimeError(f"the server didn't start: "
+                               f"{server.communicate()[1]!r}")
+        time.sleep(0.01)
+    return server
+
+
+def expect(name, answer, status, output):
+    actual = answer[0], answer[1].decode()
+    if actual != (status, output):
+        return name, f"expected {(status, output)!r}, got {actual!r}"
+    return name, None
+
+
+def check(socket, workdir):
+    arguments = workdir / "arguments.lox"
+    arguments.write_text('print argument(0) + argument(1);\n')
+    yield expect("arguments", request(socket, arguments, ["ab", "cd"]),
+                 0, "abcd\n")
+
+    runtime = workdir / "runtime.lox"
+    runtime.write_text('print "before";\nprint nil + 1;\n')
+    yield expect("runtime error", request(socket, runtime, []), 70,
+                 "before\nOperands must be two numbers or two strings.\n"
+                 "[line 2]\n")
+
+    broken = workdir / "broken.lox"
+    broken.write_text('print "never";\nprint (;\n')
+    status, output = request(socket, broken, [])
+    if status != 65 or b"Expect expression." not in output:
+        yield "compile error", f"got {(status, output)!r}"
+    else:
+        yield "compile error", None
+
+    cached = workdir / "cached.lox"
+    cached.write_text('var greeting = "hel" + "lo";\nprint greeting;\n')
+    yield expect("first run", request(socket, cached, []), 0, "hello\n")
+    # Its literals must still be there when the compiled script is reused.
+    yield expect("cached", request(socket, cached, []), 0, "hello\n")
+    cached.write_text('var greeting = "good" + "bye";\nprint greeting;\n')
+    yield expect("changed", request(socket, cached, []), 0, "goodbye\n")
+
+
+def main():
+    if len(sys.argv) != 2:
+        print(__doc__)
+        return 64
+    lox = str(Path(sys.argv[1]).resolve())
+
+    failures = 0
+    with tempfile.TemporaryDirectory() as directory:
+        workdir = Path(directory)
+        socket = workdir / "lox.socket"
+        server = start(lox, socket)
+        try:
+            for name, detail in check(str(socket), workdir):
+                print(f"{'ok  ' if detail is None else 'FAIL'} {name}")
+                if detail is not None:
+                    print(f"     {detail}")
+                    failures += 1
+        finally:
+            server.kill()
+            server.wait()
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,75 @@
+#!/usr/bin/env python3
+"""Runs tests/snapshot/prelude.lox with --snapshot-out and main.lox from
+the snapshot with --snapshot-in, on every engine that has snapshots, and
+fails unless together they print what the two scripts run as one do and
+exit with the same status. Also checks that a heap holding a generator
+isn't saved.
+
+Usage: test_snapshot.py LOX
+"""
+import subprocess
+import sys
+import tempfile
+from pathlib import Path
+
+ENGINES = ["tree", "stackless", "closure"]
+
+
+def run(command):
+    result = subprocess.run(command, capture_output=True, text=True)
+    return result.stdout, result.returncode
+
+
+def check(lox, engine, options, tests, workdir):
+    combined = workdir / "combined.lox"
+    combined.write_text((tests / "prelude.lox").read_text()
+                        + (tests / "main.lox").read_text())
+    expected = run([lox, f"--engine={engine}", *options, str(combined)])
+
+    snapshot = workdir / "prelude.snap"
+    prelude, status = run([lox, f"--engine={engine}", *options,
+                           f"--snapshot-out={snapshot}",
+                           str(tests / "prelude.lox")])
+    if status != 0:
+        return False, f"saving exited with {status}"
+    output, status = run([lox, f"--engine={engine}", *options,
+                          f"--snapshot-in={snapshot}",
+                          str(tests / "main.lox")])
+    actual = (prelude + output, status)
+    if actual != expected:
+        return False, f"expected {expected!r}, got {actual!r}"
+
+    unsaveable = workdir / "unsaveable.snap"
+    output, status = run([lox, f"--engine={engine}",
+                          f"--snapshot-out={unsaveable}",
+                          str(tests / "unsaveable.lox")])
+    if status != 74 or unsaveable.exists():
+        return False, f"saved a generator, exited with {status}"
+    return True, ""
+
+
+def main():
+    if len(sys.argv) != 2:
+        print(__doc__)
+        return 64
+    lox = sys.argv[1]
+    tests = Path(__file__).resolve().parent.parent / "tests" / "snapshot"
+
+    failures = 0
+    with tempfile.TemporaryDirectory() as directory:
+        for engine in ENGINES:
+            # Collecting at every allocation frees any restored object
+            # that nothing refers to.
+            for options in [[], ["--gc-stress"]]:
+                ok, detail = check(lox, engine, options, tests,
+                                   Path(directory))
+                name = " ".join([engine, *options])
+                print(f"{'ok  ' if ok else 'FAIL'} {name}")
+                if not ok:
+                    print(f"     {detail}")
+                    failures += 1
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())